@@ -0,0 +1,540 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "ts_message.h"
+#include "ts_compress.h"
+
+// minimum run time and iterations of each benchmark
+#define BENCH_MINIMUM_NS 200000000.0
+#define BENCH_MINIMUM_ITERATIONS 1000
+
+// number of messages of a cold working set, i.e., more than the caches hold (at most, as memory allows)
+#define BENCH_RING_SIZE 1024
+
+// batches of the compression benchmark, i.e., a stream of messages encoded back to back
+#define BENCH_BATCH_COUNT 16
+#define BENCH_BATCH_MESSAGES 32
+#define BENCH_BATCH_SIZE 8192
+
+// message shapes
+typedef TsStatus_t (*BenchShape_t)(TsMessageRef_t *message);
+
+// benchmark state, i.e., the message and buffers an operation works on
+// the cold variants work on the next message of the ring on every call
+typedef struct {
+	BenchShape_t shape;
+	TsMessageRef_t message;
+	TsMessageRef_t ring[BENCH_RING_SIZE];
+	size_t ring_size;
+	size_t ring_index;
+	TsEncoder_t encoder;
+	TsMessageRef_t projection;
+	uint8_t buffer[4096];
+	size_t buffer_size;
+	uint8_t output[4096];
+} BenchState_t;
+
+// benchmark operation, timed per call
+typedef TsStatus_t (*BenchOperation_t)(BenchState_t *state);
+
+// forward references
+static TsStatus_t bench_small(TsMessageRef_t *message);
+static TsStatus_t bench_wide(TsMessageRef_t *message);
+static TsStatus_t bench_deep(TsMessageRef_t *message);
+static void bench_run(FILE *output, const char *name, const char *shape, BenchShape_t builder,
+					  BenchOperation_t operation, TsEncoder_t encoder, bool cold);
+static TsMessageRef_t bench_message(BenchState_t *state);
+static double bench_now();
+static int bench_counter_open();
+static long long bench_counter_read(int counter);
+
+static void bench_compress(FILE *output, TsEncoder_t encoder, bool dictionary);
+static TsStatus_t bench_compress_stream(TsCompressorRef_t compressor, TsCompressDictionaryRef_t dictionary,
+										uint8_t batches[][BENCH_BATCH_SIZE], size_t *batch_sizes,
+										uint8_t compressed[][TS_COMPRESS_BOUND(BENCH_BATCH_SIZE)],
+										size_t *compressed_sizes, size_t *compressed_total);
+
+static bool bench_first = true;
+
+// bench_create_destroy, i.e., build the whole shape and tear it down
+static TsStatus_t bench_create_destroy(BenchState_t *state)
+{
+	TsMessageRef_t message;
+	TsStatus_t status = state->shape(&message);
+	if (status != TsStatusOk) {
+		return status;
+	}
+	return ts_message_destroy(message);
+}
+
+// bench_set_get, i.e., set and get the last field of the root by key
+static TsStatus_t bench_set_get(BenchState_t *state)
+{
+	static int counter = 0;
+	int value;
+	TsMessageRef_t message = bench_message(state);
+	TsStatus_t status = ts_message_set_int(message, "last", counter++);
+	if (status != TsStatusOk) {
+		return status;
+	}
+	return ts_message_get_int(message, "last", &value);
+}
+
+// bench_has, i.e., look up the last field of the root (and a missing one) by key
+static TsStatus_t bench_has(BenchState_t *state)
+{
+	TsMessageRef_t message = bench_message(state);
+	TsMessageRef_t value;
+	if (ts_message_has(message, "missing", &value) != TsStatusErrorNotFound) {
+		return TsStatusErrorInternalServerError;
+	}
+	return ts_message_has(message, "last", &value);
+}
+
+// bench_array_append, i.e., append to an array until full (reported per append)
+static TsStatus_t bench_array_append(BenchState_t *state)
+{
+	TsMessageRef_t array;
+	TsStatus_t status = ts_message_create_array(state->message, "array", &array);
+	if (status != TsStatusOk) {
+		return status;
+	}
+	for (int i = 0; i < TS_MESSAGE_MAX_BRANCHES; i++) {
+		size_t size;
+		ts_message_get_size(array, &size);
+		status = ts_message_set_int_at(array, size, i);
+		if (status != TsStatusOk) {
+			return status;
+		}
+	}
+	return ts_message_set_null(state->message, "array");
+}
+
+// bench_copy, i.e., deep copy
+static TsStatus_t bench_copy(BenchState_t *state)
+{
+	TsMessageRef_t copy;
+	TsStatus_t status = ts_message_create_copy(state->message, &copy);
+	if (status != TsStatusOk) {
+		return status;
+	}
+	return ts_message_destroy(copy);
+}
+
+// bench_encode
+static TsStatus_t bench_encode(BenchState_t *state)
+{
+	state->buffer_size = sizeof(state->buffer);
+	return ts_message_encode(bench_message(state), state->encoder, state->buffer, &(state->buffer_size));
+}
+
+// bench_decode (of the encoding made ahead of the run)
+static TsStatus_t bench_decode(BenchState_t *state)
+{
+	TsMessageRef_t message;
+	TsStatus_t status = ts_message_create(&message);
+	if (status != TsStatusOk) {
+		return status;
+	}
+	status = ts_message_decode(message, state->encoder, state->buffer, state->buffer_size);
+	ts_message_destroy(message);
+	return status;
+}
+
+// bench_decode_projected, i.e., decode just the last field of the root (or everything, when streamed)
+static TsStatus_t bench_decode_projected(BenchState_t *state)
+{
+	TsMessageRef_t message;
+	TsStatus_t status = ts_message_create(&message);
+	if (status != TsStatusOk) {
+		return status;
+	}
+	status = ts_message_decode_projected(message, state->projection, state->encoder, state->buffer,
+										 state->buffer_size);
+	ts_message_destroy(message);
+	return status;
+}
+
+// bench_decode_stream, i.e., without a projection (see bench_run)
+static TsStatus_t bench_decode_stream(BenchState_t *state)
+{
+	return bench_decode_projected(state);
+}
+
+// bench_transcode, i.e., relay the encoding (made ahead of the run) in the other format, without a tree
+static TsStatus_t bench_transcode(BenchState_t *state)
+{
+	size_t size = sizeof(state->output);
+	TsEncoder_t target = state->encoder == TsEncoderJson ? TsEncoderCbor : TsEncoderJson;
+	return ts_message_transcode(state->encoder, state->buffer, state->buffer_size, target, state->output, &size);
+}
+
+// bench_relay, i.e., the same through a tree (decoded and encoded again)
+static TsStatus_t bench_relay(BenchState_t *state)
+{
+	TsMessageRef_t message;
+	TsStatus_t status = ts_message_create(&message);
+	if (status != TsStatusOk) {
+		return status;
+	}
+	size_t size = sizeof(state->output);
+	TsEncoder_t target = state->encoder == TsEncoderJson ? TsEncoderCbor : TsEncoderJson;
+	status = ts_message_decode(message, state->encoder, state->buffer, state->buffer_size);
+	if (status == TsStatusOk) {
+		status = ts_message_encode(message, target, state->output, &size);
+	}
+	ts_message_destroy(message);
+	return status;
+}
+
+// main
+// usage, bench_message [output.json]
+int main(int argc, char *argv[])
+{
+	FILE *output = stdout;
+	if (argc > 1) {
+		output = fopen(argv[1], "w");
+		if (output == NULL) {
+			fprintf(stderr, "cannot open %s\n", argv[1]);
+			return 1;
+		}
+	}
+
+#ifdef TS_MESSAGE_STATIC_MEMORY
+	fprintf(output, "{\"build\":\"static\",\"nodes\":%d,\"results\":[", TS_MESSAGE_MAX_NODES);
+#else
+	fprintf(output, "{\"build\":\"malloc\",\"results\":[");
+#endif
+
+	const char *names[] = {"small", "wide", "deep"};
+	BenchShape_t shapes[] = {bench_small, bench_wide, bench_deep};
+	for (int i = 0; i < 3; i++) {
+		bench_run(output, "create_destroy", names[i], shapes[i], bench_create_destroy, TsEncoderDebug, false);
+		bench_run(output, "set_get", names[i], shapes[i], bench_set_get, TsEncoderDebug, false);
+		bench_run(output, "has", names[i], shapes[i], bench_has, TsEncoderDebug, false);
+		bench_run(output, "copy", names[i], shapes[i], bench_copy, TsEncoderDebug, false);
+		bench_run(output, "json_encode", names[i], shapes[i], bench_encode, TsEncoderJson, false);
+		bench_run(output, "cbor_encode", names[i], shapes[i], bench_encode, TsEncoderCbor, false);
+		bench_run(output, "json_decode", names[i], shapes[i], bench_decode, TsEncoderJson, false);
+		bench_run(output, "cbor_decode", names[i], shapes[i], bench_decode, TsEncoderCbor, false);
+		bench_run(output, "json_decode_stream", names[i], shapes[i], bench_decode_stream, TsEncoderJson, false);
+		bench_run(output, "json_decode_projected", names[i], shapes[i], bench_decode_projected, TsEncoderJson, false);
+		bench_run(output, "json_cbor_transcode", names[i], shapes[i], bench_transcode, TsEncoderJson, false);
+		bench_run(output, "cbor_json_transcode", names[i], shapes[i], bench_transcode, TsEncoderCbor, false);
+		bench_run(output, "json_cbor_relay", names[i], shapes[i], bench_relay, TsEncoderJson, false);
+		bench_run(output, "cbor_json_relay", names[i], shapes[i], bench_relay, TsEncoderCbor, false);
+	}
+	bench_run(output, "array_append", "small", bench_small, bench_array_append, TsEncoderDebug, false);
+
+	// lookups and encodes over a working set larger than the caches, i.e., dominated by the node layout
+	for (int i = 1; i < 3; i++) {
+		bench_run(output, "has_cold", names[i], shapes[i], bench_has, TsEncoderDebug, true);
+		bench_run(output, "set_get_cold", names[i], shapes[i], bench_set_get, TsEncoderDebug, true);
+		bench_run(output, "json_encode_cold", names[i], shapes[i], bench_encode, TsEncoderJson, true);
+		bench_run(output, "cbor_encode_cold", names[i], shapes[i], bench_encode, TsEncoderCbor, true);
+	}
+
+	// batches of readings, compressed as a stream (with and without the keys as dictionary)
+	bench_compress(output, TsEncoderJson, false);
+	bench_compress(output, TsEncoderJson, true);
+	bench_compress(output, TsEncoderCbor, false);
+	bench_compress(output, TsEncoderCbor, true);
+
+	fprintf(output, "]}\n");
+	if (output != stdout) {
+		fclose(output);
+	}
+	return 0;
+}
+
+// bench_run
+// run a single benchmark on a fresh message of the given shape (or a ring of them, when cold),
+// and report it as a json object (cache misses are -1 when the hardware counters are unavailable)
+static void bench_run(FILE *output, const char *name, const char *shape, BenchShape_t builder,
+					  BenchOperation_t operation, TsEncoder_t encoder, bool cold)
+{
+	static BenchState_t state;
+	state.shape = builder;
+	state.encoder = encoder;
+	state.buffer_size = sizeof(state.buffer);
+	state.ring_size = 0;
+	state.ring_index = 0;
+	TsStatus_t status = builder(&state.message);
+
+	// the ring holds as many messages as memory allows (e.g., a few in the static model)
+	while (cold && status == TsStatusOk && state.ring_size < BENCH_RING_SIZE
+		   && builder(&(state.ring[state.ring_size])) == TsStatusOk) {
+		state.ring_size++;
+	}
+
+	// decoding (and relaying) works on the encoding of the same shape (projected on its last field)
+	if (status == TsStatusOk && (operation == bench_decode || operation == bench_decode_projected
+								 || operation == bench_decode_stream || operation == bench_transcode
+								 || operation == bench_relay)) {
+		status = ts_message_encode(state.message, encoder, state.buffer, &state.buffer_size);
+	}
+	state.projection = NULL;
+	if (status == TsStatusOk && operation == bench_decode_projected) {
+		status = ts_message_create(&state.projection);
+		if (status == TsStatusOk) {
+			status = ts_message_set_null(state.projection, "last");
+		}
+	}
+
+	// warm up (and check the operation is supported), then run for the minimum time
+	if (status == TsStatusOk) {
+		status = operation(&state);
+	}
+	long iterations = 0;
+	double elapsed = 0;
+	long long misses = -1;
+	if (status == TsStatusOk) {
+		int counter = bench_counter_open();
+		double start = bench_now();
+		do {
+			for (int i = 0; i < BENCH_MINIMUM_ITERATIONS; i++) {
+				operation(&state);
+			}
+			iterations = iterations + BENCH_MINIMUM_ITERATIONS;
+			elapsed = bench_now() - start;
+		} while (elapsed < BENCH_MINIMUM_NS);
+		misses = bench_counter_read(counter);
+	}
+
+	// array append is reported per append
+	long operations = operation == bench_array_append ? iterations * TS_MESSAGE_MAX_BRANCHES : iterations;
+	double ns = operations > 0 ? elapsed / (double) operations : 0;
+	fprintf(output, "%s{\"benchmark\":\"%s\",\"shape\":\"%s\",\"status\":%d,\"iterations\":%ld,"
+					"\"ns_per_op\":%.1f,\"ops_per_sec\":%.0f,\"bytes\":%lu,\"messages\":%lu,"
+					"\"cache_misses_per_op\":%.2f}",
+			bench_first ? "" : ",", name, shape, status, operations, ns, ns > 0 ? 1e9 / ns : 0,
+			(unsigned long) (encoder == TsEncoderDebug ? 0 : state.buffer_size), (unsigned long) (state.ring_size + 1),
+			misses >= 0 && operations > 0 ? (double) misses / (double) operations : -1.0);
+	bench_first = false;
+
+	if (state.message != NULL) {
+		ts_message_destroy(state.message);
+		state.message = NULL;
+	}
+	if (state.projection != NULL) {
+		ts_message_destroy(state.projection);
+	}
+	for (size_t i = 0; i < state.ring_size; i++) {
+		ts_message_destroy(state.ring[i]);
+	}
+}
+
+// bench_compress
+// compress (and decompress) a stream of batches of small messages, each with its own readings,
+// and report the ratio and throughput (of the uncompressed bytes) as a json object
+static void bench_compress(FILE *output, TsEncoder_t encoder, bool dictionary)
+{
+	static uint8_t batches[BENCH_BATCH_COUNT][BENCH_BATCH_SIZE];
+	static uint8_t compressed[BENCH_BATCH_COUNT][TS_COMPRESS_BOUND(BENCH_BATCH_SIZE)];
+	static uint8_t decompressed[BENCH_BATCH_SIZE];
+	static TsCompressDictionary_t keys;
+	static TsCompressor_t compressor;
+	static TsDecompressor_t decompressor;
+	size_t batch_sizes[BENCH_BATCH_COUNT];
+	size_t compressed_sizes[BENCH_BATCH_COUNT];
+
+	// the batches, and the dictionary of the keys
+	TsMessageRef_t message;
+	TsStatus_t status = bench_small(&message);
+	ts_compress_dictionary_init(&keys);
+	if (status == TsStatusOk && dictionary) {
+		status = ts_compress_dictionary_keys(&keys, message, encoder);
+	}
+	size_t total = 0;
+	for (int i = 0; i < BENCH_BATCH_COUNT && status == TsStatusOk; i++) {
+		batch_sizes[i] = 0;
+		for (int j = 0; j < BENCH_BATCH_MESSAGES && status == TsStatusOk; j++) {
+			int reading = i * BENCH_BATCH_MESSAGES + j;
+			ts_message_set_float(message, "value", 50.0f + (float) (reading % 97) / 10.0f);
+			ts_message_set_int(message, "last", reading);
+			size_t size = BENCH_BATCH_SIZE - batch_sizes[i];
+			status = ts_message_encode(message, encoder, batches[i] + batch_sizes[i], &size);
+			batch_sizes[i] = batch_sizes[i] + size;
+		}
+		total = total + batch_sizes[i];
+	}
+	if (message != NULL) {
+		ts_message_destroy(message);
+	}
+
+	// compress the whole stream, checking it decompresses (the warm up), then time each direction
+	size_t compressed_total = 0;
+	long iterations = 0;
+	double compress_ns = 0, decompress_ns = 0;
+	if (status == TsStatusOk) {
+		status = bench_compress_stream(&compressor, dictionary ? &keys : NULL, batches, batch_sizes, compressed,
+									   compressed_sizes, &compressed_total);
+	}
+	ts_decompress_init(&decompressor, dictionary ? &keys : NULL);
+	for (int i = 0; i < BENCH_BATCH_COUNT && status == TsStatusOk; i++) {
+		size_t size = sizeof(decompressed);
+		status = ts_decompress(&decompressor, compressed[i], compressed_sizes[i], decompressed, &size);
+		if (status == TsStatusOk && (size != batch_sizes[i] || memcmp(decompressed, batches[i], size) != 0)) {
+			status = TsStatusErrorInternalServerError;
+		}
+	}
+	if (status == TsStatusOk) {
+		double start = bench_now();
+		do {
+			bench_compress_stream(&compressor, dictionary ? &keys : NULL, batches, batch_sizes, compressed,
+								  compressed_sizes, &compressed_total);
+			iterations++;
+		} while (bench_now() - start < BENCH_MINIMUM_NS);
+		compress_ns = (bench_now() - start) / (double) iterations;
+
+		long count = 0;
+		start = bench_now();
+		do {
+			ts_decompress_init(&decompressor, dictionary ? &keys : NULL);
+			for (int i = 0; i < BENCH_BATCH_COUNT; i++) {
+				size_t size = sizeof(decompressed);
+				ts_decompress(&decompressor, compressed[i], compressed_sizes[i], decompressed, &size);
+			}
+			count++;
+		} while (bench_now() - start < BENCH_MINIMUM_NS);
+		decompress_ns = (bench_now() - start) / (double) count;
+	}
+
+	fprintf(output, "%s{\"benchmark\":\"%s_compress%s\",\"shape\":\"small\",\"status\":%d,\"iterations\":%ld,"
+					"\"bytes\":%lu,\"compressed_bytes\":%lu,\"ratio\":%.2f,\"compress_mb_per_sec\":%.1f,"
+					"\"decompress_mb_per_sec\":%.1f}",
+			bench_first ? "" : ",", encoder == TsEncoderJson ? "json" : "cbor", dictionary ? "_dictionary" : "", status,
+			iterations, (unsigned long) total, (unsigned long) compressed_total,
+			compressed_total > 0 ? (double) total / (double) compressed_total : 0,
+			compress_ns > 0 ? (double) total * 1e3 / compress_ns : 0,
+			decompress_ns > 0 ? (double) total * 1e3 / decompress_ns : 0);
+	bench_first = false;
+}
+
+// bench_compress_stream, i.e., the batches compressed by a fresh stream
+static TsStatus_t bench_compress_stream(TsCompressorRef_t compressor, TsCompressDictionaryRef_t dictionary,
+										uint8_t batches[][BENCH_BATCH_SIZE], size_t *batch_sizes,
+										uint8_t compressed[][TS_COMPRESS_BOUND(BENCH_BATCH_SIZE)],
+										size_t *compressed_sizes, size_t *compressed_total)
+{
+	TsStatus_t status = ts_compress_init(compressor, dictionary);
+	*compressed_total = 0;
+	for (int i = 0; i < BENCH_BATCH_COUNT && status == TsStatusOk; i++) {
+		compressed_sizes[i] = TS_COMPRESS_BOUND(BENCH_BATCH_SIZE);
+		status = ts_compress(compressor, batches[i], batch_sizes[i], compressed[i], &(compressed_sizes[i]));
+		*compressed_total = *compressed_total + compressed_sizes[i];
+	}
+	return status;
+}
+
+// bench_message, i.e., the message the next call works on
+static TsMessageRef_t bench_message(BenchState_t *state)
+{
+	if (state->ring_size == 0) {
+		return state->message;
+	}
+	TsMessageRef_t message = state->ring[state->ring_index];
+	state->ring_index = (state->ring_index + 1) % state->ring_size;
+	return message;
+}
+
+// bench_now, in ns
+static double bench_now()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double) now.tv_sec * 1e9 + (double) now.tv_nsec;
+}
+
+// bench_counter_open, i.e., start counting the (last level) cache misses of this thread, or -1
+static int bench_counter_open()
+{
+#ifdef __linux__
+	struct perf_event_attr attributes;
+	memset(&attributes, 0x00, sizeof(attributes));
+	attributes.type = PERF_TYPE_HARDWARE;
+	attributes.size = sizeof(attributes);
+	attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+	attributes.exclude_kernel = 1;
+	attributes.exclude_hv = 1;
+	int counter = (int) syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+	if (counter >= 0) {
+		ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+	}
+	return counter;
+#else
+	return -1;
+#endif
+}
+
+// bench_counter_read, i.e., the cache misses since the counter was opened (and close it), or -1
+static long long bench_counter_read(int counter)
+{
+	long long misses = -1;
+#ifdef __linux__
+	if (counter >= 0) {
+		if (read(counter, &misses, sizeof(misses)) != sizeof(misses)) {
+			misses = -1;
+		}
+		close(counter);
+	}
+#endif
+	return misses;
+}
+
+// bench_small, i.e., a typical sensor reading
+static TsStatus_t bench_small(TsMessageRef_t *message)
+{
+	TsStatus_t status = ts_message_create(message);
+	if (status != TsStatusOk) {
+		return status;
+	}
+	TsMessageRef_t location;
+	ts_message_set_string(*message, "sensor", "temperature");
+	ts_message_set_float(*message, "value", 57.7f);
+	ts_message_create_message(*message, "location", &location);
+	ts_message_set_float(location, "latitude", 42.361145f);
+	ts_message_set_float(location, "longitude", -71.057083f);
+	return ts_message_set_int(*message, "last", 0);
+}
+
+// bench_wide, i.e., as many fields as allowed on the root
+static TsStatus_t bench_wide(TsMessageRef_t *message)
+{
+	TsStatus_t status = ts_message_create(message);
+	for (int i = 0; status == TsStatusOk && i < TS_MESSAGE_MAX_BRANCHES - 2; i++) {
+		char name[TS_MESSAGE_MAX_KEY_SIZE];
+		snprintf(name, sizeof(name), "field-%d", i);
+		status = ts_message_set_int(*message, name, i);
+	}
+	if (status != TsStatusOk) {
+		return status;
+	}
+	return ts_message_set_int(*message, "last", 0);
+}
+
+// bench_deep, i.e., nested messages with a field on every level
+static TsStatus_t bench_deep(TsMessageRef_t *message)
+{
+	TsStatus_t status = ts_message_create(message);
+	if (status != TsStatusOk) {
+		return status;
+	}
+	status = ts_message_set_int(*message, "last", 0);
+	TsMessageRef_t current = *message;
+	for (int i = 0; status == TsStatusOk && i < 8; i++) {
+		status = ts_message_create_message(current, "nested", &current);
+		if (status == TsStatusOk) {
+			status = ts_message_set_int(current, "depth", i);
+		}
+	}
+	return status;
+}
@@ -3,10 +3,19 @@
 #include <stdbool.h>
 #include <signal.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include "dbg.h"
 #include "cbor.h"
 #include "ts_message.h"
+#include "ts_layout.h"
+#include "ts_struct.h"
+#include "ts_queue.h"
+#include "ts_store.h"
+#include "ts_compress.h"
+#include "reading.h"
 
 // example struct to encode
 typedef struct {
@@ -20,6 +29,18 @@ typedef struct {
 	Foo_t foo;
 } Goo_t;
 
+// example struct descriptors (i.e., the field name, offset and type of each member)
+static const TsDescriptor_t foo_descriptor[] = {
+	TS_DESCRIPTOR_BOOL(Foo_t, zwitch, "switch"),
+	TS_DESCRIPTOR_STRING(Foo_t, comment, "comment"),
+};
+
+static const TsDescriptor_t goo_descriptor[] = {
+	TS_DESCRIPTOR_INT(Goo_t, setting, "setting"),
+	TS_DESCRIPTOR_FLOAT(Goo_t, temperature, "temperature"),
+	TS_DESCRIPTOR_MESSAGE(Goo_t, foo, "foo", foo_descriptor),
+};
+
 // forward references
 static void mysighandler();
 static TsStatus_t test01();
@@ -27,6 +48,25 @@ static TsStatus_t test03();
 static TsStatus_t test04();
 static TsStatus_t test05();
 static TsStatus_t test06();
+static TsStatus_t test07();
+static TsStatus_t test08();
+static TsStatus_t test09();
+static TsStatus_t test10();
+static TsStatus_t test11();
+static TsStatus_t test12();
+static TsStatus_t test13();
+static TsStatus_t test14();
+static TsStatus_t test15();
+static TsStatus_t test16();
+static TsStatus_t test17();
+static TsStatus_t test18();
+static TsStatus_t test19();
+static TsStatus_t test20();
+static TsStatus_t test21();
+static TsStatus_t test22();
+static TsStatus_t test23();
+static TsStatus_t test24();
+static TsStatus_t test25();
 
 #define CC_MAX_SEND_BUF_SZ 2048
 
@@ -42,7 +82,7 @@ int main()
 	sigaction(SIGINT, &sigIntHandler, NULL);
 	sigaction(SIGSEGV, &sigIntHandler, NULL);
 
-	TsStatus_t status = test06();
+	TsStatus_t status = test25();
 	if (status != TsStatusOk) {
 		printf("an error occurred while encoding, %d\n", status);
 	}
@@ -75,13 +115,8 @@ static TsStatus_t test06()
 	ts_message_create_array(sensors, "characteristics", &characteristics);
 
 	/* for each field of the message,... */
-	for (int i = 0; i < TS_MESSAGE_MAX_BRANCHES; i++ ) {
-
-		/* the "for-each" behavior terminates on a NULL or max-size */
-		TsMessageRef_t branch = sensor->value._xfields[ i ];
-		if (branch == NULL) {
-			break;
-		}
+	int i = 0;
+	for (TsMessageRef_t branch = sensor->value._xbranches; branch != NULL; branch = branch->next, i++ ) {
 
 		/* transform into the form expected by the server */
 		TsMessageRef_t characteristic;
@@ -109,6 +144,995 @@ static TsStatus_t test06()
 	return TsStatusOk;
 }
 
+// hand-off slot between the producer threads and the consumer thread of test12
+#define TEST12_PRODUCERS 3
+#define TEST12_MESSAGES 100000
+static TsMessageRef_t test12_slot = NULL;
+
+static void * test12_produce(void * argument)
+{
+	for (int i = 0; i < TEST12_MESSAGES; i++) {
+		TsMessageRef_t message, location;
+		if (ts_message_create(&message) != TsStatusOk) {
+			continue;
+		}
+		ts_message_set_int(message, "sequence", i);
+		ts_message_create_message(message, "location", &location);
+		ts_message_set_float(location, "latitude", 42.361145f);
+
+		// hand off (i.e., the consumer destroys it), waiting for the slot to be empty
+		TsMessageRef_t empty = NULL;
+		while (!__atomic_compare_exchange_n(&test12_slot, &empty, message, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+			empty = NULL;
+			sched_yield();
+		}
+	}
+	ts_message_cache_flush();
+	return NULL;
+}
+
+static void * test12_consume(void * argument)
+{
+	int * count = (int *) argument;
+	uint8_t buffer[256];
+	while (*count < TEST12_PRODUCERS * TEST12_MESSAGES) {
+		TsMessageRef_t message = __atomic_exchange_n(&test12_slot, NULL, __ATOMIC_ACQUIRE);
+		if (message != NULL) {
+			size_t buffer_size = sizeof(buffer);
+			ts_message_encode(message, TsEncoderJson, buffer, &buffer_size);
+			ts_message_destroy(message);
+			(*count)++;
+		} else {
+			sched_yield();
+		}
+	}
+	ts_message_cache_flush();
+	return NULL;
+}
+
+static TsStatus_t test12()
+{
+	// producers build messages concurrently, and hand them off to an encoding consumer
+	int count = 0;
+	pthread_t producers[TEST12_PRODUCERS], consumer;
+	clock_t start = clock();
+	pthread_create(&consumer, NULL, test12_consume, &count);
+	for (int i = 0; i < TEST12_PRODUCERS; i++) {
+		pthread_create(&producers[i], NULL, test12_produce, NULL);
+	}
+	for (int i = 0; i < TEST12_PRODUCERS; i++) {
+		pthread_join(producers[i], NULL);
+	}
+	pthread_join(consumer, NULL);
+	TsMessageCacheStatistics_t statistics;
+	ts_message_cache_statistics(&statistics);
+	printf("hand-off, %d messages in %.0f ms, %llu refills, %llu flushes, %llu remote frees\n", count,
+		   (double) (clock() - start) / CLOCKS_PER_SEC * 1000, (unsigned long long) statistics.refills,
+		   (unsigned long long) statistics.flushes, (unsigned long long) statistics.remote_frees);
+
+	// a retained message survives the destroy of its creator
+	TsMessageRef_t message;
+	ts_message_create(&message);
+	ts_message_set_int(message, "retained", 1);
+	ts_message_retain(message);
+	ts_message_destroy(message);
+	ts_message_encode(message, TsEncoderDebug, NULL, 0);
+	ts_message_destroy(message);
+	ts_message_report();
+	return TsStatusOk;
+}
+
+// outbound queue between the producer threads and the uplink thread of test13
+static TsQueue_t test13_queue;
+static uint64_t test13_buffer[4096 / sizeof(uint64_t)];
+
+static void * test13_produce(void * argument)
+{
+	for (int i = 0; i < TEST12_MESSAGES; i++) {
+		TsMessageRef_t message;
+		if (ts_message_create(&message) != TsStatusOk) {
+			continue;
+		}
+		ts_message_set_int(message, "sequence", i);
+		ts_message_set_float(message, "temperature", 57.7f);
+
+		// encode in place, waiting for space when the uplink falls behind
+		while (ts_queue_encode(&test13_queue, message, TsEncoderJson, 64) == TsStatusErrorOutOfMemory) {
+			sched_yield();
+		}
+		ts_message_destroy(message);
+	}
+	ts_message_cache_flush();
+	return NULL;
+}
+
+static TsStatus_t test13()
+{
+	ts_queue_init(&test13_queue, (uint8_t *) test13_buffer, sizeof(test13_buffer));
+
+	pthread_t producers[TEST12_PRODUCERS];
+	clock_t start = clock();
+	for (int i = 0; i < TEST12_PRODUCERS; i++) {
+		pthread_create(&producers[i], NULL, test13_produce, NULL);
+	}
+
+	// the uplink drains batches, i.e., a single write each
+	int count = 0, batches = 0;
+	size_t size = 0;
+	TsQueueBatch_t batch;
+	while (count < TEST12_PRODUCERS * TEST12_MESSAGES) {
+		ts_queue_drain(&test13_queue, &batch);
+		if (batch.count == 0) {
+			sched_yield();
+		} else {
+			count = count + (int) batch.count;
+			size = size + batch.size;
+			batches++;
+		}
+		ts_queue_release(&test13_queue, &batch);
+	}
+	for (int i = 0; i < TEST12_PRODUCERS; i++) {
+		pthread_join(producers[i], NULL);
+	}
+	printf("queue, %d messages (%lu bytes) in %d batches, %.0f ms\n", count, (unsigned long) size, batches,
+		   (double) (clock() - start) / CLOCKS_PER_SEC * 1000);
+	return TsStatusOk;
+}
+
+// test arena, i.e., a bump allocator over a fixed buffer (released space is only counted)
+typedef struct {
+	uint8_t buffer[32 * sizeof(TsMessage_t)] __attribute__((aligned(TS_MESSAGE_CACHE_LINE)));
+	size_t used;
+	size_t released;
+} TestArena_t;
+
+static void * test_arena_allocate(void *context, size_t size)
+{
+	// keep every allocation (e.g., a long string) on a cache line, as nodes should be
+	TestArena_t *arena = (TestArena_t *) context;
+	size = (size + TS_MESSAGE_CACHE_LINE - 1) & ~((size_t) TS_MESSAGE_CACHE_LINE - 1);
+	if (arena->used + size > sizeof(arena->buffer)) {
+		return NULL;
+	}
+	void *pointer = arena->buffer + arena->used;
+	arena->used = arena->used + size;
+	return pointer;
+}
+
+static void test_arena_release(void *context, void *pointer, size_t size)
+{
+	((TestArena_t *) context)->released += size;
+}
+
+static TsStatus_t test25()
+{
+	// a reading from a device (in cbor), relayed to the cloud (in json) without decoding it
+	TsMessageRef_t message;
+	ts_message_create(&message);
+	ts_message_set_string(message, "characteristicsName", "temperature");
+	ts_message_set_float(message, "currentValue", 57.7f);
+
+	uint8_t cbor[256], json[256];
+	size_t cbor_size = sizeof(cbor), json_size = sizeof(json);
+	TsStatus_t status = ts_message_encode(message, TsEncoderCbor, cbor, &cbor_size);
+	ts_message_destroy(message);
+	if (status == TsStatusOk) {
+		status = ts_message_transcode(TsEncoderCbor, cbor, cbor_size, TsEncoderJson, json, &json_size);
+	}
+	if (status != TsStatusOk) {
+		return status;
+	}
+	printf("cbor %lu bytes, relayed as %.*s\n", (unsigned long) cbor_size, (int) json_size, json);
+
+	// and a command from the cloud, relayed to the device
+	char command[] = "{\"command\":\"setInterval\",\"arguments\":{\"interval\":5000,\"labels\":[\"a\",\"b\"]}}";
+	cbor_size = sizeof(cbor);
+	status = ts_message_transcode(TsEncoderJson, (uint8_t *) command, strlen(command), TsEncoderCbor, cbor, &cbor_size);
+	if (status == TsStatusOk) {
+		printf("json %lu bytes, relayed as cbor %lu bytes\n", (unsigned long) strlen(command), (unsigned long) cbor_size);
+	}
+	return status;
+}
+
+static TsStatus_t test24()
+{
+	// the configuration held by the device
+	TsMessageRef_t configuration, settings;
+	ts_message_create(&configuration);
+	ts_message_set_string(configuration, "unitName", "unit-name");
+	ts_message_create_message(configuration, "settings", &settings);
+	ts_message_set_int(settings, "interval", 1000);
+	ts_message_set_float(settings, "threshold", 57.7f);
+	ts_message_set_string(settings, "mode", "eco");
+
+	// an update from the cloud, changing just a few settings (a merge patch),...
+	char update[] = "{\"settings\":{\"interval\":5000,\"mode\":null,\"alarm\":{\"enabled\":true}}}";
+	TsStatus_t status = ts_message_merge_patch_json(configuration, (uint8_t *) update, strlen(update));
+
+	// ...then a guarded one (a patch), applied only when the interval is as expected
+	char guarded[] = "[{\"op\":\"test\",\"path\":\"/settings/interval\",\"value\":5000},"
+					 "{\"op\":\"move\",\"from\":\"/settings/alarm\",\"path\":\"/alarm\"},"
+					 "{\"op\":\"replace\",\"path\":\"/unitName\",\"value\":\"unit-renamed\"}]";
+	if (status == TsStatusOk) {
+		status = ts_message_patch_json(configuration, (uint8_t *) guarded, strlen(guarded));
+	}
+	if (status == TsStatusOk) {
+		uint8_t buffer[512];
+		size_t buffer_size = sizeof(buffer);
+		ts_message_encode(configuration, TsEncoderJson, buffer, &buffer_size);
+		printf("configuration %.*s\n", (int) buffer_size, buffer);
+	}
+	ts_message_destroy(configuration);
+	return status;
+}
+
+static TsStatus_t test23()
+{
+	// an inbound document with far more than is used (and more fields than a message holds)
+	static char document[16 * 1024];
+	size_t size = (size_t) snprintf(document, sizeof(document), "{\"unitName\":\"unit-name\"");
+	for (int i = 0; i < 100; i++) {
+		size += (size_t) snprintf(document + size, sizeof(document) - size,
+								  ",\"sensor-%d\":{\"temperature\":%d.5,\"history\":[1,2,3]}", i, i);
+	}
+	size += (size_t) snprintf(document + size, sizeof(document) - size,
+							  ",\"settings\":{\"interval\":1000,\"threshold\":57.7,\"labels\":[\"a\",\"b\"]}}");
+
+	// keep the unit name, the temperature of one sensor and the interval
+	TsMessageRef_t projection, message;
+	ts_message_create(&projection);
+	ts_message_set_null(projection, "unitName");
+	ts_message_set_null_path(projection, (TsPath_t)(TsPathNode_t[]){"sensor-42", "temperature", NULL});
+	ts_message_set_null_path(projection, (TsPath_t)(TsPathNode_t[]){"settings", "interval", NULL});
+
+	ts_message_create(&message);
+	TsStatus_t status = ts_message_decode_projected(message, projection, TsEncoderJson, (uint8_t *) document, size);
+	if (status == TsStatusOk) {
+		uint8_t buffer[512];
+		size_t buffer_size = sizeof(buffer);
+		ts_message_encode(message, TsEncoderJson, buffer, &buffer_size);
+		printf("document %lu bytes, decoded %.*s\n", (unsigned long) size, (int) buffer_size, buffer);
+	}
+	ts_message_destroy(message);
+	ts_message_destroy(projection);
+	return status;
+}
+
+static TsStatus_t test22()
+{
+	// a batch of readings, sent as one payload
+	TsMessageRef_t message;
+	ts_message_create(&message);
+	ts_message_set_string(message, "characteristicsName", "temperature");
+	ts_message_set_float(message, "currentValue", 57.7f);
+
+	// the keys are known to both ends ahead of time
+	static TsCompressDictionary_t dictionary;
+	ts_compress_dictionary_init(&dictionary);
+	ts_compress_dictionary_keys(&dictionary, message, TsEncoderJson);
+
+	static uint8_t batch[16 * 1024], compressed[TS_COMPRESS_BOUND(16 * 1024)], decompressed[16 * 1024];
+	size_t batch_size = 0;
+	for (int i = 0; i < 100; i++) {
+		ts_message_set_float(message, "currentValue", 57.7f + (float) (i % 10));
+		size_t size = sizeof(batch) - batch_size;
+		ts_message_encode(message, TsEncoderJson, batch + batch_size, &size);
+		batch_size = batch_size + size;
+	}
+	ts_message_destroy(message);
+
+	static TsCompressor_t compressor;
+	static TsDecompressor_t decompressor;
+	ts_compress_init(&compressor, &dictionary);
+	ts_decompress_init(&decompressor, &dictionary);
+	size_t compressed_size = sizeof(compressed), decompressed_size = sizeof(decompressed);
+	TsStatus_t status = ts_compress(&compressor, batch, batch_size, compressed, &compressed_size);
+	if (status == TsStatusOk) {
+		status = ts_decompress(&decompressor, compressed, compressed_size, decompressed, &decompressed_size);
+	}
+	if (status != TsStatusOk) {
+		return status;
+	}
+	printf("batch %lu bytes, compressed %lu bytes, %s\n", (unsigned long) batch_size, (unsigned long) compressed_size,
+		   decompressed_size == batch_size && memcmp(batch, decompressed, batch_size) == 0 ? "restored" : "corrupt");
+	return TsStatusOk;
+}
+
+static TsStatus_t test21()
+{
+	// the uplink is down, so readings are kept in a store (a local file)
+	const char *path = "/tmp/test_message_store.bin";
+	unlink(path);
+	TsStore_t store;
+	TsStatus_t status = ts_store_open(&store, path, 1024 * 1024);
+	if (status != TsStatusOk) {
+		return status;
+	}
+
+	TsMessageRef_t message;
+	ts_message_create(&message);
+	ts_message_set_string(message, "unitName", "unit-name");
+	int stored = 0;
+	for (int i = 0; i < 10000; i++) {
+		ts_message_set_int(message, "sequence", i);
+		ts_message_set_float(message, "temperature", 57.7f + (float) (i % 10));
+		if (ts_store_encode(&store, message, i % 2 == 0 ? TsEncoderJson : TsEncoderCbor, 256) == TsStatusOk) {
+			stored++;
+		}
+	}
+	ts_message_destroy(message);
+	ts_store_sync(&store);
+	ts_store_close(&store);
+
+	// after a restart, replay (and release) everything stored
+	clock_t start = clock();
+	status = ts_store_open(&store, path, 1024 * 1024);
+	if (status != TsStatusOk) {
+		return status;
+	}
+	TsStoreBatch_t batch;
+	size_t records = 0, bytes = 0;
+	for (ts_store_read(&store, &batch); batch.count > 0; ts_store_read(&store, &batch)) {
+		records = records + batch.count;
+		bytes = bytes + batch.size;
+		ts_store_release(&store, &batch);
+	}
+	double elapsed = (double) (clock() - start) / CLOCKS_PER_SEC;
+	printf("stored %d, replayed %lu records (%lu bytes) in %.2f ms, %.0f MB/s\n", stored, (unsigned long) records,
+		   (unsigned long) bytes, elapsed * 1e3, elapsed > 0 ? (double) bytes / elapsed / 1e6 : 0.0);
+
+	ts_store_close(&store);
+	unlink(path);
+	return TsStatusOk;
+}
+
+static TsStatus_t test20()
+{
+	// the configuration, as kept in flash
+	TsMessageRef_t message, sensor;
+	ts_message_create(&message);
+	ts_message_set_string(message, "unitName", "unit-name");
+	ts_message_set_string(message, "unitSerialNo", "unit-serial-number, long enough not to be kept inline");
+	for (int i = 0; i < 8; i++) {
+		char name[TS_MESSAGE_MAX_KEY_SIZE];
+		snprintf(name, sizeof(name), "sensor-%d", i);
+		ts_message_create_message(message, name, &sensor);
+		ts_message_set_int(sensor, "interval", 1000 * i);
+		ts_message_set_float(sensor, "threshold", 57.7f + i);
+		ts_message_set_bool(sensor, "enabled", i % 2 == 0);
+	}
+
+	static uint8_t json[4096], flash[16 * 1024] __attribute__((aligned(TS_MESSAGE_CACHE_LINE)));
+	static uint8_t image[16 * 1024] __attribute__((aligned(TS_MESSAGE_CACHE_LINE)));
+	size_t json_size = sizeof(json), flash_size = sizeof(flash);
+	ts_message_encode(message, TsEncoderJson, json, &json_size);
+	TsStatus_t status = ts_message_snapshot_save(message, flash, &flash_size);
+	if (status != TsStatusOk) {
+		ts_message_destroy(message);
+		return status;
+	}
+	printf("json %lu bytes, snapshot %lu bytes\n", (unsigned long) json_size, (unsigned long) flash_size);
+
+	// read a setting in place, without loading
+	TsType_t type;
+	const void *value;
+	ts_message_snapshot_get_path(flash, flash_size, (TsPath_t)(TsPathNode_t[]){"sensor-3", "interval", NULL}, &type,
+								 &value);
+	printf("sensor-3 interval %d\n", *((const int *) value));
+
+	// restore by parsing, or by copying the image and fixing it up
+	const int iterations = 10000;
+	TsMessageRef_t restored;
+	clock_t start = clock();
+	for (int i = 0; i < iterations; i++) {
+		ts_message_create(&restored);
+		ts_message_decode(restored, TsEncoderJson, json, json_size);
+		ts_message_destroy(restored);
+	}
+	clock_t middle = clock();
+	for (int i = 0; i < iterations; i++) {
+		memcpy(image, flash, flash_size);
+		ts_message_snapshot_load(image, flash_size, &restored);
+		ts_message_destroy(restored);
+	}
+	clock_t end = clock();
+
+	memcpy(image, flash, flash_size);
+	ts_message_snapshot_load(image, flash_size, &restored);
+	bool equal = false;
+	ts_message_equal(message, restored, &equal);
+	printf("restore, decode %.1f us/op, snapshot %.1f us/op, equal(%s)\n",
+		   (double) (middle - start) * 1e6 / CLOCKS_PER_SEC / iterations,
+		   (double) (end - middle) * 1e6 / CLOCKS_PER_SEC / iterations, equal ? "yes" : "no");
+
+	// the restored message changes like any other
+	ts_message_set_int(restored, "sequence", 1);
+	ts_message_destroy(restored);
+	ts_message_destroy(message);
+	return TsStatusOk;
+}
+
+static TsStatus_t test19()
+{
+	// the report, and the last one sent (with the same fields, in another order)
+	TsMessageRef_t message, sent, location;
+	ts_message_create(&message);
+	ts_message_set_string(message, "unitName", "unit-name");
+	ts_message_set_int(message, "sequence", 1234);
+	ts_message_create_message(message, "location", &location);
+	ts_message_set_float(location, "latitude", 42.361145f);
+	ts_message_set_float(location, "longitude", -71.057083f);
+
+	ts_message_create(&sent);
+	ts_message_set_message(sent, "location", location);
+	ts_message_set_int(sent, "sequence", 1234);
+	ts_message_set_string(sent, "unitName", "unit-name");
+
+	uint64_t digest, last;
+	bool equal;
+	ts_message_digest(sent, &last);
+	ts_message_digest(message, &digest);
+	ts_message_equal(message, sent, &equal);
+	printf("unchanged, digests %016llx %016llx, equal(%s)\n", (unsigned long long) digest,
+		   (unsigned long long) last, equal ? "yes" : "no");
+
+	// nothing changed, i.e., the digest is kept
+	const int iterations = 1000000;
+	clock_t start = clock();
+	for (int i = 0; i < iterations; i++) {
+		ts_message_digest(message, &digest);
+	}
+	printf("kept digest, %.1f ns/op\n", (double) (clock() - start) * 1e9 / CLOCKS_PER_SEC / iterations);
+
+	// a changed leaf is picked up
+	ts_message_set_float(location, "latitude", 42.0f);
+	ts_message_digest(message, &digest);
+	ts_message_equal(message, sent, &equal);
+	printf("changed, digests %016llx %016llx, equal(%s)\n", (unsigned long long) digest,
+		   (unsigned long long) last, equal ? "yes" : "no");
+
+	ts_message_destroy(sent);
+	ts_message_destroy(message);
+	return TsStatusOk;
+}
+
+static TsStatus_t test18()
+{
+	// devices of readings, where only one reading changes between reports
+	TsMessageRef_t message, plain;
+	ts_message_create(&message);
+	for (int i = 0; i < TS_MESSAGE_MAX_BRANCHES; i++) {
+		char name[TS_MESSAGE_MAX_KEY_SIZE];
+		TsMessageRef_t device;
+		snprintf(name, sizeof(name), "device-%d", i);
+		ts_message_create_message(message, name, &device);
+		for (int k = 0; k < TS_MESSAGE_MAX_BRANCHES - 1; k++) {
+			snprintf(name, sizeof(name), "reading-%d", k);
+			ts_message_set_float(device, name, (float) (i * k) / 7.0f);
+		}
+	}
+	TsMessageRef_t device = message->value._xbranches;
+	ts_message_cache_encodings(message, true);
+
+	static uint8_t cached[64 * 1024], uncached[64 * 1024];
+	TsEncoder_t encoders[] = {TsEncoderJson, TsEncoderCbor};
+	for (int e = 0; e < 2; e++) {
+
+		size_t cached_size = 0, uncached_size = 0;
+		clock_t start = clock();
+		for (int n = 0; n < 1000; n++) {
+			ts_message_set_int(device, "sequence", n);
+			cached_size = sizeof(cached);
+			ts_message_encode(message, encoders[e], cached, &cached_size);
+		}
+		clock_t middle = clock();
+		ts_message_create_copy(message, &plain);
+		for (int n = 0; n < 1000; n++) {
+			ts_message_set_int(plain->value._xbranches, "sequence", n);
+			uncached_size = sizeof(uncached);
+			ts_message_encode(plain, encoders[e], uncached, &uncached_size);
+		}
+		clock_t end = clock();
+		ts_message_destroy(plain);
+
+		// (the copy doesnt cache, and the last encodes of both are of the same content)
+		printf("%s: cached %.1f us/op, uncached %.1f us/op, identical(%s)\n",
+			   encoders[e] == TsEncoderJson ? "json" : "cbor",
+			   (double) (middle - start) * 1e6 / CLOCKS_PER_SEC / 1000,
+			   (double) (end - middle) * 1e6 / CLOCKS_PER_SEC / 1000,
+			   cached_size == uncached_size && memcmp(cached, uncached, cached_size) == 0 ? "yes" : "no");
+	}
+
+	// a reading set from a node (i.e., a primitive, linked as it is into the cached message)
+	ts_message_create_copy(message, &plain);
+	TsMessageRef_t reading = device->next->value._xbranches->next;
+	ts_message_set(device->next, "copied", reading);
+	ts_message_set(plain->value._xbranches->next, "copied", reading);
+	for (int e = 0; e < 2; e++) {
+		size_t cached_size = sizeof(cached), uncached_size = sizeof(uncached);
+		ts_message_encode(message, encoders[e], cached, &cached_size);
+		ts_message_encode(plain, encoders[e], uncached, &uncached_size);
+		printf("%s: set from a node, identical(%s)\n", encoders[e] == TsEncoderJson ? "json" : "cbor",
+			   cached_size == uncached_size && memcmp(cached, uncached, cached_size) == 0 ? "yes" : "no");
+	}
+	ts_message_destroy(plain);
+
+	TsMessageFootprint_t footprint;
+	ts_message_footprint(message, &footprint);
+	printf("bytes allocated %lu, including the cached encodings\n", (unsigned long) footprint.bytes_allocated);
+	ts_message_destroy(message);
+	return TsStatusOk;
+}
+
+static TsStatus_t test17()
+{
+	static TestArena_t arena;
+	static TsMessageTrace_t trace;
+	TsMessageAllocator_t allocator = {test_arena_allocate, test_arena_release, &arena};
+	ts_message_trace_init(&trace, &allocator);
+
+	// a root (and all of its branches) traced over the arena
+	TsMessageRef_t message, location, copy;
+	ts_message_trace_site(__FILE__, __LINE__);
+	TsStatus_t status = ts_message_create_with(&(trace.allocator), &message);
+	if (status != TsStatusOk) {
+		return status;
+	}
+	ts_message_set_string(message, "unitName", "unit-name");
+	ts_message_set_string_borrowed(message, "unitSerialNo", "unit-serial-number");
+	ts_message_set_int(message, "sequence", 1234);
+	ts_message_trace_site(__FILE__, __LINE__);
+	ts_message_create_message(message, "location", &location);
+	ts_message_set_float(location, "latitude", 42.361145f);
+	ts_message_set_float(location, "longitude", -71.057083f);
+
+	// the global allocator, e.g., for the decoding of a copy
+	ts_message_set_allocator(&(trace.allocator));
+	ts_message_trace_site(__FILE__, __LINE__);
+	ts_message_create_copy(location, &copy);
+	ts_message_set_allocator(NULL);
+
+	// fill the arena, every failure must give back what it took
+	for (int i = 0; status == TsStatusOk; i++) {
+		char name[TS_MESSAGE_MAX_KEY_SIZE];
+		snprintf(name, sizeof(name), "field-%d", i);
+		status = ts_message_create_message(message, name, &location);
+	}
+	printf("arena full (%d), %lu bytes used, %lu released\n", status, (unsigned long) arena.used,
+		   (unsigned long) arena.released);
+
+	// the copy is left behind on purpose, i.e., reported as live
+	ts_message_destroy(message);
+	ts_message_trace_report(&trace);
+	ts_message_destroy(copy);
+	ts_message_trace_report(&trace);
+	return TsStatusOk;
+}
+
+static TsStatus_t test16()
+{
+	TsMessageRef_t message, location, readings, nested;
+	ts_message_create(&message);
+	ts_message_set_string(message, "unitName", "unit-name");
+	ts_message_set_int(message, "sequence", -1234);
+	ts_message_set_bool(message, "enabled", true);
+	ts_message_set_null(message, "comment");
+	ts_message_create_message(message, "location", &location);
+	ts_message_set_float(location, "latitude", 42.361145f);
+	ts_message_set_float(location, "longitude", -71.057083f);
+
+	TsMessageFootprint_t footprint;
+	uint8_t buffer[1024];
+	for (int i = 0; i < 2; i++) {
+
+		// the second time around, with arrays (nested in arrays too)
+		if (i == 1) {
+			ts_message_create_array(message, "readings", &readings);
+			ts_message_set_int_at(readings, 0, 100000);
+			ts_message_create_array(message, "nested", &nested);
+			ts_message_set_array_at(readings, 1, nested);
+		}
+
+		ts_message_footprint(message, &footprint);
+		printf("nodes %lu, depth %lu, widest %lu, longest name %lu, string %lu, bytes %lu (used %lu)\n",
+			   (unsigned long) footprint.nodes, (unsigned long) footprint.depth, (unsigned long) footprint.widest,
+			   (unsigned long) footprint.longest_name, (unsigned long) footprint.longest_string,
+			   (unsigned long) footprint.bytes_allocated, (unsigned long) footprint.bytes_used);
+
+		size_t buffer_size = sizeof(buffer);
+		ts_message_encode(message, TsEncoderJson, buffer, &buffer_size);
+		printf("json predicted %lu, encoded %lu\n", (unsigned long) footprint.json_size, (unsigned long) buffer_size);
+		buffer_size = sizeof(buffer);
+		TsStatus_t status = ts_message_encode(message, TsEncoderCbor, buffer, &buffer_size);
+		printf("cbor predicted %lu, encoded %lu (%d)\n", (unsigned long) footprint.cbor_size,
+			   (unsigned long) buffer_size, status);
+	}
+	ts_message_destroy(message);
+	return TsStatusOk;
+}
+
+static TsStatus_t test15()
+{
+	// some activity to count
+	TsMessageRef_t message;
+	uint8_t buffer[1024];
+	for (int i = 0; i < 1000; i++) {
+		TsEncoder_t encoder = i % 2 == 0 ? TsEncoderJson : TsEncoderCbor;
+		size_t buffer_size = sizeof(buffer);
+		ts_message_create(&message);
+		ts_message_set_int(message, "sequence", i);
+		ts_message_set_float(message, "temperature", 57.7f);
+		ts_message_encode(message, encoder, buffer, &buffer_size);
+		ts_message_destroy(message);
+		if (encoder == TsEncoderJson) {
+			ts_message_create(&message);
+			ts_message_decode(message, TsEncoderJson, buffer, buffer_size);
+			ts_message_destroy(message);
+		}
+	}
+	ts_message_report();
+
+	// report on itself, as a message
+	ts_message_create(&message);
+	TsStatus_t status = ts_message_statistics_export(message);
+	size_t buffer_size = sizeof(buffer);
+	ts_message_encode(message, TsEncoderJson, buffer, &buffer_size);
+	printf("%d, %s\n", status, buffer);
+	ts_message_destroy(message);
+	return status;
+}
+
+static TsStatus_t test14()
+{
+	// aggregate of downstream devices, i.e., (as wide as allowed) subtrees of readings
+	TsMessageRef_t message;
+	ts_message_create(&message);
+	for (int i = 0; i < TS_MESSAGE_MAX_BRANCHES; i++) {
+		char name[TS_MESSAGE_MAX_KEY_SIZE];
+		TsMessageRef_t device;
+		snprintf(name, sizeof(name), "device-%d", i);
+		ts_message_create_message(message, name, &device);
+		for (int j = 0; j < TS_MESSAGE_MAX_BRANCHES - 1; j++) {
+			TsMessageRef_t sensor;
+			snprintf(name, sizeof(name), "sensor-%d", j);
+			ts_message_create_message(device, name, &sensor);
+			for (int k = 0; k < TS_MESSAGE_MAX_BRANCHES; k++) {
+				snprintf(name, sizeof(name), "reading-%d", k);
+				ts_message_set_float(sensor, name, (float) (i * j * k) / 7.0f);
+			}
+		}
+
+		// and the history of the device, i.e., an array (the serial and parallel encodings must still match)
+		TsMessageRef_t history;
+		ts_message_create_array(device, "history", &history);
+		for (int k = 0; k < TS_MESSAGE_MAX_BRANCHES; k++) {
+			ts_message_set_float_at(history, k, (float) (i * k) / 7.0f);
+		}
+	}
+
+	static uint8_t serial[256 * 1024], parallel[256 * 1024];
+	TsEncoder_t encoders[] = {TsEncoderJson, TsEncoderCbor};
+	for (int e = 0; e < 2; e++) {
+
+		// note, clock() is cpu time (summed over all threads), so the wall time is taken instead
+		size_t serial_size = sizeof(serial);
+		struct timespec begin, end;
+		clock_gettime(CLOCK_MONOTONIC, &begin);
+		for (int n = 0; n < 20; n++) {
+			serial_size = sizeof(serial);
+			ts_message_encode(message, encoders[e], serial, &serial_size);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double elapsed = ((end.tv_sec - begin.tv_sec) * 1e3 + (end.tv_nsec - begin.tv_nsec) / 1e6) / 20;
+		printf("%s serial, %lu bytes, %.2f ms\n", e == 0 ? "json" : "cbor", (unsigned long) serial_size, elapsed);
+
+		for (size_t workers = 1; workers <= 4; workers = workers * 2) {
+			TsPool_t pool;
+			ts_pool_create(&pool, workers);
+			size_t parallel_size = sizeof(parallel);
+			clock_gettime(CLOCK_MONOTONIC, &begin);
+			TsStatus_t status = TsStatusOk;
+			for (int n = 0; n < 20; n++) {
+				parallel_size = sizeof(parallel);
+				status = ts_message_encode_parallel(message, encoders[e], &pool, parallel, &parallel_size);
+			}
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			ts_pool_destroy(&pool);
+			elapsed = ((end.tv_sec - begin.tv_sec) * 1e3 + (end.tv_nsec - begin.tv_nsec) / 1e6) / 20;
+			printf("%s parallel (%lu workers), %d, %lu bytes, %.2f ms, %s\n", e == 0 ? "json" : "cbor",
+				   (unsigned long) workers, status, (unsigned long) parallel_size, elapsed,
+				   parallel_size == serial_size && memcmp(serial, parallel, serial_size) == 0 ? "identical" : "different");
+		}
+	}
+
+	// a batch of messages, e.g., the devices themselves
+	TsPool_t pool;
+	ts_pool_create(&pool, 4);
+	TsMessageRef_t devices[TS_MESSAGE_MAX_BRANCHES];
+	uint8_t *buffers[TS_MESSAGE_MAX_BRANCHES];
+	size_t sizes[TS_MESSAGE_MAX_BRANCHES];
+	TsMessageRef_t device = message->value._xbranches;
+	for (int i = 0; i < TS_MESSAGE_MAX_BRANCHES; i++, device = device != NULL ? device->next : NULL) {
+		devices[i] = device;
+		buffers[i] = parallel + i * 16 * 1024;
+		sizes[i] = 16 * 1024;
+	}
+	TsStatus_t status = ts_message_encode_batch(devices, TS_MESSAGE_MAX_BRANCHES, TsEncoderCbor, &pool, buffers, sizes);
+	ts_pool_destroy(&pool);
+	printf("batch, %d, first %lu bytes\n", status, (unsigned long) sizes[0]);
+
+	ts_message_destroy(message);
+	return TsStatusOk;
+}
+
+static TsStatus_t test11()
+{
+	/* set through paths, creating the messages along them */
+	char text[] = "sensor.location.latitude";
+	TsPathNode_t path[TS_MESSAGE_MAX_DEPTH];
+	TsStatus_t status = ts_message_path_parse(text, path, TS_MESSAGE_MAX_DEPTH);
+	if (status != TsStatusOk) {
+		return status;
+	}
+
+	TsMessageRef_t message;
+	ts_message_create(&message);
+	ts_message_set_float_path(message, path, 42.361145f);
+	ts_message_set_int_path(message, (TsPath_t)(TsPathNode_t[]){"sensor", "setting", NULL}, 12);
+
+	/* compile once, then resolve without key lookups */
+	TsPathHandle_t handle;
+	status = ts_message_path_compile(message, path, &handle);
+	if (status != TsStatusOk) {
+		return status;
+	}
+
+	clock_t start = clock();
+	for (int i = 0; i < 100000; i++) {
+		TsMessageRef_t latitude;
+		ts_message_path_resolve(&handle, &latitude);
+		ts_message_set_float(latitude, NULL, (float) i);
+	}
+	double compiled = (double) (clock() - start) / CLOCKS_PER_SEC * 1e9 / 100000;
+
+	start = clock();
+	for (int i = 0; i < 100000; i++) {
+		ts_message_set_float_path(message, path, (float) i);
+	}
+	double uncompiled = (double) (clock() - start) / CLOCKS_PER_SEC * 1e9 / 100000;
+	printf("path set, compiled %.0f ns, by name %.0f ns\n", compiled, uncompiled);
+
+	/* structural changes are picked up on the next resolve */
+	ts_message_set_float_path(message, (TsPath_t)(TsPathNode_t[]){"sensor", "location", "longitude", NULL}, -71.057083f);
+	TsMessageRef_t sensor, latitude;
+	ts_message_create_message(message, "sensor", &sensor);
+	status = ts_message_path_resolve(&handle, &latitude);
+	printf("after replace, resolve %d\n", status);
+
+	ts_message_set_float_path(message, path, 42.361145f);
+	float value = 0;
+	ts_message_get_float_path(message, path, &value);
+	ts_message_path_resolve(&handle, &latitude);
+	printf("latitude %f %f\n", value, latitude->value._xfloat);
+
+	ts_message_encode(message, TsEncoderDebug, NULL, 0);
+	ts_message_destroy(message);
+	ts_message_report();
+	return TsStatusOk;
+}
+
+static TsStatus_t test10()
+{
+	Reading_t reading = {
+		.setting = 12,
+		.temperature = 52.2f,
+		.foo = {.zwitch = true, .comment = "this is my comment"},
+	};
+
+	/* the same content, as a message tree */
+	TsMessageRef_t message;
+	ts_message_create(&message);
+	TsStatus_t status = ts_reading_to_message(&reading, message);
+	if (status != TsStatusOk) {
+		ts_message_destroy(message);
+		return status;
+	}
+
+	/* compare the generated encoder with the generic (recursive) one */
+	const int iterations = 100000;
+	TsEncoder_t encoders[] = {TsEncoderJson, TsEncoderCbor};
+	for (int e = 0; e < 2; e++) {
+
+		uint8_t generated[CC_MAX_SEND_BUF_SZ], generic[CC_MAX_SEND_BUF_SZ];
+		size_t generated_size = 0, generic_size = 0;
+
+		clock_t start = clock();
+		for (int i = 0; i < iterations; i++) {
+			generated_size = sizeof(generated);
+			ts_reading_encode(&reading, encoders[e], generated, &generated_size);
+		}
+		clock_t middle = clock();
+		for (int i = 0; i < iterations; i++) {
+			generic_size = sizeof(generic);
+			ts_message_encode(message, encoders[e], generic, &generic_size);
+		}
+		clock_t end = clock();
+
+		printf("%s: generated %.1f ns/op, generic %.1f ns/op, identical(%s)\n",
+			   encoders[e] == TsEncoderJson ? "json" : "cbor",
+			   (double) (middle - start) * 1e9 / CLOCKS_PER_SEC / iterations,
+			   (double) (end - middle) * 1e9 / CLOCKS_PER_SEC / iterations,
+			   generated_size == generic_size && memcmp(generated, generic, generic_size) == 0 ? "yes" : "no");
+
+		/* and decode back */
+		Reading_t copy;
+		memset(&copy, 0x00, sizeof(copy));
+		status = ts_reading_decode(&copy, encoders[e], generated, generated_size);
+		if (status != TsStatusOk || memcmp(&copy, &reading, sizeof(copy)) != 0) {
+			printf("decode mismatch, %d\n", status);
+		}
+	}
+
+	/* clean up */
+	ts_message_destroy(message);
+
+	return TsStatusOk;
+}
+
+static TsStatus_t test09()
+{
+	Goo_t goo = {
+		.setting = 12,
+		.temperature = 52.2f,
+		.foo = {.zwitch = true, .comment = "this is my comment"},
+	};
+
+	/* encode the struct directly, i.e., without a message tree */
+	uint8_t buffer[CC_MAX_SEND_BUF_SZ];
+	size_t buffer_size = sizeof(buffer);
+	TsStatus_t status = ts_struct_encode(goo_descriptor, TS_DESCRIPTOR_COUNT(goo_descriptor), &goo,
+										 TsEncoderJson, buffer, &buffer_size);
+	if (status != TsStatusOk) {
+		return status;
+	}
+	printf("%s\n(length = %zu)\n", buffer, buffer_size);
+
+	/* and decode it back into another */
+	Goo_t copy;
+	memset(&copy, 0x00, sizeof(copy));
+	status = ts_struct_decode(goo_descriptor, TS_DESCRIPTOR_COUNT(goo_descriptor), &copy,
+							  TsEncoderJson, buffer, buffer_size);
+	if (status != TsStatusOk) {
+		return status;
+	}
+	printf("json: setting(%d) temperature(%f) switch(%u) comment(%s)\n",
+		   copy.setting, copy.temperature, copy.foo.zwitch, copy.foo.comment);
+
+	/* same again, using cbor */
+	buffer_size = sizeof(buffer);
+	status = ts_struct_encode(goo_descriptor, TS_DESCRIPTOR_COUNT(goo_descriptor), &goo,
+							  TsEncoderCbor, buffer, &buffer_size);
+	if (status != TsStatusOk) {
+		return status;
+	}
+	memset(&copy, 0x00, sizeof(copy));
+	status = ts_struct_decode(goo_descriptor, TS_DESCRIPTOR_COUNT(goo_descriptor), &copy,
+							  TsEncoderCbor, buffer, buffer_size);
+	if (status != TsStatusOk) {
+		return status;
+	}
+	printf("cbor: setting(%d) temperature(%f) switch(%u) comment(%s)\n(length = %zu)\n",
+		   copy.setting, copy.temperature, copy.foo.zwitch, copy.foo.comment, buffer_size);
+
+	return TsStatusOk;
+}
+
+static TsStatus_t test08()
+{
+	/* the test06 message, declared once as a schema (depth-first) */
+	enum {
+		UNIT_NAME, UNIT_MAC_ID, UNIT_SERIAL_NO, SENSOR, CHARACTERISTICS,
+		TEMPERATURE, TEMPERATURE_NAME, TEMPERATURE_VALUE,
+		LOCATION, LOCATION_NAME, LOCATION_VALUE, LATITUDE, LONGITUDE,
+	};
+	static const TsLayoutField_t schema[] = {
+		[UNIT_NAME] = {-1, "unitName", TsTypeString},
+		[UNIT_MAC_ID] = {-1, "unitMacId", TsTypeString},
+		[UNIT_SERIAL_NO] = {-1, "unitSerialNo", TsTypeString},
+		[SENSOR] = {-1, "sensor", TsTypeMessage},
+		[CHARACTERISTICS] = {SENSOR, "characteristics", TsTypeArray},
+		[TEMPERATURE] = {CHARACTERISTICS, NULL, TsTypeMessage},
+		[TEMPERATURE_NAME] = {TEMPERATURE, "characteristicsName", TsTypeString},
+		[TEMPERATURE_VALUE] = {TEMPERATURE, "currentValue", TsTypeFloat},
+		[LOCATION] = {CHARACTERISTICS, NULL, TsTypeMessage},
+		[LOCATION_NAME] = {LOCATION, "characteristicsName", TsTypeString},
+		[LOCATION_VALUE] = {LOCATION, "currentValue", TsTypeMessage},
+		[LATITUDE] = {LOCATION_VALUE, "latitude", TsTypeFloat},
+		[LONGITUDE] = {LOCATION_VALUE, "longitude", TsTypeFloat},
+	};
+
+	/* compile it into a layout */
+	static TsLayout_t layout;
+	TsStatus_t status = ts_layout_compile(&layout, schema, sizeof(schema) / sizeof(schema[0]));
+	if (status != TsStatusOk) {
+		return status;
+	}
+
+	/* set by slot, and encode */
+	ts_layout_set_string(&layout, UNIT_NAME, "unit-name");
+	ts_layout_set_string(&layout, UNIT_MAC_ID, "device-id");
+	ts_layout_set_string(&layout, UNIT_SERIAL_NO, "unit-serial-number");
+	ts_layout_set_string(&layout, TEMPERATURE_NAME, "temperature");
+	ts_layout_set_float(&layout, TEMPERATURE_VALUE, 57.7f);
+	ts_layout_set_string(&layout, LOCATION_NAME, "location");
+	ts_layout_set_float(&layout, LATITUDE, 42.361145f);
+	ts_layout_set_float(&layout, LONGITUDE, -71.057083f);
+
+	uint8_t buffer[CC_MAX_SEND_BUF_SZ];
+	size_t buffer_size = sizeof(buffer);
+	status = ts_layout_encode(&layout, TsEncoderJson, buffer, &buffer_size);
+	if (status != TsStatusOk) {
+		return status;
+	}
+	printf("%s\n(length = %zu)\n", buffer, buffer_size);
+
+	buffer_size = sizeof(buffer);
+	status = ts_layout_encode(&layout, TsEncoderCbor, buffer, &buffer_size);
+	if (status != TsStatusOk) {
+		return status;
+	}
+	for (size_t i = 0; i < buffer_size; i++) {
+		printf("%02x ", buffer[i]);
+	}
+	printf("\n(length = %zu)\n", buffer_size);
+
+	return TsStatusOk;
+}
+
+static TsStatus_t test07()
+{
+	/* build the message shape once,... */
+	TsMessageRef_t message, sensor, location;
+	ts_message_create(&message);
+	ts_message_set_string(message, "unitName", "unit-name");
+	ts_message_create_message(message, "sensor", &sensor);
+	ts_message_set_float(sensor, "temperature", 0.0f);
+	ts_message_create_message(sensor, "location", &location);
+	ts_message_set_float(location, "latitude", 0.0f);
+	ts_message_set_float(location, "longitude", 0.0f);
+
+	/* ...freeze it as a template, and keep handles to its leaves */
+	TsMessageRef_t temperature, latitude, longitude;
+	ts_message_freeze(message);
+	ts_message_get(sensor, "temperature", &temperature);
+	ts_message_get(location, "latitude", &latitude);
+	ts_message_get(location, "longitude", &longitude);
+
+	/* each reporting cycle only overwrites leaf values in place */
+	uint8_t buffer[CC_MAX_SEND_BUF_SZ];
+	for (int i = 0; i < 3; i++) {
+
+		ts_message_reset(message);
+		ts_message_set_float(temperature, NULL, 57.7f + i);
+		ts_message_set_float(latitude, NULL, 42.361145f);
+		ts_message_set_float(longitude, NULL, -71.057083f);
+
+		size_t buffer_size = sizeof(buffer);
+		TsStatus_t status = ts_message_encode(message, TsEncoderJson, buffer, &buffer_size);
+		if (status != TsStatusOk) {
+			ts_message_destroy(message);
+			return status;
+		}
+		printf("%s\n(length = %zu)\n", buffer, buffer_size);
+	}
+
+	/* clean up */
+	ts_message_destroy(message);
+	ts_message_report();
+
+	return TsStatusOk;
+}
+
 static TsStatus_t test05()
 {
 
@@ -145,12 +1169,8 @@ static TsStatus_t test04()
 	char content_format[CC_MAX_SEND_BUF_SZ] = "%s{\"characteristicsName\":\"%s\",\"currentValue\":%s}";
 
 	memset(content, 0x00, CC_MAX_SEND_BUF_SZ);
-	for (int i = 0; i < TS_MESSAGE_MAX_BRANCHES; i++) {
-
-		TsMessageRef_t branch = sensor->value._xfields[i];
-		if (branch == NULL) {
-			break;
-		}
+	int i = 0;
+	for (TsMessageRef_t branch = sensor->value._xbranches; branch != NULL; branch = branch->next, i++) {
 
 		char value[CC_MAX_SEND_BUF_SZ];
 		size_t value_size = CC_MAX_SEND_BUF_SZ;
@@ -0,0 +1,917 @@
+/* ts_message_gen */
+/* offline code generator, reads a json schema of message types and emits c source with */
+/* type-specialized (unrolled) encoders and decoders for the corresponding plain structs. */
+/* usage: ts_message_gen <schema.json> <output directory> */
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cJSON.h"
+#include "ts_message.h"
+
+/* generator limits */
+#define GEN_MAX_TYPES       32
+#define GEN_MAX_FIELDS      32
+#define GEN_MAX_NAME_SIZE   64
+#define GEN_MAX_PATH_SIZE   512
+#define GEN_MAX_CONST_SIZE  4096
+
+/* schema model */
+typedef struct GenType GenType_t;
+typedef struct {
+	char		name[GEN_MAX_NAME_SIZE];    /* field (key) name */
+	char		member[GEN_MAX_NAME_SIZE];  /* struct member name */
+	TsType_t	type;
+	size_t		size;                       /* string capacity */
+	GenType_t	*nested;                    /* nested type (TsTypeMessage only) */
+} GenField_t;
+
+struct GenType {
+	char		name[GEN_MAX_NAME_SIZE];    /* type name, e.g., Reading (emits Reading_t) */
+	char		lower[GEN_MAX_NAME_SIZE];   /* function prefix, e.g., reading (emits ts_reading_*) */
+	GenField_t	fields[GEN_MAX_FIELDS];
+	size_t		count;
+};
+
+/* pending constant output, merged between values */
+typedef struct {
+	FILE		*out;
+	uint8_t		data[GEN_MAX_CONST_SIZE];
+	size_t		size;
+} GenConst_t;
+
+static GenType_t _gen_types[GEN_MAX_TYPES];
+static size_t _gen_count = 0;
+
+/* support code, emitted verbatim into each generated source */
+static const char *_gen_support =
+	"/* output buffer */\n"
+	"typedef struct {\n"
+	"\tuint8_t\t*buffer;\n"
+	"\tsize_t\tsize;\n"
+	"\tsize_t\tused;\n"
+	"\tbool\toverflow;\n"
+	"} TsGenWriter_t;\n"
+	"\n"
+	"static void _ts_gen_put(TsGenWriter_t *w, const void *data, size_t length)\n"
+	"{\n"
+	"\tif (w->used + length > w->size) {\n"
+	"\t\tw->overflow = true;\n"
+	"\t\treturn;\n"
+	"\t}\n"
+	"\tmemcpy(w->buffer + w->used, data, length);\n"
+	"\tw->used = w->used + length;\n"
+	"}\n"
+	"\n"
+	"static void _ts_gen_put_int(TsGenWriter_t *w, int value)\n"
+	"{\n"
+	"\tchar text[12];\n"
+	"\tsize_t i = sizeof(text);\n"
+	"\tunsigned int xvalue = value < 0 ? 0u - (unsigned int) value : (unsigned int) value;\n"
+	"\tdo {\n"
+	"\t\ttext[--i] = (char) ('0' + xvalue % 10);\n"
+	"\t\txvalue = xvalue / 10;\n"
+	"\t} while (xvalue > 0);\n"
+	"\tif (value < 0) {\n"
+	"\t\ttext[--i] = '-';\n"
+	"\t}\n"
+	"\t_ts_gen_put(w, text + i, sizeof(text) - i);\n"
+	"}\n"
+	"\n"
+	"static void _ts_gen_put_float(TsGenWriter_t *w, float value)\n"
+	"{\n"
+	"\t/* note, formatted as ts_message does */\n"
+	"\tchar text[64];\n"
+	"\tint length = snprintf(text, sizeof(text), \"%f\", value);\n"
+	"\t_ts_gen_put(w, text, length > 0 ? (size_t) length : 0);\n"
+	"}\n"
+	"\n"
+	"static void _ts_gen_put_bool(TsGenWriter_t *w, bool value)\n"
+	"{\n"
+	"\t_ts_gen_put(w, value ? \"true\" : \"false\", value ? 4 : 5);\n"
+	"}\n"
+	"\n"
+	"static size_t _ts_gen_length(const char *value, size_t size)\n"
+	"{\n"
+	"\tconst char *end = memchr(value, '\\0', size);\n"
+	"\treturn end != NULL ? (size_t) (end - value) : size;\n"
+	"}\n"
+	"\n"
+	"static void _ts_gen_put_string(TsGenWriter_t *w, const char *value, size_t size)\n"
+	"{\n"
+	"\t_ts_gen_put(w, value, _ts_gen_length(value, size));\n"
+	"}\n"
+	"\n"
+	"static void _ts_gen_put_cbor_head(TsGenWriter_t *w, uint8_t major, uint32_t value)\n"
+	"{\n"
+	"\tuint8_t head[5];\n"
+	"\tmajor = (uint8_t) (major << 5);\n"
+	"\tif (value < 24) {\n"
+	"\t\thead[0] = (uint8_t) (major | value);\n"
+	"\t\t_ts_gen_put(w, head, 1);\n"
+	"\t} else if (value <= UINT8_MAX) {\n"
+	"\t\thead[0] = (uint8_t) (major | 24);\n"
+	"\t\thead[1] = (uint8_t) value;\n"
+	"\t\t_ts_gen_put(w, head, 2);\n"
+	"\t} else if (value <= UINT16_MAX) {\n"
+	"\t\thead[0] = (uint8_t) (major | 25);\n"
+	"\t\thead[1] = (uint8_t) (value >> 8);\n"
+	"\t\thead[2] = (uint8_t) value;\n"
+	"\t\t_ts_gen_put(w, head, 3);\n"
+	"\t} else {\n"
+	"\t\thead[0] = (uint8_t) (major | 26);\n"
+	"\t\thead[1] = (uint8_t) (value >> 24);\n"
+	"\t\thead[2] = (uint8_t) (value >> 16);\n"
+	"\t\thead[3] = (uint8_t) (value >> 8);\n"
+	"\t\thead[4] = (uint8_t) value;\n"
+	"\t\t_ts_gen_put(w, head, 5);\n"
+	"\t}\n"
+	"}\n"
+	"\n"
+	"static void _ts_gen_put_cbor_int(TsGenWriter_t *w, int value)\n"
+	"{\n"
+	"\tif (value >= 0) {\n"
+	"\t\t_ts_gen_put_cbor_head(w, 0, (uint32_t) value);\n"
+	"\t} else {\n"
+	"\t\t_ts_gen_put_cbor_head(w, 1, (uint32_t) (-1 - value));\n"
+	"\t}\n"
+	"}\n"
+	"\n"
+	"static void _ts_gen_put_cbor_float(TsGenWriter_t *w, float value)\n"
+	"{\n"
+	"\tuint32_t bits;\n"
+	"\tmemcpy(&bits, &value, sizeof(bits));\n"
+	"\tuint8_t item[5] = {0xfa, (uint8_t) (bits >> 24), (uint8_t) (bits >> 16), (uint8_t) (bits >> 8), (uint8_t) bits};\n"
+	"\t_ts_gen_put(w, item, sizeof(item));\n"
+	"}\n"
+	"\n"
+	"static void _ts_gen_put_cbor_bool(TsGenWriter_t *w, bool value)\n"
+	"{\n"
+	"\t_ts_gen_put(w, value ? \"\\xf5\" : \"\\xf4\", 1);\n"
+	"}\n"
+	"\n"
+	"static void _ts_gen_put_cbor_string(TsGenWriter_t *w, const char *value, size_t size)\n"
+	"{\n"
+	"\tsize_t length = _ts_gen_length(value, size);\n"
+	"\t_ts_gen_put_cbor_head(w, 3, (uint32_t) length);\n"
+	"\t_ts_gen_put(w, value, length);\n"
+	"}\n"
+	"\n"
+	"static TsStatus_t _ts_gen_json_number(TsJsonReaderRef_t reader, double *value, bool *found)\n"
+	"{\n"
+	"\tTsJsonToken_t token;\n"
+	"\tTsStatus_t status = ts_json_next(reader, &token);\n"
+	"\t*found = false;\n"
+	"\tif (status != TsStatusOk || token.type == TsJsonTokenNull) {\n"
+	"\t\treturn status;\n"
+	"\t}\n"
+	"\t*found = true;\n"
+	"\treturn ts_json_number(&token, value);\n"
+	"}\n"
+	"\n"
+	"static TsStatus_t _ts_gen_json_int(TsJsonReaderRef_t reader, int *value)\n"
+	"{\n"
+	"\tdouble xvalue;\n"
+	"\tbool found;\n"
+	"\tTsStatus_t status = _ts_gen_json_number(reader, &xvalue, &found);\n"
+	"\tif (status == TsStatusOk && found) {\n"
+	"\t\tif (!(xvalue >= INT32_MIN && xvalue <= INT32_MAX)) {\n"
+	"\t\t\treturn TsStatusErrorPreconditionFailed;\n"
+	"\t\t}\n"
+	"\t\t*value = (int) xvalue;\n"
+	"\t}\n"
+	"\treturn status;\n"
+	"}\n"
+	"\n"
+	"static TsStatus_t _ts_gen_json_float(TsJsonReaderRef_t reader, float *value)\n"
+	"{\n"
+	"\tdouble xvalue;\n"
+	"\tbool found;\n"
+	"\tTsStatus_t status = _ts_gen_json_number(reader, &xvalue, &found);\n"
+	"\tif (status == TsStatusOk && found) {\n"
+	"\t\t*value = (float) xvalue;\n"
+	"\t}\n"
+	"\treturn status;\n"
+	"}\n"
+	"\n"
+	"static TsStatus_t _ts_gen_json_bool(TsJsonReaderRef_t reader, bool *value)\n"
+	"{\n"
+	"\tTsJsonToken_t token;\n"
+	"\tTsStatus_t status = ts_json_next(reader, &token);\n"
+	"\tif (status != TsStatusOk || token.type == TsJsonTokenNull) {\n"
+	"\t\treturn status;\n"
+	"\t}\n"
+	"\tif (token.type != TsJsonTokenTrue && token.type != TsJsonTokenFalse) {\n"
+	"\t\treturn TsStatusErrorPreconditionFailed;\n"
+	"\t}\n"
+	"\t*value = (token.type == TsJsonTokenTrue);\n"
+	"\treturn TsStatusOk;\n"
+	"}\n"
+	"\n"
+	"static TsStatus_t _ts_gen_json_string(TsJsonReaderRef_t reader, char *value, size_t size)\n"
+	"{\n"
+	"\tTsJsonToken_t token;\n"
+	"\tTsStatus_t status = ts_json_next(reader, &token);\n"
+	"\tif (status != TsStatusOk || token.type == TsJsonTokenNull) {\n"
+	"\t\treturn status;\n"
+	"\t}\n"
+	"\tif (token.type != TsJsonTokenString) {\n"
+	"\t\treturn TsStatusErrorPreconditionFailed;\n"
+	"\t}\n"
+	"\t/* note, strings larger than the member are truncated */\n"
+	"\tts_json_string(&token, value, size);\n"
+	"\treturn TsStatusOk;\n"
+	"}\n"
+	"\n"
+	"static TsStatus_t _ts_gen_json_object(TsJsonReaderRef_t reader, bool *found)\n"
+	"{\n"
+	"\tTsJsonToken_t token;\n"
+	"\tTsStatus_t status = ts_json_next(reader, &token);\n"
+	"\t*found = false;\n"
+	"\tif (status != TsStatusOk || token.type == TsJsonTokenNull) {\n"
+	"\t\treturn status;\n"
+	"\t}\n"
+	"\tif (token.type != TsJsonTokenObjectBegin) {\n"
+	"\t\treturn TsStatusErrorPreconditionFailed;\n"
+	"\t}\n"
+	"\t*found = true;\n"
+	"\treturn TsStatusOk;\n"
+	"}\n"
+	"\n"
+	"static TsStatus_t _ts_gen_cbor_number(CborValue *it, double *value, bool *found)\n"
+	"{\n"
+	"\t*found = true;\n"
+	"\tif (cbor_value_is_integer(it)) {\n"
+	"\t\tint64_t xvalue;\n"
+	"\t\tcbor_value_get_int64(it, &xvalue);\n"
+	"\t\t*value = (double) xvalue;\n"
+	"\t} else if (cbor_value_is_float(it)) {\n"
+	"\t\tfloat xvalue;\n"
+	"\t\tcbor_value_get_float(it, &xvalue);\n"
+	"\t\t*value = xvalue;\n"
+	"\t} else if (cbor_value_is_double(it)) {\n"
+	"\t\tcbor_value_get_double(it, value);\n"
+	"\t} else if (cbor_value_is_null(it)) {\n"
+	"\t\t*found = false;\n"
+	"\t} else {\n"
+	"\t\treturn TsStatusErrorPreconditionFailed;\n"
+	"\t}\n"
+	"\treturn cbor_value_advance_fixed(it) == CborNoError ? TsStatusOk : TsStatusErrorBadRequest;\n"
+	"}\n"
+	"\n"
+	"static TsStatus_t _ts_gen_cbor_int(CborValue *it, int *value)\n"
+	"{\n"
+	"\tdouble xvalue;\n"
+	"\tbool found;\n"
+	"\tTsStatus_t status = _ts_gen_cbor_number(it, &xvalue, &found);\n"
+	"\tif (status == TsStatusOk && found) {\n"
+	"\t\tif (!(xvalue >= INT32_MIN && xvalue <= INT32_MAX)) {\n"
+	"\t\t\treturn TsStatusErrorPreconditionFailed;\n"
+	"\t\t}\n"
+	"\t\t*value = (int) xvalue;\n"
+	"\t}\n"
+	"\treturn status;\n"
+	"}\n"
+	"\n"
+	"static TsStatus_t _ts_gen_cbor_float(CborValue *it, float *value)\n"
+	"{\n"
+	"\tdouble xvalue;\n"
+	"\tbool found;\n"
+	"\tTsStatus_t status = _ts_gen_cbor_number(it, &xvalue, &found);\n"
+	"\tif (status == TsStatusOk && found) {\n"
+	"\t\t*value = (float) xvalue;\n"
+	"\t}\n"
+	"\treturn status;\n"
+	"}\n"
+	"\n"
+	"static TsStatus_t _ts_gen_cbor_bool(CborValue *it, bool *value)\n"
+	"{\n"
+	"\tif (cbor_value_is_boolean(it)) {\n"
+	"\t\tcbor_value_get_boolean(it, value);\n"
+	"\t} else if (!cbor_value_is_null(it)) {\n"
+	"\t\treturn TsStatusErrorPreconditionFailed;\n"
+	"\t}\n"
+	"\treturn cbor_value_advance_fixed(it) == CborNoError ? TsStatusOk : TsStatusErrorBadRequest;\n"
+	"}\n"
+	"\n"
+	"static TsStatus_t _ts_gen_cbor_string(CborValue *it, char *value, size_t size)\n"
+	"{\n"
+	"\tif (cbor_value_is_null(it)) {\n"
+	"\t\treturn cbor_value_advance_fixed(it) == CborNoError ? TsStatusOk : TsStatusErrorBadRequest;\n"
+	"\t}\n"
+	"\tif (!cbor_value_is_text_string(it)) {\n"
+	"\t\treturn TsStatusErrorPreconditionFailed;\n"
+	"\t}\n"
+	"\tCborError error = cbor_value_copy_text_string(it, value, &size, it);\n"
+	"\tif (error == CborErrorOutOfMemory) {\n"
+	"\t\treturn TsStatusErrorPayloadTooLarge;\n"
+	"\t}\n"
+	"\treturn error == CborNoError ? TsStatusOk : TsStatusErrorBadRequest;\n"
+	"}\n"
+	"\n";
+
+/* forward references */
+static int _gen_load(const char *, char *, size_t);
+static GenType_t *_gen_find(const char *);
+static void _gen_emit_header(FILE *, const char *);
+static void _gen_emit_source(FILE *, const char *);
+static void _gen_emit_encode_json(GenConst_t *, GenType_t *, const char *);
+static void _gen_emit_encode_cbor(GenConst_t *, GenType_t *, const char *);
+static void _gen_emit_decode_json(FILE *, GenType_t *);
+static void _gen_emit_decode_cbor(FILE *, GenType_t *);
+static void _gen_emit_to_message(FILE *, GenType_t *);
+static void _gen_emit_from_message(FILE *, GenType_t *);
+static void _gen_const(GenConst_t *, const void *, size_t);
+static void _gen_const_text(GenConst_t *, const char *);
+static void _gen_const_cbor(GenConst_t *, uint8_t, uint32_t);
+static void _gen_flush(GenConst_t *);
+static void _gen_value(GenConst_t *, const char *, ...);
+
+/* main */
+int main(int argc, char *argv[])
+{
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s <schema.json> <output directory>\n", argv[0]);
+		return 1;
+	}
+
+	/* load the schema */
+	char name[GEN_MAX_NAME_SIZE];
+	if (_gen_load(argv[1], name, sizeof(name)) != 0) {
+		return 1;
+	}
+
+	/* and emit its header and source */
+	char path[GEN_MAX_PATH_SIZE];
+	snprintf(path, sizeof(path), "%s/%s.h", argv[2], name);
+	FILE *header = fopen(path, "w");
+	if (header == NULL) {
+		fprintf(stderr, "ts_message_gen: cannot write %s\n", path);
+		return 1;
+	}
+	_gen_emit_header(header, name);
+	fclose(header);
+
+	snprintf(path, sizeof(path), "%s/%s.c", argv[2], name);
+	FILE *source = fopen(path, "w");
+	if (source == NULL) {
+		fprintf(stderr, "ts_message_gen: cannot write %s\n", path);
+		return 1;
+	}
+	_gen_emit_source(source, name);
+	fclose(source);
+	return 0;
+}
+
+/* _gen_load */
+static int _gen_load(const char *filename, char *name, size_t name_size)
+{
+	/* read the whole schema */
+	FILE *file = fopen(filename, "rb");
+	if (file == NULL) {
+		fprintf(stderr, "ts_message_gen: cannot read %s\n", filename);
+		return -1;
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	char *text = malloc((size_t) size + 1);
+	if (text == NULL || fread(text, 1, (size_t) size, file) != (size_t) size) {
+		fprintf(stderr, "ts_message_gen: cannot read %s\n", filename);
+		fclose(file);
+		free(text);
+		return -1;
+	}
+	text[size] = '\0';
+	fclose(file);
+
+	cJSON *schema = cJSON_Parse(text);
+	free(text);
+	cJSON *xname = cJSON_GetObjectItemCaseSensitive(schema, "name");
+	cJSON *types = cJSON_GetObjectItemCaseSensitive(schema, "types");
+	if (!cJSON_IsString(xname) || !cJSON_IsArray(types)) {
+		fprintf(stderr, "ts_message_gen: %s requires a name and types\n", filename);
+		cJSON_Delete(schema);
+		return -1;
+	}
+	snprintf(name, name_size, "%s", xname->valuestring);
+
+	/* types may only refer to types declared before them */
+	cJSON *type;
+	cJSON_ArrayForEach(type, types) {
+
+		cJSON *tname = cJSON_GetObjectItemCaseSensitive(type, "name");
+		cJSON *fields = cJSON_GetObjectItemCaseSensitive(type, "fields");
+		if (_gen_count >= GEN_MAX_TYPES || !cJSON_IsString(tname) || !cJSON_IsArray(fields)) {
+			fprintf(stderr, "ts_message_gen: invalid type declaration\n");
+			cJSON_Delete(schema);
+			return -1;
+		}
+		GenType_t *xtype = &(_gen_types[_gen_count++]);
+		snprintf(xtype->name, sizeof(xtype->name), "%s", tname->valuestring);
+		for (size_t i = 0; xtype->name[i] != '\0'; i++) {
+			xtype->lower[i] = (char) tolower((unsigned char) xtype->name[i]);
+		}
+
+		cJSON *field;
+		cJSON_ArrayForEach(field, fields) {
+
+			cJSON *fname = cJSON_GetObjectItemCaseSensitive(field, "name");
+			cJSON *fmember = cJSON_GetObjectItemCaseSensitive(field, "member");
+			cJSON *ftype = cJSON_GetObjectItemCaseSensitive(field, "type");
+			cJSON *fsize = cJSON_GetObjectItemCaseSensitive(field, "size");
+			if (xtype->count >= GEN_MAX_FIELDS || !cJSON_IsString(fname) || !cJSON_IsString(ftype)) {
+				fprintf(stderr, "ts_message_gen: invalid field declaration in %s\n", xtype->name);
+				cJSON_Delete(schema);
+				return -1;
+			}
+			GenField_t *xfield = &(xtype->fields[xtype->count++]);
+			snprintf(xfield->name, sizeof(xfield->name), "%s", fname->valuestring);
+			snprintf(xfield->member, sizeof(xfield->member), "%s",
+					 cJSON_IsString(fmember) ? fmember->valuestring : fname->valuestring);
+
+			const char *t = ftype->valuestring;
+			if (strcmp(t, "integer") == 0) {
+				xfield->type = TsTypeInteger;
+			} else if (strcmp(t, "float") == 0) {
+				xfield->type = TsTypeFloat;
+			} else if (strcmp(t, "boolean") == 0) {
+				xfield->type = TsTypeBoolean;
+			} else if (strcmp(t, "string") == 0) {
+				xfield->type = TsTypeString;
+				xfield->size = cJSON_IsNumber(fsize) ? (size_t) fsize->valueint : TS_MESSAGE_MAX_STRING_SIZE;
+			} else if ((xfield->nested = _gen_find(t)) != NULL) {
+				xfield->type = TsTypeMessage;
+			} else {
+				fprintf(stderr, "ts_message_gen: unknown type %s in %s\n", t, xtype->name);
+				cJSON_Delete(schema);
+				return -1;
+			}
+		}
+	}
+	cJSON_Delete(schema);
+	return 0;
+}
+
+/* _gen_find */
+static GenType_t *_gen_find(const char *name)
+{
+	for (size_t i = 0; i < _gen_count; i++) {
+		if (strcmp(_gen_types[i].name, name) == 0) {
+			return &(_gen_types[i]);
+		}
+	}
+	return NULL;
+}
+
+/* _gen_emit_header */
+static void _gen_emit_header(FILE *out, const char *name)
+{
+	fprintf(out, "/* generated by ts_message_gen from the %s schema, do not edit */\n", name);
+	char upper[GEN_MAX_NAME_SIZE];
+	for (size_t i = 0; i < sizeof(upper); i++) {
+		upper[i] = (char) toupper((unsigned char) name[i]);
+		if (name[i] == '\0') {
+			break;
+		}
+	}
+	fprintf(out, "#ifndef TS_GEN_%s_H\n#define TS_GEN_%s_H\n\n", upper, upper);
+	fprintf(out, "#include <stdbool.h>\n#include <stdint.h>\n#include <stdlib.h>\n\n");
+	fprintf(out, "#include \"ts_common.h\"\n#include \"ts_message.h\"\n\n");
+
+	for (size_t i = 0; i < _gen_count; i++) {
+		GenType_t *type = &(_gen_types[i]);
+		fprintf(out, "typedef struct {\n");
+		for (size_t j = 0; j < type->count; j++) {
+			GenField_t *field = &(type->fields[j]);
+			switch (field->type) {
+			case TsTypeInteger:
+				fprintf(out, "\tint\t\t%s;\n", field->member);
+				break;
+			case TsTypeFloat:
+				fprintf(out, "\tfloat\t%s;\n", field->member);
+				break;
+			case TsTypeBoolean:
+				fprintf(out, "\tbool\t%s;\n", field->member);
+				break;
+			case TsTypeString:
+				fprintf(out, "\tchar\t%s[%zu];\n", field->member, field->size);
+				break;
+			default:
+				fprintf(out, "\t%s_t\t%s;\n", field->nested->name, field->member);
+				break;
+			}
+		}
+		fprintf(out, "} %s_t;\n\n", type->name);
+	}
+
+	fprintf(out, "#ifdef __cplusplus\nextern \"C\" {\n#endif\n\n");
+	for (size_t i = 0; i < _gen_count; i++) {
+		GenType_t *type = &(_gen_types[i]);
+		fprintf(out, "/* %s */\n", type->name);
+		fprintf(out, "TsStatus_t ts_%s_encode(const %s_t *value, TsEncoder_t encoder, uint8_t *buffer, "
+					 "size_t *buffer_size);\n", type->lower, type->name);
+		fprintf(out, "TsStatus_t ts_%s_decode(%s_t *value, TsEncoder_t encoder, uint8_t *buffer, "
+					 "size_t buffer_size);\n", type->lower, type->name);
+		fprintf(out, "TsStatus_t ts_%s_to_message(const %s_t *value, TsMessageRef_t message);\n",
+				type->lower, type->name);
+		fprintf(out, "TsStatus_t ts_%s_from_message(TsMessageRef_t message, %s_t *value);\n\n",
+				type->lower, type->name);
+	}
+	fprintf(out, "#ifdef __cplusplus\n}\n#endif\n\n#endif /* TS_GEN_%s_H */\n", upper);
+}
+
+/* _gen_emit_source */
+static void _gen_emit_source(FILE *out, const char *name)
+{
+	fprintf(out, "/* generated by ts_message_gen from the %s schema, do not edit */\n", name);
+	fprintf(out, "#include <string.h>\n#include <stdio.h>\n#include \"cbor.h\"\n\n");
+	fprintf(out, "#include \"ts_common.h\"\n#include \"ts_json.h\"\n#include \"%s.h\"\n\n", name);
+	fputs(_gen_support, out);
+
+	for (size_t i = 0; i < _gen_count; i++) {
+		GenType_t *type = &(_gen_types[i]);
+		GenConst_t xconst = {.out = out, .size = 0};
+
+		/* encoders, fully unrolled (nested types are inlined) */
+		fprintf(out, "/* %s */\n", type->name);
+		fprintf(out, "static TsStatus_t _ts_%s_encode_json(const %s_t *value, TsGenWriter_t *w)\n{\n",
+				type->lower, type->name);
+		_gen_emit_encode_json(&xconst, type, "value->");
+		_gen_flush(&xconst);
+		fprintf(out, "\tif (w->overflow || w->used >= w->size) {\n\t\treturn TsStatusErrorOutOfMemory;\n\t}\n");
+		fprintf(out, "\tw->buffer[w->used] = 0x00;\n\treturn TsStatusOk;\n}\n\n");
+
+		fprintf(out, "static TsStatus_t _ts_%s_encode_cbor(const %s_t *value, TsGenWriter_t *w)\n{\n",
+				type->lower, type->name);
+		_gen_emit_encode_cbor(&xconst, type, "value->");
+		_gen_flush(&xconst);
+		fprintf(out, "\treturn w->overflow ? TsStatusErrorOutOfMemory : TsStatusOk;\n}\n\n");
+
+		fprintf(out, "TsStatus_t ts_%s_encode(const %s_t *value, TsEncoder_t encoder, uint8_t *buffer, "
+					 "size_t *buffer_size)\n{\n", type->lower, type->name);
+		fprintf(out, "\tif (value == NULL || buffer == NULL || buffer_size == NULL) {\n"
+					 "\t\treturn TsStatusErrorPreconditionFailed;\n\t}\n");
+		fprintf(out, "\tTsGenWriter_t w = {.buffer = buffer, .size = *buffer_size, .used = 0, .overflow = false};\n");
+		fprintf(out, "\tTsStatus_t status = TsStatusErrorNotImplemented;\n");
+		fprintf(out, "\tswitch (encoder) {\n");
+		fprintf(out, "\tcase TsEncoderJson:\n\t\tstatus = _ts_%s_encode_json(value, &w);\n\t\tbreak;\n",
+				type->lower);
+		fprintf(out, "\tcase TsEncoderCbor:\n\t\tstatus = _ts_%s_encode_cbor(value, &w);\n\t\tbreak;\n",
+				type->lower);
+		fprintf(out, "\tdefault:\n\t\tbreak;\n\t}\n\t*buffer_size = w.used;\n\treturn status;\n}\n\n");
+
+		/* decoders */
+		_gen_emit_decode_json(out, type);
+		_gen_emit_decode_cbor(out, type);
+		fprintf(out, "TsStatus_t ts_%s_decode(%s_t *value, TsEncoder_t encoder, uint8_t *buffer, "
+					 "size_t buffer_size)\n{\n", type->lower, type->name);
+		fprintf(out, "\tif (value == NULL || buffer == NULL) {\n\t\treturn TsStatusErrorPreconditionFailed;\n\t}\n");
+		fprintf(out, "\tswitch (encoder) {\n");
+		fprintf(out, "\tcase TsEncoderJson: {\n");
+		fprintf(out, "\t\tTsJsonReader_t reader;\n\t\tbool found;\n");
+		fprintf(out, "\t\tts_json_reader_init(&reader, (const char *) buffer, buffer_size);\n");
+		fprintf(out, "\t\tTsStatus_t status = _ts_gen_json_object(&reader, &found);\n");
+		fprintf(out, "\t\tif (status != TsStatusOk || !found) {\n"
+					 "\t\t\treturn status != TsStatusOk ? status : TsStatusErrorPreconditionFailed;\n\t\t}\n");
+		fprintf(out, "\t\treturn _ts_%s_decode_json(value, &reader);\n\t}\n", type->lower);
+		fprintf(out, "\tcase TsEncoderCbor: {\n");
+		fprintf(out, "\t\tCborParser parser;\n\t\tCborValue it;\n");
+		fprintf(out, "\t\tif (cbor_parser_init(buffer, buffer_size, 0, &parser, &it) != CborNoError) {\n"
+					 "\t\t\treturn TsStatusErrorBadRequest;\n\t\t}\n");
+		fprintf(out, "\t\treturn _ts_%s_decode_cbor(value, &it);\n\t}\n", type->lower);
+		fprintf(out, "\tdefault:\n\t\tbreak;\n\t}\n\treturn TsStatusErrorNotImplemented;\n}\n\n");
+
+		/* message interoperability, i.e., with ts_message_encode and ts_message_decode */
+		_gen_emit_to_message(out, type);
+		_gen_emit_from_message(out, type);
+	}
+}
+
+/* _gen_emit_encode_json */
+static void _gen_emit_encode_json(GenConst_t *xconst, GenType_t *type, const char *path)
+{
+	_gen_const_text(xconst, "{");
+	for (size_t i = 0; i < type->count; i++) {
+		GenField_t *field = &(type->fields[i]);
+		_gen_const_text(xconst, i > 0 ? ",\"" : "\"");
+		_gen_const_text(xconst, field->name);
+		_gen_const_text(xconst, "\":");
+		switch (field->type) {
+		case TsTypeInteger:
+			_gen_value(xconst, "\t_ts_gen_put_int(w, %s%s);\n", path, field->member);
+			break;
+		case TsTypeFloat:
+			_gen_value(xconst, "\t_ts_gen_put_float(w, %s%s);\n", path, field->member);
+			break;
+		case TsTypeBoolean:
+			_gen_value(xconst, "\t_ts_gen_put_bool(w, %s%s);\n", path, field->member);
+			break;
+		case TsTypeString:
+			_gen_const_text(xconst, "\"");
+			_gen_value(xconst, "\t_ts_gen_put_string(w, %s%s, sizeof(%s%s));\n", path, field->member, path,
+					   field->member);
+			_gen_const_text(xconst, "\"");
+			break;
+		default: {
+			char xpath[GEN_MAX_PATH_SIZE];
+			snprintf(xpath, sizeof(xpath), "%s%s.", path, field->member);
+			_gen_emit_encode_json(xconst, field->nested, xpath);
+			break;
+		}
+		}
+	}
+	_gen_const_text(xconst, "}");
+}
+
+/* _gen_emit_encode_cbor */
+static void _gen_emit_encode_cbor(GenConst_t *xconst, GenType_t *type, const char *path)
+{
+	/* note, container sizes are known, i.e., maps have a definite length */
+	_gen_const_cbor(xconst, 5, (uint32_t) type->count);
+	for (size_t i = 0; i < type->count; i++) {
+		GenField_t *field = &(type->fields[i]);
+		_gen_const_cbor(xconst, 3, (uint32_t) strlen(field->name));
+		_gen_const_text(xconst, field->name);
+		switch (field->type) {
+		case TsTypeInteger:
+			_gen_value(xconst, "\t_ts_gen_put_cbor_int(w, %s%s);\n", path, field->member);
+			break;
+		case TsTypeFloat:
+			_gen_value(xconst, "\t_ts_gen_put_cbor_float(w, %s%s);\n", path, field->member);
+			break;
+		case TsTypeBoolean:
+			_gen_value(xconst, "\t_ts_gen_put_cbor_bool(w, %s%s);\n", path, field->member);
+			break;
+		case TsTypeString:
+			_gen_value(xconst, "\t_ts_gen_put_cbor_string(w, %s%s, sizeof(%s%s));\n", path, field->member, path,
+					   field->member);
+			break;
+		default: {
+			char xpath[GEN_MAX_PATH_SIZE];
+			snprintf(xpath, sizeof(xpath), "%s%s.", path, field->member);
+			_gen_emit_encode_cbor(xconst, field->nested, xpath);
+			break;
+		}
+		}
+	}
+}
+
+/* _gen_emit_decode_json */
+/* keys are matched by length first, and then compared with the baked in constant */
+static void _gen_emit_decode_json(FILE *out, GenType_t *type)
+{
+	fprintf(out, "static TsStatus_t _ts_%s_decode_json(%s_t *value, TsJsonReaderRef_t reader)\n{\n",
+			type->lower, type->name);
+	fprintf(out, "\tTsJsonToken_t token;\n\tfor (;;) {\n");
+	fprintf(out, "\t\tTsStatus_t status = ts_json_next(reader, &token);\n");
+	fprintf(out, "\t\tif (status != TsStatusOk || token.type == TsJsonTokenObjectEnd) {\n\t\t\treturn status;\n\t\t}\n");
+	fprintf(out, "\t\tstatus = TsStatusErrorNotFound;\n");
+	fprintf(out, "\t\tswitch (token.size) {\n");
+	for (size_t i = 0; i < type->count; i++) {
+
+		/* group by length */
+		size_t length = strlen(type->fields[i].name);
+		bool seen = false;
+		for (size_t j = 0; j < i; j++) {
+			seen = seen || strlen(type->fields[j].name) == length;
+		}
+		if (seen) {
+			continue;
+		}
+		fprintf(out, "\t\tcase %zu:\n", length);
+		const char *prefix = "\t\t\tif";
+		for (size_t j = i; j < type->count; j++) {
+			GenField_t *field = &(type->fields[j]);
+			if (strlen(field->name) != length) {
+				continue;
+			}
+			fprintf(out, "%s (memcmp(token.text, \"%s\", %zu) == 0) {\n", prefix, field->name, length);
+			switch (field->type) {
+			case TsTypeInteger:
+				fprintf(out, "\t\t\t\tstatus = _ts_gen_json_int(reader, &(value->%s));\n", field->member);
+				break;
+			case TsTypeFloat:
+				fprintf(out, "\t\t\t\tstatus = _ts_gen_json_float(reader, &(value->%s));\n", field->member);
+				break;
+			case TsTypeBoolean:
+				fprintf(out, "\t\t\t\tstatus = _ts_gen_json_bool(reader, &(value->%s));\n", field->member);
+				break;
+			case TsTypeString:
+				fprintf(out, "\t\t\t\tstatus = _ts_gen_json_string(reader, value->%s, sizeof(value->%s));\n",
+						field->member, field->member);
+				break;
+			default:
+				fprintf(out, "\t\t\t\tbool found;\n");
+				fprintf(out, "\t\t\t\tstatus = _ts_gen_json_object(reader, &found);\n");
+				fprintf(out, "\t\t\t\tif (status == TsStatusOk && found) {\n");
+				fprintf(out, "\t\t\t\t\tstatus = _ts_%s_decode_json(&(value->%s), reader);\n\t\t\t\t}\n",
+						field->nested->lower, field->member);
+				break;
+			}
+			fprintf(out, "\t\t\t}");
+			prefix = " else if";
+		}
+		fprintf(out, "\n\t\t\tbreak;\n");
+	}
+	fprintf(out, "\t\tdefault:\n\t\t\tbreak;\n\t\t}\n");
+	fprintf(out, "\t\tif (status == TsStatusErrorNotFound) {\n\t\t\tstatus = ts_json_skip(reader, &token);\n\t\t}\n");
+	fprintf(out, "\t\tif (status != TsStatusOk) {\n\t\t\treturn status;\n\t\t}\n\t}\n}\n\n");
+}
+
+/* _gen_emit_decode_cbor */
+static void _gen_emit_decode_cbor(FILE *out, GenType_t *type)
+{
+	fprintf(out, "static TsStatus_t _ts_%s_decode_cbor(%s_t *value, CborValue *it)\n{\n", type->lower, type->name);
+	fprintf(out, "\tif (cbor_value_is_null(it)) {\n"
+				 "\t\treturn cbor_value_advance_fixed(it) == CborNoError ? TsStatusOk : TsStatusErrorBadRequest;\n\t}\n");
+	fprintf(out, "\tCborValue map;\n");
+	fprintf(out, "\tif (!cbor_value_is_map(it) || cbor_value_enter_container(it, &map) != CborNoError) {\n"
+				 "\t\treturn TsStatusErrorPreconditionFailed;\n\t}\n");
+	fprintf(out, "\twhile (!cbor_value_at_end(&map)) {\n");
+	fprintf(out, "\t\tint field = -1;\n\t\tbool match = false;\n");
+	fprintf(out, "\t\tif (!cbor_value_is_text_string(&map)) {\n\t\t\treturn TsStatusErrorBadRequest;\n\t\t}\n");
+	for (size_t i = 0; i < type->count; i++) {
+		fprintf(out, "\t\t%sif (cbor_value_text_string_equals(&map, \"%s\", &match) == CborNoError && match) {\n"
+					 "\t\t\tfield = %zu;\n\t\t}\n", i > 0 ? "else " : "", type->fields[i].name, i);
+	}
+	fprintf(out, "\t\tif (cbor_value_advance(&map) != CborNoError) {\n\t\t\treturn TsStatusErrorBadRequest;\n\t\t}\n");
+	fprintf(out, "\t\tTsStatus_t status;\n\t\tswitch (field) {\n");
+	for (size_t i = 0; i < type->count; i++) {
+		GenField_t *field = &(type->fields[i]);
+		fprintf(out, "\t\tcase %zu:\n", i);
+		switch (field->type) {
+		case TsTypeInteger:
+			fprintf(out, "\t\t\tstatus = _ts_gen_cbor_int(&map, &(value->%s));\n", field->member);
+			break;
+		case TsTypeFloat:
+			fprintf(out, "\t\t\tstatus = _ts_gen_cbor_float(&map, &(value->%s));\n", field->member);
+			break;
+		case TsTypeBoolean:
+			fprintf(out, "\t\t\tstatus = _ts_gen_cbor_bool(&map, &(value->%s));\n", field->member);
+			break;
+		case TsTypeString:
+			fprintf(out, "\t\t\tstatus = _ts_gen_cbor_string(&map, value->%s, sizeof(value->%s));\n",
+					field->member, field->member);
+			break;
+		default:
+			fprintf(out, "\t\t\tstatus = _ts_%s_decode_cbor(&(value->%s), &map);\n", field->nested->lower,
+					field->member);
+			break;
+		}
+		fprintf(out, "\t\t\tbreak;\n");
+	}
+	fprintf(out, "\t\tdefault:\n\t\t\tstatus = cbor_value_advance(&map) == CborNoError ? TsStatusOk : "
+				 "TsStatusErrorBadRequest;\n\t\t\tbreak;\n\t\t}\n");
+	fprintf(out, "\t\tif (status != TsStatusOk) {\n\t\t\treturn status;\n\t\t}\n\t}\n");
+	fprintf(out, "\treturn cbor_value_leave_container(it, &map) == CborNoError ? TsStatusOk : "
+				 "TsStatusErrorBadRequest;\n}\n\n");
+}
+
+/* _gen_emit_to_message */
+static void _gen_emit_to_message(FILE *out, GenType_t *type)
+{
+	fprintf(out, "TsStatus_t ts_%s_to_message(const %s_t *value, TsMessageRef_t message)\n{\n", type->lower,
+			type->name);
+	fprintf(out, "\tTsStatus_t status = TsStatusOk;\n");
+	for (size_t i = 0; i < type->count; i++) {
+		GenField_t *field = &(type->fields[i]);
+		switch (field->type) {
+		case TsTypeInteger:
+			fprintf(out, "\tif (status == TsStatusOk) {\n\t\tstatus = ts_message_set_int(message, \"%s\", "
+						 "value->%s);\n\t}\n", field->name, field->member);
+			break;
+		case TsTypeFloat:
+			fprintf(out, "\tif (status == TsStatusOk) {\n\t\tstatus = ts_message_set_float(message, \"%s\", "
+						 "value->%s);\n\t}\n", field->name, field->member);
+			break;
+		case TsTypeBoolean:
+			fprintf(out, "\tif (status == TsStatusOk) {\n\t\tstatus = ts_message_set_bool(message, \"%s\", "
+						 "value->%s);\n\t}\n", field->name, field->member);
+			break;
+		case TsTypeString:
+			fprintf(out, "\tif (status == TsStatusOk) {\n\t\tstatus = ts_message_set_string(message, \"%s\", "
+						 "(char *) value->%s);\n\t}\n", field->name, field->member);
+			break;
+		default:
+			fprintf(out, "\tif (status == TsStatusOk) {\n\t\tTsMessageRef_t branch;\n"
+						 "\t\tstatus = ts_message_create_message(message, \"%s\", &branch);\n"
+						 "\t\tif (status == TsStatusOk) {\n\t\t\tstatus = ts_%s_to_message(&(value->%s), branch);\n"
+						 "\t\t}\n\t}\n", field->name, field->nested->lower, field->member);
+			break;
+		}
+	}
+	fprintf(out, "\treturn status;\n}\n\n");
+}
+
+/* _gen_emit_from_message */
+static void _gen_emit_from_message(FILE *out, GenType_t *type)
+{
+	fprintf(out, "TsStatus_t ts_%s_from_message(TsMessageRef_t message, %s_t *value)\n{\n", type->lower,
+			type->name);
+	fprintf(out, "\tTsStatus_t status;\n");
+	for (size_t i = 0; i < type->count; i++) {
+		GenField_t *field = &(type->fields[i]);
+		switch (field->type) {
+		case TsTypeInteger:
+			fprintf(out, "\tstatus = ts_message_get_int(message, \"%s\", &(value->%s));\n", field->name,
+					field->member);
+			break;
+		case TsTypeFloat:
+			fprintf(out, "\tstatus = ts_message_get_float(message, \"%s\", &(value->%s));\n", field->name,
+					field->member);
+			break;
+		case TsTypeBoolean:
+			fprintf(out, "\tstatus = ts_message_get_bool(message, \"%s\", &(value->%s));\n", field->name,
+					field->member);
+			break;
+		case TsTypeString:
+			fprintf(out, "\t{\n\t\tchar *xstring;\n\t\tstatus = ts_message_get_string(message, \"%s\", &xstring);\n"
+						 "\t\tif (status == TsStatusOk) {\n"
+						 "\t\t\tsnprintf(value->%s, sizeof(value->%s), \"%%s\", xstring);\n\t\t}\n\t}\n",
+					field->name, field->member, field->member);
+			break;
+		default:
+			fprintf(out, "\t{\n\t\tTsMessageRef_t branch;\n"
+						 "\t\tstatus = ts_message_get_message(message, \"%s\", &branch);\n"
+						 "\t\tif (status == TsStatusOk) {\n\t\t\tstatus = ts_%s_from_message(branch, &(value->%s));\n"
+						 "\t\t}\n\t}\n", field->name, field->nested->lower, field->member);
+			break;
+		}
+		fprintf(out, "\tif (status != TsStatusOk && status != TsStatusErrorNotFound) {\n\t\treturn status;\n\t}\n");
+	}
+	fprintf(out, "\treturn TsStatusOk;\n}\n\n");
+}
+
+/* _gen_const */
+static void _gen_const(GenConst_t *xconst, const void *data, size_t size)
+{
+	if (xconst->size + size > GEN_MAX_CONST_SIZE) {
+		_gen_flush(xconst);
+	}
+	memcpy(xconst->data + xconst->size, data, size);
+	xconst->size = xconst->size + size;
+}
+
+/* _gen_const_text */
+static void _gen_const_text(GenConst_t *xconst, const char *text)
+{
+	_gen_const(xconst, text, strlen(text));
+}
+
+/* _gen_const_cbor */
+static void _gen_const_cbor(GenConst_t *xconst, uint8_t major, uint32_t value)
+{
+	uint8_t head[5];
+	size_t size = 1;
+	major = (uint8_t) (major << 5);
+	if (value < 24) {
+		head[0] = (uint8_t) (major | value);
+	} else if (value <= UINT8_MAX) {
+		head[0] = (uint8_t) (major | 24);
+		head[1] = (uint8_t) value;
+		size = 2;
+	} else {
+		head[0] = (uint8_t) (major | 25);
+		head[1] = (uint8_t) (value >> 8);
+		head[2] = (uint8_t) value;
+		size = 3;
+	}
+	_gen_const(xconst, head, size);
+}
+
+/* _gen_flush */
+/* emit the pending constant as a single (escaped) literal */
+static void _gen_flush(GenConst_t *xconst)
+{
+	if (xconst->size == 0) {
+		return;
+	}
+	fprintf(xconst->out, "\t_ts_gen_put(w, \"");
+	for (size_t i = 0; i < xconst->size; i++) {
+		uint8_t c = xconst->data[i];
+		if (c == '"' || c == '\\') {
+			fprintf(xconst->out, "\\%c", c);
+		} else if (c >= 0x20 && c < 0x7f && c != '?') {
+			fputc(c, xconst->out);
+		} else {
+			/* note, octal escapes are at most three digits (unlike hex escapes) */
+			fprintf(xconst->out, "\\%03o", c);
+		}
+	}
+	fprintf(xconst->out, "\", %zu);\n", xconst->size);
+	xconst->size = 0;
+}
+
+/* _gen_value */
+/* emit a value statement, after any pending constant */
+static void _gen_value(GenConst_t *xconst, const char *format, ...)
+{
+	_gen_flush(xconst);
+	va_list args;
+	va_start(args, format);
+	vfprintf(xconst->out, format, args);
+	va_end(args);
+}
@@ -0,0 +1,391 @@
+#include <string.h>
+#include <stdio.h>
+
+/* client debug */
+/* dbg_printf() */
+#include "dbg.h"
+
+#include "ts_common.h"
+#include "ts_compress.h"
+
+/* shortest match, shorter ones are kept as literals */
+#define TS_COMPRESS_MIN_MATCH   4
+
+/* capacity of the history, once full the latest window is moved to the front (after the dictionary) */
+#define TS_COMPRESS_HISTORY(dictionary) ((dictionary) + 2 * TS_COMPRESS_WINDOW_SIZE)
+
+/* forward references */
+static bool _ts_compress_contains(TsCompressDictionaryRef_t, const uint8_t *, size_t);
+static uint32_t _ts_compress_hash(const uint8_t *);
+static size_t _ts_compress_slide(uint8_t *, size_t, size_t);
+static uint8_t * _ts_compress_length(uint8_t *, size_t);
+static uint8_t * _ts_compress_varint(uint8_t *, size_t);
+static uint8_t * _ts_compress_sequence(uint8_t *, const uint8_t *, size_t, size_t, size_t);
+static bool _ts_decompress_varint(const uint8_t **, const uint8_t *, size_t *);
+static bool _ts_decompress_block(TsDecompressorRef_t, const uint8_t **, const uint8_t *, size_t);
+
+/* ts_compress_dictionary_init */
+TsStatus_t ts_compress_dictionary_init(TsCompressDictionaryRef_t dictionary)
+{
+	/* check preconditions */
+	if (dictionary == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	dictionary->size = 0;
+	return TsStatusOk;
+}
+
+/* ts_compress_dictionary_add */
+/* append the given bytes, e.g., identity fields repeated in every message */
+TsStatus_t ts_compress_dictionary_add(TsCompressDictionaryRef_t dictionary, const uint8_t *buffer, size_t buffer_size)
+{
+	/* check preconditions */
+	if (dictionary == NULL || buffer == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	if (dictionary->size + buffer_size > TS_COMPRESS_DICTIONARY_SIZE) {
+		return TsStatusErrorPayloadTooLarge;
+	}
+	memcpy(dictionary->bytes + dictionary->size, buffer, buffer_size);
+	dictionary->size = dictionary->size + buffer_size;
+	return TsStatusOk;
+}
+
+/* ts_compress_dictionary_keys */
+/* add the keys of the given message as encoded, e.g., "name": in json, skipping those added before */
+/* (keys not fitting the dictionary are left out) */
+TsStatus_t ts_compress_dictionary_keys(TsCompressDictionaryRef_t dictionary, TsMessageRef_t message,
+									   TsEncoder_t encoder)
+{
+	/* check preconditions */
+	if (dictionary == NULL || message == NULL || (encoder != TsEncoderJson && encoder != TsEncoderCbor)) {
+		return TsStatusErrorPreconditionFailed;
+	}
+
+	/* walk the branches depth first, keeping the next branch of every level */
+	TsStatus_t status = TsStatusOk;
+	TsMessageRef_t stack[TS_MESSAGE_MAX_DEPTH];
+	size_t top = 0;
+	if (message->type == TsTypeMessage || message->type == TsTypeArray) {
+		stack[top++] = message->value._xbranches;
+	}
+	while (top > 0) {
+		TsMessageRef_t branch = stack[top - 1];
+		if (branch == NULL) {
+			top--;
+			continue;
+		}
+		stack[top - 1] = branch->next;
+
+		/* the keys of message fields (array items have none) */
+		if (branch->parent->type == TsTypeMessage) {
+			uint8_t key[TS_MESSAGE_MAX_KEY_SIZE + 3];
+			size_t length = strlen(branch->name), size;
+			if (encoder == TsEncoderJson) {
+				size = (size_t) snprintf((char *) key, sizeof(key), "\"%s\":", branch->name);
+			} else {
+				key[0] = (uint8_t) (0x60 | length);
+				memcpy(key + 1, branch->name, length);
+				size = length + 1;
+			}
+			if (!_ts_compress_contains(dictionary, key, size)
+				&& ts_compress_dictionary_add(dictionary, key, size) != TsStatusOk) {
+				status = TsStatusErrorPayloadTooLarge;
+			}
+		}
+		if ((branch->type == TsTypeMessage || branch->type == TsTypeArray) && top < TS_MESSAGE_MAX_DEPTH) {
+			stack[top++] = branch->value._xbranches;
+		}
+	}
+	return status;
+}
+
+/* ts_compress_init */
+/* start a stream, the history holding the given dictionary (or none) */
+TsStatus_t ts_compress_init(TsCompressorRef_t compressor, TsCompressDictionaryRef_t dictionary)
+{
+	/* check preconditions */
+	if (compressor == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+
+	memset(compressor->table, 0x00, sizeof(compressor->table));
+	compressor->dictionary = dictionary != NULL ? dictionary->size : 0;
+	compressor->used = compressor->dictionary;
+	if (compressor->dictionary > 0) {
+		memcpy(compressor->history, dictionary->bytes, compressor->dictionary);
+	}
+	for (size_t i = 0; i + TS_COMPRESS_MIN_MATCH <= compressor->dictionary; i++) {
+		compressor->table[_ts_compress_hash(compressor->history + i)] = (uint16_t) (i + 1);
+	}
+	return TsStatusOk;
+}
+
+/* ts_compress */
+/* compress the given input, a block per window (greedy, matching the latest position of every hash) */
+TsStatus_t ts_compress(TsCompressorRef_t compressor, const uint8_t *input, size_t input_size, uint8_t *output,
+					   size_t *output_size)
+{
+	/* check preconditions */
+	if (compressor == NULL || (input == NULL && input_size > 0) || output == NULL || output_size == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	if (*output_size < TS_COMPRESS_BOUND(input_size)) {
+		return TsStatusErrorPayloadTooLarge;
+	}
+
+	uint8_t *out = output;
+	uint8_t *history = compressor->history;
+	while (input_size > 0) {
+		size_t size = input_size < TS_COMPRESS_WINDOW_SIZE ? input_size : TS_COMPRESS_WINDOW_SIZE;
+
+		/* make room, moving the positions of the table along (and forgetting those dropped) */
+		if (compressor->used + size > TS_COMPRESS_HISTORY(compressor->dictionary)) {
+			size_t shift = _ts_compress_slide(history, compressor->dictionary, compressor->used);
+			for (size_t i = 0; i < (1 << TS_COMPRESS_HASH_BITS); i++) {
+				size_t position = compressor->table[i];
+				if (position > compressor->dictionary) {
+					compressor->table[i] = (uint16_t) (position > compressor->dictionary + shift ? position - shift : 0);
+				}
+			}
+			compressor->used = compressor->used - shift;
+		}
+		memcpy(history + compressor->used, input, size);
+
+		/* the block, i.e., its size and sequences (the last one without a match) */
+		out = _ts_compress_varint(out, size);
+		size_t start = compressor->used, end = compressor->used + size;
+		size_t anchor = start, position = start;
+		while (position + TS_COMPRESS_MIN_MATCH <= end) {
+			uint32_t hash = _ts_compress_hash(history + position);
+			size_t candidate = compressor->table[hash];
+			compressor->table[hash] = (uint16_t) (position + 1);
+			if (candidate == 0 || candidate - 1 >= position
+				|| memcmp(history + candidate - 1, history + position, TS_COMPRESS_MIN_MATCH) != 0) {
+				position++;
+				continue;
+			}
+			size_t match = candidate - 1;
+			size_t length = TS_COMPRESS_MIN_MATCH;
+			while (position + length < end && history[match + length] == history[position + length]) {
+				length++;
+			}
+			out = _ts_compress_sequence(out, history + anchor, position - anchor, position - match, length);
+			position = position + length;
+			anchor = position;
+		}
+		out = _ts_compress_sequence(out, history + anchor, end - anchor, 0, 0);
+
+		compressor->used = end;
+		input = input + size;
+		input_size = input_size - size;
+	}
+	*output_size = (size_t) (out - output);
+	return TsStatusOk;
+}
+
+/* ts_decompress_init */
+TsStatus_t ts_decompress_init(TsDecompressorRef_t decompressor, TsCompressDictionaryRef_t dictionary)
+{
+	/* check preconditions */
+	if (decompressor == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+
+	decompressor->dictionary = dictionary != NULL ? dictionary->size : 0;
+	decompressor->used = decompressor->dictionary;
+	if (decompressor->dictionary > 0) {
+		memcpy(decompressor->history, dictionary->bytes, decompressor->dictionary);
+	}
+	return TsStatusOk;
+}
+
+/* ts_decompress */
+/* decompress the given blocks, each into the history (moved along as when compressing) and the output */
+TsStatus_t ts_decompress(TsDecompressorRef_t decompressor, const uint8_t *input, size_t input_size, uint8_t *output,
+						 size_t *output_size)
+{
+	/* check preconditions */
+	if (decompressor == NULL || (input == NULL && input_size > 0) || output == NULL || output_size == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+
+	const uint8_t *end = input + input_size;
+	size_t produced = 0;
+	while (input < end) {
+		size_t size;
+		if (!_ts_decompress_varint(&input, end, &size) || size == 0 || size > TS_COMPRESS_WINDOW_SIZE) {
+			return TsStatusErrorBadRequest;
+		}
+		if (produced + size > *output_size) {
+			return TsStatusErrorPayloadTooLarge;
+		}
+		if (decompressor->used + size > TS_COMPRESS_HISTORY(decompressor->dictionary)) {
+			size_t shift = _ts_compress_slide(decompressor->history, decompressor->dictionary, decompressor->used);
+			decompressor->used = decompressor->used - shift;
+		}
+		if (!_ts_decompress_block(decompressor, &input, end, size)) {
+			dbg_printf("ts_decompress: corrupt block\n");
+			return TsStatusErrorBadRequest;
+		}
+		memcpy(output + produced, decompressor->history + decompressor->used, size);
+		decompressor->used = decompressor->used + size;
+		produced = produced + size;
+	}
+	*output_size = produced;
+	return TsStatusOk;
+}
+
+/* //////////////////////////////////////////////////////////////////////////// */
+/* P R I V A T E */
+
+/* (private) _ts_compress_contains */
+static bool _ts_compress_contains(TsCompressDictionaryRef_t dictionary, const uint8_t *bytes, size_t size)
+{
+	for (size_t i = 0; i + size <= dictionary->size; i++) {
+		if (memcmp(dictionary->bytes + i, bytes, size) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* (private) _ts_compress_hash */
+static uint32_t _ts_compress_hash(const uint8_t *bytes)
+{
+	uint32_t value;
+	memcpy(&value, bytes, sizeof(value));
+	return (value * 2654435761u) >> (32 - TS_COMPRESS_HASH_BITS);
+}
+
+/* (private) _ts_compress_slide */
+/* keep the latest window of the history (after the dictionary), returning how far it moved */
+static size_t _ts_compress_slide(uint8_t *history, size_t dictionary, size_t used)
+{
+	size_t shift = used - dictionary - TS_COMPRESS_WINDOW_SIZE;
+	memmove(history + dictionary, history + dictionary + shift, TS_COMPRESS_WINDOW_SIZE);
+	return shift;
+}
+
+/* (private) _ts_compress_length */
+/* the remainder of a length not fitting its token, in bytes of 255 */
+static uint8_t * _ts_compress_length(uint8_t *out, size_t length)
+{
+	for (; length >= 255; length = length - 255) {
+		*out++ = 255;
+	}
+	*out++ = (uint8_t) length;
+	return out;
+}
+
+/* (private) _ts_compress_varint */
+static uint8_t * _ts_compress_varint(uint8_t *out, size_t value)
+{
+	for (; value >= 0x80; value = value >> 7) {
+		*out++ = (uint8_t) (value | 0x80);
+	}
+	*out++ = (uint8_t) value;
+	return out;
+}
+
+/* (private) _ts_compress_sequence */
+/* a token (of the literal and match lengths), the literals, and the offset and length of the match (if any) */
+static uint8_t * _ts_compress_sequence(uint8_t *out, const uint8_t *literals, size_t count, size_t offset,
+									   size_t length)
+{
+	size_t match = length > 0 ? length - TS_COMPRESS_MIN_MATCH : 0;
+	*out++ = (uint8_t) (((count < 15 ? count : 15) << 4) | (match < 15 ? match : 15));
+	if (count >= 15) {
+		out = _ts_compress_length(out, count - 15);
+	}
+	memcpy(out, literals, count);
+	out = out + count;
+	if (length > 0) {
+		*out++ = (uint8_t) offset;
+		*out++ = (uint8_t) (offset >> 8);
+		if (match >= 15) {
+			out = _ts_compress_length(out, match - 15);
+		}
+	}
+	return out;
+}
+
+/* (private) _ts_decompress_varint */
+static bool _ts_decompress_varint(const uint8_t **in, const uint8_t *end, size_t *value)
+{
+	*value = 0;
+	for (int shift = 0; shift < 32; shift = shift + 7) {
+		if (*in >= end) {
+			return false;
+		}
+		uint8_t byte = *(*in)++;
+		*value = *value | ((size_t) (byte & 0x7f) << shift);
+		if ((byte & 0x80) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* (private) _ts_decompress_block */
+/* decode the sequences of a block of the given size into the history, checking every length and offset */
+static bool _ts_decompress_block(TsDecompressorRef_t decompressor, const uint8_t **input, const uint8_t *end,
+								 size_t size)
+{
+	const uint8_t *in = *input;
+	uint8_t *start = decompressor->history + decompressor->used;
+	uint8_t *out = start;
+	uint8_t *last = start + size;
+	for (;;) {
+		if (in >= end) {
+			return false;
+		}
+		uint8_t token = *in++;
+
+		/* literals */
+		size_t count = token >> 4;
+		for (uint8_t byte = 255; count >= 15 && byte == 255; count = count + byte) {
+			if (in >= end) {
+				return false;
+			}
+			byte = *in++;
+		}
+		if (count > (size_t) (last - out) || count > (size_t) (end - in)) {
+			return false;
+		}
+		memcpy(out, in, count);
+		out = out + count;
+		in = in + count;
+		if (out == last) {
+			break;
+		}
+
+		/* match, copied forward (it may overlap itself) */
+		if (end - in < 2) {
+			return false;
+		}
+		size_t offset = in[0] | ((size_t) in[1] << 8);
+		in = in + 2;
+		size_t length = token & 0x0f;
+		for (uint8_t byte = 255; length >= 15 && byte == 255; length = length + byte) {
+			if (in >= end) {
+				return false;
+			}
+			byte = *in++;
+		}
+		length = length + TS_COMPRESS_MIN_MATCH;
+		if (offset == 0 || offset > (size_t) (out - decompressor->history) || length > (size_t) (last - out)) {
+			return false;
+		}
+		if (offset >= length) {
+			memcpy(out, out - offset, length);
+			out = out + length;
+		} else {
+			for (size_t i = 0; i < length; i++, out++) {
+				*out = *(out - offset);
+			}
+		}
+	}
+	*input = in;
+	return true;
+}
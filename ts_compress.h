@@ -0,0 +1,77 @@
+#ifndef TS_COMPRESS_H
+#define TS_COMPRESS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "ts_common.h"
+#include "ts_message.h"
+
+/* history of a stream, i.e., how far back (besides the dictionary) a match may refer */
+/* (input is compressed in blocks of at most this size) */
+#define TS_COMPRESS_WINDOW_SIZE         4096
+
+/* maximum size of a static dictionary */
+#define TS_COMPRESS_DICTIONARY_SIZE     2048
+
+/* size of the match finder hash table (log2) */
+#define TS_COMPRESS_HASH_BITS           12
+
+/* worst case compressed size of the given input size, i.e., incompressible input */
+#define TS_COMPRESS_BOUND(size)         ((size) + (size) / 255 + 16 * ((size) / TS_COMPRESS_WINDOW_SIZE + 1))
+
+/* static dictionary, e.g., the keys of the messages sent, known to both ends of the stream */
+typedef struct TsCompressDictionary *TsCompressDictionaryRef_t;
+typedef struct TsCompressDictionary {
+	size_t		size;
+	uint8_t		bytes[TS_COMPRESS_DICTIONARY_SIZE];
+} TsCompressDictionary_t;
+
+/* lz compression stream (of a fixed size, i.e., without allocation) */
+/* the input is compressed in blocks, each made of lz4 like sequences (literals followed by a match of */
+/* earlier input or of the dictionary), and each referring to the input of the blocks before it. */
+/* the history holds the dictionary followed by the latest input (at least a window of it). */
+typedef struct TsCompressor *TsCompressorRef_t;
+typedef struct TsCompressor {
+	size_t		dictionary;     /* size of the dictionary, at the start of the history */
+	size_t		used;           /* size of the history */
+	uint16_t	table[1 << TS_COMPRESS_HASH_BITS];  /* last position of a hashed 4 bytes, plus one (zero for none) */
+	uint8_t		history[TS_COMPRESS_DICTIONARY_SIZE + 2 * TS_COMPRESS_WINDOW_SIZE];
+} TsCompressor_t;
+
+/* lz decompression stream, the counterpart of a compression stream */
+typedef struct TsDecompressor *TsDecompressorRef_t;
+typedef struct TsDecompressor {
+	size_t		dictionary;
+	size_t		used;
+	uint8_t		history[TS_COMPRESS_DICTIONARY_SIZE + 2 * TS_COMPRESS_WINDOW_SIZE];
+} TsDecompressor_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* dictionary operations */
+/* the keys of the given message (and its branches) are added as encoded by the given encoder, once each */
+TsStatus_t ts_compress_dictionary_init(TsCompressDictionaryRef_t dictionary);
+TsStatus_t ts_compress_dictionary_add(TsCompressDictionaryRef_t dictionary, const uint8_t *buffer, size_t buffer_size);
+TsStatus_t ts_compress_dictionary_keys(TsCompressDictionaryRef_t dictionary, TsMessageRef_t message,
+									   TsEncoder_t encoder);
+
+/* stream operations */
+/* both ends start with the same dictionary (or none), and decompress the output of each compress as a whole, */
+/* in order. the output of a compress holds at least TS_COMPRESS_BOUND of the input, that of a decompress */
+/* the whole decompressed input. a stream failing to decompress is started again. */
+TsStatus_t ts_compress_init(TsCompressorRef_t compressor, TsCompressDictionaryRef_t dictionary);
+TsStatus_t ts_compress(TsCompressorRef_t compressor, const uint8_t *input, size_t input_size, uint8_t *output,
+					   size_t *output_size);
+TsStatus_t ts_decompress_init(TsDecompressorRef_t decompressor, TsCompressDictionaryRef_t dictionary);
+TsStatus_t ts_decompress(TsDecompressorRef_t decompressor, const uint8_t *input, size_t input_size, uint8_t *output,
+						 size_t *output_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TS_COMPRESS_H */
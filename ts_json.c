@@ -0,0 +1,440 @@
+#include <string.h>
+#include <stdio.h>
+
+/* client debug */
+/* dbg_printf() */
+#include "dbg.h"
+
+#include "ts_common.h"
+#include "ts_json.h"
+
+/* reader states, i.e., what is expected next */
+#define TS_JSON_STATE_VALUE             0
+#define TS_JSON_STATE_KEY_OR_CLOSE      1
+#define TS_JSON_STATE_KEY               2
+#define TS_JSON_STATE_COLON             3
+#define TS_JSON_STATE_VALUE_OR_CLOSE    4
+#define TS_JSON_STATE_NEXT              5
+#define TS_JSON_STATE_DONE              6
+
+/* maximum size of a number token */
+#define TS_JSON_MAX_NUMBER_SIZE         32
+
+/* forward references */
+static TsStatus_t _ts_json_value(TsJsonReaderRef_t, TsJsonToken_t *);
+static TsStatus_t _ts_json_close(TsJsonReaderRef_t, TsJsonToken_t *, bool);
+static TsStatus_t _ts_json_text(TsJsonReaderRef_t, TsJsonToken_t *, TsJsonTokenType_t);
+static TsStatus_t _ts_json_literal(TsJsonReaderRef_t, TsJsonToken_t *, const char *, TsJsonTokenType_t);
+static void _ts_json_after_value(TsJsonReaderRef_t);
+static int _ts_json_peek(TsJsonReaderRef_t);
+static int _ts_json_hex4(const char *);
+
+/* ts_json_reader_init */
+TsStatus_t ts_json_reader_init(TsJsonReaderRef_t reader, const char *text, size_t size)
+{
+	/* check preconditions */
+	if (reader == NULL || text == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	reader->text = text;
+	reader->size = size;
+	reader->offset = 0;
+	reader->depth = 0;
+	reader->state = TS_JSON_STATE_VALUE;
+	return TsStatusOk;
+}
+
+/* ts_json_next */
+/* read the next token of the document, validating its structure along the way */
+TsStatus_t ts_json_next(TsJsonReaderRef_t reader, TsJsonToken_t *token)
+{
+	/* check preconditions */
+	if (reader == NULL || token == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	token->type = TsJsonTokenNone;
+	token->text = NULL;
+	token->size = 0;
+
+	/* note, separators (i.e., colons and commas) don't produce tokens */
+	for (;;) {
+		int c = _ts_json_peek(reader);
+		switch (reader->state) {
+
+		case TS_JSON_STATE_DONE:
+			if (c >= 0) {
+				return TsStatusErrorBadRequest;
+			}
+			token->type = TsJsonTokenEnd;
+			return TsStatusOk;
+
+		case TS_JSON_STATE_NEXT:
+			if (c == ',' && reader->depth > 0) {
+				reader->offset++;
+				reader->state = reader->stack[reader->depth - 1] ? TS_JSON_STATE_KEY : TS_JSON_STATE_VALUE;
+				continue;
+			}
+			if (c == '}' || c == ']') {
+				return _ts_json_close(reader, token, c == '}');
+			}
+			return TsStatusErrorBadRequest;
+
+		case TS_JSON_STATE_KEY_OR_CLOSE:
+			if (c == '}') {
+				return _ts_json_close(reader, token, true);
+			}
+			/* fallthrough */
+
+		case TS_JSON_STATE_KEY:
+			if (c != '"') {
+				return TsStatusErrorBadRequest;
+			}
+			reader->state = TS_JSON_STATE_COLON;
+			return _ts_json_text(reader, token, TsJsonTokenKey);
+
+		case TS_JSON_STATE_COLON:
+			if (c != ':') {
+				return TsStatusErrorBadRequest;
+			}
+			reader->offset++;
+			reader->state = TS_JSON_STATE_VALUE;
+			continue;
+
+		case TS_JSON_STATE_VALUE_OR_CLOSE:
+			if (c == ']') {
+				return _ts_json_close(reader, token, false);
+			}
+			/* fallthrough */
+
+		case TS_JSON_STATE_VALUE:
+		default:
+			return _ts_json_value(reader, token);
+		}
+	}
+}
+
+/* ts_json_skip */
+/* skip the value starting with the given token, i.e., the rest of an object or array, */
+/* or in the case of a key, the value that follows it (without allocation) */
+TsStatus_t ts_json_skip(TsJsonReaderRef_t reader, TsJsonToken_t *token)
+{
+	/* check preconditions */
+	if (reader == NULL || token == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	TsJsonToken_t current = *token;
+	if (current.type == TsJsonTokenKey) {
+		TsStatus_t status = ts_json_next(reader, &current);
+		if (status != TsStatusOk) {
+			return status;
+		}
+	}
+	if (current.type != TsJsonTokenObjectBegin && current.type != TsJsonTokenArrayBegin) {
+		return TsStatusOk;
+	}
+
+	/* skip until the matching close */
+	size_t depth = reader->depth - 1;
+	while (reader->depth > depth) {
+		TsStatus_t status = ts_json_next(reader, &current);
+		if (status != TsStatusOk) {
+			return status;
+		}
+		if (current.type == TsJsonTokenEnd) {
+			return TsStatusErrorBadRequest;
+		}
+	}
+	return TsStatusOk;
+}
+
+/* ts_json_string */
+/* copy the unescaped key or string into the given value, always terminated */
+TsStatus_t ts_json_string(TsJsonToken_t *token, char *value, size_t value_size)
+{
+	/* check preconditions */
+	if (token == NULL || value == NULL || value_size == 0) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	if (token->type != TsJsonTokenKey && token->type != TsJsonTokenString) {
+		return TsStatusErrorPreconditionFailed;
+	}
+
+	size_t length = 0;
+	for (size_t i = 0; i < token->size; i++) {
+
+		/* unescape */
+		char xvalue[4];
+		size_t xvalue_size = 1;
+		xvalue[0] = token->text[i];
+		if (xvalue[0] == '\\' && i + 1 < token->size) {
+			i++;
+			switch (token->text[i]) {
+			case 'b': xvalue[0] = '\b'; break;
+			case 'f': xvalue[0] = '\f'; break;
+			case 'n': xvalue[0] = '\n'; break;
+			case 'r': xvalue[0] = '\r'; break;
+			case 't': xvalue[0] = '\t'; break;
+			case 'u': {
+				if (i + 4 >= token->size) {
+					return TsStatusErrorBadRequest;
+				}
+				int code = _ts_json_hex4(token->text + i + 1);
+				i = i + 4;
+
+				/* combine utf-16 surrogate pairs */
+				if (code >= 0xd800 && code <= 0xdbff && i + 6 < token->size && token->text[i + 1] == '\\'
+					&& token->text[i + 2] == 'u') {
+					int low = _ts_json_hex4(token->text + i + 3);
+					if (low >= 0xdc00 && low <= 0xdfff) {
+						code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+						i = i + 6;
+					}
+				}
+				if (code < 0) {
+					return TsStatusErrorBadRequest;
+				}
+
+				/* and encode as utf-8 */
+				if (code < 0x80) {
+					xvalue[0] = (char) code;
+				} else if (code < 0x800) {
+					xvalue[0] = (char) (0xc0 | (code >> 6));
+					xvalue[1] = (char) (0x80 | (code & 0x3f));
+					xvalue_size = 2;
+				} else if (code < 0x10000) {
+					xvalue[0] = (char) (0xe0 | (code >> 12));
+					xvalue[1] = (char) (0x80 | ((code >> 6) & 0x3f));
+					xvalue[2] = (char) (0x80 | (code & 0x3f));
+					xvalue_size = 3;
+				} else {
+					xvalue[0] = (char) (0xf0 | (code >> 18));
+					xvalue[1] = (char) (0x80 | ((code >> 12) & 0x3f));
+					xvalue[2] = (char) (0x80 | ((code >> 6) & 0x3f));
+					xvalue[3] = (char) (0x80 | (code & 0x3f));
+					xvalue_size = 4;
+				}
+				break;
+			}
+			default:
+				/* i.e., quote, solidus and reverse solidus */
+				xvalue[0] = token->text[i];
+				break;
+			}
+		}
+
+		/* copy, unless truncated */
+		if (length + xvalue_size >= value_size) {
+			value[length] = '\0';
+			return TsStatusErrorPayloadTooLarge;
+		}
+		memcpy(value + length, xvalue, xvalue_size);
+		length = length + xvalue_size;
+	}
+	value[length] = '\0';
+	return TsStatusOk;
+}
+
+/* ts_json_number */
+TsStatus_t ts_json_number(TsJsonToken_t *token, double *value)
+{
+	/* check preconditions */
+	if (token == NULL || value == NULL || token->type != TsJsonTokenNumber) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	if (token->size >= TS_JSON_MAX_NUMBER_SIZE) {
+		return TsStatusErrorPayloadTooLarge;
+	}
+
+	/* note, the token isn't terminated */
+	char number[TS_JSON_MAX_NUMBER_SIZE];
+	memcpy(number, token->text, token->size);
+	number[token->size] = '\0';
+	*value = strtod(number, NULL);
+	return TsStatusOk;
+}
+
+/* ts_json_equals */
+/* compare the (unescaped) key or string with the given value */
+bool ts_json_equals(TsJsonToken_t *token, const char *value)
+{
+	if (token == NULL || value == NULL) {
+		return false;
+	}
+	if (memchr(token->text, '\\', token->size) == NULL) {
+		return strlen(value) == token->size && memcmp(token->text, value, token->size) == 0;
+	}
+	char xvalue[TS_JSON_MAX_NUMBER_SIZE * 4];
+	if (ts_json_string(token, xvalue, sizeof(xvalue)) != TsStatusOk) {
+		return false;
+	}
+	return strcmp(xvalue, value) == 0;
+}
+
+/* //////////////////////////////////////////////////////////////////////////// */
+/* P R I V A T E */
+
+/* _ts_json_value */
+static TsStatus_t _ts_json_value(TsJsonReaderRef_t reader, TsJsonToken_t *token)
+{
+	int c = _ts_json_peek(reader);
+	switch (c) {
+	case '{':
+	case '[':
+		if (reader->depth >= TS_JSON_MAX_DEPTH) {
+			dbg_printf("ts_json_next: the document is nested too deep\n");
+			return TsStatusErrorRecursionTooDeep;
+		}
+		reader->offset++;
+		reader->stack[reader->depth++] = (c == '{');
+		reader->state = (c == '{') ? TS_JSON_STATE_KEY_OR_CLOSE : TS_JSON_STATE_VALUE_OR_CLOSE;
+		token->type = (c == '{') ? TsJsonTokenObjectBegin : TsJsonTokenArrayBegin;
+		return TsStatusOk;
+
+	case '"':
+		_ts_json_after_value(reader);
+		return _ts_json_text(reader, token, TsJsonTokenString);
+
+	case 't':
+		return _ts_json_literal(reader, token, "true", TsJsonTokenTrue);
+
+	case 'f':
+		return _ts_json_literal(reader, token, "false", TsJsonTokenFalse);
+
+	case 'n':
+		return _ts_json_literal(reader, token, "null", TsJsonTokenNull);
+
+	default:
+		break;
+	}
+
+	/* number, i.e., -?digits(.digits)?([eE][+-]?digits)? */
+	if (c != '-' && (c < '0' || c > '9')) {
+		return TsStatusErrorBadRequest;
+	}
+	size_t start = reader->offset;
+	size_t offset = start + (c == '-' ? 1 : 0);
+	size_t digits = 0;
+	while (offset < reader->size && reader->text[offset] >= '0' && reader->text[offset] <= '9') {
+		offset++;
+		digits++;
+	}
+	if (offset < reader->size && reader->text[offset] == '.') {
+		offset++;
+		while (offset < reader->size && reader->text[offset] >= '0' && reader->text[offset] <= '9') {
+			offset++;
+		}
+	}
+	if (offset < reader->size && (reader->text[offset] == 'e' || reader->text[offset] == 'E')) {
+		offset++;
+		if (offset < reader->size && (reader->text[offset] == '+' || reader->text[offset] == '-')) {
+			offset++;
+		}
+		while (offset < reader->size && reader->text[offset] >= '0' && reader->text[offset] <= '9') {
+			offset++;
+		}
+	}
+	if (digits == 0) {
+		return TsStatusErrorBadRequest;
+	}
+	reader->offset = offset;
+	token->type = TsJsonTokenNumber;
+	token->text = reader->text + start;
+	token->size = offset - start;
+	_ts_json_after_value(reader);
+	return TsStatusOk;
+}
+
+/* _ts_json_close */
+static TsStatus_t _ts_json_close(TsJsonReaderRef_t reader, TsJsonToken_t *token, bool object)
+{
+	if (reader->depth == 0 || reader->stack[reader->depth - 1] != object) {
+		return TsStatusErrorBadRequest;
+	}
+	reader->offset++;
+	reader->depth--;
+	token->type = object ? TsJsonTokenObjectEnd : TsJsonTokenArrayEnd;
+	_ts_json_after_value(reader);
+	return TsStatusOk;
+}
+
+/* _ts_json_text */
+/* scan a key or string, the token refers to the (still escaped) text between the quotes */
+static TsStatus_t _ts_json_text(TsJsonReaderRef_t reader, TsJsonToken_t *token, TsJsonTokenType_t type)
+{
+	size_t start = reader->offset + 1;
+	for (size_t offset = start; offset < reader->size; offset++) {
+		unsigned char c = (unsigned char) reader->text[offset];
+		if (c == '"') {
+			token->type = type;
+			token->text = reader->text + start;
+			token->size = offset - start;
+			reader->offset = offset + 1;
+			return TsStatusOk;
+		}
+		if (c == '\\') {
+			offset++;
+		} else if (c < 0x20) {
+			break;
+		}
+	}
+	return TsStatusErrorBadRequest;
+}
+
+/* _ts_json_literal */
+static TsStatus_t _ts_json_literal(TsJsonReaderRef_t reader, TsJsonToken_t *token, const char *literal,
+								   TsJsonTokenType_t type)
+{
+	size_t length = strlen(literal);
+	if (reader->offset + length > reader->size || memcmp(reader->text + reader->offset, literal, length) != 0) {
+		return TsStatusErrorBadRequest;
+	}
+	token->type = type;
+	token->text = reader->text + reader->offset;
+	token->size = length;
+	reader->offset = reader->offset + length;
+	_ts_json_after_value(reader);
+	return TsStatusOk;
+}
+
+/* _ts_json_after_value */
+static void _ts_json_after_value(TsJsonReaderRef_t reader)
+{
+	reader->state = reader->depth == 0 ? TS_JSON_STATE_DONE : TS_JSON_STATE_NEXT;
+}
+
+/* _ts_json_peek */
+/* skip whitespace and return the next character, or -1 at the end of the document */
+static int _ts_json_peek(TsJsonReaderRef_t reader)
+{
+	while (reader->offset < reader->size) {
+		char c = reader->text[reader->offset];
+		if (c == '\0') {
+			break;
+		}
+		if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+			return (unsigned char) c;
+		}
+		reader->offset++;
+	}
+	return -1;
+}
+
+/* _ts_json_hex4 */
+static int _ts_json_hex4(const char *text)
+{
+	int value = 0;
+	for (int i = 0; i < 4; i++) {
+		char c = text[i];
+		value = value << 4;
+		if (c >= '0' && c <= '9') {
+			value = value | (c - '0');
+		} else if (c >= 'a' && c <= 'f') {
+			value = value | (c - 'a' + 10);
+		} else if (c >= 'A' && c <= 'F') {
+			value = value | (c - 'A' + 10);
+		} else {
+			return -1;
+		}
+	}
+	return value;
+}
@@ -0,0 +1,65 @@
+#ifndef TS_JSON_H
+#define TS_JSON_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "ts_common.h"
+
+/* maximum nesting of json objects and arrays the reader will follow */
+#define TS_JSON_MAX_DEPTH   32
+
+/* json token types */
+typedef enum {
+	TsJsonTokenNone,
+	TsJsonTokenObjectBegin,
+	TsJsonTokenObjectEnd,
+	TsJsonTokenArrayBegin,
+	TsJsonTokenArrayEnd,
+	TsJsonTokenKey,         /* object member name, text holds the raw (escaped) name */
+	TsJsonTokenString,      /* text holds the raw (escaped) string, without quotes */
+	TsJsonTokenNumber,      /* text holds the number as found in the document */
+	TsJsonTokenTrue,
+	TsJsonTokenFalse,
+	TsJsonTokenNull,
+	TsJsonTokenEnd          /* end of document */
+} TsJsonTokenType_t;
+
+/* json token, pointing into the document (no copies are made) */
+typedef struct {
+	TsJsonTokenType_t	type;
+	const char			*text;
+	size_t				size;
+} TsJsonToken_t;
+
+/* pull reader, i.e., a tokenizer that doesn't build a tree */
+/* (nesting is tracked with a fixed stack, so memory use is bounded) */
+typedef struct TsJsonReader *TsJsonReaderRef_t;
+typedef struct TsJsonReader {
+	const char	*text;
+	size_t		size;
+	size_t		offset;
+	size_t		depth;
+	int			state;
+	bool		stack[TS_JSON_MAX_DEPTH];
+} TsJsonReader_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+TsStatus_t ts_json_reader_init(TsJsonReaderRef_t reader, const char *text, size_t size);
+TsStatus_t ts_json_next(TsJsonReaderRef_t reader, TsJsonToken_t *token);
+TsStatus_t ts_json_skip(TsJsonReaderRef_t reader, TsJsonToken_t *token);
+
+/* token values */
+TsStatus_t ts_json_string(TsJsonToken_t *token, char *value, size_t value_size);
+TsStatus_t ts_json_number(TsJsonToken_t *token, double *value);
+bool ts_json_equals(TsJsonToken_t *token, const char *value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TS_JSON_H */
@@ -0,0 +1,471 @@
+#include <string.h>
+#include <stdio.h>
+
+/* client debug */
+/* dbg_printf() */
+#include "dbg.h"
+
+#include "ts_common.h"
+#include "ts_layout.h"
+
+/* fragment builder, used while compiling a layout for a single encoder */
+typedef struct {
+	uint8_t				*pool;
+	TsLayoutFragment_t	*fragments;
+	size_t				used;
+	size_t				start;
+	size_t				count;
+	bool				overflow;
+} TsLayoutBuilder_t;
+
+/* forward references */
+static void _ts_layout_append(TsLayoutBuilder_t *, const void *, size_t);
+static void _ts_layout_append_text(TsLayoutBuilder_t *, const char *);
+static void _ts_layout_append_cbor(TsLayoutBuilder_t *, uint8_t, uint32_t);
+static void _ts_layout_cut(TsLayoutBuilder_t *);
+static void _ts_layout_close(TsLayoutBuilder_t *, TsType_t);
+static size_t _ts_layout_cbor_header(uint8_t *, uint8_t, uint32_t);
+static TsStatus_t _ts_layout_set(TsLayoutRef_t, size_t, TsType_t, TsValue_t);
+static TsStatus_t _ts_layout_encode_json(TsLayoutRef_t, uint8_t *, size_t *);
+static TsStatus_t _ts_layout_encode_cbor(TsLayoutRef_t, uint8_t *, size_t *);
+
+/* ts_layout_compile */
+/* compile the given schema into a layout, pre-rendering everything but the leaf values */
+TsStatus_t ts_layout_compile(TsLayoutRef_t layout, const TsLayoutField_t *schema, size_t schema_size)
+{
+	/* check preconditions */
+	if (layout == NULL || (schema == NULL && schema_size > 0)) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	if (schema_size > TS_LAYOUT_MAX_FIELDS) {
+		return TsStatusErrorPayloadTooLarge;
+	}
+
+	/* count the branches of each container (the root is held at index zero) */
+	/* note, cbor maps and arrays are encoded with their definite length */
+	uint32_t branches[TS_LAYOUT_MAX_FIELDS + 1];
+	memset(branches, 0x00, sizeof(branches));
+	for (int i = 0; i < (int) schema_size; i++) {
+		int parent = schema[i].parent;
+		if (parent < -1 || parent >= i) {
+			dbg_printf("ts_layout_compile: field (%d) must follow its parent\n", i);
+			return TsStatusErrorBadRequest;
+		}
+		if (parent >= 0 && schema[parent].type != TsTypeMessage && schema[parent].type != TsTypeArray) {
+			dbg_printf("ts_layout_compile: field (%d) has a primitive parent\n", i);
+			return TsStatusErrorBadRequest;
+		}
+		branches[parent + 1]++;
+	}
+
+	/* clear all */
+	memset(layout, 0x00, sizeof(TsLayout_t));
+	TsLayoutBuilder_t json = {.pool = layout->json_fragments, .fragments = layout->json};
+	TsLayoutBuilder_t cbor = {.pool = layout->cbor_fragments, .fragments = layout->cbor};
+
+	/* open the root */
+	int stack[TS_LAYOUT_MAX_FIELDS + 1];
+	bool first[TS_LAYOUT_MAX_FIELDS + 1];
+	size_t depth = 0;
+	stack[0] = -1;
+	first[0] = true;
+	_ts_layout_append_text(&json, "{");
+	_ts_layout_append_cbor(&cbor, 5, branches[0]);
+
+	/* render each field in (depth-first) order */
+	for (int i = 0; i < (int) schema_size; i++) {
+
+		/* close containers until the parent of this field is found */
+		while (stack[depth] != schema[i].parent) {
+			if (depth == 0) {
+				dbg_printf("ts_layout_compile: field (%d) is not listed depth-first\n", i);
+				return TsStatusErrorBadRequest;
+			}
+			_ts_layout_close(&json, schema[stack[depth]].type);
+			depth--;
+		}
+
+		/* separate siblings, and tag if the parent is a message (i.e., not an array) */
+		if (!first[depth]) {
+			_ts_layout_append_text(&json, ",");
+		}
+		first[depth] = false;
+		if (stack[depth] < 0 || schema[stack[depth]].type == TsTypeMessage) {
+			if (schema[i].name == NULL || strlen(schema[i].name) >= TS_MESSAGE_MAX_KEY_SIZE) {
+				dbg_printf("ts_layout_compile: field (%d) requires a valid name\n", i);
+				return TsStatusErrorBadRequest;
+			}
+			_ts_layout_append_text(&json, "\"");
+			_ts_layout_append_text(&json, schema[i].name);
+			_ts_layout_append_text(&json, "\":");
+			_ts_layout_append_cbor(&cbor, 3, (uint32_t) strlen(schema[i].name));
+			_ts_layout_append(&cbor, schema[i].name, strlen(schema[i].name));
+		}
+
+		/* open containers, or leave a slot for leaves */
+		layout->slots[i].type = schema[i].type;
+		switch (schema[i].type) {
+		case TsTypeMessage:
+			_ts_layout_append_text(&json, "{");
+			_ts_layout_append_cbor(&cbor, 5, branches[i + 1]);
+			depth++;
+			stack[depth] = i;
+			first[depth] = true;
+			break;
+
+		case TsTypeArray:
+			_ts_layout_append_text(&json, "[");
+			_ts_layout_append_cbor(&cbor, 4, branches[i + 1]);
+			depth++;
+			stack[depth] = i;
+			first[depth] = true;
+			break;
+
+		case TsTypeString:
+			/* note, the quotes surrounding a string are pre-rendered as well */
+			_ts_layout_append_text(&json, "\"");
+			_ts_layout_cut(&json);
+			_ts_layout_cut(&cbor);
+			_ts_layout_append_text(&json, "\"");
+			layout->order[layout->leaves++] = (uint8_t) i;
+			break;
+
+		case TsTypeInteger:
+		case TsTypeFloat:
+		case TsTypeBoolean:
+		case TsTypeNull:
+			_ts_layout_cut(&json);
+			_ts_layout_cut(&cbor);
+			layout->order[layout->leaves++] = (uint8_t) i;
+			break;
+
+		default:
+			dbg_printf("ts_layout_compile: field (%d) has an unknown type\n", i);
+			return TsStatusErrorBadRequest;
+		}
+	}
+
+	/* close all */
+	while (depth > 0) {
+		_ts_layout_close(&json, schema[stack[depth]].type);
+		depth--;
+	}
+	_ts_layout_append_text(&json, "}");
+	_ts_layout_cut(&json);
+	_ts_layout_cut(&cbor);
+	if (json.overflow || cbor.overflow) {
+		dbg_printf("ts_layout_compile: the pre-rendered fragments are too large\n");
+		return TsStatusErrorPayloadTooLarge;
+	}
+	layout->fields = schema_size;
+
+	/* return ok */
+	return TsStatusOk;
+}
+
+/* ts_layout_reset */
+/* reset all slot values, e.g., between send cycles */
+TsStatus_t ts_layout_reset(TsLayoutRef_t layout)
+{
+	/* check preconditions */
+	if (layout == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	for (size_t i = 0; i < layout->fields; i++) {
+		memset(&(layout->slots[i].value), 0x00, sizeof(layout->slots[i].value));
+	}
+	return TsStatusOk;
+}
+
+/* ts_layout_set_int */
+TsStatus_t ts_layout_set_int(TsLayoutRef_t layout, size_t slot, int value)
+{
+	return _ts_layout_set(layout, slot, TsTypeInteger, &value);
+}
+
+/* ts_layout_set_float */
+TsStatus_t ts_layout_set_float(TsLayoutRef_t layout, size_t slot, float value)
+{
+	return _ts_layout_set(layout, slot, TsTypeFloat, &value);
+}
+
+/* ts_layout_set_string */
+TsStatus_t ts_layout_set_string(TsLayoutRef_t layout, size_t slot, char *value)
+{
+	return _ts_layout_set(layout, slot, TsTypeString, value);
+}
+
+/* ts_layout_set_bool */
+TsStatus_t ts_layout_set_bool(TsLayoutRef_t layout, size_t slot, bool value)
+{
+	return _ts_layout_set(layout, slot, TsTypeBoolean, &value);
+}
+
+/* ts_layout_encode */
+/* encode will attempt to fill the given buffer with the fragments and values of the given layout. */
+TsStatus_t ts_layout_encode(TsLayoutRef_t layout, TsEncoder_t encoder, uint8_t *buffer, size_t *buffer_size)
+{
+	/* check preconditions */
+	if (layout == NULL || buffer_size == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	if (buffer == NULL) {
+		return TsStatusErrorBadRequest;
+	}
+
+	/* perform encoding */
+	switch (encoder) {
+	case TsEncoderJson:
+		return _ts_layout_encode_json(layout, buffer, buffer_size);
+
+	case TsEncoderCbor:
+		return _ts_layout_encode_cbor(layout, buffer, buffer_size);
+
+	case TsEncoderDebug:
+	default:
+		/* do nothing */
+		break;
+	}
+	return TsStatusErrorNotImplemented;
+}
+
+/* //////////////////////////////////////////////////////////////////////////// */
+/* P R I V A T E */
+
+/* _ts_layout_append */
+static void _ts_layout_append(TsLayoutBuilder_t *builder, const void *data, size_t size)
+{
+	if (builder->used + size > TS_LAYOUT_MAX_FRAGMENTS_SIZE) {
+		builder->overflow = true;
+		return;
+	}
+	memcpy(builder->pool + builder->used, data, size);
+	builder->used = builder->used + size;
+}
+
+/* _ts_layout_append_text */
+static void _ts_layout_append_text(TsLayoutBuilder_t *builder, const char *text)
+{
+	_ts_layout_append(builder, text, strlen(text));
+}
+
+/* _ts_layout_append_cbor */
+/* append a cbor item header, e.g., the definite length of a map or the size of a text string */
+static void _ts_layout_append_cbor(TsLayoutBuilder_t *builder, uint8_t major, uint32_t value)
+{
+	uint8_t header[5];
+	_ts_layout_append(builder, header, _ts_layout_cbor_header(header, major, value));
+}
+
+/* _ts_layout_cut */
+/* end the current fragment, i.e., the next leaf value follows */
+static void _ts_layout_cut(TsLayoutBuilder_t *builder)
+{
+	builder->fragments[builder->count].offset = (uint16_t) builder->start;
+	builder->fragments[builder->count].size = (uint16_t) (builder->used - builder->start);
+	builder->count++;
+	builder->start = builder->used;
+}
+
+/* _ts_layout_close */
+/* note, definite length cbor containers don't require a break */
+static void _ts_layout_close(TsLayoutBuilder_t *json, TsType_t type)
+{
+	_ts_layout_append_text(json, type == TsTypeArray ? "]" : "}");
+}
+
+/* _ts_layout_cbor_header */
+static size_t _ts_layout_cbor_header(uint8_t *header, uint8_t major, uint32_t value)
+{
+	major = (uint8_t) (major << 5);
+	if (value < 24) {
+		header[0] = (uint8_t) (major | value);
+		return 1;
+	}
+	if (value <= UINT8_MAX) {
+		header[0] = (uint8_t) (major | 24);
+		header[1] = (uint8_t) value;
+		return 2;
+	}
+	if (value <= UINT16_MAX) {
+		header[0] = (uint8_t) (major | 25);
+		header[1] = (uint8_t) (value >> 8);
+		header[2] = (uint8_t) value;
+		return 3;
+	}
+	header[0] = (uint8_t) (major | 26);
+	header[1] = (uint8_t) (value >> 24);
+	header[2] = (uint8_t) (value >> 16);
+	header[3] = (uint8_t) (value >> 8);
+	header[4] = (uint8_t) value;
+	return 5;
+}
+
+/* _ts_layout_set */
+static TsStatus_t _ts_layout_set(TsLayoutRef_t layout, size_t slot, TsType_t type, TsValue_t value)
+{
+	/* check preconditions */
+	if (layout == NULL || value == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	if (slot >= layout->fields) {
+		return TsStatusErrorIndexOutOfRange;
+	}
+
+	/* strict type checks, no promotion */
+	TsLayoutSlot_t *xslot = &(layout->slots[slot]);
+	if (xslot->type != type) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	switch (type) {
+	case TsTypeInteger:
+		xslot->value._xinteger = *((int *) (value));
+		break;
+
+	case TsTypeFloat:
+		xslot->value._xfloat = *((float *) (value));
+		break;
+
+	case TsTypeBoolean:
+		xslot->value._xboolean = *((bool *) (value));
+		break;
+
+	case TsTypeString:
+		snprintf(xslot->value._xstring, TS_MESSAGE_MAX_STRING_SIZE, "%s", (char *) value);
+		if (strlen(xslot->value._xstring) < strlen((char *) value)) {
+			dbg_printf("issue detected during set (%zu), string truncated; the given string is too large\n", slot);
+		}
+		break;
+
+	default:
+		/* do nothing */
+		break;
+	}
+	return TsStatusOk;
+}
+
+/* _ts_layout_encode_json */
+/* note, values are formatted as they are in ts_message, i.e., the output is the same */
+static TsStatus_t _ts_layout_encode_json(TsLayoutRef_t layout, uint8_t *buffer, size_t *buffer_size)
+{
+	size_t size = *buffer_size;
+	size_t used = 0;
+	for (size_t k = 0; k <= layout->leaves; k++) {
+
+		/* copy the pre-rendered fragment,... */
+		TsLayoutFragment_t *fragment = &(layout->json[k]);
+		if (used + fragment->size >= size) {
+			return TsStatusErrorOutOfMemory;
+		}
+		memcpy(buffer + used, layout->json_fragments + fragment->offset, fragment->size);
+		used = used + fragment->size;
+		if (k == layout->leaves) {
+			break;
+		}
+
+		/* ...followed by the value of the slot */
+		TsLayoutSlot_t *slot = &(layout->slots[layout->order[k]]);
+		char *xbuffer = (char *) (buffer + used);
+		size_t xbuffer_size = size - used;
+		int length = 0;
+		switch (slot->type) {
+		case TsTypeInteger:
+			length = snprintf(xbuffer, xbuffer_size, "%d", slot->value._xinteger);
+			break;
+
+		case TsTypeFloat:
+			length = snprintf(xbuffer, xbuffer_size, "%f", slot->value._xfloat);
+			break;
+
+		case TsTypeBoolean:
+			length = snprintf(xbuffer, xbuffer_size, "%s", slot->value._xboolean ? "true" : "false");
+			break;
+
+		case TsTypeString:
+			length = snprintf(xbuffer, xbuffer_size, "%s", slot->value._xstring);
+			break;
+
+		case TsTypeNull:
+		default:
+			length = snprintf(xbuffer, xbuffer_size, "null");
+			break;
+		}
+		if (length < 0 || (size_t) length >= xbuffer_size) {
+			return TsStatusErrorOutOfMemory;
+		}
+		used = used + (size_t) length;
+	}
+
+	/* terminate (like ts_message_encode, the size excludes the termination) */
+	buffer[used] = 0x00;
+	*buffer_size = used;
+	return TsStatusOk;
+}
+
+/* _ts_layout_encode_cbor */
+static TsStatus_t _ts_layout_encode_cbor(TsLayoutRef_t layout, uint8_t *buffer, size_t *buffer_size)
+{
+	size_t size = *buffer_size;
+	size_t used = 0;
+	for (size_t k = 0; k <= layout->leaves; k++) {
+
+		/* copy the pre-rendered fragment,... */
+		TsLayoutFragment_t *fragment = &(layout->cbor[k]);
+		if (used + fragment->size > size) {
+			return TsStatusErrorOutOfMemory;
+		}
+		memcpy(buffer + used, layout->cbor_fragments + fragment->offset, fragment->size);
+		used = used + fragment->size;
+		if (k == layout->leaves) {
+			break;
+		}
+
+		/* ...followed by the value of the slot (at most five bytes plus the string) */
+		TsLayoutSlot_t *slot = &(layout->slots[layout->order[k]]);
+		uint8_t item[5];
+		size_t length = 0;
+		switch (slot->type) {
+		case TsTypeInteger: {
+			int value = slot->value._xinteger;
+			length = value >= 0
+					 ? _ts_layout_cbor_header(item, 0, (uint32_t) value)
+					 : _ts_layout_cbor_header(item, 1, (uint32_t) (-1 - value));
+			break;
+		}
+		case TsTypeFloat: {
+			uint32_t bits;
+			memcpy(&bits, &(slot->value._xfloat), sizeof(bits));
+			item[0] = 0xfa;
+			item[1] = (uint8_t) (bits >> 24);
+			item[2] = (uint8_t) (bits >> 16);
+			item[3] = (uint8_t) (bits >> 8);
+			item[4] = (uint8_t) bits;
+			length = 5;
+			break;
+		}
+		case TsTypeBoolean:
+			item[0] = slot->value._xboolean ? 0xf5 : 0xf4;
+			length = 1;
+			break;
+
+		case TsTypeString:
+			length = _ts_layout_cbor_header(item, 3, (uint32_t) strlen(slot->value._xstring));
+			break;
+
+		case TsTypeNull:
+		default:
+			item[0] = 0xf6;
+			length = 1;
+			break;
+		}
+		size_t string_size = slot->type == TsTypeString ? strlen(slot->value._xstring) : 0;
+		if (used + length + string_size > size) {
+			return TsStatusErrorOutOfMemory;
+		}
+		memcpy(buffer + used, item, length);
+		memcpy(buffer + used + length, slot->value._xstring, string_size);
+		used = used + length + string_size;
+	}
+	*buffer_size = used;
+	return TsStatusOk;
+}
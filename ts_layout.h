@@ -0,0 +1,79 @@
+#ifndef TS_LAYOUT_H
+#define TS_LAYOUT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "ts_common.h"
+#include "ts_message.h"
+
+/* maximum number of schema fields (containers and leaves) per layout */
+#define TS_LAYOUT_MAX_FIELDS            32
+
+/* maximum size of all pre-rendered fragments of a layout, per encoder */
+#define TS_LAYOUT_MAX_FRAGMENTS_SIZE    512
+
+/* schema field declaration */
+/* fields are listed depth-first, i.e., a parent always precedes its branches, */
+/* and the branches of a parent are listed before any of its later siblings. */
+typedef struct {
+	int			parent;     /* index of the parent field, or -1 for a branch of the root */
+	char		*name;      /* field name (ignored, and may be NULL, for array items) */
+	TsType_t	type;       /* field type, TsTypeMessage and TsTypeArray are containers */
+} TsLayoutField_t;
+
+/* slot value, i.e., the value of a single leaf field */
+typedef struct {
+	TsType_t		type;
+	union {
+		int			_xinteger;
+		float		_xfloat;
+		bool		_xboolean;
+		char		_xstring[TS_MESSAGE_MAX_STRING_SIZE];
+	} value;
+} TsLayoutSlot_t;
+
+/* pre-rendered fragment, written ahead of the slot of the same index */
+typedef struct {
+	uint16_t	offset;
+	uint16_t	size;
+} TsLayoutFragment_t;
+
+/* compiled layout */
+/* fields are set by slot index (i.e., the index of the field in the schema), */
+/* encoding copies the pre-rendered fragments found between the leaf values. */
+typedef struct TsLayout *TsLayoutRef_t;
+typedef struct TsLayout {
+	size_t				fields;
+	size_t				leaves;
+	TsLayoutSlot_t		slots[TS_LAYOUT_MAX_FIELDS];
+	uint8_t				order[TS_LAYOUT_MAX_FIELDS];
+	TsLayoutFragment_t	json[TS_LAYOUT_MAX_FIELDS + 1];
+	TsLayoutFragment_t	cbor[TS_LAYOUT_MAX_FIELDS + 1];
+	uint8_t				json_fragments[TS_LAYOUT_MAX_FRAGMENTS_SIZE];
+	uint8_t				cbor_fragments[TS_LAYOUT_MAX_FRAGMENTS_SIZE];
+} TsLayout_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* compile and reset */
+TsStatus_t ts_layout_compile(TsLayoutRef_t layout, const TsLayoutField_t *schema, size_t schema_size);
+TsStatus_t ts_layout_reset(TsLayoutRef_t layout);
+
+/* slot-indexed set operations */
+TsStatus_t ts_layout_set_int(TsLayoutRef_t layout, size_t slot, int value);
+TsStatus_t ts_layout_set_float(TsLayoutRef_t layout, size_t slot, float value);
+TsStatus_t ts_layout_set_string(TsLayoutRef_t layout, size_t slot, char *value);
+TsStatus_t ts_layout_set_bool(TsLayoutRef_t layout, size_t slot, bool value);
+
+/* encoding */
+TsStatus_t ts_layout_encode(TsLayoutRef_t layout, TsEncoder_t encoder, uint8_t *buffer, size_t *buffer_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TS_LAYOUT_H */
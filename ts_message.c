@@ -1,5 +1,8 @@
 #include <string.h>
 #include <stdio.h>
+#include <math.h>
+#include <stdarg.h>
+#include <time.h>
 #include "cbor.h"
 #include "cJSON.h"
 
@@ -9,158 +12,412 @@
 
 #include "ts_common.h"
 #include "ts_message.h"
+#include "ts_json.h"
+
+/* message node flags */
+#define TS_MESSAGE_FLAG_FROZEN		0x01
+#define TS_MESSAGE_FLAG_SPILLED		0x02	/* the string is kept outside the node, see _ts_message_store */
+#define TS_MESSAGE_FLAG_BORROWED	0x04	/* the string is owned by the caller, see _ts_message_borrow */
+#define TS_MESSAGE_FLAG_CACHED		0x08	/* see ts_message_cache_encodings */
+#define TS_MESSAGE_FLAG_HASHED		0x10	/* the digest is valid, see ts_message_digest */
+
+/* size of the node header, i.e., all of the node but its name and value */
+#define TS_MESSAGE_HEADER_SIZE		(sizeof(TsType_t) + sizeof(uint32_t) + 2 * sizeof(TsMessageRef_t) \
+									 + 5 * sizeof(unsigned int) + sizeof(TsMessageAllocatorRef_t))
+
+/* maximum size of a json pointer (of a patch), i.e., of the longest path with every character escaped */
+#define TS_MESSAGE_POINTER_SIZE		(TS_MESSAGE_MAX_DEPTH * (2 * TS_MESSAGE_MAX_KEY_SIZE + 1))
+
+/* atomic operations (gcc and clang builtins), used for the reference counts and the shared state below */
+#define _ts_message_atomic_load(pointer) __atomic_load_n((pointer), __ATOMIC_ACQUIRE)
+#define _ts_message_atomic_store(pointer, value) __atomic_store_n((pointer), (value), __ATOMIC_RELEASE)
+#define _ts_message_atomic_add(pointer, value) __atomic_add_fetch((pointer), (value), __ATOMIC_ACQ_REL)
+#define _ts_message_atomic_cas(pointer, expected, desired) \
+	__atomic_compare_exchange_n((pointer), (expected), (desired), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+
+/* structure generation, changed whenever a branch is added to or removed from a message */
+/* (used to revalidate compiled paths) */
+static unsigned int _ts_message_generation = 0;
 
 /* static memory model, e.g., for debug (warning - affects bss directly) */
 /* TS_MESSAGE_STATIC_MEMORY define. */
+/* nodes held by threads (in use or cached), and their peak, updated once per cache batch */
+static int _ts_message_counter = 0;
+static int _ts_message_peak = 0;
+
 #ifdef TS_MESSAGE_STATIC_MEMORY
 static TsMessage_t _ts_message_nodes[TS_MESSAGE_MAX_NODES];
-static bool _ts_message_nodes_initialized = false;
-static int _ts_message_counter = 0;
+
+/* lock-free node pool, i.e., nodes are taken from a free list (treiber stack) of destroyed nodes, */
+/* or when empty, from the nodes never used so far. the head of the free list holds the index */
+/* of the top node plus one (zero when empty) in the low half, and an aba tag in the high half */
+static uint64_t _ts_message_free_list = 0;
+static int _ts_message_free_next[TS_MESSAGE_MAX_NODES];
+static int _ts_message_unused = 0;
+#else
+
+/* shared node pool, i.e., free nodes chained through their first field, guarded by a spin lock */
+/* (taken once per batch only) */
+static TsMessageRef_t _ts_message_pool = NULL;
+static int _ts_message_pool_size = 0;
+static bool _ts_message_pool_lock = false;
 #endif
 
+/* arena shared by the tasks of a parallel encoding, i.e., each task takes as much as its branch used */
+typedef struct TsMessageArena {
+	uint8_t			*bytes;
+	size_t			size;
+	size_t			used;
+} TsMessageArena_t;
+
+/* parallel encoding task, i.e., a single top-level branch or message of a batch */
+typedef struct TsMessageTask {
+	TsMessageRef_t		message;
+	TsMessageRef_t		parent;     /* NULL when encoding the whole message */
+	TsMessageArena_t	*arena;     /* NULL when encoding the whole message */
+	TsEncoder_t			encoder;
+	uint8_t				*buffer;
+	size_t				buffer_size;
+	TsStatus_t			status;
+} TsMessageTask_t;
+
+/* traversal frame, i.e., a message or array and the index of its next branch */
+/* (messages are traversed depth first on an explicit stack of frames, rather than by recursion) */
+typedef struct TsMessageFrame {
+	TsMessageRef_t	message;
+	TsMessageRef_t	branch;     /* the next branch */
+	int				index;      /* of the next branch */
+	TsMessageRef_t	copy;       /* the copy of the message and its last branch, when copying */
+	TsMessageRef_t	last;       /* (or the message compared with and its next branch, when comparing) */
+	size_t			start;      /* of the encoding of the message, when encoding */
+	uint64_t		digest;     /* of the branches so far, when hashing */
+} TsMessageFrame_t;
+
+/* cached encodings of a message or array, see ts_message_cache_encodings */
+/* (kept once encoded below the root of an encode, and invalidated by any change of its branches) */
+#define TS_MESSAGE_ENCODING_JSON	0
+#define TS_MESSAGE_ENCODING_CBOR	1
+typedef struct TsMessageEncoding {
+	uint8_t		*bytes[2];
+	size_t		sizes[2];
+	size_t		capacities[2];
+	bool		valid[2];
+} TsMessageEncoding_t;
+
+/* snapshot header, ahead of the nodes (in depth first order, the root first) and the string table */
+/* (links and long strings are kept as offsets from the header, zero for none) */
+#define TS_MESSAGE_SNAPSHOT_MAGIC	0x31534d54	/* "TMS1" in little endian, i.e., also of the byte order */
+#define TS_MESSAGE_SNAPSHOT_VERSION	1
+typedef struct TsMessageSnapshot {
+	uint32_t				magic;
+	uint16_t				version;
+	uint16_t				node_size;  /* sizeof(TsMessage_t) of the build that saved it */
+	uint32_t				nodes;
+	uint32_t				strings;    /* size of the string table */
+	uint64_t				size;       /* of the whole snapshot */
+	TsMessageAllocator_t	allocator;  /* of the loaded nodes, set on load */
+} __attribute__((aligned(TS_MESSAGE_CACHE_LINE))) TsMessageSnapshot_t;
+
+/* per-thread counters, summed on read */
+/* a thread claims a slot when it first counts, and gives it back on ts_message_cache_flush, */
+/* the counts stay (and are added to by the next thread to claim it). the last slot is shared. */
+typedef struct TsMessageCounters {
+	bool			used;
+	uint64_t		creates;
+	uint64_t		destroys;
+	uint64_t		failures;
+	uint64_t		encodes[TS_MESSAGE_ENCODERS];
+	uint64_t		encode_bytes[TS_MESSAGE_ENCODERS];
+	uint64_t		encode_errors[TS_MESSAGE_ENCODERS];
+	uint64_t		decodes[TS_MESSAGE_ENCODERS];
+	uint64_t		decode_bytes[TS_MESSAGE_ENCODERS];
+	uint64_t		decode_errors[TS_MESSAGE_ENCODERS];
+	uint64_t		encode_latency[TS_MESSAGE_ENCODERS][TS_MESSAGE_HISTOGRAM_SIZE];
+	uint64_t		decode_latency[TS_MESSAGE_ENCODERS][TS_MESSAGE_HISTOGRAM_SIZE];
+} __attribute__((aligned(64))) TsMessageCounters_t;
+static TsMessageCounters_t _ts_message_counters[TS_MESSAGE_MAX_THREADS];
+
+/* count on a slot, i.e., without contention unless shared */
+#define _ts_message_count(counter, value) __atomic_fetch_add(&(counter), (value), __ATOMIC_RELAXED)
+
+/* per-thread node cache (magazine), refilled from and flushed to the shared node pool in batches, */
+/* making the common create and destroy path lock-free */
+typedef struct TsMessageCache {
+	unsigned int		id;             /* zero until first used */
+	int					count;
+	uint64_t			remote_frees;   /* not yet added to the shared statistics */
+	TsMessageCounters_t	*counters;      /* NULL until first used */
+	uint8_t				*scratch;       /* encoding buffer of parallel tasks, NULL until first used */
+	size_t				scratch_size;
+	TsMessageRef_t		nodes[TS_MESSAGE_CACHE_SIZE];
+} TsMessageCache_t;
+static __thread TsMessageCache_t _ts_message_cache;
+static unsigned int _ts_message_caches = 0;
+static TsMessageCacheStatistics_t _ts_message_cache_statistics;
+
+/* allocator of new roots, NULL for the node caches */
+static TsMessageAllocatorRef_t _ts_message_allocator = NULL;
+
+/* allocation site of the calling thread, recorded by the tracing allocator */
+typedef struct TsMessageSite {
+	const char	*function;
+	const char	*file;
+	int			line;
+} TsMessageSite_t;
+static __thread TsMessageSite_t _ts_message_site;
+
 /* forward references */
 #ifdef TS_MESSAGE_STATIC_MEMORY
-static TsStatus_t _ts_message_initialize();
+static TsMessageRef_t _ts_message_pop();
+static void _ts_message_push(TsMessageRef_t);
 #endif
+static TsMessageCache_t * _ts_message_thread_cache();
+static TsMessageRef_t _ts_message_alloc(TsMessageAllocatorRef_t, const char *);
+static void _ts_message_free(TsMessageRef_t);
+static TsStatus_t _ts_message_create(TsMessageAllocatorRef_t, const char *, TsMessageRef_t *);
+static TsStatus_t _ts_message_copy(TsMessageAllocatorRef_t, TsMessageRef_t, unsigned int, TsMessageRef_t *);
+static TsStatus_t _ts_message_clone(TsMessageAllocatorRef_t, TsMessageRef_t, unsigned int, TsMessageRef_t *);
+static bool _ts_message_is_too_deep(TsType_t, unsigned int);
+static uint32_t _ts_message_hash(const char *);
+static void _ts_message_name(TsMessageRef_t, const char *);
+static TsMessageRef_t * _ts_message_find(TsMessageRef_t, const char *);
+static TsMessageRef_t * _ts_message_at(TsMessageRef_t, size_t);
+static TsValue_t _ts_message_value(TsMessageRef_t);
+static void _ts_message_push_frame(TsMessageFrame_t *, TsMessageRef_t);
+static void * _ts_message_aligned(size_t);
+static char * _ts_message_string(TsMessageRef_t);
+static TsStatus_t _ts_message_store(TsMessageRef_t, const char *, size_t);
+static void _ts_message_release_string(TsMessageRef_t);
+static void _ts_message_borrow(TsMessageRef_t, const char *, size_t);
+static TsStatus_t _ts_message_assign_node(TsMessageRef_t, TsMessageRef_t);
+static void * _ts_message_allocate_bytes(TsMessageAllocatorRef_t, size_t, const char *);
+static void _ts_message_release_bytes(TsMessageAllocatorRef_t, void *, size_t);
+static void _ts_message_touch(TsMessageRef_t);
+static void _ts_message_link(TsMessageRef_t, TsMessageRef_t);
+static const TsMessageEncoding_t * _ts_message_cached(TsMessageRef_t, int);
+static void _ts_message_remember(TsMessageRef_t, int, const uint8_t *, size_t);
+static void _ts_message_release_encoding(TsMessageRef_t);
+static void _ts_message_uncache(TsMessageRef_t);
+static uint64_t _ts_message_fnv(uint64_t, const void *, size_t);
+static uint64_t _ts_message_mix(uint64_t);
+static uint64_t _ts_message_leaf_digest(TsMessageRef_t);
+static void _ts_message_add_digest(TsMessageFrame_t *, TsMessageRef_t, uint64_t);
+static TsStatus_t _ts_message_digest(TsMessageRef_t, uint64_t *);
+static bool _ts_message_same(TsMessageRef_t, TsMessageRef_t);
+static TsStatus_t _ts_message_snapshot_measure(TsMessageRef_t, size_t *, size_t *);
+static void _ts_message_snapshot_node(uint8_t *, TsMessageRef_t, unsigned int, TsMessageRef_t, size_t *);
+static TsMessageSnapshot_t * _ts_message_snapshot_header(const uint8_t *, size_t);
+static bool _ts_message_snapshot_link(const TsMessageSnapshot_t *, size_t, uintptr_t);
+static bool _ts_message_snapshot_string(const TsMessageSnapshot_t *, uintptr_t, size_t);
+static void * _ts_message_snapshot_allocate(void *, size_t);
+static void _ts_message_snapshot_release(void *, void *, size_t);
+static void _ts_message_json_key(TsMessageRef_t, TsMessageRef_t, int, char *, size_t, size_t *);
+static void _ts_message_cbor_splice(CborEncoder *, const uint8_t *, size_t);
+static void * _ts_message_trace_allocate(void *, size_t);
+static void _ts_message_trace_release(void *, void *, size_t);
+static void _ts_message_trace_lock(TsMessageTraceRef_t);
+static void _ts_message_trace_unlock(TsMessageTraceRef_t);
+static void _ts_message_refill(TsMessageCache_t *);
+static void _ts_message_flush(TsMessageCache_t *, int);
 static TsStatus_t _ts_message_set(TsMessageRef_t, TsPathNode_t, TsType_t, TsValue_t);
 static TsStatus_t _ts_message_get(TsMessageRef_t, TsPathNode_t, TsType_t, TsValue_t);
-static TsStatus_t _ts_message_encode_debug(TsMessageRef_t, int);
+static TsStatus_t _ts_message_assign(TsMessageRef_t, TsType_t, TsValue_t);
+static bool _ts_message_is_primitive(TsType_t);
+static void _ts_message_flag(TsMessageRef_t, unsigned int, bool);
+static TsStatus_t _ts_message_child(TsMessageRef_t, TsPathNode_t, TsMessageRef_t *);
+static TsStatus_t _ts_message_path_parent(TsMessageRef_t, TsPath_t, bool, TsMessageRef_t *, TsPathNode_t *);
+static TsStatus_t _ts_message_get_path(TsMessageRef_t, TsPath_t, TsType_t, TsValue_t);
+static TsStatus_t _ts_message_set_path(TsMessageRef_t, TsPath_t, TsType_t, TsValue_t);
+static void _ts_message_encode_task(void *);
+static TsStatus_t _ts_message_encode(TsMessageRef_t, TsEncoder_t, uint8_t *, size_t *);
+static TsStatus_t _ts_message_decode(TsMessageRef_t, TsEncoder_t, uint8_t *, size_t);
+static TsStatus_t _ts_message_decode_projected(TsMessageRef_t, TsMessageRef_t, const char *, size_t);
+static TsStatus_t _ts_message_decode_content(TsJsonReaderRef_t, TsMessageRef_t, TsMessageRef_t);
+static TsStatus_t _ts_message_decode_value(TsMessageRef_t, const char *, TsJsonToken_t *, TsMessageRef_t *);
+static TsStatus_t _ts_message_unlink(TsMessageRef_t, TsMessageRef_t *);
+static TsStatus_t _ts_message_insert(TsMessageRef_t, size_t, TsMessageRef_t);
+static TsStatus_t _ts_message_set_node(TsMessageRef_t, const char *, TsMessageRef_t);
+static TsStatus_t _ts_message_merge(TsMessageRef_t, TsMessageRef_t);
+static TsStatus_t _ts_message_merge_json(TsMessageRef_t, const char *, size_t);
+static TsStatus_t _ts_message_pointer(TsMessageRef_t, const char *, TsMessageRef_t *, char *);
+static TsStatus_t _ts_message_index(TsMessageRef_t, const char *, bool, size_t *);
+static TsStatus_t _ts_message_locate(TsMessageRef_t, TsMessageRef_t, const char *, TsMessageRef_t *);
+static TsStatus_t _ts_message_patch_add(TsMessageRef_t, TsMessageRef_t, const char *, TsMessageRef_t, bool);
+static TsStatus_t _ts_message_patch_remove(TsMessageRef_t, const char *);
+static TsStatus_t _ts_message_patch_apply(TsMessageRef_t, const char *, const char *, const char *, TsMessageRef_t);
+static TsStatus_t _ts_message_patch_json(TsMessageRef_t, const char *, size_t);
+static TsStatus_t _ts_message_patch_tokens(TsMessageRef_t, TsJsonToken_t *, TsJsonToken_t *, TsJsonToken_t *,
+										   TsJsonReaderRef_t);
+static TsStatus_t _ts_message_transcode_json(const char *, size_t, uint8_t *, size_t *);
+static TsStatus_t _ts_message_transcode_cbor(const uint8_t *, size_t, char *, size_t *);
+static TsStatus_t _ts_message_cbor_put(uint8_t *, size_t, size_t *, uint8_t, uint64_t);
+static TsStatus_t _ts_message_cbor_byte(uint8_t *, size_t, size_t *, uint8_t);
+static TsStatus_t _ts_message_cbor_number(uint8_t *, size_t, size_t *, TsJsonToken_t *);
+static TsStatus_t _ts_message_cbor_text(uint8_t *, size_t, size_t *, TsJsonToken_t *);
+static TsStatus_t _ts_message_json_number(CborValue *, char *, size_t, size_t *);
+static TsStatus_t _ts_message_json_text(CborValue *, char *, size_t, size_t *);
+static void _ts_message_json_escape(char *, size_t, size_t *, const char *, size_t);
+static void _ts_message_json_put(char *, size_t, size_t *, const char *, size_t);
+static uint64_t _ts_message_now();
+static void _ts_message_count_encode(TsEncoder_t, TsStatus_t, size_t, uint64_t);
+static void _ts_message_count_decode(TsEncoder_t, TsStatus_t, size_t, uint64_t);
+static void _ts_message_latency(uint64_t *, uint64_t);
+static int _ts_message_clamp(int64_t);
+static void _ts_message_footprint(TsMessageRef_t, TsMessageRef_t, size_t, TsMessageFootprint_t *);
+static size_t _ts_message_cbor_head(uint64_t);
+static TsStatus_t _ts_message_export_coder(TsMessageRef_t, TsPathNode_t, TsMessageCoderStatistics_t *);
+static TsStatus_t _ts_message_encode_debug(TsMessageRef_t);
+static void _ts_message_debug_node(TsMessageRef_t, size_t);
 static TsStatus_t _ts_message_encode_json(TsMessageRef_t, uint8_t *, size_t);
+static void _ts_message_json_node(TsMessageRef_t, char *, size_t, size_t *);
+static void _ts_message_append(char *, size_t, size_t *, const char *, ...);
+static size_t _ts_message_json_depth(const char *, size_t);
 static TsStatus_t _ts_message_encode_cbor(TsMessageRef_t, CborEncoder *, uint8_t *, size_t);
 
+/* ts_message_report */
 TsStatus_t ts_message_report()
 {
+	TsMessageStatistics_t statistics;
+	ts_message_statistics(&statistics);
+	dbg_printf("report: nodes live %lld, held (in use or cached) %lld, peak %lld, allocation failures %llu\n",
+			   (long long) statistics.live_nodes, (long long) statistics.held_nodes,
+			   (long long) statistics.peak_nodes, (unsigned long long) statistics.allocation_failures);
+	dbg_printf("report: cache refills %llu, flushes %llu, remote frees %llu\n",
+			   (unsigned long long) statistics.cache.refills, (unsigned long long) statistics.cache.flushes,
+			   (unsigned long long) statistics.cache.remote_frees);
+	for (int i = TsEncoderJson; i < TS_MESSAGE_ENCODERS; i++) {
+		TsMessageCoderStatistics_t *coder = &(statistics.coders[i]);
+		dbg_printf("report: %s encodes %llu (%llu bytes, %llu errors), decodes %llu (%llu bytes, %llu errors)\n",
+				   i == TsEncoderJson ? "json" : "cbor",
+				   (unsigned long long) coder->encodes, (unsigned long long) coder->encode_bytes,
+				   (unsigned long long) coder->encode_errors, (unsigned long long) coder->decodes,
+				   (unsigned long long) coder->decode_bytes, (unsigned long long) coder->decode_errors);
+	}
 #ifdef TS_MESSAGE_STATIC_MEMORY
-	dbg_printf("report: counter, %d\n", _ts_message_counter);
 	for (int i = 0; i < TS_MESSAGE_MAX_NODES; i++) {
-		if (_ts_message_nodes[i].references > 0) {
+		int references = _ts_message_atomic_load(&(_ts_message_nodes[i].references));
+		if (references > 0) {
 			dbg_printf("report: referenced node %d: %s has %d references\n",
 					   i,
 					   _ts_message_nodes[i].name,
-					   _ts_message_nodes[i].references);
+					   references);
 		}
 	}
 #endif
 	return TsStatusOk;
 }
 
-/* ts_message_create */
-TsStatus_t ts_message_create(TsMessageRef_t *message)
+/* ts_message_statistics */
+TsStatus_t ts_message_statistics(TsMessageStatistics_t *statistics)
 {
-#ifdef TS_MESSAGE_STATIC_MEMORY
-	/* initialize static memory system */
-	if (!_ts_message_nodes_initialized) {
-		_ts_message_initialize();
+	/* check preconditions */
+	if (statistics == NULL) {
+		return TsStatusErrorPreconditionFailed;
 	}
-
-	/* search for next free */
-	for (int i = 0; i < TS_MESSAGE_MAX_NODES; i++) {
-
-		if (_ts_message_nodes[i].references == 0) {
-
-			/* mark as assigned */
-			_ts_message_nodes[i].references = 1;
-
-			/* clear all, assume root (avoiding memset) */
-			snprintf(_ts_message_nodes[i].name, TS_MESSAGE_MAX_KEY_SIZE, "$root");
-			_ts_message_nodes[i].type = TsTypeMessage;
-			for (int j = 0; j < TS_MESSAGE_MAX_BRANCHES; j++) {
-				_ts_message_nodes[i].value._xfields[j] = NULL;
+	memset(statistics, 0x00, sizeof(TsMessageStatistics_t));
+
+	/* sum the per-thread counters */
+	uint64_t creates = 0, destroys = 0;
+	for (int i = 0; i < TS_MESSAGE_MAX_THREADS; i++) {
+		TsMessageCounters_t *counters = &_ts_message_counters[i];
+		creates = creates + __atomic_load_n(&(counters->creates), __ATOMIC_RELAXED);
+		destroys = destroys + __atomic_load_n(&(counters->destroys), __ATOMIC_RELAXED);
+		statistics->allocation_failures += __atomic_load_n(&(counters->failures), __ATOMIC_RELAXED);
+		for (int j = 0; j < TS_MESSAGE_ENCODERS; j++) {
+			TsMessageCoderStatistics_t *coder = &(statistics->coders[j]);
+			coder->encodes += __atomic_load_n(&(counters->encodes[j]), __ATOMIC_RELAXED);
+			coder->encode_bytes += __atomic_load_n(&(counters->encode_bytes[j]), __ATOMIC_RELAXED);
+			coder->encode_errors += __atomic_load_n(&(counters->encode_errors[j]), __ATOMIC_RELAXED);
+			coder->decodes += __atomic_load_n(&(counters->decodes[j]), __ATOMIC_RELAXED);
+			coder->decode_bytes += __atomic_load_n(&(counters->decode_bytes[j]), __ATOMIC_RELAXED);
+			coder->decode_errors += __atomic_load_n(&(counters->decode_errors[j]), __ATOMIC_RELAXED);
+			for (int k = 0; k < TS_MESSAGE_HISTOGRAM_SIZE; k++) {
+				coder->encode_latency[k] += __atomic_load_n(&(counters->encode_latency[j][k]), __ATOMIC_RELAXED);
+				coder->decode_latency[k] += __atomic_load_n(&(counters->decode_latency[j][k]), __ATOMIC_RELAXED);
 			}
-
-			/* set the return value (root) */
-			*message = &_ts_message_nodes[i];
-			_ts_message_counter++;
-
-			/* return ok */
-			return TsStatusOk;
 		}
 	}
 
-	/* if none found, then clear the return value */
-	*message = NULL;
-
-	/* and return an out-of-memory error */
-	dbg_printf("ts_message_create: out of memory");
-	return TsStatusErrorOutOfMemory;
-
-#else
-
-	*message = (TsMessageRef_t) (malloc(sizeof(TsMessage_t)));
-
-	memset(*message, 0x00, sizeof(TsMessage_t));
-	(*message)->references = 1;
-	(*message)->type = TsTypeMessage;
-	snprintf((*message)->name, TS_MESSAGE_MAX_KEY_SIZE, "$root");
-
-	return TsStatusOk;
-#endif
+	statistics->live_nodes = (int64_t) (creates - destroys);
+	statistics->held_nodes = _ts_message_atomic_load(&_ts_message_counter);
+	statistics->peak_nodes = _ts_message_atomic_load(&_ts_message_peak);
+	statistics->live_bytes = (uint64_t) statistics->live_nodes * sizeof(TsMessage_t);
+	statistics->held_bytes = (uint64_t) statistics->held_nodes * sizeof(TsMessage_t);
+	return ts_message_cache_statistics(&(statistics->cache));
 }
 
-/* ts_message_create_message */
-TsStatus_t ts_message_create_copy(TsMessageRef_t message, TsMessageRef_t *value)
+/* ts_message_statistics_export */
+/* set the statistics as fields of the given message, e.g., to report them over the uplink */
+/* (latency histograms are cut after their last non-empty bucket) */
+TsStatus_t ts_message_statistics_export(TsMessageRef_t message)
 {
-	/* TODO - check depth, check message null */
-	/* allocate a single message node */
-	TsStatus_t status = ts_message_create(value);
-	if (status == TsStatusOk) {
-
-		/* set the field relative to the given message to the new message */
-		snprintf((*value)->name, TS_MESSAGE_MAX_KEY_SIZE, "%s", message->name);
-		(*value)->type = message->type;
-		switch (message->type) {
-		case TsTypeInteger:
-			(*value)->value._xinteger = message->value._xinteger;
-			break;
-
-		case TsTypeFloat:
-			(*value)->value._xfloat = message->value._xfloat;
-			break;
+	/* check preconditions */
+	if (message == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
 
-		case TsTypeBoolean:
-			(*value)->value._xboolean = message->value._xboolean;
-			break;
+	TsMessageStatistics_t statistics;
+	ts_message_statistics(&statistics);
 
-		case TsTypeString:
-			snprintf((*value)->value._xstring, TS_MESSAGE_MAX_STRING_SIZE, "%s", message->value._xstring);
-			break;
+	TsMessageRef_t nodes, cache;
+	TsStatus_t status = ts_message_create_message(message, "nodes", &nodes);
+	if (status == TsStatusOk) {
+		ts_message_set_int(nodes, "live", _ts_message_clamp(statistics.live_nodes));
+		ts_message_set_int(nodes, "held", _ts_message_clamp(statistics.held_nodes));
+		ts_message_set_int(nodes, "peak", _ts_message_clamp(statistics.peak_nodes));
+		ts_message_set_int(nodes, "bytes", _ts_message_clamp((int64_t) statistics.live_bytes));
+		status = ts_message_set_int(nodes, "failures", _ts_message_clamp((int64_t) statistics.allocation_failures));
+	}
+	if (status == TsStatusOk) {
+		status = ts_message_create_message(message, "cache", &cache);
+	}
+	if (status == TsStatusOk) {
+		ts_message_set_int(cache, "refills", _ts_message_clamp((int64_t) statistics.cache.refills));
+		ts_message_set_int(cache, "flushes", _ts_message_clamp((int64_t) statistics.cache.flushes));
+		status = ts_message_set_int(cache, "remoteFrees", _ts_message_clamp((int64_t) statistics.cache.remote_frees));
+	}
+	if (status == TsStatusOk) {
+		status = _ts_message_export_coder(message, "json", &(statistics.coders[TsEncoderJson]));
+	}
+	if (status == TsStatusOk) {
+		status = _ts_message_export_coder(message, "cbor", &(statistics.coders[TsEncoderCbor]));
+	}
+	return status;
+}
 
-		case TsTypeMessage:
-		case TsTypeArray:
-			for (int i = 0; i < TS_MESSAGE_MAX_BRANCHES; i++) {
-				if (message->value._xfields[i] == NULL) {
-					break;
-				}
-				TsMessageRef_t field;
-				status = ts_message_create_copy(message->value._xfields[i], &field);
-				if (status != TsStatusOk) {
-					ts_message_destroy(*value);
-					return status;
-				}
-				(*value)->value._xfields[i] = field;
-			}
-			break;
+/* ts_message_create */
+TsStatus_t ts_message_create(TsMessageRef_t *message)
+{
+	return _ts_message_create(_ts_message_atomic_load(&_ts_message_allocator), "ts_message_create", message);
+}
 
-		case TsTypeNull:
-		default:
-			/* do nothing */
-			break;
-		}
+/* ts_message_create_with */
+/* create a root taking its nodes from the given allocator (or the node caches when NULL) */
+TsStatus_t ts_message_create_with(TsMessageAllocatorRef_t allocator, TsMessageRef_t *message)
+{
+	/* check preconditions */
+	if (message == NULL || (allocator != NULL && (allocator->allocate == NULL || allocator->release == NULL))) {
+		return TsStatusErrorPreconditionFailed;
 	}
+	return _ts_message_create(allocator, "ts_message_create_with", message);
+}
 
-	/* return result */
-	return status;
+/* ts_message_create_copy */
+/* copy the given message into a new root */
+TsStatus_t ts_message_create_copy(TsMessageRef_t message, TsMessageRef_t *value)
+{
+	return _ts_message_copy(_ts_message_atomic_load(&_ts_message_allocator), message, 0, value);
 }
 
 /* ts_message_create_message */
 TsStatus_t ts_message_create_message(TsMessageRef_t message, TsPathNode_t field, TsMessageRef_t *value)
 {
 	/* allocate a single message node */
-	TsStatus_t status = ts_message_create(value);
+	TsStatus_t status = _ts_message_create(message->allocator, "ts_message_create_message", value);
 	if (status == TsStatusOk) {
 
 		/* set the field relative to the given message to the new message */
-		snprintf((*value)->name, TS_MESSAGE_MAX_KEY_SIZE, "%s", field);
+		_ts_message_name(*value, field);
 		(*value)->type = TsTypeMessage;
 		status = _ts_message_set(message, field, TsTypeMessage, *value);
 
@@ -171,7 +428,7 @@ TsStatus_t ts_message_create_message(TsMessageRef_t message, TsPathNode_t field,
 			*value = NULL;
 			return status;
 		}
-		ts_message_get(message, field, value);
+		status = ts_message_get(message, field, value);
 	}
 
 	/* return result */
@@ -183,11 +440,11 @@ TsStatus_t ts_message_create_message(TsMessageRef_t message, TsPathNode_t field,
 TsStatus_t ts_message_create_array(TsMessageRef_t message, TsPathNode_t field, TsMessageRef_t *value)
 {
 	/* allocate a single message node */
-	TsStatus_t status = ts_message_create(value);
+	TsStatus_t status = _ts_message_create(message->allocator, "ts_message_create_array", value);
 	if (status == TsStatusOk) {
 
 		/* set the field relative to the given message to the new message */
-		snprintf((*value)->name, TS_MESSAGE_MAX_KEY_SIZE, "%s", field);
+		_ts_message_name(*value, field);
 		(*value)->type = TsTypeArray;
 		status = _ts_message_set(message, field, TsTypeArray, *value);
 
@@ -198,7 +455,7 @@ TsStatus_t ts_message_create_array(TsMessageRef_t message, TsPathNode_t field, T
 			*value = NULL;
 			return status;
 		}
-		ts_message_get(message, field, value);
+		status = ts_message_get(message, field, value);
 	}
 
 	/* return result */
@@ -209,35 +466,321 @@ TsStatus_t ts_message_create_array(TsMessageRef_t message, TsPathNode_t field, T
 TsStatus_t ts_message_destroy(TsMessageRef_t message)
 {
 	/* check preconditions */
-	if (message == NULL || message->references <= 0) {
+	if (message == NULL || _ts_message_atomic_load(&(message->references)) <= 0) {
 		return TsStatusErrorPreconditionFailed;
 	}
 
-	/* simply change its status */
-	message->references--;
+	/* simply change its status, and destroy along with children when it was the last reference */
+	/* (i.e., only the thread that releases the last reference touches the node from here on) */
+	if (_ts_message_atomic_add(&(message->references), -1) > 0) {
+		return TsStatusOk;
+	}
 
-	/* and destroy along with children */
-	if (message->references <= 0) {
+	/* destroy the branches released along with it depth first, each node after its branches */
+	TsMessageFrame_t stack[TS_MESSAGE_MAX_DEPTH];
+	size_t top = 0;
+	TsStatus_t status = TsStatusOk;
+	TsMessageRef_t node = message;
+	for (;;) {
 
-		if (message->type == TsTypeArray || message->type == TsTypeMessage) {
-			for (int i = 0; i < TS_MESSAGE_MAX_BRANCHES; i++) {
-				if (message->value._xfields[i] != NULL) {
-					ts_message_destroy(message->value._xfields[i]);
+		/* descend into a released message or array, or free a released leaf */
+		if (node != NULL) {
+			if (!_ts_message_is_primitive(node->type) && top < TS_MESSAGE_MAX_DEPTH) {
+				_ts_message_push_frame(&(stack[top++]), node);
+			} else {
+				if (!_ts_message_is_primitive(node->type)) {
+					dbg_printf("ts_message_destroy: message too deep, its branches are lost\n");
+					status = TsStatusErrorRecursionTooDeep;
 				}
+				_ts_message_free(node);
 			}
+			node = NULL;
 		}
-#ifdef TS_MESSAGE_STATIC_MEMORY
-		message->references = 0;
-		_ts_message_counter--;
-		if (_ts_message_counter <= 0) {
-			dbg_printf("ts_message_destroy: all messages that had been created are now destroyed\n");
+		if (top == 0) {
+			break;
+		}
+
+		/* release the next branch (moving on before it is freed), or free the container once all are done */
+		TsMessageFrame_t *frame = &(stack[top - 1]);
+		if (frame->branch != NULL) {
+			TsMessageRef_t branch = frame->branch;
+			frame->branch = branch->next;
+			if (_ts_message_atomic_load(&(branch->references)) > 0
+				&& _ts_message_atomic_add(&(branch->references), -1) <= 0) {
+				node = branch;
+			}
+		} else {
+			_ts_message_free(frame->message);
+			top--;
 		}
-#else
-		free(message);
-#endif
 	}
 
-	/* return ok */
+	/* return result */
+	return status;
+}
+
+/* ts_message_retain */
+TsStatus_t ts_message_retain(TsMessageRef_t message)
+{
+	/* check preconditions */
+	if (message == NULL || _ts_message_atomic_load(&(message->references)) <= 0) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	_ts_message_atomic_add(&(message->references), 1);
+	return TsStatusOk;
+}
+
+/* ts_message_cache_flush */
+/* return all nodes cached by the calling thread to the shared node pool */
+TsStatus_t ts_message_cache_flush()
+{
+	TsMessageCache_t *cache = _ts_message_thread_cache();
+	_ts_message_flush(cache, cache->count);
+
+	/* release the encoding buffer, and give back the counter slot */
+	free(cache->scratch);
+	cache->scratch = NULL;
+	cache->scratch_size = 0;
+	if (cache->counters != &_ts_message_counters[TS_MESSAGE_MAX_THREADS - 1]) {
+		_ts_message_atomic_store(&(cache->counters->used), false);
+	}
+	cache->counters = NULL;
+	return TsStatusOk;
+}
+
+/* ts_message_cache_statistics */
+TsStatus_t ts_message_cache_statistics(TsMessageCacheStatistics_t *statistics)
+{
+	/* check preconditions */
+	if (statistics == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	statistics->refills = _ts_message_atomic_load(&(_ts_message_cache_statistics.refills));
+	statistics->flushes = _ts_message_atomic_load(&(_ts_message_cache_statistics.flushes));
+	statistics->remote_frees = _ts_message_atomic_load(&(_ts_message_cache_statistics.remote_frees));
+	return TsStatusOk;
+}
+
+/* ts_message_set_allocator */
+/* set the allocator of new roots, existing messages keep theirs */
+TsStatus_t ts_message_set_allocator(TsMessageAllocatorRef_t allocator)
+{
+	/* check preconditions */
+	if (allocator != NULL && (allocator->allocate == NULL || allocator->release == NULL)) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	_ts_message_atomic_store(&_ts_message_allocator, allocator);
+	return TsStatusOk;
+}
+
+/* ts_message_trace_init */
+/* initialize a tracing allocator wrapping the given one (or malloc when NULL) */
+TsStatus_t ts_message_trace_init(TsMessageTraceRef_t trace, TsMessageAllocatorRef_t target)
+{
+	/* check preconditions */
+	if (trace == NULL || target == &(trace->allocator)) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	memset(trace, 0x00, sizeof(TsMessageTrace_t));
+	trace->allocator.allocate = _ts_message_trace_allocate;
+	trace->allocator.release = _ts_message_trace_release;
+	trace->allocator.context = trace;
+	trace->target = target;
+	return TsStatusOk;
+}
+
+/* ts_message_trace_site */
+/* set the call site recorded with the allocations of the calling thread */
+TsStatus_t ts_message_trace_site(const char *file, int line)
+{
+	_ts_message_site.file = file;
+	_ts_message_site.line = line;
+	return TsStatusOk;
+}
+
+/* ts_message_trace_report */
+/* print the totals of the given tracing allocator, and its live allocations, e.g., the leaks at shutdown */
+TsStatus_t ts_message_trace_report(TsMessageTraceRef_t trace)
+{
+	/* check preconditions */
+	if (trace == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+
+	_ts_message_trace_lock(trace);
+	dbg_printf("trace: allocations %llu, releases %llu, failures %llu, untracked %llu\n",
+			   (unsigned long long) trace->allocations, (unsigned long long) trace->releases,
+			   (unsigned long long) trace->failures, (unsigned long long) trace->untracked);
+	dbg_printf("trace: bytes live %llu, peak %llu, ns per allocate %llu, per release %llu\n",
+			   (unsigned long long) trace->live_bytes, (unsigned long long) trace->peak_bytes,
+			   (unsigned long long) (trace->allocations > 0 ? trace->allocate_ns / trace->allocations : 0),
+			   (unsigned long long) (trace->releases > 0 ? trace->release_ns / trace->releases : 0));
+	uint64_t now = _ts_message_now();
+	for (size_t i = 0; i < trace->count; i++) {
+		TsMessageTraceRecord_t *record = &(trace->records[i]);
+		dbg_printf("trace: live %p, %lu bytes, by %s at %s:%d, for %llu us\n",
+				   record->pointer, (unsigned long) record->size,
+				   record->function != NULL ? record->function : "?",
+				   record->file != NULL ? record->file : "?", record->line,
+				   (unsigned long long) ((now - record->created) / 1000));
+	}
+	_ts_message_trace_unlock(trace);
+	return TsStatusOk;
+}
+
+/* ts_message_freeze */
+/* freeze the structure of the given message, i.e., turn it into a reusable template */
+TsStatus_t ts_message_freeze(TsMessageRef_t message)
+{
+	/* check preconditions */
+	if (message == NULL || _ts_message_atomic_load(&(message->references)) <= 0) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	_ts_message_flag(message, TS_MESSAGE_FLAG_FROZEN, true);
+	return TsStatusOk;
+}
+
+/* ts_message_thaw */
+/* allow the structure of the given (frozen) message to change again */
+TsStatus_t ts_message_thaw(TsMessageRef_t message)
+{
+	/* check preconditions */
+	if (message == NULL || _ts_message_atomic_load(&(message->references)) <= 0) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	_ts_message_flag(message, TS_MESSAGE_FLAG_FROZEN, false);
+	return TsStatusOk;
+}
+
+/* ts_message_reset */
+/* reset the leaf values of the given message in place, keeping names, types and nodes */
+TsStatus_t ts_message_reset(TsMessageRef_t message)
+{
+	/* check preconditions */
+	if (message == NULL || _ts_message_atomic_load(&(message->references)) <= 0) {
+		return TsStatusErrorPreconditionFailed;
+	}
+
+	switch (message->type) {
+	case TsTypeInteger:
+		message->value._xinteger = 0;
+		break;
+
+	case TsTypeFloat:
+		message->value._xfloat = 0.0f;
+		break;
+
+	case TsTypeBoolean:
+		message->value._xboolean = false;
+		break;
+
+	case TsTypeString:
+		_ts_message_store(message, "", 0);
+		break;
+
+	case TsTypeMessage:
+	case TsTypeArray:
+		for (TsMessageRef_t branch = message->value._xbranches; branch != NULL; branch = branch->next) {
+			ts_message_reset(branch);
+		}
+		break;
+
+	case TsTypeNull:
+	default:
+		/* do nothing */
+		break;
+	}
+	_ts_message_touch(_ts_message_is_primitive(message->type) ? message->parent : message);
+	return TsStatusOk;
+}
+
+/* ts_message_cache_encodings */
+/* keep (or drop) the encodings of the messages and arrays of the given message between encodes */
+TsStatus_t ts_message_cache_encodings(TsMessageRef_t message, bool enable)
+{
+	/* check preconditions */
+	if (message == NULL || _ts_message_atomic_load(&(message->references)) <= 0) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	if (enable) {
+		_ts_message_flag(message, TS_MESSAGE_FLAG_CACHED, true);
+	} else {
+		_ts_message_uncache(message);
+		_ts_message_touch(message->parent);
+	}
+	return TsStatusOk;
+}
+
+/* ts_message_digest */
+/* the structural hash of the given message, kept by its messages and arrays until changed */
+TsStatus_t ts_message_digest(TsMessageRef_t message, uint64_t *digest)
+{
+	/* check preconditions */
+	if (message == NULL || digest == NULL || _ts_message_atomic_load(&(message->references)) <= 0) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	if ((message->flags & TS_MESSAGE_FLAG_HASHED) != 0) {
+		*digest = message->digest;
+		return TsStatusOk;
+	}
+	return _ts_message_digest(message, digest);
+}
+
+/* ts_message_equal */
+/* compare the given messages (regardless of the order of their fields) */
+TsStatus_t ts_message_equal(TsMessageRef_t message, TsMessageRef_t other, bool *equal)
+{
+	/* check preconditions */
+	if (message == NULL || other == NULL || equal == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+
+	/* compare the roots, then their branches depth first, */
+	/* looking up the fields of messages by name and stepping through the items of arrays in order */
+	*equal = false;
+	if (!_ts_message_same(message, other)) {
+		return TsStatusOk;
+	}
+	if (_ts_message_is_primitive(message->type) || message == other) {
+		*equal = true;
+		return TsStatusOk;
+	}
+	TsMessageFrame_t stack[TS_MESSAGE_MAX_DEPTH];
+	_ts_message_push_frame(&(stack[0]), message);
+	stack[0].copy = other;
+	stack[0].last = other->value._xbranches;
+	size_t top = 1;
+	while (top > 0) {
+		TsMessageFrame_t *frame = &(stack[top - 1]);
+		TsMessageRef_t branch = frame->branch;
+		if (branch == NULL) {
+			top--;
+			continue;
+		}
+		frame->branch = branch->next;
+
+		/* (both have as many branches, see _ts_message_same) */
+		TsMessageRef_t match;
+		if (frame->message->type == TsTypeArray) {
+			match = frame->last;
+			frame->last = match->next;
+		} else {
+			match = *(_ts_message_find(frame->copy, branch->name));
+		}
+		if (match == NULL || !_ts_message_same(branch, match)) {
+			return TsStatusOk;
+		}
+		if (!_ts_message_is_primitive(branch->type) && branch != match) {
+			if (top == TS_MESSAGE_MAX_DEPTH) {
+				return TsStatusErrorRecursionTooDeep;
+			}
+			_ts_message_push_frame(&(stack[top]), branch);
+			stack[top].copy = match;
+			stack[top].last = match->value._xbranches;
+			top++;
+		}
+	}
+	*equal = true;
 	return TsStatusOk;
 }
 
@@ -257,22 +800,13 @@ TsStatus_t ts_message_destroy(TsMessageRef_t message)
  */
 TsStatus_t ts_message_set(TsMessageRef_t message, TsPathNode_t field, TsMessageRef_t value)
 {
-	/* hold the type of the value, since set will force it to be TsTypeMessage */
-	TsType_t type = value->type;
-
-	/* find the best field (e.g., by name) and set that field to this value */
-	TsStatus_t status = _ts_message_set(message, field, TsTypeMessage, value);
+	/* find the best field (e.g., by name) and set that field to a copy of this value, */
+	/* the copy keeps the type of the value (primitives too, i.e., it is never retyped as a message) */
 	/* note that this message doesnt take ownership of the given value, so subsequent
 	 * destroys most occur on both the given value and this message in order to
 	 * clean up memory allocated */
-
-	/* reset the "new" field (i.e., the given pointer with references bumped by one) */
-	/* to the correct type. */
-	TsMessageRef_t copy;
-	ts_message_get(message, field, &copy);
-	copy->type = type;
-
-	return status;
+	TsType_t type = value != NULL && value->type == TsTypeArray ? TsTypeArray : TsTypeMessage;
+	return _ts_message_set(message, field, type, value);
 }
 
 /* ts_message_set_null */
@@ -299,6 +833,24 @@ TsStatus_t ts_message_set_string(TsMessageRef_t message, TsPathNode_t field, cha
 	return _ts_message_set(message, field, TsTypeString, value);
 }
 
+/* ts_message_set_string_borrowed */
+/* refer to the given string rather than copy it (see ts_message.h for its lifetime) */
+TsStatus_t ts_message_set_string_borrowed(TsMessageRef_t message, TsPathNode_t field, const char *value)
+{
+	/* check preconditions */
+	if (value == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+
+	/* establish the (empty) string, then borrow the given one */
+	TsStatus_t status = _ts_message_set(message, field, TsTypeString, "");
+	if (status != TsStatusOk) {
+		return status;
+	}
+	_ts_message_borrow(field == NULL ? message : *(_ts_message_find(message, field)), value, strlen(value));
+	return TsStatusOk;
+}
+
 /* ts_message_set_bool */
 TsStatus_t ts_message_set_bool(TsMessageRef_t message, TsPathNode_t field, bool value)
 {
@@ -326,17 +878,12 @@ TsStatus_t ts_message_has(TsMessageRef_t message, TsPathNode_t field, TsMessageR
 	if (message->type != TsTypeMessage) {
 		return TsStatusErrorPreconditionFailed;
 	}
-	for (int i = 0; i < TS_MESSAGE_MAX_BRANCHES; i++) {
-		TsMessageRef_t object = message->value._xfields[i];
-		if (object == NULL) {
-			return TsStatusErrorNotFound;
-		}
-		if (strcmp(object->name, field) == 0) {
-			*value = object;
-			return TsStatusOk;
-		}
+	TsMessageRef_t object = *(_ts_message_find(message, field));
+	if (object == NULL) {
+		return TsStatusErrorNotFound;
 	}
-	return TsStatusErrorNotFound;
+	*value = object;
+	return TsStatusOk;
 }
 
 /* ts_message_get */
@@ -381,23 +928,160 @@ TsStatus_t ts_message_get_message(TsMessageRef_t message, TsPathNode_t field, Ts
 	return _ts_message_get(message, field, TsTypeMessage, value);
 }
 
-/* ts_message_get_size */
-TsStatus_t ts_message_get_size(TsMessageRef_t array, size_t *size)
+/* ts_message_path_parse */
+/* split the given text (e.g., "sensor.location.latitude") in place, into a NULL terminated path */
+TsStatus_t ts_message_path_parse(char *text, TsPathNode_t *path, size_t path_size)
 {
 	/* check preconditions */
-	if (array == NULL || array->type != TsTypeArray) {
+	if (text == NULL || path == NULL || path_size == 0) {
 		return TsStatusErrorPreconditionFailed;
 	}
 
-	/* return last available position */
-	/* TODO - should manage a cached length attribute instead */
-	*size = TS_MESSAGE_MAX_BRANCHES;
-	for (size_t i = 0; i < TS_MESSAGE_MAX_BRANCHES; i++) {
-		if (array->value._xfields[i] == NULL) {
-			*size = i;
+	size_t depth = 0;
+	char *node = text;
+	for (;;) {
+		if (depth + 1 >= path_size) {
+			return TsStatusErrorPayloadTooLarge;
+		}
+		if (*node == '\0' || *node == '.') {
+			return TsStatusErrorBadRequest;
+		}
+		path[depth++] = node;
+		char *separator = strchr(node, '.');
+		if (separator == NULL) {
 			break;
 		}
+		*separator = '\0';
+		node = separator + 1;
+	}
+	path[depth] = NULL;
+	return TsStatusOk;
+}
+
+/* ts_message_path_compile */
+/* resolve the given path once, holding the nodes along it in the given handle */
+TsStatus_t ts_message_path_compile(TsMessageRef_t message, TsPath_t path, TsPathHandleRef_t handle)
+{
+	/* check preconditions */
+	if (message == NULL || path == NULL || path[0] == NULL || handle == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	handle->root = message;
+	handle->path = path;
+	handle->depth = 0;
+	handle->generation = _ts_message_atomic_load(&_ts_message_generation);
+
+	TsMessageRef_t current = message;
+	size_t depth = 0;
+	for (; path[depth] != NULL; depth++) {
+		if (depth >= TS_MESSAGE_MAX_DEPTH) {
+			return TsStatusErrorRecursionTooDeep;
+		}
+		TsStatus_t status = _ts_message_child(current, path[depth], &current);
+		if (status != TsStatusOk) {
+			return status;
+		}
+		handle->nodes[depth] = current;
+	}
+	handle->depth = depth;
+	return TsStatusOk;
+}
+
+/* ts_message_path_resolve */
+/* return the node the compiled path refers to, i.e., without any key lookups, */
+/* unless the structure of a message has changed since (in which case the path is compiled again) */
+TsStatus_t ts_message_path_resolve(TsPathHandleRef_t handle, TsMessageRef_t *value)
+{
+	/* check preconditions */
+	if (handle == NULL || value == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	if (handle->depth == 0 || handle->generation != _ts_message_atomic_load(&_ts_message_generation)) {
+		TsStatus_t status = ts_message_path_compile(handle->root, handle->path, handle);
+		if (status != TsStatusOk) {
+			return status;
+		}
+	}
+	*value = handle->nodes[handle->depth - 1];
+	return TsStatusOk;
+}
+
+/* ts_message_get_path */
+TsStatus_t ts_message_get_path(TsMessageRef_t message, TsPath_t path, TsMessageRef_t *value)
+{
+	TsMessageRef_t parent;
+	TsPathNode_t field;
+	TsStatus_t status = _ts_message_path_parent(message, path, false, &parent, &field);
+	if (status != TsStatusOk) {
+		return status;
+	}
+	return _ts_message_child(parent, field, value);
+}
+
+/* ts_message_get_int_path */
+TsStatus_t ts_message_get_int_path(TsMessageRef_t message, TsPath_t path, int *value)
+{
+	return _ts_message_get_path(message, path, TsTypeInteger, value);
+}
+
+/* ts_message_get_float_path */
+TsStatus_t ts_message_get_float_path(TsMessageRef_t message, TsPath_t path, float *value)
+{
+	return _ts_message_get_path(message, path, TsTypeFloat, value);
+}
+
+/* ts_message_get_string_path */
+TsStatus_t ts_message_get_string_path(TsMessageRef_t message, TsPath_t path, char **value)
+{
+	return _ts_message_get_path(message, path, TsTypeString, value);
+}
+
+/* ts_message_get_bool_path */
+TsStatus_t ts_message_get_bool_path(TsMessageRef_t message, TsPath_t path, bool *value)
+{
+	return _ts_message_get_path(message, path, TsTypeBoolean, value);
+}
+
+/* ts_message_set_null_path */
+TsStatus_t ts_message_set_null_path(TsMessageRef_t message, TsPath_t path)
+{
+	return _ts_message_set_path(message, path, TsTypeNull, NULL);
+}
+
+/* ts_message_set_int_path */
+TsStatus_t ts_message_set_int_path(TsMessageRef_t message, TsPath_t path, int value)
+{
+	return _ts_message_set_path(message, path, TsTypeInteger, &value);
+}
+
+/* ts_message_set_float_path */
+TsStatus_t ts_message_set_float_path(TsMessageRef_t message, TsPath_t path, float value)
+{
+	return _ts_message_set_path(message, path, TsTypeFloat, &value);
+}
+
+/* ts_message_set_string_path */
+TsStatus_t ts_message_set_string_path(TsMessageRef_t message, TsPath_t path, char *value)
+{
+	return _ts_message_set_path(message, path, TsTypeString, value);
+}
+
+/* ts_message_set_bool_path */
+TsStatus_t ts_message_set_bool_path(TsMessageRef_t message, TsPath_t path, bool value)
+{
+	return _ts_message_set_path(message, path, TsTypeBoolean, &value);
+}
+
+/* ts_message_get_size */
+TsStatus_t ts_message_get_size(TsMessageRef_t array, size_t *size)
+{
+	/* check preconditions */
+	if (array == NULL || array->type != TsTypeArray) {
+		return TsStatusErrorPreconditionFailed;
 	}
+
+	/* return last available position */
+	*size = array->size;
 	return TsStatusOk;
 }
 
@@ -408,12 +1092,12 @@ TsStatus_t ts_message_get_at(TsMessageRef_t array, size_t index, TsMessageRef_t
 	if (array == NULL || array->type != TsTypeArray) {
 		return TsStatusErrorPreconditionFailed;
 	}
-	if (index >= TS_MESSAGE_MAX_BRANCHES || array->value._xfields[index] == NULL) {
+	if (index >= array->size) {
 		return TsStatusErrorIndexOutOfRange;
 	}
 
 	/* return indexed value */
-	*item = array->value._xfields[index];
+	*item = *(_ts_message_at(array, index));
 	return TsStatusOk;
 }
 
@@ -436,17 +1120,47 @@ TsStatus_t ts_message_set_at(TsMessageRef_t array, size_t index, TsMessageRef_t
 		return TsStatusErrorBadRequest;
 	}
 
-	/* remove old,... */
-	TsMessageRef_t current = array->value._xfields[index];
+	/* the structure of a frozen array is fixed, only its primitive items may change */
+	TsMessageRef_t *link = _ts_message_at(array, index);
+	TsMessageRef_t current = *link;
+	if ((array->flags & TS_MESSAGE_FLAG_FROZEN) != 0) {
+		if (current == NULL || item == NULL || !_ts_message_is_primitive(current->type)) {
+			return TsStatusErrorPreconditionFailed;
+		}
+		_ts_message_touch(array);
+		return _ts_message_assign_node(current, item);
+	}
+
+	/* primitives are overwritten in place,... */
+	if (current != NULL && item != NULL && _ts_message_is_primitive(current->type)
+		&& _ts_message_is_primitive(item->type)) {
+		_ts_message_touch(array);
+		return _ts_message_assign_node(current, item);
+	}
+
+	/* ...otherwise set new (from the allocator of the array) in place of the old,... */
+	TsStatus_t status = TsStatusOk;
+	TsMessageRef_t update = NULL;
+	if (item != NULL) {
+		status = _ts_message_copy(array->allocator, item, array->depth + 1, &update);
+	}
+	if (update != NULL) {
+		update->next = current != NULL ? current->next : NULL;
+		_ts_message_link(array, update);
+		*link = update;
+		array->size = current != NULL ? array->size : array->size + 1;
+	} else if (current != NULL) {
+		*link = current->next;
+		array->size--;
+	}
+	_ts_message_touch(array);
+	_ts_message_atomic_add(&_ts_message_generation, 1);
+
+	/* ...and only then remove old */
 	if (current != NULL) {
-		array->value._xfields[index] = NULL;
 		ts_message_destroy(current);
 	}
-
-	/* ...and set new and return */
-	ts_message_create_copy(item, &current);
-	array->value._xfields[index] = current;
-	return TsStatusOk;
+	return status;
 }
 
 TsStatus_t ts_message_set_int_at(TsMessageRef_t array, size_t index, int value)
@@ -463,8 +1177,22 @@ TsStatus_t ts_message_set_float_at(TsMessageRef_t array, size_t index, float val
 
 TsStatus_t ts_message_set_string_at(TsMessageRef_t array, size_t index, char *value)
 {
-	TsMessage_t item = {.type = TsTypeString};
-	snprintf(item.value._xstring, TS_MESSAGE_MAX_STRING_SIZE, "%s", value);
+	/* the item only refers to the given string, which is copied once set (the item is never released) */
+	if (value == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	TsMessage_t item = {.type = TsTypeString, .flags = TS_MESSAGE_FLAG_SPILLED, .value._xstring = value,
+						.size = (unsigned int) strlen(value)};
+	return ts_message_set_at(array, index, &item);
+}
+
+TsStatus_t ts_message_set_string_borrowed_at(TsMessageRef_t array, size_t index, const char *value)
+{
+	if (value == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	TsMessage_t item = {.type = TsTypeString, .flags = TS_MESSAGE_FLAG_BORROWED, .value._xstring = (char *) value,
+						.size = (unsigned int) strlen(value)};
 	return ts_message_set_at(array, index, &item);
 }
 
@@ -487,314 +1215,3370 @@ TsStatus_t ts_message_set_message_at(TsMessageRef_t array, size_t index, TsMessa
 /* ts_message_encode */
 /* encode will attempt to fill the given buffer with the encoded data found in the given message. */
 TsStatus_t ts_message_encode(TsMessageRef_t message, TsEncoder_t encoder, uint8_t *buffer, size_t *buffer_size)
+{
+	uint64_t start = _ts_message_now();
+	TsStatus_t status = _ts_message_encode(message, encoder, buffer, buffer_size);
+	_ts_message_count_encode(encoder, status, encoder == TsEncoderDebug ? 0 : *buffer_size, start);
+	return status;
+}
+
+/* ts_message_decode */
+TsStatus_t ts_message_decode(TsMessageRef_t message, TsEncoder_t encoder, uint8_t *buffer, size_t buffer_size)
+{
+	uint64_t start = _ts_message_now();
+	TsStatus_t status = _ts_message_decode(message, encoder, buffer, buffer_size);
+	_ts_message_count_decode(encoder, status, buffer_size, start);
+	return status;
+}
+
+/* ts_message_decode_projected */
+/* decode only the fields of the given projection, skipping the others without creating their nodes */
+TsStatus_t ts_message_decode_projected(TsMessageRef_t message, TsMessageRef_t projection, TsEncoder_t encoder,
+									   uint8_t *buffer, size_t buffer_size)
 {
 	/* check preconditions */
-	if (message == NULL) {
+	if (message == NULL || message->type != TsTypeMessage || buffer == NULL
+		|| (projection != NULL && projection->type != TsTypeMessage)) {
 		return TsStatusErrorPreconditionFailed;
 	}
-
-	/* perform encoding */
-	switch (encoder) {
-	case TsEncoderDebug:
-
-		return _ts_message_encode_debug(message, 0);
-
-	case TsEncoderJson: {
-
-		if (buffer == NULL) {
-			return TsStatusErrorBadRequest;
-		}
-		memset(buffer, 0x00, *buffer_size);
-		TsStatus_t status = _ts_message_encode_json(message, buffer, *buffer_size);
-		*buffer_size = strlen((char *) buffer);
-		return status;
+	if (encoder != TsEncoderJson) {
+		return TsStatusErrorNotImplemented;
 	}
 
-	case TsEncoderCbor: {
+	uint64_t start = _ts_message_now();
+	TsStatus_t status = _ts_message_decode_projected(message, projection, (const char *) buffer, buffer_size);
+	_ts_message_count_decode(encoder, status, buffer_size, start);
+	return status;
+}
 
-		if (buffer == NULL) {
-			return TsStatusErrorBadRequest;
-		}
-		CborEncoder cbor;
-		cbor_encoder_init(&cbor, buffer, *buffer_size, 0);
-		TsStatus_t status = _ts_message_encode_cbor(message, &cbor, buffer, *buffer_size);
-		*buffer_size = cbor_encoder_get_buffer_size(&cbor, buffer);
-		return status;
+/* ts_message_transcode */
+/* convert the given encoding into the other (json to cbor, or cbor to json) as it is read */
+TsStatus_t ts_message_transcode(TsEncoder_t encoder, uint8_t *buffer, size_t buffer_size, TsEncoder_t target,
+								uint8_t *output, size_t *output_size)
+{
+	/* check preconditions */
+	if (buffer == NULL || output == NULL || output_size == NULL || *output_size == 0) {
+		return TsStatusErrorPreconditionFailed;
 	}
 
-	default:
-		/* do nothing */
-		break;
+	uint64_t start = _ts_message_now();
+	TsStatus_t status;
+	if (encoder == TsEncoderJson && target == TsEncoderCbor) {
+		status = _ts_message_transcode_json((const char *) buffer, buffer_size, output, output_size);
+	} else if (encoder == TsEncoderCbor && target == TsEncoderJson) {
+		status = _ts_message_transcode_cbor(buffer, buffer_size, (char *) output, output_size);
+	} else {
+		return TsStatusErrorNotImplemented;
 	}
-	return TsStatusErrorNotImplemented;
+	_ts_message_count_decode(encoder, status, buffer_size, start);
+	_ts_message_count_encode(target, status, *output_size, start);
+	return status;
 }
 
-/* ts_message_set */
-TsStatus_t ts_message_decode(TsMessageRef_t message, TsEncoder_t encoder, uint8_t *buffer, size_t buffer_size)
+/* ts_message_merge_patch */
+/* apply the given rfc 7386 merge patch in place, i.e., null fields are removed, message fields are merged, */
+/* and any other field is set (a copy of the patch) */
+TsStatus_t ts_message_merge_patch(TsMessageRef_t message, TsMessageRef_t patch)
 {
 	/* check preconditions */
-	if (message == NULL) {
+	if (message == NULL || patch == NULL || message->type != TsTypeMessage || patch->type != TsTypeMessage) {
 		return TsStatusErrorPreconditionFailed;
 	}
+	return _ts_message_merge(message, patch);
+}
 
-	/* perform encoding */
-	switch (encoder) {
+/* ts_message_merge_patch_json */
+/* apply the given (json encoded) merge patch while reading it, i.e., without decoding it first */
+TsStatus_t ts_message_merge_patch_json(TsMessageRef_t message, uint8_t *buffer, size_t buffer_size)
+{
+	/* check preconditions */
+	if (message == NULL || buffer == NULL || message->type != TsTypeMessage) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	return _ts_message_merge_json(message, (const char *) buffer, buffer_size);
+}
 
-	case TsEncoderJson: {
+/* ts_message_patch */
+/* apply the operations of the given rfc 6902 patch (an array of messages) in order */
+TsStatus_t ts_message_patch(TsMessageRef_t message, TsMessageRef_t patch)
+{
+	/* check preconditions */
+	if (message == NULL || patch == NULL || message->type != TsTypeMessage || patch->type != TsTypeArray) {
+		return TsStatusErrorPreconditionFailed;
+	}
 
-		if (buffer == NULL) {
+	for (TsMessageRef_t operation = patch->value._xbranches; operation != NULL; operation = operation->next) {
+		char *op, *path, *from = NULL;
+		TsMessageRef_t value = NULL;
+		if (operation->type != TsTypeMessage || ts_message_get_string(operation, "op", &op) != TsStatusOk
+			|| ts_message_get_string(operation, "path", &path) != TsStatusOk) {
 			return TsStatusErrorBadRequest;
 		}
-
-		cJSON *cjson = cJSON_Parse((const char *) buffer);
-		if (cjson->type == cJSON_Object) {
-			cjson = cjson->child;
+		ts_message_get_string(operation, "from", &from);
+		ts_message_has(operation, "value", &value);
+		TsStatus_t status = _ts_message_patch_apply(message, op, path, from, value);
+		if (status != TsStatusOk) {
+			return status;
 		}
-		TsStatus_t status = ts_message_decode_json(message, cjson);
-		cJSON_Delete(cjson);
-
-		return status;
 	}
+	return TsStatusOk;
+}
 
-	case TsEncoderCbor:
-		/* not implemented */
-		/* fallthrough */
+/* ts_message_patch_json */
+/* apply the operations of the given (json encoded) patch while reading it, the value of each operation is */
+/* decoded just before it is applied */
+TsStatus_t ts_message_patch_json(TsMessageRef_t message, uint8_t *buffer, size_t buffer_size)
+{
+	/* check preconditions */
+	if (message == NULL || buffer == NULL || message->type != TsTypeMessage) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	return _ts_message_patch_json(message, (const char *) buffer, buffer_size);
+}
 
-	case TsEncoderDebug:
-	default:
-		/* do nothing */
-		break;
+/* ts_message_footprint */
+TsStatus_t ts_message_footprint(TsMessageRef_t message, TsMessageFootprint_t *footprint)
+{
+	/* check preconditions */
+	if (message == NULL || footprint == NULL) {
+		return TsStatusErrorPreconditionFailed;
 	}
-	return TsStatusErrorNotImplemented;
+	memset(footprint, 0x00, sizeof(TsMessageFootprint_t));
+	_ts_message_footprint(message, NULL, 1, footprint);
+	return TsStatusOk;
 }
 
-/* ts_message_decode_json */
-TsStatus_t ts_message_decode_json(TsMessageRef_t message, cJSON *value)
+/* ts_message_snapshot_size */
+TsStatus_t ts_message_snapshot_size(TsMessageRef_t message, size_t *size)
 {
-	/* decode each node in the current value */
-	TsStatus_t status = TsStatusOk;
-	while (value != NULL) {
+	/* check preconditions */
+	if (message == NULL || size == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
 
-		/* decode current node */
-		switch (value->type) {
+	size_t nodes, strings;
+	TsStatus_t status = _ts_message_snapshot_measure(message, &nodes, &strings);
+	if (status == TsStatusOk) {
+		*size = sizeof(TsMessageSnapshot_t) + nodes * sizeof(TsMessage_t) + strings;
+	}
+	return status;
+}
 
-		case cJSON_NULL:
-			status = ts_message_set_null(message, value->string);
-			break;
+/* ts_message_snapshot_save */
+/* write the image of the given message, i.e., its nodes depth first with their links as offsets */
+TsStatus_t ts_message_snapshot_save(TsMessageRef_t message, uint8_t *buffer, size_t *buffer_size)
+{
+	/* check preconditions */
+	if (message == NULL || buffer == NULL || buffer_size == NULL
+		|| ((uintptr_t) buffer) % TS_MESSAGE_CACHE_LINE != 0) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	size_t nodes, strings;
+	TsStatus_t status = _ts_message_snapshot_measure(message, &nodes, &strings);
+	if (status != TsStatusOk) {
+		return status;
+	}
+	size_t size = sizeof(TsMessageSnapshot_t) + nodes * sizeof(TsMessage_t) + strings;
+	if (size > *buffer_size || nodes > UINT32_MAX || strings > UINT32_MAX) {
+		dbg_printf("ts_message_snapshot_save: snapshot too large (%lu)\n", (unsigned long) size);
+		return TsStatusErrorPayloadTooLarge;
+	}
 
-		case cJSON_Number:
-			if (value->valuedouble == (double) (value->valueint)) {
-				status = ts_message_set_int(message, value->string, value->valueint);
+	TsMessageSnapshot_t *header = (TsMessageSnapshot_t *) buffer;
+	memset(header, 0x00, sizeof(TsMessageSnapshot_t));
+	header->magic = TS_MESSAGE_SNAPSHOT_MAGIC;
+	header->version = TS_MESSAGE_SNAPSHOT_VERSION;
+	header->node_size = (uint16_t) sizeof(TsMessage_t);
+	header->nodes = (uint32_t) nodes;
+	header->strings = (uint32_t) strings;
+	header->size = size;
+
+	/* the root, then its branches depth first (appending long strings to the string table) */
+	TsMessageRef_t image = (TsMessageRef_t) (header + 1);
+	size_t used = (size_t) ((uint8_t *) (image + nodes) - buffer);
+	_ts_message_snapshot_node(buffer, message, message->depth, &(image[0]), &used);
+	size_t count = 1;
+	if (!_ts_message_is_primitive(message->type)) {
+		TsMessageFrame_t stack[TS_MESSAGE_MAX_DEPTH];
+		_ts_message_push_frame(&(stack[0]), message);
+		stack[0].copy = &(image[0]);
+		size_t top = 1;
+		while (top > 0) {
+			TsMessageFrame_t *frame = &(stack[top - 1]);
+			TsMessageRef_t branch = frame->branch;
+			if (branch == NULL) {
+				top--;
+				continue;
+			}
+			frame->branch = branch->next;
+
+			/* link the next node from its container (or its previous sibling) */
+			TsMessageRef_t node = &(image[count++]);
+			_ts_message_snapshot_node(buffer, branch, message->depth, node, &used);
+			TsMessageRef_t offset = (TsMessageRef_t) (uintptr_t) ((uint8_t *) node - buffer);
+			if (frame->last == NULL) {
+				frame->copy->value._xbranches = offset;
 			} else {
-				status = ts_message_set_float(message, value->string, (float) (value->valuedouble));
+				frame->last->next = offset;
 			}
-			break;
-
-		case cJSON_String:
-			status = ts_message_set_string(message, value->string, value->valuestring);
-			break;
-
-		case cJSON_True:
-			status = ts_message_set_bool(message, value->string, true);
-			break;
-
-		case cJSON_False:
-			status = ts_message_set_bool(message, value->string, false);
-			break;
-
-		case cJSON_Object: {
-
-			TsMessageRef_t content;
-			status = ts_message_create_message(message, value->string, &content);
-			if (status == TsStatusOk) {
-				status = ts_message_decode_json(content, value->child);
+			frame->last = node;
+			if (!_ts_message_is_primitive(branch->type)) {
+				_ts_message_push_frame(&(stack[top]), branch);
+				stack[top].copy = node;
+				top++;
 			}
-			break;
-		}
-		case cJSON_Array:
-			/* TODO */
-			/* fallthrough */
-
-		case cJSON_Invalid:
-		case cJSON_Raw:
-		default:
-			return TsStatusErrorNotImplemented;
 		}
-
-		/* get next sibling */
-		value = value->next;
 	}
-	return status;
+	*buffer_size = size;
+	return TsStatusOk;
 }
 
-/* ts_message_decode_cbor */
-TsStatus_t ts_message_decode_cbor(TsMessageRef_t message, CborValue *value)
+/* ts_message_snapshot_load */
+/* load the given image in place, i.e., turn its offsets into links (checking each of them first) */
+TsStatus_t ts_message_snapshot_load(uint8_t *buffer, size_t buffer_size, TsMessageRef_t *message)
 {
-	/* TODO */
-	return TsStatusErrorNotImplemented;
-}
-
-/* //////////////////////////////////////////////////////////////////////////// */
-/* P R I V A T E */
-
-#ifdef TS_MESSAGE_STATIC_MEMORY
-/* (private) _ts_message_initialize */
-static TsStatus_t _ts_message_initialize()
+	/* check preconditions */
+	if (buffer == NULL || message == NULL || ((uintptr_t) buffer) % TS_MESSAGE_CACHE_LINE != 0) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	TsMessageSnapshot_t *header = _ts_message_snapshot_header(buffer, buffer_size);
+	if (header == NULL) {
+		dbg_printf("ts_message_snapshot_load: not a snapshot (of this build)\n");
+		return TsStatusErrorBadRequest;
+	}
+	header->allocator.allocate = _ts_message_snapshot_allocate;
+	header->allocator.release = _ts_message_snapshot_release;
+	header->allocator.context = header;
+
+	/* every link points ahead, so a node is reached (and its parent set) before it is fixed up */
+	/* (the sizes of messages and arrays are counted again, rather than trusted) */
+	TsMessageRef_t image = (TsMessageRef_t) (header + 1);
+	for (size_t i = 0; i < header->nodes; i++) {
+		image[i].parent = NULL;
+	}
+	for (size_t i = 0; i < header->nodes; i++) {
+		TsMessageRef_t node = &(image[i]);
+		size_t offset = (size_t) ((uint8_t *) node - buffer);
+		uintptr_t next = (uintptr_t) node->next;
+		if ((unsigned int) node->type > TsTypeNull || !_ts_message_snapshot_link(header, offset, next)
+			|| (i == 0 && next != 0) || (i > 0 && node->parent == NULL)) {
+			return TsStatusErrorBadRequest;
+		}
+		node->depth = node->parent != NULL ? node->parent->depth + 1 : 0;
+		if (_ts_message_is_too_deep(node->type, node->depth)) {
+			return TsStatusErrorRecursionTooDeep;
+		}
+		node->next = next != 0 ? (TsMessageRef_t) (buffer + next) : NULL;
+		if (node->next != NULL) {
+			node->next->parent = node->parent;
+			node->parent->size++;
+		}
+
+		if (!_ts_message_is_primitive(node->type)) {
+			uintptr_t branches = (uintptr_t) node->value._xbranches;
+			if (!_ts_message_snapshot_link(header, offset, branches)) {
+				return TsStatusErrorBadRequest;
+			}
+			node->value._xbranches = branches != 0 ? (TsMessageRef_t) (buffer + branches) : NULL;
+			node->size = 0;
+			if (node->value._xbranches != NULL) {
+				node->value._xbranches->parent = node;
+				node->size++;
+			}
+			node->encoding = NULL;
+		} else if (node->type == TsTypeString && (node->flags & TS_MESSAGE_FLAG_SPILLED) != 0) {
+			uintptr_t string = (uintptr_t) node->value._xstring;
+			if (!_ts_message_snapshot_string(header, string, node->size)) {
+				return TsStatusErrorBadRequest;
+			}
+			node->value._xstring = (char *) (buffer + string);
+		} else if (node->type == TsTypeString && (node->size >= TS_MESSAGE_INLINE_STRING_SIZE
+												  || node->string[node->size] != '\0')) {
+			return TsStatusErrorBadRequest;
+		} else if (node->type == TsTypeBoolean) {
+			node->value._xboolean = *((uint8_t *) &(node->value._xboolean)) != 0;
+		}
+		node->name[TS_MESSAGE_MAX_KEY_SIZE - 1] = '\0';
+		node->flags &= TS_MESSAGE_FLAG_FROZEN | TS_MESSAGE_FLAG_HASHED
+					   | (node->type == TsTypeString ? TS_MESSAGE_FLAG_SPILLED : 0);
+		node->references = 1;
+		node->cache = _ts_message_cache.id;
+		node->allocator = &(header->allocator);
+	}
+	_ts_message_count(_ts_message_thread_cache()->counters->creates, header->nodes);
+	*message = &(image[0]);
+	return TsStatusOk;
+}
+
+/* ts_message_snapshot_get_path */
+/* read the value at the given path of an image, in place (e.g., read-only in flash) */
+/* (the value of a string is the string itself, that of a message or array is NULL) */
+TsStatus_t ts_message_snapshot_get_path(const uint8_t *buffer, size_t buffer_size, TsPath_t path, TsType_t *type,
+										const void **value)
+{
+	/* check preconditions */
+	if (buffer == NULL || path == NULL || type == NULL || value == NULL
+		|| ((uintptr_t) buffer) % TS_MESSAGE_CACHE_LINE != 0) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	const TsMessageSnapshot_t *header = _ts_message_snapshot_header(buffer, buffer_size);
+	if (header == NULL) {
+		return TsStatusErrorBadRequest;
+	}
+
+	/* follow the path by offsets */
+	const TsMessage_t *node = (const TsMessage_t *) (header + 1);
+	for (; *path != NULL; path++) {
+		if (_ts_message_is_primitive(node->type)) {
+			return TsStatusErrorNotFound;
+		}
+		uint32_t hash = _ts_message_hash(*path);
+		size_t after = (size_t) ((const uint8_t *) node - buffer);
+		uintptr_t offset = (uintptr_t) node->value._xbranches;
+		node = NULL;
+		while (offset != 0) {
+			if (!_ts_message_snapshot_link(header, after, offset)) {
+				return TsStatusErrorBadRequest;
+			}
+			const TsMessage_t *branch = (const TsMessage_t *) (buffer + offset);
+			if (branch->hash == hash && strncmp(branch->name, *path, TS_MESSAGE_MAX_KEY_SIZE) == 0) {
+				node = branch;
+				break;
+			}
+			after = offset;
+			offset = (uintptr_t) branch->next;
+		}
+		if (node == NULL) {
+			return TsStatusErrorNotFound;
+		}
+	}
+
+	*type = node->type;
+	switch (node->type) {
+	case TsTypeInteger:
+	case TsTypeFloat:
+	case TsTypeBoolean:
+		*value = &(node->value);
+		break;
+
+	case TsTypeString:
+		if ((node->flags & TS_MESSAGE_FLAG_SPILLED) == 0) {
+			if (node->size >= TS_MESSAGE_INLINE_STRING_SIZE || node->string[node->size] != '\0') {
+				return TsStatusErrorBadRequest;
+			}
+			*value = node->string;
+			break;
+		}
+		if (!_ts_message_snapshot_string(header, (uintptr_t) node->value._xstring, node->size)) {
+			return TsStatusErrorBadRequest;
+		}
+		*value = buffer + (uintptr_t) node->value._xstring;
+		break;
+
+	default:
+		*value = NULL;
+		break;
+	}
+	return TsStatusOk;
+}
+
+/* ts_message_encode_parallel */
+TsStatus_t ts_message_encode_parallel(TsMessageRef_t message, TsEncoder_t encoder, TsPoolRef_t pool, uint8_t *buffer,
+									  size_t *buffer_size)
+{
+	/* check preconditions */
+	if (message == NULL || buffer == NULL || buffer_size == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+
+	/* only the branches of a container are split, otherwise encode serially */
+	bool json = encoder == TsEncoderJson && (message->type == TsTypeMessage || message->type == TsTypeArray);
+	bool cbor = encoder == TsEncoderCbor && message->type == TsTypeMessage;
+	if (pool == NULL || (!json && !cbor)) {
+		return ts_message_encode(message, encoder, buffer, buffer_size);
+	}
+
+	/* encode each branch into its part of a shared arena, i.e., a single allocation for all branches */
+	/* (the output size bounds the branches together) */
+	uint64_t start = _ts_message_now();
+	TsMessageArena_t arena;
+	arena.bytes = (uint8_t *) (malloc(*buffer_size));
+	arena.size = *buffer_size;
+	arena.used = 0;
+	if (arena.bytes == NULL) {
+		return TsStatusErrorOutOfMemory;
+	}
+	TsMessageTask_t tasks[TS_MESSAGE_MAX_BRANCHES];
+	size_t count = 0;
+	TsStatus_t status = TsStatusOk;
+	for (TsMessageRef_t branch = message->value._xbranches; branch != NULL && count < TS_MESSAGE_MAX_BRANCHES;
+		 branch = branch->next, count++) {
+		TsMessageTask_t *task = &tasks[count];
+		task->message = branch;
+		task->parent = message;
+		task->arena = &arena;
+		task->encoder = encoder;
+		task->buffer_size = *buffer_size;
+		task->buffer = NULL;
+		task->status = TsStatusErrorOutOfMemory;
+		ts_pool_submit(pool, _ts_message_encode_task, task);
+	}
+	ts_pool_wait(pool);
+
+	/* stitch the branches in order */
+	size_t size = 0;
+	if (cbor) {
+
+		/* tag if not root, then the map header (its length always fits the initial byte) */
+		if (strcmp(message->name, "$root") != 0) {
+			CborEncoder name;
+			cbor_encoder_init(&name, buffer, *buffer_size, 0);
+			cbor_encode_text_stringz(&name, message->name);
+			size = cbor_encoder_get_buffer_size(&name, buffer);
+		}
+		if (size < *buffer_size) {
+			buffer[size++] = (uint8_t) (0xa0 | count);
+		}
+	} else {
+		buffer[size++] = message->type == TsTypeArray ? '[' : '{';
+	}
+	for (size_t i = 0; i < count; i++) {
+		if (status == TsStatusOk) {
+			status = tasks[i].status;
+		}
+		if (status == TsStatusOk) {
+			size_t separator = (json && i > 0) ? 1 : 0;
+			if (size + separator + tasks[i].buffer_size >= *buffer_size) {
+				status = TsStatusErrorOutOfMemory;
+			} else {
+				if (separator > 0) {
+					buffer[size++] = ',';
+				}
+				memcpy(buffer + size, tasks[i].buffer, tasks[i].buffer_size);
+				size = size + tasks[i].buffer_size;
+			}
+		}
+	}
+	free(arena.bytes);
+	if (json) {
+		if (status == TsStatusOk && size + 1 >= *buffer_size - 1) {
+			status = TsStatusErrorOutOfMemory;
+		}
+		if (status == TsStatusOk) {
+			buffer[size++] = message->type == TsTypeArray ? ']' : '}';
+			buffer[size] = '\0';
+		}
+	} else if (status == TsStatusOk && size >= *buffer_size) {
+		status = TsStatusErrorOutOfMemory;
+	}
+	*buffer_size = size;
+	_ts_message_count_encode(encoder, status, size, start);
+	return status;
+}
+
+/* ts_message_encode_batch */
+/* encode each of the given messages into the buffer of the same index (sizes are updated in place) */
+TsStatus_t ts_message_encode_batch(TsMessageRef_t *messages, size_t count, TsEncoder_t encoder, TsPoolRef_t pool,
+								   uint8_t **buffers, size_t *buffer_sizes)
+{
+	/* check preconditions */
+	if (messages == NULL || buffers == NULL || buffer_sizes == NULL || pool == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+
+	TsMessageTask_t *tasks = (TsMessageTask_t *) (malloc(count * sizeof(TsMessageTask_t)));
+	if (tasks == NULL && count > 0) {
+		return TsStatusErrorOutOfMemory;
+	}
+	for (size_t i = 0; i < count; i++) {
+		tasks[i].message = messages[i];
+		tasks[i].parent = NULL;
+		tasks[i].arena = NULL;
+		tasks[i].encoder = encoder;
+		tasks[i].buffer = buffers[i];
+		tasks[i].buffer_size = buffer_sizes[i];
+		ts_pool_submit(pool, _ts_message_encode_task, &tasks[i]);
+	}
+	ts_pool_wait(pool);
+
+	/* report the first failure, if any */
+	TsStatus_t status = TsStatusOk;
+	for (size_t i = 0; i < count; i++) {
+		buffer_sizes[i] = tasks[i].buffer_size;
+		if (status == TsStatusOk) {
+			status = tasks[i].status;
+		}
+	}
+	free(tasks);
+	return status;
+}
+
+
+/* ts_message_decode_json */
+TsStatus_t ts_message_decode_json(TsMessageRef_t message, cJSON *value)
+{
+	/* objects are decoded depth first, holding the message and next sibling of each level on a stack */
+	TsMessageRef_t messages[TS_MESSAGE_MAX_DEPTH];
+	cJSON *siblings[TS_MESSAGE_MAX_DEPTH];
+	size_t top = 0;
+	TsStatus_t status = TsStatusOk;
+	for (;;) {
+
+		/* return to the parent level when all siblings are decoded */
+		if (value == NULL) {
+			if (top == 0) {
+				break;
+			}
+			top--;
+			message = messages[top];
+			value = siblings[top];
+			continue;
+		}
+
+		/* decode current node */
+		switch (value->type) {
+
+		case cJSON_NULL:
+			status = ts_message_set_null(message, value->string);
+			break;
+
+		case cJSON_Number:
+			if (value->valuedouble == (double) (value->valueint)) {
+				status = ts_message_set_int(message, value->string, value->valueint);
+			} else {
+				status = ts_message_set_float(message, value->string, (float) (value->valuedouble));
+			}
+			break;
+
+		case cJSON_String:
+			status = ts_message_set_string(message, value->string, value->valuestring);
+			break;
+
+		case cJSON_True:
+			status = ts_message_set_bool(message, value->string, true);
+			break;
+
+		case cJSON_False:
+			status = ts_message_set_bool(message, value->string, false);
+			break;
+
+		case cJSON_Object: {
+
+			/* descend into the content (the depth of which is checked on create) */
+			TsMessageRef_t content;
+			status = ts_message_create_message(message, value->string, &content);
+			if (status == TsStatusOk && top == TS_MESSAGE_MAX_DEPTH) {
+				status = TsStatusErrorRecursionTooDeep;
+			}
+			if (status != TsStatusOk) {
+				return status;
+			}
+			messages[top] = message;
+			siblings[top] = value->next;
+			top++;
+			message = content;
+			value = value->child;
+			continue;
+		}
+		case cJSON_Array:
+			/* TODO */
+			/* fallthrough */
+
+		case cJSON_Invalid:
+		case cJSON_Raw:
+		default:
+			return TsStatusErrorNotImplemented;
+		}
+		if (status != TsStatusOk) {
+			return status;
+		}
+
+		/* get next sibling */
+		value = value->next;
+	}
+	return status;
+}
+
+/* ts_message_decode_cbor */
+TsStatus_t ts_message_decode_cbor(TsMessageRef_t message, CborValue *value)
+{
+	/* TODO */
+	return TsStatusErrorNotImplemented;
+}
+
+/* //////////////////////////////////////////////////////////////////////////// */
+/* P R I V A T E */
+
+#ifdef TS_MESSAGE_STATIC_MEMORY
+/* (private) _ts_message_pop */
+static TsMessageRef_t _ts_message_pop()
+{
+	uint64_t head = _ts_message_atomic_load(&_ts_message_free_list);
+	for (;;) {
+
+		/* take a destroyed node from the free list,... */
+		int top = (int) (head & 0xffffffff);
+		if (top != 0) {
+			int next = __atomic_load_n(&(_ts_message_free_next[top - 1]), __ATOMIC_RELAXED);
+			uint64_t update = (((head >> 32) + 1) << 32) | (uint32_t) next;
+			if (_ts_message_atomic_cas(&_ts_message_free_list, &head, update)) {
+				return &_ts_message_nodes[top - 1];
+			}
+			continue;
+		}
+
+		/* ...or, when empty, a node never used so far */
+		int unused = _ts_message_atomic_load(&_ts_message_unused);
+		while (unused < TS_MESSAGE_MAX_NODES) {
+			if (_ts_message_atomic_cas(&_ts_message_unused, &unused, unused + 1)) {
+				return &_ts_message_nodes[unused];
+			}
+		}
+
+		/* a node may have been destroyed meanwhile */
+		uint64_t current = _ts_message_atomic_load(&_ts_message_free_list);
+		if ((current & 0xffffffff) == 0) {
+			return NULL;
+		}
+		head = current;
+	}
+}
+
+/* _ts_message_push */
+static void _ts_message_push(TsMessageRef_t message)
+{
+	int index = (int) (message - _ts_message_nodes);
+	uint64_t head = _ts_message_atomic_load(&_ts_message_free_list);
+	uint64_t update;
+	do {
+		__atomic_store_n(&(_ts_message_free_next[index]), (int) (head & 0xffffffff), __ATOMIC_RELAXED);
+		update = (((head >> 32) + 1) << 32) | (uint32_t) (index + 1);
+	} while (!_ts_message_atomic_cas(&_ts_message_free_list, &head, update));
+}
+#else
+/* (private) _ts_message_lock */
+static void _ts_message_lock()
+{
+	while (__atomic_test_and_set(&_ts_message_pool_lock, __ATOMIC_ACQUIRE)) {
+	}
+}
+
+/* (private) _ts_message_unlock */
+static void _ts_message_unlock()
+{
+	__atomic_clear(&_ts_message_pool_lock, __ATOMIC_RELEASE);
+}
+#endif
+
+/* (private) _ts_message_encode */
+/* encode will attempt to fill the given buffer with the encoded data found in the given message. */
+static TsStatus_t _ts_message_encode(TsMessageRef_t message, TsEncoder_t encoder, uint8_t *buffer, size_t *buffer_size)
+{
+	/* check preconditions */
+	if (message == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+
+	/* perform encoding */
+	switch (encoder) {
+	case TsEncoderDebug:
+
+		return _ts_message_encode_debug(message);
+
+	case TsEncoderJson: {
+
+		if (buffer == NULL) {
+			return TsStatusErrorBadRequest;
+		}
+		memset(buffer, 0x00, *buffer_size);
+		TsStatus_t status = _ts_message_encode_json(message, buffer, *buffer_size);
+		*buffer_size = strlen((char *) buffer);
+		return status;
+	}
+
+	case TsEncoderCbor: {
+
+		if (buffer == NULL) {
+			return TsStatusErrorBadRequest;
+		}
+		CborEncoder cbor;
+		cbor_encoder_init(&cbor, buffer, *buffer_size, 0);
+		TsStatus_t status = _ts_message_encode_cbor(message, &cbor, buffer, *buffer_size);
+		*buffer_size = cbor_encoder_get_buffer_size(&cbor, buffer);
+		return status;
+	}
+
+	default:
+		/* do nothing */
+		break;
+	}
+	return TsStatusErrorNotImplemented;
+}
+
+/* (private) _ts_message_decode */
+static TsStatus_t _ts_message_decode(TsMessageRef_t message, TsEncoder_t encoder, uint8_t *buffer, size_t buffer_size)
+{
+	/* check preconditions */
+	if (message == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+
+	/* perform encoding */
+	switch (encoder) {
+
+	case TsEncoderJson: {
+
+		if (buffer == NULL) {
+			return TsStatusErrorBadRequest;
+		}
+
+		/* the parser recurses on the nesting of the text, so check it first */
+		if (_ts_message_json_depth((const char *) buffer, buffer_size) > TS_MESSAGE_MAX_DEPTH) {
+			dbg_printf("ts_message_decode: message too deep\n");
+			return TsStatusErrorRecursionTooDeep;
+		}
+
+		/* note, the parsed root is held for cleanup, i.e., not just the fields decoded */
+		cJSON *root = cJSON_Parse((const char *) buffer);
+		if (root == NULL) {
+			return TsStatusErrorBadRequest;
+		}
+		cJSON *cjson = root;
+		if (cjson->type == cJSON_Object) {
+			cjson = cjson->child;
+		}
+		TsStatus_t status = ts_message_decode_json(message, cjson);
+		cJSON_Delete(root);
+
+		return status;
+	}
+
+	case TsEncoderCbor:
+		/* not implemented */
+		/* fallthrough */
+
+	case TsEncoderDebug:
+	default:
+		/* do nothing */
+		break;
+	}
+	return TsStatusErrorNotImplemented;
+}
+
+/* (private) _ts_message_decode_projected */
+static TsStatus_t _ts_message_decode_projected(TsMessageRef_t message, TsMessageRef_t projection, const char *text,
+											   size_t size)
+{
+	TsJsonReader_t reader;
+	TsJsonToken_t token;
+	ts_json_reader_init(&reader, text, size);
+	TsStatus_t status = ts_json_next(&reader, &token);
+	if (status == TsStatusOk && token.type != TsJsonTokenObjectBegin) {
+		status = TsStatusErrorBadRequest;
+	}
+	if (status == TsStatusOk) {
+		status = _ts_message_decode_content(&reader, message, projection);
+	}
+
+	/* nothing follows the document */
+	if (status == TsStatusOk) {
+		status = ts_json_next(&reader, &token);
+	}
+	if (status == TsStatusOk && token.type != TsJsonTokenEnd) {
+		status = TsStatusErrorBadRequest;
+	}
+	return status;
+}
+
+/* (private) _ts_message_decode_content */
+/* decode the content of the given message or array (just opened by the reader) token by token, up to its close. */
+/* the projection of each level (if any) is held on a stack along with the message or array decoded into, */
+/* fields outside of it are skipped by the reader */
+static TsStatus_t _ts_message_decode_content(TsJsonReaderRef_t reader, TsMessageRef_t message,
+											 TsMessageRef_t projection)
+{
+	TsJsonToken_t token;
+	TsMessageRef_t messages[TS_MESSAGE_MAX_DEPTH];
+	TsMessageRef_t projections[TS_MESSAGE_MAX_DEPTH];
+	messages[0] = message;
+	projections[0] = projection;
+	size_t top = 1;
+	while (top > 0) {
+		TsStatus_t status = ts_json_next(reader, &token);
+		if (status != TsStatusOk) {
+			return status;
+		}
+		if (token.type == TsJsonTokenObjectEnd || token.type == TsJsonTokenArrayEnd) {
+			top--;
+			continue;
+		}
+
+		/* the field, unless outside of the projection (array items share the projection of their array) */
+		char name[TS_MESSAGE_MAX_KEY_SIZE];
+		const char *key = NULL;
+		TsMessageRef_t filter = projections[top - 1];
+		if (messages[top - 1]->type == TsTypeMessage) {
+			bool whole = ts_json_string(&token, name, sizeof(name)) == TsStatusOk;
+			if (filter != NULL && (!whole || ts_message_has(filter, name, &filter) != TsStatusOk)) {
+				status = ts_json_skip(reader, &token);
+				if (status != TsStatusOk) {
+					return status;
+				}
+				continue;
+			}
+
+			/* a field projected by a message keeps just its fields, any other keeps it whole */
+			if (filter != NULL && filter->type != TsTypeMessage) {
+				filter = NULL;
+			}
+			key = name;
+			status = ts_json_next(reader, &token);
+			if (status != TsStatusOk) {
+				return status;
+			}
+		}
+
+		/* decode the value, and descend into the content of an object or array */
+		TsMessageRef_t content = NULL;
+		status = _ts_message_decode_value(messages[top - 1], key, &token, &content);
+		if (status == TsStatusOk && content != NULL && top == TS_MESSAGE_MAX_DEPTH) {
+			status = TsStatusErrorRecursionTooDeep;
+		}
+		if (status != TsStatusOk) {
+			return status;
+		}
+		if (content != NULL) {
+			messages[top] = content;
+			projections[top] = filter;
+			top++;
+		}
+	}
+	return TsStatusOk;
+}
+
+/* (private) _ts_message_decode_value */
+/* set the given field (or append the array item) to the value of the given token, returning the content of */
+/* an object or array. strings are stored as found in the document, and unescaped in place (when needed) */
+static TsStatus_t _ts_message_decode_value(TsMessageRef_t parent, const char *key, TsJsonToken_t *token,
+										   TsMessageRef_t *content)
+{
+	TsMessage_t item = {.type = TsTypeNull};
+	switch (token->type) {
+
+	case TsJsonTokenObjectBegin:
+		if (key != NULL) {
+			return ts_message_create_message(parent, (TsPathNode_t) key, content);
+		}
+		item.type = TsTypeMessage;
+		break;
+
+	case TsJsonTokenArrayBegin:
+		if (key != NULL) {
+			return ts_message_create_array(parent, (TsPathNode_t) key, content);
+		}
+		item.type = TsTypeArray;
+		break;
+
+	case TsJsonTokenNumber: {
+		double number;
+		TsStatus_t status = ts_json_number(token, &number);
+		if (status != TsStatusOk) {
+			return status;
+		}
+		if (number >= INT32_MIN && number <= INT32_MAX && number == (double) (int) number) {
+			item.type = TsTypeInteger;
+			item.value._xinteger = (int) number;
+		} else {
+			item.type = TsTypeFloat;
+			item.value._xfloat = (float) number;
+		}
+		break;
+	}
+	case TsJsonTokenTrue:
+	case TsJsonTokenFalse:
+		item.type = TsTypeBoolean;
+		item.value._xboolean = token->type == TsJsonTokenTrue;
+		break;
+
+	case TsJsonTokenString:
+		item.type = TsTypeString;
+		item.string[0] = '\0';
+		break;
+
+	case TsJsonTokenNull:
+		break;
+
+	default:
+		return TsStatusErrorBadRequest;
+	}
+
+	/* set the field, or append the item */
+	TsStatus_t status;
+	size_t index = parent->size;
+	if (key != NULL) {
+		status = _ts_message_set(parent, (TsPathNode_t) key, item.type, _ts_message_value(&item));
+	} else {
+		status = ts_message_set_at(parent, index, &item);
+	}
+	if (status != TsStatusOk || (item.type != TsTypeString && _ts_message_is_primitive(item.type))) {
+		return status;
+	}
+	TsMessageRef_t node = key != NULL ? *(_ts_message_find(parent, key)) : *(_ts_message_at(parent, index));
+	if (item.type != TsTypeString) {
+		*content = node;
+		return TsStatusOk;
+	}
+
+	/* the string (an unescaped string is never longer than its escaped text) */
+	status = _ts_message_store(node, token->text, token->size);
+	if (status != TsStatusOk || memchr(token->text, '\\', token->size) == NULL) {
+		return status;
+	}
+	char *storage = _ts_message_string(node);
+	TsJsonToken_t escaped = {.type = TsJsonTokenString, .text = storage, .size = node->size};
+	status = ts_json_string(&escaped, storage, node->size + 1);
+	if (status != TsStatusOk) {
+		return status;
+	}
+	return _ts_message_store(node, storage, strlen(storage));
+}
+
+/* (private) _ts_message_unlink */
+/* remove the given branch of the given message or array */
+static TsStatus_t _ts_message_unlink(TsMessageRef_t message, TsMessageRef_t *link)
+{
+	if ((message->flags & TS_MESSAGE_FLAG_FROZEN) != 0) {
+		dbg_printf("failed to remove (%s), the message is frozen\n", (*link)->name);
+		return TsStatusErrorPreconditionFailed;
+	}
+	TsMessageRef_t branch = *link;
+	*link = branch->next;
+	message->size--;
+	_ts_message_touch(message);
+	_ts_message_atomic_add(&_ts_message_generation, 1);
+	ts_message_destroy(branch);
+	return TsStatusOk;
+}
+
+/* (private) _ts_message_insert */
+/* insert a copy of the given item in the given array, ahead of the indexed item (or last, at the size) */
+static TsStatus_t _ts_message_insert(TsMessageRef_t array, size_t index, TsMessageRef_t item)
+{
+	if ((array->flags & TS_MESSAGE_FLAG_FROZEN) != 0) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	if (array->size >= TS_MESSAGE_MAX_BRANCHES) {
+		return TsStatusErrorIndexOutOfRange;
+	}
+	TsMessageRef_t update;
+	TsStatus_t status = _ts_message_copy(array->allocator, item, array->depth + 1, &update);
+	if (status != TsStatusOk) {
+		return status;
+	}
+	TsMessageRef_t *link = _ts_message_at(array, index);
+	update->next = *link;
+	_ts_message_link(array, update);
+	*link = update;
+	array->size++;
+	_ts_message_touch(array);
+	_ts_message_atomic_add(&_ts_message_generation, 1);
+	return TsStatusOk;
+}
+
+/* (private) _ts_message_set_node */
+/* set the given field to (a copy of) the given node, primitives are assigned in place */
+static TsStatus_t _ts_message_set_node(TsMessageRef_t message, const char *field, TsMessageRef_t value)
+{
+	TsValue_t xvalue = _ts_message_is_primitive(value->type) ? _ts_message_value(value) : (TsValue_t) value;
+	return _ts_message_set(message, (TsPathNode_t) field, value->type, xvalue);
+}
+
+/* (private) _ts_message_merge */
+/* merge the given patch depth first, holding the message merged into and the next patch field of each level */
+static TsStatus_t _ts_message_merge(TsMessageRef_t message, TsMessageRef_t patch)
+{
+	TsMessageRef_t messages[TS_MESSAGE_MAX_DEPTH];
+	TsMessageRef_t branches[TS_MESSAGE_MAX_DEPTH];
+	messages[0] = message;
+	branches[0] = patch->value._xbranches;
+	size_t top = 1;
+	while (top > 0) {
+		TsMessageRef_t branch = branches[top - 1];
+		if (branch == NULL) {
+			top--;
+			continue;
+		}
+		branches[top - 1] = branch->next;
+
+		TsStatus_t status = TsStatusOk;
+		TsMessageRef_t target = messages[top - 1];
+		TsMessageRef_t *link = _ts_message_find(target, branch->name);
+		if (branch->type == TsTypeNull) {
+			if (*link != NULL) {
+				status = _ts_message_unlink(target, link);
+			}
+		} else if (branch->type == TsTypeMessage) {
+
+			/* merge into the message found, replacing anything else */
+			TsMessageRef_t content = *link;
+			if (content == NULL || content->type != TsTypeMessage) {
+				status = ts_message_create_message(target, branch->name, &content);
+			}
+			if (status == TsStatusOk && top == TS_MESSAGE_MAX_DEPTH) {
+				status = TsStatusErrorRecursionTooDeep;
+			}
+			if (status == TsStatusOk) {
+				messages[top] = content;
+				branches[top] = branch->value._xbranches;
+				top++;
+			}
+		} else {
+			status = _ts_message_set_node(target, branch->name, branch);
+		}
+		if (status != TsStatusOk) {
+			return status;
+		}
+	}
+	return TsStatusOk;
+}
+
+/* (private) _ts_message_merge_json */
+/* merge the given json patch token by token, holding the message merged into of each level */
+static TsStatus_t _ts_message_merge_json(TsMessageRef_t message, const char *text, size_t size)
+{
+	TsJsonReader_t reader;
+	TsJsonToken_t token;
+	ts_json_reader_init(&reader, text, size);
+	TsStatus_t status = ts_json_next(&reader, &token);
+	if (status == TsStatusOk && token.type != TsJsonTokenObjectBegin) {
+		status = TsStatusErrorBadRequest;
+	}
+
+	TsMessageRef_t messages[TS_MESSAGE_MAX_DEPTH];
+	messages[0] = message;
+	size_t top = 1;
+	while (status == TsStatusOk && top > 0) {
+		status = ts_json_next(&reader, &token);
+		if (status != TsStatusOk) {
+			break;
+		}
+		if (token.type == TsJsonTokenObjectEnd) {
+			top--;
+			continue;
+		}
+
+		/* the field */
+		char name[TS_MESSAGE_MAX_KEY_SIZE];
+		if (ts_json_string(&token, name, sizeof(name)) != TsStatusOk) {
+			status = TsStatusErrorBadRequest;
+			break;
+		}
+		status = ts_json_next(&reader, &token);
+		if (status != TsStatusOk) {
+			break;
+		}
+		TsMessageRef_t target = messages[top - 1];
+		TsMessageRef_t *link = _ts_message_find(target, name);
+		TsMessageRef_t content = NULL;
+		if (token.type == TsJsonTokenNull) {
+			if (*link != NULL) {
+				status = _ts_message_unlink(target, link);
+			}
+		} else if (token.type == TsJsonTokenObjectBegin) {
+
+			/* merge into the message found, replacing anything else */
+			content = *link;
+			if (content == NULL || content->type != TsTypeMessage) {
+				status = ts_message_create_message(target, name, &content);
+			}
+			if (status == TsStatusOk && top == TS_MESSAGE_MAX_DEPTH) {
+				status = TsStatusErrorRecursionTooDeep;
+			}
+			if (status == TsStatusOk) {
+				messages[top++] = content;
+			}
+		} else {
+
+			/* set anything else, arrays as a whole */
+			status = _ts_message_decode_value(target, name, &token, &content);
+			if (status == TsStatusOk && content != NULL) {
+				status = _ts_message_decode_content(&reader, content, NULL);
+			}
+		}
+	}
+
+	/* nothing follows the patch */
+	if (status == TsStatusOk) {
+		status = ts_json_next(&reader, &token);
+	}
+	if (status == TsStatusOk && token.type != TsJsonTokenEnd) {
+		status = TsStatusErrorBadRequest;
+	}
+	return status;
+}
+
+/* (private) _ts_message_pointer */
+/* resolve all but the last token of the given rfc 6901 json pointer, the last is unescaped into the given name */
+/* (of TS_MESSAGE_MAX_KEY_SIZE). the parent of the root itself, i.e., of the empty pointer, is NULL */
+static TsStatus_t _ts_message_pointer(TsMessageRef_t message, const char *pointer, TsMessageRef_t *parent,
+									  char *name)
+{
+	*parent = NULL;
+	name[0] = '\0';
+	if (*pointer == '\0') {
+		return TsStatusOk;
+	}
+	if (*pointer != '/') {
+		return TsStatusErrorBadRequest;
+	}
+
+	TsMessageRef_t current = message;
+	for (size_t depth = 0;; depth++) {
+
+		/* unescape the next token, i.e., ~0 and ~1 */
+		size_t length = 0;
+		for (pointer++; *pointer != '\0' && *pointer != '/'; pointer++) {
+			char c = *pointer;
+			if (c == '~') {
+				pointer++;
+				if (*pointer != '0' && *pointer != '1') {
+					return TsStatusErrorBadRequest;
+				}
+				c = *pointer == '0' ? '~' : '/';
+			}
+			if (length + 1 >= TS_MESSAGE_MAX_KEY_SIZE) {
+				return TsStatusErrorBadRequest;
+			}
+			name[length++] = c;
+		}
+		name[length] = '\0';
+		if (*pointer == '\0') {
+			*parent = current;
+			return TsStatusOk;
+		}
+
+		/* and descend */
+		if (depth + 1 >= TS_MESSAGE_MAX_DEPTH) {
+			return TsStatusErrorRecursionTooDeep;
+		}
+		if (_ts_message_locate(message, current, name, &current) != TsStatusOk) {
+			return TsStatusErrorNotFound;
+		}
+	}
+}
+
+/* (private) _ts_message_index */
+/* the array index of the given pointer token, i.e., digits without leading zeros (or "-" for the end, when */
+/* appending), within the size of the array */
+static TsStatus_t _ts_message_index(TsMessageRef_t array, const char *name, bool append, size_t *index)
+{
+	if (append && strcmp(name, "-") == 0) {
+		*index = array->size;
+		return TsStatusOk;
+	}
+	size_t value = 0;
+	size_t length = strlen(name);
+	if (length == 0 || length > 9 || (name[0] == '0' && length > 1)) {
+		return TsStatusErrorBadRequest;
+	}
+	for (size_t i = 0; i < length; i++) {
+		if (name[i] < '0' || name[i] > '9') {
+			return TsStatusErrorBadRequest;
+		}
+		value = value * 10 + (size_t) (name[i] - '0');
+	}
+	if (value > array->size || (value == array->size && !append)) {
+		return TsStatusErrorIndexOutOfRange;
+	}
+	*index = value;
+	return TsStatusOk;
+}
+
+/* (private) _ts_message_locate */
+/* the named branch of the given message or array, or the root itself (without a parent) */
+static TsStatus_t _ts_message_locate(TsMessageRef_t message, TsMessageRef_t parent, const char *name,
+									 TsMessageRef_t *value)
+{
+	if (parent == NULL) {
+		*value = message;
+		return TsStatusOk;
+	}
+	if (parent->type == TsTypeArray) {
+		size_t index;
+		TsStatus_t status = _ts_message_index(parent, name, false, &index);
+		if (status != TsStatusOk) {
+			return status;
+		}
+		*value = *(_ts_message_at(parent, index));
+		return TsStatusOk;
+	}
+	if (parent->type != TsTypeMessage) {
+		return TsStatusErrorNotFound;
+	}
+	return ts_message_has(parent, (TsPathNode_t) name, value);
+}
+
+/* (private) _ts_message_patch_add */
+/* add (or replace) the named branch of the given message or array, or replace the content of the root */
+static TsStatus_t _ts_message_patch_add(TsMessageRef_t message, TsMessageRef_t parent, const char *name,
+										TsMessageRef_t value, bool replace)
+{
+	/* the root, i.e., its fields are replaced with (a copy of) those of the value */
+	if (parent == NULL) {
+		if (value->type != TsTypeMessage) {
+			return TsStatusErrorBadRequest;
+		}
+		TsMessageRef_t copy;
+		TsStatus_t status = ts_message_create_copy(value, &copy);
+		while (status == TsStatusOk && message->value._xbranches != NULL) {
+			status = _ts_message_unlink(message, &(message->value._xbranches));
+		}
+		for (TsMessageRef_t branch = copy->value._xbranches; status == TsStatusOk && branch != NULL;
+			 branch = branch->next) {
+			status = _ts_message_set_node(message, branch->name, branch);
+		}
+		if (copy != NULL) {
+			ts_message_destroy(copy);
+		}
+		return status;
+	}
+
+	if (parent->type == TsTypeMessage) {
+		if (replace && *(_ts_message_find(parent, name)) == NULL) {
+			return TsStatusErrorNotFound;
+		}
+		return _ts_message_set_node(parent, name, value);
+	}
+	if (parent->type != TsTypeArray) {
+		return TsStatusErrorNotFound;
+	}
+	size_t index;
+	TsStatus_t status = _ts_message_index(parent, name, !replace, &index);
+	if (status != TsStatusOk) {
+		return status;
+	}
+	return replace ? ts_message_set_at(parent, index, value) : _ts_message_insert(parent, index, value);
+}
+
+/* (private) _ts_message_patch_remove */
+static TsStatus_t _ts_message_patch_remove(TsMessageRef_t parent, const char *name)
+{
+	TsMessageRef_t *link;
+	if (parent == NULL) {
+		return TsStatusErrorBadRequest;
+	}
+	if (parent->type == TsTypeMessage) {
+		link = _ts_message_find(parent, name);
+	} else if (parent->type == TsTypeArray) {
+		size_t index;
+		TsStatus_t status = _ts_message_index(parent, name, false, &index);
+		if (status != TsStatusOk) {
+			return status;
+		}
+		link = _ts_message_at(parent, index);
+	} else {
+		return TsStatusErrorNotFound;
+	}
+	if (*link == NULL) {
+		return TsStatusErrorNotFound;
+	}
+	return _ts_message_unlink(parent, link);
+}
+
+/* (private) _ts_message_patch_apply */
+/* apply a single operation (add, remove, replace, move, copy or test), only the nodes along its path(s) are */
+/* looked up. a failing test returns TsStatusErrorPreconditionFailed */
+static TsStatus_t _ts_message_patch_apply(TsMessageRef_t message, const char *op, const char *path, const char *from,
+										  TsMessageRef_t value)
+{
+	TsMessageRef_t parent, source;
+	char name[TS_MESSAGE_MAX_KEY_SIZE];
+	TsStatus_t status;
+
+	/* operations taking a value */
+	bool add = strcmp(op, "add") == 0, replace = strcmp(op, "replace") == 0;
+	if (add || replace || strcmp(op, "test") == 0) {
+		if (value == NULL) {
+			return TsStatusErrorBadRequest;
+		}
+		status = _ts_message_pointer(message, path, &parent, name);
+		if (status != TsStatusOk || add || replace) {
+			return status == TsStatusOk ? _ts_message_patch_add(message, parent, name, value, replace) : status;
+		}
+		status = _ts_message_locate(message, parent, name, &source);
+		if (status != TsStatusOk) {
+			return TsStatusErrorNotFound;
+		}
+		bool equal = false;
+		ts_message_equal(source, value, &equal);
+		return equal ? TsStatusOk : TsStatusErrorPreconditionFailed;
+	}
+
+	if (strcmp(op, "remove") == 0) {
+		status = _ts_message_pointer(message, path, &parent, name);
+		return status == TsStatusOk ? _ts_message_patch_remove(parent, name) : status;
+	}
+
+	/* operations taking the value of another location */
+	bool move = strcmp(op, "move") == 0;
+	if (!move && strcmp(op, "copy") != 0) {
+		return TsStatusErrorBadRequest;
+	}
+	if (from == NULL) {
+		return TsStatusErrorBadRequest;
+	}
+	status = _ts_message_pointer(message, from, &parent, name);
+	if (status == TsStatusOk) {
+		status = _ts_message_locate(message, parent, name, &source);
+	}
+	if (status != TsStatusOk) {
+		return TsStatusErrorNotFound;
+	}
+
+	/* a location is moved onto itself as is, but cannot be moved into one of its children */
+	size_t length = strlen(from);
+	if (move && strcmp(from, path) == 0) {
+		return TsStatusOk;
+	}
+	if (move && strncmp(from, path, length) == 0 && path[length] == '/') {
+		return TsStatusErrorBadRequest;
+	}
+	if (!move) {
+		status = _ts_message_pointer(message, path, &parent, name);
+		return status == TsStatusOk ? _ts_message_patch_add(message, parent, name, source, false) : status;
+	}
+
+	/* a move is a remove of (a copy of) the value, then an add */
+	TsMessageRef_t copy;
+	status = ts_message_create_copy(source, &copy);
+	if (status == TsStatusOk) {
+		status = _ts_message_patch_remove(parent, name);
+	}
+	if (status == TsStatusOk) {
+		status = _ts_message_pointer(message, path, &parent, name);
+	}
+	if (status == TsStatusOk) {
+		status = _ts_message_patch_add(message, parent, name, copy, false);
+	}
+	if (copy != NULL) {
+		ts_message_destroy(copy);
+	}
+	return status;
+}
+
+/* (private) _ts_message_patch_json */
+/* apply the operations of the given json patch as read, skipping the value of each operation until known */
+static TsStatus_t _ts_message_patch_json(TsMessageRef_t message, const char *text, size_t size)
+{
+	TsJsonReader_t reader;
+	TsJsonToken_t token;
+	ts_json_reader_init(&reader, text, size);
+	TsStatus_t status = ts_json_next(&reader, &token);
+	if (status == TsStatusOk && token.type != TsJsonTokenArrayBegin) {
+		status = TsStatusErrorBadRequest;
+	}
+	while (status == TsStatusOk) {
+		status = ts_json_next(&reader, &token);
+		if (status != TsStatusOk || token.type == TsJsonTokenArrayEnd) {
+			break;
+		}
+		if (token.type != TsJsonTokenObjectBegin) {
+			status = TsStatusErrorBadRequest;
+			break;
+		}
+
+		/* the members of the operation (in any order), the reader is held at the value */
+		TsJsonToken_t op = {.type = TsJsonTokenNone}, path = {.type = TsJsonTokenNone};
+		TsJsonToken_t from = {.type = TsJsonTokenNone};
+		TsJsonReader_t value;
+		bool valued = false;
+		for (status = ts_json_next(&reader, &token); status == TsStatusOk && token.type == TsJsonTokenKey;
+			 status = ts_json_next(&reader, &token)) {
+			TsJsonToken_t *member = NULL;
+			if (ts_json_equals(&token, "op")) {
+				member = &op;
+			} else if (ts_json_equals(&token, "path")) {
+				member = &path;
+			} else if (ts_json_equals(&token, "from")) {
+				member = &from;
+			} else if (ts_json_equals(&token, "value")) {
+				value = reader;
+				valued = true;
+			}
+			if (member != NULL) {
+				status = ts_json_next(&reader, member);
+			} else {
+				status = ts_json_skip(&reader, &token);
+			}
+			if (status != TsStatusOk) {
+				break;
+			}
+		}
+		if (status == TsStatusOk) {
+			status = _ts_message_patch_tokens(message, &op, &path, &from, valued ? &value : NULL);
+		}
+	}
+
+	/* nothing follows the patch */
+	if (status == TsStatusOk) {
+		status = ts_json_next(&reader, &token);
+	}
+	if (status == TsStatusOk && token.type != TsJsonTokenEnd) {
+		status = TsStatusErrorBadRequest;
+	}
+	return status;
+}
+
+/* (private) _ts_message_patch_tokens */
+/* apply the operation of the given (json) members, decoding its value (if any) from the given reader */
+static TsStatus_t _ts_message_patch_tokens(TsMessageRef_t message, TsJsonToken_t *op, TsJsonToken_t *path,
+										   TsJsonToken_t *from, TsJsonReaderRef_t reader)
+{
+	char xop[TS_MESSAGE_MAX_KEY_SIZE], xpath[TS_MESSAGE_POINTER_SIZE], xfrom[TS_MESSAGE_POINTER_SIZE];
+	if (op->type != TsJsonTokenString || path->type != TsJsonTokenString
+		|| (from->type != TsJsonTokenNone && from->type != TsJsonTokenString)) {
+		return TsStatusErrorBadRequest;
+	}
+	if (ts_json_string(op, xop, sizeof(xop)) != TsStatusOk || ts_json_string(path, xpath, sizeof(xpath)) != TsStatusOk
+		|| (from->type == TsJsonTokenString && ts_json_string(from, xfrom, sizeof(xfrom)) != TsStatusOk)) {
+		return TsStatusErrorBadRequest;
+	}
+
+	/* the value, decoded on its own */
+	TsMessageRef_t holder = NULL, value = NULL;
+	TsStatus_t status = TsStatusOk;
+	if (reader != NULL) {
+		TsJsonToken_t token;
+		TsMessageRef_t content = NULL;
+		status = ts_message_create(&holder);
+		if (status == TsStatusOk) {
+			status = ts_json_next(reader, &token);
+		}
+		if (status == TsStatusOk) {
+			status = _ts_message_decode_value(holder, "value", &token, &content);
+		}
+		if (status == TsStatusOk && content != NULL) {
+			status = _ts_message_decode_content(reader, content, NULL);
+		}
+		if (status == TsStatusOk) {
+			value = *(_ts_message_find(holder, "value"));
+		}
+	}
+	if (status == TsStatusOk) {
+		status = _ts_message_patch_apply(message, xop, xpath, from->type == TsJsonTokenString ? xfrom : NULL, value);
+	}
+	if (holder != NULL) {
+		ts_message_destroy(holder);
+	}
+	return status;
+}
+
+/* (private) _ts_message_transcode_json */
+/* write each token of the given json as read, containers as indefinite length (their size isn't known yet) */
+static TsStatus_t _ts_message_transcode_json(const char *text, size_t size, uint8_t *output, size_t *output_size)
+{
+	TsJsonReader_t reader;
+	TsJsonToken_t token;
+	size_t length = 0, depth = 0;
+	ts_json_reader_init(&reader, text, size);
+	TsStatus_t status = ts_json_next(&reader, &token);
+	if (status == TsStatusOk && token.type != TsJsonTokenObjectBegin) {
+		status = TsStatusErrorBadRequest;
+	}
+	while (status == TsStatusOk) {
+		switch (token.type) {
+
+		case TsJsonTokenObjectBegin:
+		case TsJsonTokenArrayBegin:
+			if (depth == TS_MESSAGE_MAX_DEPTH) {
+				status = TsStatusErrorRecursionTooDeep;
+				break;
+			}
+			depth++;
+			status = _ts_message_cbor_byte(output, *output_size, &length,
+										   token.type == TsJsonTokenObjectBegin ? 0xbf : 0x9f);
+			break;
+
+		case TsJsonTokenObjectEnd:
+		case TsJsonTokenArrayEnd:
+			depth--;
+			status = _ts_message_cbor_byte(output, *output_size, &length, 0xff);
+			break;
+
+		case TsJsonTokenKey: {
+			/* a key is the name of a field, i.e., of less than TS_MESSAGE_MAX_KEY_SIZE */
+			char name[TS_MESSAGE_MAX_KEY_SIZE];
+			if (ts_json_string(&token, name, sizeof(name)) != TsStatusOk) {
+				status = TsStatusErrorBadRequest;
+				break;
+			}
+			size_t name_size = strlen(name);
+			status = _ts_message_cbor_put(output, *output_size, &length, 3, name_size);
+			if (status == TsStatusOk && length + name_size > *output_size) {
+				status = TsStatusErrorOutOfMemory;
+			}
+			if (status == TsStatusOk) {
+				memcpy(output + length, name, name_size);
+				length = length + name_size;
+			}
+			break;
+		}
+		case TsJsonTokenString:
+			status = _ts_message_cbor_text(output, *output_size, &length, &token);
+			break;
+
+		case TsJsonTokenNumber:
+			status = _ts_message_cbor_number(output, *output_size, &length, &token);
+			break;
+
+		case TsJsonTokenTrue:
+		case TsJsonTokenFalse:
+			status = _ts_message_cbor_byte(output, *output_size, &length, token.type == TsJsonTokenTrue ? 0xf5 : 0xf4);
+			break;
+
+		case TsJsonTokenNull:
+			status = _ts_message_cbor_byte(output, *output_size, &length, 0xf6);
+			break;
+
+		default:
+			status = TsStatusErrorBadRequest;
+			break;
+		}
+		if (status != TsStatusOk || depth == 0) {
+			break;
+		}
+		status = ts_json_next(&reader, &token);
+	}
+
+	/* nothing follows the root */
+	if (status == TsStatusOk) {
+		status = ts_json_next(&reader, &token);
+	}
+	if (status == TsStatusOk && token.type != TsJsonTokenEnd) {
+		status = TsStatusErrorBadRequest;
+	}
+	*output_size = length;
+	return status;
+}
+
+/* (private) _ts_message_transcode_cbor */
+/* write each item of the given cbor as read, holding the iterator (and the number of items) of each container */
+static TsStatus_t _ts_message_transcode_cbor(const uint8_t *buffer, size_t size, char *output, size_t *output_size)
+{
+	CborParser parser;
+	CborValue values[TS_MESSAGE_MAX_DEPTH + 1];
+	bool maps[TS_MESSAGE_MAX_DEPTH];
+	size_t counts[TS_MESSAGE_MAX_DEPTH];
+	size_t length = 0, top = 0;
+	output[0] = '\0';
+	if (cbor_parser_init(buffer, size, 0, &parser, &(values[0])) != CborNoError || !cbor_value_is_map(&(values[0]))) {
+		return TsStatusErrorBadRequest;
+	}
+
+	TsStatus_t status = TsStatusOk;
+	do {
+		CborValue *value = &(values[top]);
+
+		/* close the containers done,... */
+		if (top > 0 && cbor_value_at_end(value)) {
+			top--;
+			_ts_message_json_put(output, *output_size, &length, maps[top] ? "}" : "]", 1);
+			if (cbor_value_leave_container(&(values[top]), value) != CborNoError) {
+				status = TsStatusErrorBadRequest;
+			}
+			continue;
+		}
+
+		/* ...or separate the next item (a key and its value are one), the key being the name of a field */
+		bool key = top > 0 && maps[top - 1] && counts[top - 1] % 2 == 0;
+		if (top > 0 && counts[top - 1] > 0 && (key || !maps[top - 1])) {
+			_ts_message_json_put(output, *output_size, &length, ",", 1);
+		}
+		if (top > 0) {
+			counts[top - 1]++;
+		}
+		if (key) {
+			char name[TS_MESSAGE_MAX_KEY_SIZE];
+			size_t name_size = sizeof(name);
+			CborValue next;
+			if (!cbor_value_is_text_string(value)
+				|| cbor_value_copy_text_string(value, name, &name_size, &next) != CborNoError
+				|| name_size >= sizeof(name)) {
+				status = TsStatusErrorBadRequest;
+				continue;
+			}
+			*value = next;
+			_ts_message_json_put(output, *output_size, &length, "\"", 1);
+			_ts_message_json_escape(output, *output_size, &length, name, name_size);
+			_ts_message_json_put(output, *output_size, &length, "\":", 2);
+			continue;
+		}
+
+		/* the value (tags are dropped) */
+		CborError error = CborNoError;
+		while (error == CborNoError && cbor_value_is_tag(value)) {
+			error = cbor_value_skip_tag(value);
+		}
+		switch (error == CborNoError ? cbor_value_get_type(value) : CborInvalidType) {
+
+		case CborMapType:
+		case CborArrayType:
+			if (top == TS_MESSAGE_MAX_DEPTH) {
+				status = TsStatusErrorRecursionTooDeep;
+				break;
+			}
+			maps[top] = cbor_value_is_map(value);
+			counts[top] = 0;
+			_ts_message_json_put(output, *output_size, &length, maps[top] ? "{" : "[", 1);
+			error = cbor_value_enter_container(value, &(values[top + 1]));
+			top++;
+			break;
+
+		case CborIntegerType:
+		case CborHalfFloatType:
+		case CborFloatType:
+		case CborDoubleType:
+			status = _ts_message_json_number(value, output, *output_size, &length);
+			break;
+
+		case CborTextStringType:
+			status = _ts_message_json_text(value, output, *output_size, &length);
+			break;
+
+		case CborBooleanType: {
+			bool boolean = false;
+			cbor_value_get_boolean(value, &boolean);
+			_ts_message_json_put(output, *output_size, &length, boolean ? "true" : "false", boolean ? 4 : 5);
+			error = cbor_value_advance_fixed(value);
+			break;
+		}
+		case CborNullType:
+		case CborUndefinedType:
+			_ts_message_json_put(output, *output_size, &length, "null", 4);
+			error = cbor_value_advance_fixed(value);
+			break;
+
+		default:
+			/* i.e., byte strings and other simple values, not held by messages */
+			status = TsStatusErrorBadRequest;
+			break;
+		}
+		if (error != CborNoError) {
+			status = TsStatusErrorBadRequest;
+		}
+	} while (status == TsStatusOk && top > 0);
+
+	/* nothing follows the root */
+	if (status == TsStatusOk && cbor_value_get_next_byte(&(values[0])) != buffer + size) {
+		status = TsStatusErrorBadRequest;
+	}
+	if (status == TsStatusOk && length >= *output_size - 1) {
+		status = TsStatusErrorOutOfMemory;
+	}
+	*output_size = length;
+	return status;
+}
+
+/* (private) _ts_message_cbor_put */
+/* append the head of a cbor item, i.e., its major type and (shortest) argument */
+static TsStatus_t _ts_message_cbor_put(uint8_t *output, size_t output_size, size_t *length, uint8_t major,
+									   uint64_t argument)
+{
+	size_t size = _ts_message_cbor_head(argument);
+	if (*length + size > output_size) {
+		return TsStatusErrorOutOfMemory;
+	}
+	uint8_t *head = output + *length;
+	if (size == 1) {
+		head[0] = (uint8_t) ((major << 5) | argument);
+	} else {
+		head[0] = (uint8_t) ((major << 5) | (size == 2 ? 24 : size == 3 ? 25 : size == 5 ? 26 : 27));
+		for (size_t i = size - 1; i > 0; i--) {
+			head[i] = (uint8_t) (argument & 0xff);
+			argument = argument >> 8;
+		}
+	}
+	*length = *length + size;
+	return TsStatusOk;
+}
+
+/* (private) _ts_message_cbor_byte */
+/* append a single byte item, e.g., a simple value, the start of an indefinite length container or a break */
+static TsStatus_t _ts_message_cbor_byte(uint8_t *output, size_t output_size, size_t *length, uint8_t byte)
+{
+	if (*length + 1 > output_size) {
+		return TsStatusErrorOutOfMemory;
+	}
+	output[(*length)++] = byte;
+	return TsStatusOk;
+}
+
+/* (private) _ts_message_cbor_number */
+/* append the given json number as decoded, i.e., an integer (in range) or a (single precision) float */
+static TsStatus_t _ts_message_cbor_number(uint8_t *output, size_t output_size, size_t *length, TsJsonToken_t *token)
+{
+	double number;
+	if (ts_json_number(token, &number) != TsStatusOk) {
+		return TsStatusErrorBadRequest;
+	}
+	if (number >= INT32_MIN && number <= INT32_MAX && number == (double) (int) number) {
+		int64_t integer = (int64_t) number;
+		return integer >= 0 ? _ts_message_cbor_put(output, output_size, length, 0, (uint64_t) integer)
+							: _ts_message_cbor_put(output, output_size, length, 1, (uint64_t) (-1 - integer));
+	}
+	if (*length + 5 > output_size) {
+		return TsStatusErrorOutOfMemory;
+	}
+	float xnumber = (float) number;
+	uint32_t bits;
+	memcpy(&bits, &xnumber, sizeof(bits));
+	uint8_t *head = output + *length;
+	head[0] = 0xfa;
+	head[1] = (uint8_t) (bits >> 24);
+	head[2] = (uint8_t) (bits >> 16);
+	head[3] = (uint8_t) (bits >> 8);
+	head[4] = (uint8_t) bits;
+	*length = *length + 5;
+	return TsStatusOk;
+}
+
+/* (private) _ts_message_cbor_text */
+/* append the given json string, unescaped in place, i.e., behind room for the head (of its escaped size) */
+static TsStatus_t _ts_message_cbor_text(uint8_t *output, size_t output_size, size_t *length, TsJsonToken_t *token)
+{
+	/* an unescaped string is never longer than its escaped text */
+	size_t reserved = _ts_message_cbor_head(token->size);
+	size_t size = token->size;
+	char *text = (char *) output + *length + reserved;
+	if (memchr(token->text, '\\', token->size) == NULL) {
+		if (*length + reserved + size > output_size) {
+			return TsStatusErrorOutOfMemory;
+		}
+		memcpy(text, token->text, size);
+	} else {
+		if (*length + reserved + size + 1 > output_size) {
+			return TsStatusErrorOutOfMemory;
+		}
+		if (ts_json_string(token, text, size + 1) != TsStatusOk) {
+			return TsStatusErrorBadRequest;
+		}
+		size = strlen(text);
+	}
+
+	/* the head of the unescaped size is at most the one reserved */
+	TsStatus_t status = _ts_message_cbor_put(output, output_size, length, 3, size);
+	if (status == TsStatusOk) {
+		memmove(output + *length, text, size);
+		*length = *length + size;
+	}
+	return status;
+}
+
+/* (private) _ts_message_json_number */
+/* append the given cbor number as encoded, i.e., an integer (in range) as such and anything else as a float */
+/* (numbers json doesn't hold, i.e., infinities and nan, are null) */
+static TsStatus_t _ts_message_json_number(CborValue *value, char *output, size_t output_size, size_t *length)
+{
+	float number = 0;
+	if (cbor_value_is_integer(value)) {
+		uint64_t argument;
+		cbor_value_get_raw_integer(value, &argument);
+		if (argument <= INT32_MAX) {
+			int integer = cbor_value_is_unsigned_integer(value) ? (int) argument : -1 - (int) argument;
+			_ts_message_append(output, output_size, length, "%d", integer);
+			return cbor_value_advance_fixed(value) == CborNoError ? TsStatusOk : TsStatusErrorBadRequest;
+		}
+		number = cbor_value_is_unsigned_integer(value) ? (float) argument : -1.0f - (float) argument;
+	} else if (cbor_value_is_half_float(value)) {
+
+		/* widen the half precision float */
+		uint16_t half;
+		cbor_value_get_half_float(value, &half);
+		uint32_t exponent = (half >> 10) & 0x1f, mantissa = half & 0x3ff, bits;
+		if (exponent == 0) {
+			number = (float) mantissa / 16777216.0f;
+		} else {
+			bits = exponent == 31 ? 0x7f800000 | (mantissa << 13) : ((exponent + 112) << 23) | (mantissa << 13);
+			memcpy(&number, &bits, sizeof(number));
+		}
+		number = (half & 0x8000) != 0 ? -number : number;
+	} else if (cbor_value_is_float(value)) {
+		cbor_value_get_float(value, &number);
+	} else {
+		double xnumber;
+		cbor_value_get_double(value, &xnumber);
+		number = (float) xnumber;
+	}
+	if (isfinite(number)) {
+		_ts_message_append(output, output_size, length, "%f", number);
+	} else {
+		_ts_message_json_put(output, output_size, length, "null", 4);
+	}
+	return cbor_value_advance_fixed(value) == CborNoError ? TsStatusOk : TsStatusErrorBadRequest;
+}
+
+/* (private) _ts_message_json_text */
+/* append the given cbor text string (of one or more chunks) escaped, straight from the encoding */
+static TsStatus_t _ts_message_json_text(CborValue *value, char *output, size_t output_size, size_t *length)
+{
+	/* the parser checks the chunks on the way to the next item */
+	const uint8_t *cursor = cbor_value_get_next_byte(value);
+	CborValue next = *value;
+	if (cbor_value_advance(&next) != CborNoError) {
+		return TsStatusErrorBadRequest;
+	}
+	const uint8_t *end = cbor_value_get_next_byte(&next);
+	if ((*cursor & 0x1f) == 31) {
+		cursor++;
+	}
+
+	_ts_message_json_put(output, output_size, length, "\"", 1);
+	while (cursor < end && *cursor != 0xff) {
+		uint8_t additional = *cursor & 0x1f;
+		size_t head = additional < 24 ? 1 : (size_t) 1 + ((size_t) 1 << (additional - 24));
+		uint64_t size = additional < 24 ? additional : 0;
+		for (size_t i = 1; i < head; i++) {
+			size = (size << 8) | cursor[i];
+		}
+		_ts_message_json_escape(output, output_size, length, (const char *) cursor + head, (size_t) size);
+		cursor = cursor + head + size;
+	}
+	_ts_message_json_put(output, output_size, length, "\"", 1);
+	*value = next;
+	return TsStatusOk;
+}
+
+/* (private) _ts_message_json_escape */
+/* append the given text as the content of a json string, truncating as _ts_message_append */
+static void _ts_message_json_escape(char *buffer, size_t buffer_size, size_t *length, const char *text, size_t size)
+{
+	for (size_t i = 0; i < size; i++) {
+
+		/* copy the run of characters needing no escape,... */
+		size_t run = i;
+		while (run < size && (unsigned char) text[run] >= 0x20 && text[run] != '"' && text[run] != '\\') {
+			run++;
+		}
+		_ts_message_json_put(buffer, buffer_size, length, text + i, run - i);
+		if (run == size) {
+			break;
+		}
+
+		/* ...then the escaped one */
+		i = run;
+		unsigned char c = (unsigned char) text[i];
+		switch (c) {
+		case '"': _ts_message_json_put(buffer, buffer_size, length, "\\\"", 2); break;
+		case '\\': _ts_message_json_put(buffer, buffer_size, length, "\\\\", 2); break;
+		case '\b': _ts_message_json_put(buffer, buffer_size, length, "\\b", 2); break;
+		case '\f': _ts_message_json_put(buffer, buffer_size, length, "\\f", 2); break;
+		case '\n': _ts_message_json_put(buffer, buffer_size, length, "\\n", 2); break;
+		case '\r': _ts_message_json_put(buffer, buffer_size, length, "\\r", 2); break;
+		case '\t': _ts_message_json_put(buffer, buffer_size, length, "\\t", 2); break;
+		default: _ts_message_append(buffer, buffer_size, length, "\\u%04x", c); break;
+		}
+	}
+}
+
+/* (private) _ts_message_json_put */
+/* append the given text as is, truncating as _ts_message_append */
+static void _ts_message_json_put(char *buffer, size_t buffer_size, size_t *length, const char *text, size_t size)
+{
+	if (*length + size >= buffer_size) {
+		size = *length + 1 < buffer_size ? buffer_size - 1 - *length : 0;
+	}
+	memcpy(buffer + *length, text, size);
+	*length = *length + size;
+	buffer[*length] = '\0';
+}
+
+/* (private) _ts_message_now */
+/* monotonic time in ns */
+static uint64_t _ts_message_now()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+
+/* (private) _ts_message_count_encode */
+/* count an encode on the calling thread */
+static void _ts_message_count_encode(TsEncoder_t encoder, TsStatus_t status, size_t size, uint64_t start)
+{
+	if (encoder >= 0 && encoder < TS_MESSAGE_ENCODERS) {
+		TsMessageCounters_t *counters = _ts_message_thread_cache()->counters;
+		_ts_message_count(counters->encodes[encoder], 1);
+		if (status == TsStatusOk) {
+			_ts_message_count(counters->encode_bytes[encoder], size);
+		} else {
+			_ts_message_count(counters->encode_errors[encoder], 1);
+		}
+		_ts_message_latency(counters->encode_latency[encoder], _ts_message_now() - start);
+	}
+}
+
+/* (private) _ts_message_count_decode */
+/* count a decode (of the given size) on the calling thread */
+static void _ts_message_count_decode(TsEncoder_t encoder, TsStatus_t status, size_t size, uint64_t start)
+{
+	if (encoder >= 0 && encoder < TS_MESSAGE_ENCODERS) {
+		TsMessageCounters_t *counters = _ts_message_thread_cache()->counters;
+		_ts_message_count(counters->decodes[encoder], 1);
+		if (status == TsStatusOk) {
+			_ts_message_count(counters->decode_bytes[encoder], size);
+		} else {
+			_ts_message_count(counters->decode_errors[encoder], 1);
+		}
+		_ts_message_latency(counters->decode_latency[encoder], _ts_message_now() - start);
+	}
+}
+
+/* (private) _ts_message_latency */
+/* count the given latency (in ns) in its histogram bucket */
+static void _ts_message_latency(uint64_t *histogram, uint64_t latency)
+{
+	uint64_t microseconds = latency / 1000;
+	int bucket = 0;
+	while (bucket < TS_MESSAGE_HISTOGRAM_SIZE - 1 && microseconds >= ((uint64_t) 1 << bucket)) {
+		bucket++;
+	}
+	_ts_message_count(histogram[bucket], 1);
+}
+
+/* (private) _ts_message_clamp */
+/* clamp a counter to a message integer */
+static int _ts_message_clamp(int64_t value)
+{
+	if (value > 0x7fffffff) {
+		return 0x7fffffff;
+	}
+	return value < 0 ? 0 : (int) value;
+}
+
+/* (private) _ts_message_footprint */
+/* account for the given node (within the given parent) and its branches */
+static void _ts_message_footprint(TsMessageRef_t message, TsMessageRef_t parent, size_t depth,
+								  TsMessageFootprint_t *footprint)
+{
+	/* shape */
+	size_t name = strlen(message->name);
+	footprint->nodes++;
+	footprint->bytes_allocated += sizeof(TsMessage_t);
+	footprint->bytes_used += TS_MESSAGE_HEADER_SIZE + name + 1;
+	if (depth > footprint->depth) {
+		footprint->depth = depth;
+	}
+	if (name > footprint->longest_name) {
+		footprint->longest_name = name;
+	}
+
+	/* json, i.e., as _ts_message_encode_json, keyed in a message, and arrays in arrays are bracketed twice */
+	/* cbor, i.e., as _ts_message_encode_cbor, keyed everywhere but in arrays and on the root */
+	bool keyed = parent == NULL ? false : parent->type == TsTypeMessage;
+	if (keyed) {
+		footprint->json_size += name + 3 + (parent->value._xbranches != message ? 1 : 0);
+	} else if (parent != NULL && parent->value._xbranches != message) {
+		footprint->json_size += 1;
+	}
+	bool primitive = _ts_message_is_primitive(message->type);
+	if ((parent == NULL || parent->type != TsTypeArray) && (primitive || strcmp(message->name, "$root") != 0)) {
+		footprint->cbor_size += _ts_message_cbor_head(name) + name;
+	}
+
+	switch (message->type) {
+	case TsTypeNull:
+		footprint->json_size += 4;
+		footprint->cbor_size += 1;
+		break;
+
+	case TsTypeInteger: {
+		int value = message->value._xinteger;
+		footprint->bytes_used += sizeof(int);
+		footprint->json_size += snprintf(NULL, 0, "%d", value);
+		footprint->cbor_size += _ts_message_cbor_head(value < 0 ? (uint64_t) (-1 - (int64_t) value) : (uint64_t) value);
+		break;
+	}
+	case TsTypeFloat:
+		footprint->bytes_used += sizeof(float);
+		footprint->json_size += snprintf(NULL, 0, "%f", message->value._xfloat);
+		footprint->cbor_size += 5;
+		break;
+
+	case TsTypeBoolean:
+		footprint->bytes_used += sizeof(bool);
+		footprint->json_size += message->value._xboolean ? 4 : 5;
+		footprint->cbor_size += 1;
+		break;
+
+	case TsTypeString: {
+		size_t length = message->size;
+		footprint->bytes_used += length + 1;
+		if ((message->flags & TS_MESSAGE_FLAG_SPILLED) != 0) {
+			footprint->bytes_allocated += length + 1;
+		}
+		footprint->json_size += length + 2;
+		footprint->cbor_size += _ts_message_cbor_head(length) + length;
+		if (length > footprint->longest_string) {
+			footprint->longest_string = length;
+		}
+		break;
+	}
+	case TsTypeArray:
+	case TsTypeMessage: {
+		size_t length = message->size;
+		if (length > footprint->widest) {
+			footprint->widest = length;
+		}
+		if (message->encoding != NULL) {
+			footprint->bytes_allocated += sizeof(TsMessageEncoding_t) + message->encoding->capacities[0]
+										  + message->encoding->capacities[1];
+		}
+		footprint->bytes_used += sizeof(TsMessageRef_t);
+		footprint->json_size += 2;
+		if (message->type == TsTypeArray && parent != NULL && parent->type == TsTypeArray) {
+			footprint->json_size += 2;
+		}
+		footprint->cbor_size += _ts_message_cbor_head(length);
+		for (TsMessageRef_t branch = message->value._xbranches; branch != NULL; branch = branch->next) {
+			_ts_message_footprint(branch, message, depth + 1, footprint);
+		}
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+/* (private) _ts_message_cbor_head */
+/* size of a cbor initial byte and its argument */
+static size_t _ts_message_cbor_head(uint64_t argument)
+{
+	if (argument < 24) {
+		return 1;
+	} else if (argument <= 0xff) {
+		return 2;
+	} else if (argument <= 0xffff) {
+		return 3;
+	} else if (argument <= 0xffffffff) {
+		return 5;
+	}
+	return 9;
+}
+
+/* (private) _ts_message_export_coder */
+static TsStatus_t _ts_message_export_coder(TsMessageRef_t message, TsPathNode_t field,
+										   TsMessageCoderStatistics_t *coder)
+{
+	TsMessageRef_t content;
+	TsStatus_t status = ts_message_create_message(message, field, &content);
+	if (status != TsStatusOk) {
+		return status;
+	}
+	ts_message_set_int(content, "encodes", _ts_message_clamp((int64_t) coder->encodes));
+	ts_message_set_int(content, "encodeBytes", _ts_message_clamp((int64_t) coder->encode_bytes));
+	ts_message_set_int(content, "encodeErrors", _ts_message_clamp((int64_t) coder->encode_errors));
+	ts_message_set_int(content, "decodes", _ts_message_clamp((int64_t) coder->decodes));
+	ts_message_set_int(content, "decodeBytes", _ts_message_clamp((int64_t) coder->decode_bytes));
+	status = ts_message_set_int(content, "decodeErrors", _ts_message_clamp((int64_t) coder->decode_errors));
+
+	/* histograms */
+	for (int i = 0; status == TsStatusOk && i < 2; i++) {
+		uint64_t *histogram = i == 0 ? coder->encode_latency : coder->decode_latency;
+		size_t size = TS_MESSAGE_HISTOGRAM_SIZE;
+		while (size > 0 && histogram[size - 1] == 0) {
+			size--;
+		}
+		TsMessageRef_t array;
+		status = ts_message_create_array(content, i == 0 ? "encodeLatency" : "decodeLatency", &array);
+		for (size_t j = 0; status == TsStatusOk && j < size; j++) {
+			status = ts_message_set_int_at(array, j, _ts_message_clamp((int64_t) histogram[j]));
+		}
+	}
+	return status;
+}
+
+/* (private) _ts_message_encode_task */
+/* encode a single message, or a single branch the way its parent would */
+static void _ts_message_encode_task(void *argument)
+{
+	TsMessageTask_t *task = (TsMessageTask_t *) argument;
+	if (task->parent == NULL) {
+		task->status = ts_message_encode(task->message, task->encoder, task->buffer, &(task->buffer_size));
+		return;
+	}
+
+	/* encode into the scratch buffer of the thread (as large as the output, and kept until the thread flushes),... */
+	TsMessageCache_t *cache = _ts_message_thread_cache();
+	if (cache->scratch_size < task->buffer_size) {
+		free(cache->scratch);
+		cache->scratch = (uint8_t *) (malloc(task->buffer_size));
+		cache->scratch_size = cache->scratch != NULL ? task->buffer_size : 0;
+		if (cache->scratch == NULL) {
+			task->status = TsStatusErrorOutOfMemory;
+			return;
+		}
+	}
+	uint8_t *buffer = cache->scratch;
+	size_t size = 0;
+	switch (task->encoder) {
+	case TsEncoderJson: {
+
+		/* as in _ts_message_encode_json, i.e., keyed in a message, and arrays in arrays are bracketed twice */
+		char *xbuffer = (char *) buffer;
+		xbuffer[0] = '\0';
+		bool nested = task->parent->type == TsTypeArray && task->message->type == TsTypeArray;
+		if (task->parent->type == TsTypeMessage) {
+			snprintf(xbuffer, task->buffer_size, "\"%s\":", task->message->name);
+		} else if (nested) {
+			snprintf(xbuffer, task->buffer_size, "[");
+		}
+		task->status = _ts_message_encode_json(task->message, buffer, task->buffer_size);
+		if (nested) {
+			snprintf(xbuffer + strlen(xbuffer), task->buffer_size - strlen(xbuffer), "]");
+		}
+		size = strlen(xbuffer);
+		break;
+	}
+	case TsEncoderCbor: {
+		CborEncoder cbor;
+		cbor_encoder_init(&cbor, buffer, task->buffer_size, 0);
+		task->status = _ts_message_encode_cbor(task->message, &cbor, buffer, task->buffer_size);
+		size = cbor_encoder_get_buffer_size(&cbor, buffer);
+		break;
+	}
+	default:
+		task->status = TsStatusErrorNotImplemented;
+		break;
+	}
+
+	/* ...then carve as much as used out of the arena shared by the branches (as large as the output too) */
+	if (task->status == TsStatusOk) {
+		size_t offset = __atomic_fetch_add(&(task->arena->used), size, __ATOMIC_ACQ_REL);
+		if (offset + size > task->arena->size) {
+			task->status = TsStatusErrorOutOfMemory;
+		} else {
+			task->buffer = task->arena->bytes + offset;
+			task->buffer_size = size;
+			memcpy(task->buffer, buffer, size);
+		}
+	}
+}
+
+/* (private) _ts_message_create */
+/* take a node from the given allocator, and clear it as a root */
+static TsStatus_t _ts_message_create(TsMessageAllocatorRef_t allocator, const char *function, TsMessageRef_t *message)
+{
+	/* take the next free node */
+	TsMessageRef_t node = _ts_message_alloc(allocator, function);
+	if (node == NULL) {
+
+		/* if none found, then clear the return value */
+		*message = NULL;
+
+		/* and return an out-of-memory error */
+		dbg_printf("ts_message_create: out of memory\n");
+		return TsStatusErrorOutOfMemory;
+	}
+
+#ifdef TS_MESSAGE_STATIC_MEMORY
+	/* clear all, assume root (avoiding memset) */
+	_ts_message_name(node, "$root");
+	node->flags = 0;
+	node->type = TsTypeMessage;
+	node->next = NULL;
+	node->value._xbranches = NULL;
+	node->size = 0;
+	node->encoding = NULL;
+	node->parent = NULL;
+#else
+	memset(node, 0x00, sizeof(TsMessage_t));
+	node->type = TsTypeMessage;
+	_ts_message_name(node, "$root");
+#endif
+
+	/* mark as assigned, and set the return value (root) */
+	node->cache = _ts_message_cache.id;
+	node->allocator = allocator;
+	node->depth = 0;
+	_ts_message_atomic_store(&(node->references), 1);
+	*message = node;
+
+	/* return ok */
+	return TsStatusOk;
+}
+
+/* (private) _ts_message_copy */
+/* copy the given message (to the given depth), taking the nodes of the copy from the given allocator */
+static TsStatus_t _ts_message_copy(TsMessageAllocatorRef_t allocator, TsMessageRef_t message, unsigned int depth,
+								   TsMessageRef_t *value)
+{
+	/* check preconditions */
+	if (message == NULL || value == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+
+	/* copy the node itself,... */
+	TsStatus_t status = _ts_message_clone(allocator, message, depth, value);
+	if (status != TsStatusOk || _ts_message_is_primitive(message->type)) {
+		return status;
+	}
+
+	/* ...then its branches depth first */
+	/* (the depth is checked on every clone, so the stack never holds more than TS_MESSAGE_MAX_DEPTH frames) */
+	TsMessageFrame_t stack[TS_MESSAGE_MAX_DEPTH];
+	_ts_message_push_frame(&(stack[0]), message);
+	stack[0].copy = *value;
+	size_t top = 1;
+	while (top > 0) {
+		TsMessageFrame_t *frame = &(stack[top - 1]);
+		TsMessageRef_t branch = frame->branch;
+		if (branch == NULL) {
+			top--;
+			continue;
+		}
+		frame->branch = branch->next;
+
+		/* append the copy of the branch, in order */
+		TsMessageRef_t field;
+		status = _ts_message_clone(allocator, branch, depth + (unsigned int) top, &field);
+		if (status != TsStatusOk) {
+			ts_message_destroy(*value);
+			*value = NULL;
+			return status;
+		}
+		if (frame->last == NULL) {
+			frame->copy->value._xbranches = field;
+		} else {
+			frame->last->next = field;
+		}
+		field->parent = frame->copy;
+		frame->last = field;
+		frame->copy->size++;
+		if (!_ts_message_is_primitive(branch->type)) {
+			_ts_message_push_frame(&(stack[top]), branch);
+			stack[top].copy = field;
+			top++;
+		}
+	}
+
+	/* return result */
+	return TsStatusOk;
+}
+
+/* (private) _ts_message_clone */
+/* copy the given node alone (i.e., without its branches) to the given depth */
+static TsStatus_t _ts_message_clone(TsMessageAllocatorRef_t allocator, TsMessageRef_t message, unsigned int depth,
+									TsMessageRef_t *value)
+{
+	if (_ts_message_is_too_deep(message->type, depth)) {
+		dbg_printf("_ts_message_clone: message too deep (%u)\n", depth);
+		return TsStatusErrorRecursionTooDeep;
+	}
+
+	/* allocate a single message node */
+	TsStatus_t status = _ts_message_create(allocator, "ts_message_create_copy", value);
+	if (status == TsStatusOk) {
+
+		/* set the field relative to the given message to the new message */
+		memcpy((*value)->name, message->name, TS_MESSAGE_MAX_KEY_SIZE);
+		(*value)->hash = message->hash;
+		(*value)->type = message->type;
+		(*value)->depth = depth;
+		switch (message->type) {
+		case TsTypeInteger:
+			(*value)->value._xinteger = message->value._xinteger;
+			break;
+
+		case TsTypeFloat:
+			(*value)->value._xfloat = message->value._xfloat;
+			break;
+
+		case TsTypeBoolean:
+			(*value)->value._xboolean = message->value._xboolean;
+			break;
+
+		case TsTypeString:
+			if ((message->flags & TS_MESSAGE_FLAG_BORROWED) != 0) {
+				_ts_message_borrow(*value, message->value._xstring, message->size);
+				break;
+			}
+			status = _ts_message_store(*value, _ts_message_string(message), message->size);
+			if (status != TsStatusOk) {
+				ts_message_destroy(*value);
+				*value = NULL;
+			}
+			break;
+
+		case TsTypeMessage:
+		case TsTypeArray:
+		case TsTypeNull:
+		default:
+			/* do nothing, i.e., no branches yet */
+			break;
+		}
+	}
+
+	/* return result */
+	return status;
+}
+
+/* (private) _ts_message_is_too_deep */
+/* whether a node of the given type may not be set at the given depth, */
+/* i.e., leaves may be TS_MESSAGE_MAX_DEPTH levels below the root, messages and arrays one less */
+static bool _ts_message_is_too_deep(TsType_t type, unsigned int depth)
+{
+	return depth > TS_MESSAGE_MAX_DEPTH || (depth == TS_MESSAGE_MAX_DEPTH && !_ts_message_is_primitive(type));
+}
+
+/* (private) _ts_message_hash */
+/* hash of a name (fnv-1a), compared ahead of the name itself */
+static uint32_t _ts_message_hash(const char *name)
+{
+	uint32_t hash = 2166136261u;
+	for (; *name != '\0'; name++) {
+		hash = (hash ^ (uint8_t) (*name)) * 16777619u;
+	}
+	return hash;
+}
+
+/* (private) _ts_message_name */
+static void _ts_message_name(TsMessageRef_t message, const char *name)
+{
+	snprintf(message->name, TS_MESSAGE_MAX_KEY_SIZE, "%s", name);
+	message->hash = _ts_message_hash(message->name);
+}
+
+/* (private) _ts_message_find */
+/* the link to the branch of the given name, or to the end of the branches when not found */
+/* (i.e., only the hot part of the branches is read, but for those matching the hash) */
+static TsMessageRef_t * _ts_message_find(TsMessageRef_t message, const char *name)
+{
+	uint32_t hash = _ts_message_hash(name);
+	TsMessageRef_t *link = &(message->value._xbranches);
+	while (*link != NULL && ((*link)->hash != hash || strcmp((*link)->name, name) != 0)) {
+		link = &((*link)->next);
+	}
+	return link;
+}
+
+/* (private) _ts_message_at */
+/* the link to the indexed branch, or to the end of the branches when the index is the size */
+static TsMessageRef_t * _ts_message_at(TsMessageRef_t message, size_t index)
+{
+	TsMessageRef_t *link = &(message->value._xbranches);
+	for (size_t i = 0; i < index && *link != NULL; i++) {
+		link = &((*link)->next);
+	}
+	return link;
+}
+
+/* (private) _ts_message_value */
+/* the value of a primitive node, as taken by _ts_message_assign */
+static TsValue_t _ts_message_value(TsMessageRef_t message)
+{
+	return message->type == TsTypeString ? (TsValue_t) _ts_message_string(message) : (TsValue_t) &(message->value);
+}
+
+/* (private) _ts_message_push_frame */
+/* start the traversal of the branches of the given message or array */
+static void _ts_message_push_frame(TsMessageFrame_t *frame, TsMessageRef_t message)
+{
+	frame->message = message;
+	frame->branch = message->value._xbranches;
+	frame->index = 0;
+	frame->copy = NULL;
+	frame->last = NULL;
+}
+
+/* (private) _ts_message_aligned */
+/* allocate on a cache line, so the hot part of a node never straddles two */
+static void * _ts_message_aligned(size_t size)
+{
+	void *pointer = NULL;
+	if (posix_memalign(&pointer, TS_MESSAGE_CACHE_LINE, size) != 0) {
+		return NULL;
+	}
+	return pointer;
+}
+
+/* (private) _ts_message_string */
+static char * _ts_message_string(TsMessageRef_t message)
+{
+	return (message->flags & (TS_MESSAGE_FLAG_SPILLED | TS_MESSAGE_FLAG_BORROWED)) != 0 ? message->value._xstring
+																						: message->string;
+}
+
+/* (private) _ts_message_store */
+/* keep the given string inline when short, otherwise with the allocator of the node (or the heap), */
+/* releasing the previous one only once copied (i.e., the given string may be part of it) */
+static TsStatus_t _ts_message_store(TsMessageRef_t message, const char *value, size_t length)
+{
+#ifdef TS_MESSAGE_STATIC_MEMORY
+	if (length >= TS_MESSAGE_INLINE_STRING_SIZE && message->allocator == NULL) {
+		dbg_printf("issue detected during set (%s), string truncated; the given string is too large\n",
+				   message->name);
+		length = TS_MESSAGE_INLINE_STRING_SIZE - 1;
+	}
+#endif
+	char *storage = message->string;
+	if (length >= TS_MESSAGE_INLINE_STRING_SIZE) {
+		storage = (char *) _ts_message_allocate_bytes(message->allocator, length + 1, "_ts_message_store");
+		if (storage == NULL) {
+			dbg_printf("_ts_message_store: out of memory\n");
+			return TsStatusErrorOutOfMemory;
+		}
+	}
+	memmove(storage, value, length);
+	storage[length] = '\0';
+
+	_ts_message_release_string(message);
+	if (storage != message->string) {
+		message->value._xstring = storage;
+		message->flags |= TS_MESSAGE_FLAG_SPILLED;
+	}
+	message->size = (unsigned int) length;
+	return TsStatusOk;
+}
+
+/* (private) _ts_message_release_string */
+/* release a spilled string, or let go of a borrowed one */
+static void _ts_message_release_string(TsMessageRef_t message)
+{
+	if ((message->flags & TS_MESSAGE_FLAG_SPILLED) != 0) {
+		_ts_message_release_bytes(message->allocator, message->value._xstring, message->size + 1);
+	}
+	message->flags &= ~(TS_MESSAGE_FLAG_SPILLED | TS_MESSAGE_FLAG_BORROWED);
+}
+
+/* (private) _ts_message_borrow */
+/* refer to the given (terminated) string of the given length, which the caller keeps alive and unchanged */
+static void _ts_message_borrow(TsMessageRef_t message, const char *value, size_t length)
+{
+	_ts_message_release_string(message);
+	message->value._xstring = (char *) value;
+	message->size = (unsigned int) length;
+	message->flags |= TS_MESSAGE_FLAG_BORROWED;
+}
+
+/* (private) _ts_message_assign_node */
+/* assign the value of the given primitive node, keeping a borrowed string borrowed */
+static TsStatus_t _ts_message_assign_node(TsMessageRef_t message, TsMessageRef_t item)
+{
+	if (item->type != TsTypeString || (item->flags & TS_MESSAGE_FLAG_BORROWED) == 0) {
+		return _ts_message_assign(message, item->type, _ts_message_value(item));
+	}
+	TsStatus_t status = _ts_message_assign(message, TsTypeString, "");
+	if (status == TsStatusOk) {
+		_ts_message_borrow(message, item->value._xstring, item->size);
+	}
+	return status;
+}
+
+/* (private) _ts_message_allocate_bytes */
+/* take storage (e.g., of a long string) from the given allocator, or the heap (none in the static memory model) */
+static void * _ts_message_allocate_bytes(TsMessageAllocatorRef_t allocator, size_t size, const char *function)
+{
+	if (allocator != NULL) {
+		_ts_message_site.function = function;
+		return allocator->allocate(allocator->context, size);
+	}
+#ifdef TS_MESSAGE_STATIC_MEMORY
+	return NULL;
+#else
+	return malloc(size);
+#endif
+}
+
+/* (private) _ts_message_release_bytes */
+static void _ts_message_release_bytes(TsMessageAllocatorRef_t allocator, void *pointer, size_t size)
+{
+	if (allocator != NULL) {
+		allocator->release(allocator->context, pointer, size);
+		return;
+	}
+#ifndef TS_MESSAGE_STATIC_MEMORY
+	free(pointer);
+#endif
+}
+
+/* (private) _ts_message_touch */
+/* invalidate the cached encodings of the given (changed) message or array, and of all that contain it */
+static void _ts_message_touch(TsMessageRef_t message)
+{
+	for (; message != NULL; message = message->parent) {
+		message->flags &= ~TS_MESSAGE_FLAG_HASHED;
+		if (message->encoding != NULL) {
+			message->encoding->valid[TS_MESSAGE_ENCODING_JSON] = false;
+			message->encoding->valid[TS_MESSAGE_ENCODING_CBOR] = false;
+		}
+	}
+}
+
+/* (private) _ts_message_link */
+/* make the given (new) branch a branch of the given message or array, cached as the message is */
+static void _ts_message_link(TsMessageRef_t message, TsMessageRef_t branch)
+{
+	branch->parent = message;
+	if ((message->flags & TS_MESSAGE_FLAG_CACHED) != 0) {
+		_ts_message_flag(branch, TS_MESSAGE_FLAG_CACHED, true);
+	}
+}
+
+/* (private) _ts_message_cached */
+/* the cached encodings of the given message or array, when valid for the given encoder */
+static const TsMessageEncoding_t * _ts_message_cached(TsMessageRef_t message, int encoder)
+{
+	if (_ts_message_is_primitive(message->type) || message->encoding == NULL || !message->encoding->valid[encoder]) {
+		return NULL;
+	}
+	return message->encoding;
+}
+
+/* (private) _ts_message_remember */
+/* cache the given encoding of the given message or array (a copy, skipped when out of memory) */
+static void _ts_message_remember(TsMessageRef_t message, int encoder, const uint8_t *bytes, size_t size)
+{
+	if ((message->flags & TS_MESSAGE_FLAG_CACHED) == 0 || _ts_message_is_primitive(message->type)) {
+		return;
+	}
+	TsMessageEncoding_t *encoding = message->encoding;
+	if (encoding == NULL) {
+		encoding = (TsMessageEncoding_t *) _ts_message_allocate_bytes(message->allocator, sizeof(TsMessageEncoding_t),
+																	  "_ts_message_remember");
+		if (encoding == NULL) {
+			return;
+		}
+		memset(encoding, 0x00, sizeof(TsMessageEncoding_t));
+		message->encoding = encoding;
+	}
+	if (encoding->capacities[encoder] < size) {
+		uint8_t *storage = (uint8_t *) _ts_message_allocate_bytes(message->allocator, size, "_ts_message_remember");
+		if (storage == NULL) {
+			encoding->valid[encoder] = false;
+			return;
+		}
+		if (encoding->bytes[encoder] != NULL) {
+			_ts_message_release_bytes(message->allocator, encoding->bytes[encoder], encoding->capacities[encoder]);
+		}
+		encoding->bytes[encoder] = storage;
+		encoding->capacities[encoder] = size;
+	}
+	memcpy(encoding->bytes[encoder], bytes, size);
+	encoding->sizes[encoder] = size;
+	encoding->valid[encoder] = true;
+}
+
+/* (private) _ts_message_release_encoding */
+static void _ts_message_release_encoding(TsMessageRef_t message)
+{
+	TsMessageEncoding_t *encoding = message->encoding;
+	if (_ts_message_is_primitive(message->type) || encoding == NULL) {
+		return;
+	}
+	for (int i = 0; i < 2; i++) {
+		if (encoding->bytes[i] != NULL) {
+			_ts_message_release_bytes(message->allocator, encoding->bytes[i], encoding->capacities[i]);
+		}
+	}
+	_ts_message_release_bytes(message->allocator, encoding, sizeof(TsMessageEncoding_t));
+	message->encoding = NULL;
+}
+
+/* (private) _ts_message_uncache */
+/* stop caching the encodings of the given message and its branches, releasing them */
+static void _ts_message_uncache(TsMessageRef_t message)
+{
+	message->flags &= ~TS_MESSAGE_FLAG_CACHED;
+	if (!_ts_message_is_primitive(message->type)) {
+		_ts_message_release_encoding(message);
+		for (TsMessageRef_t branch = message->value._xbranches; branch != NULL; branch = branch->next) {
+			_ts_message_uncache(branch);
+		}
+	}
+}
+
+/* (private) _ts_message_fnv */
+/* fnv-1a over the given bytes, continuing from the given hash */
+static uint64_t _ts_message_fnv(uint64_t hash, const void *bytes, size_t size)
+{
+	for (size_t i = 0; i < size; i++) {
+		hash = (hash ^ ((const uint8_t *) bytes)[i]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+/* (private) _ts_message_mix */
+/* spread the bits of the given hash, i.e., the murmur3 finalizer */
+static uint64_t _ts_message_mix(uint64_t hash)
+{
+	hash = (hash ^ (hash >> 33)) * 0xff51afd7ed558ccdull;
+	hash = (hash ^ (hash >> 33)) * 0xc4ceb9fe1a85ec53ull;
+	return hash ^ (hash >> 33);
+}
+
+/* (private) _ts_message_leaf_digest */
+/* the digest of a primitive, i.e., its type and value (in little endian, so it is stable across platforms) */
+static uint64_t _ts_message_leaf_digest(TsMessageRef_t message)
+{
+	uint8_t bytes[5] = {(uint8_t) message->type};
+	uint32_t value = 0;
+	switch (message->type) {
+	case TsTypeInteger:
+		value = (uint32_t) message->value._xinteger;
+		break;
+
+	case TsTypeFloat:
+		memcpy(&value, &(message->value._xfloat), sizeof(value));
+		break;
+
+	case TsTypeBoolean:
+		value = message->value._xboolean ? 1 : 0;
+		break;
+
+	case TsTypeString:
+		return _ts_message_fnv(_ts_message_fnv(14695981039346656037ull, bytes, 1),
+							   _ts_message_string(message), message->size);
+
+	case TsTypeNull:
+	default:
+		break;
+	}
+	for (int i = 0; i < 4; i++) {
+		bytes[i + 1] = (uint8_t) (value >> (8 * i));
+	}
+	return _ts_message_fnv(14695981039346656037ull, bytes, sizeof(bytes));
+}
+
+/* (private) _ts_message_add_digest */
+/* add the digest of the given branch to that of the message or array of the given frame */
+/* (fields are summed, i.e., in any order, and items are chained, i.e., in order) */
+static void _ts_message_add_digest(TsMessageFrame_t *frame, TsMessageRef_t branch, uint64_t digest)
+{
+	if (frame->message->type == TsTypeArray) {
+		frame->digest = _ts_message_mix(frame->digest ^ digest) + 0x9e3779b97f4a7c15ull;
+	} else {
+		uint64_t name = _ts_message_fnv(14695981039346656037ull, branch->name, strlen(branch->name));
+		frame->digest += _ts_message_mix(name ^ _ts_message_mix(digest));
+	}
+}
+
+/* (private) _ts_message_digest */
+/* hash the given message depth first, keeping the digests of its messages and arrays */
+static TsStatus_t _ts_message_digest(TsMessageRef_t message, uint64_t *digest)
+{
+	if (_ts_message_is_primitive(message->type)) {
+		*digest = _ts_message_leaf_digest(message);
+		return TsStatusOk;
+	}
+
+	TsMessageFrame_t stack[TS_MESSAGE_MAX_DEPTH];
+	_ts_message_push_frame(&(stack[0]), message);
+	stack[0].digest = message->type;
+	size_t top = 1;
+	for (;;) {
+		TsMessageFrame_t *frame = &(stack[top - 1]);
+		TsMessageRef_t branch = frame->branch;
+
+		/* all branches done, keep the digest and add it to that of the parent */
+		if (branch == NULL) {
+			TsMessageRef_t node = frame->message;
+			node->digest = _ts_message_mix(frame->digest ^ ((uint64_t) node->size << 8));
+			node->flags |= TS_MESSAGE_FLAG_HASHED;
+			if (--top == 0) {
+				*digest = node->digest;
+				return TsStatusOk;
+			}
+			_ts_message_add_digest(&(stack[top - 1]), node, node->digest);
+			continue;
+		}
+		frame->branch = branch->next;
+
+		/* descend into messages and arrays changed since they were last hashed */
+		if (_ts_message_is_primitive(branch->type)) {
+			_ts_message_add_digest(frame, branch, _ts_message_leaf_digest(branch));
+		} else if ((branch->flags & TS_MESSAGE_FLAG_HASHED) != 0) {
+			_ts_message_add_digest(frame, branch, branch->digest);
+		} else {
+			if (top == TS_MESSAGE_MAX_DEPTH) {
+				return TsStatusErrorRecursionTooDeep;
+			}
+			_ts_message_push_frame(&(stack[top]), branch);
+			stack[top].digest = branch->type;
+			top++;
+		}
+	}
+}
+
+/* (private) _ts_message_same */
+/* compare the given nodes alone, i.e., primitives by value, and messages and arrays by size (and digest) */
+static bool _ts_message_same(TsMessageRef_t message, TsMessageRef_t other)
+{
+	if (message->type != other->type || message->size != other->size) {
+		return false;
+	}
+	switch (message->type) {
+	case TsTypeInteger:
+		return message->value._xinteger == other->value._xinteger;
+
+	case TsTypeFloat:
+		return memcmp(&(message->value._xfloat), &(other->value._xfloat), sizeof(float)) == 0;
+
+	case TsTypeBoolean:
+		return message->value._xboolean == other->value._xboolean;
+
+	case TsTypeString:
+		return memcmp(_ts_message_string(message), _ts_message_string(other), message->size) == 0;
+
+	case TsTypeMessage:
+	case TsTypeArray:
+		return (message->flags & other->flags & TS_MESSAGE_FLAG_HASHED) == 0 || message->digest == other->digest;
+
+	case TsTypeNull:
+	default:
+		return true;
+	}
+}
+
+/* (private) _ts_message_snapshot_measure */
+/* count the nodes of the given message, and the size of its long strings (zero terminated) */
+static TsStatus_t _ts_message_snapshot_measure(TsMessageRef_t message, size_t *nodes, size_t *strings)
+{
+	*nodes = 0;
+	*strings = 0;
+	TsMessageFrame_t stack[TS_MESSAGE_MAX_DEPTH];
+	size_t top = 0;
+	TsMessageRef_t node = message;
+	for (;;) {
+		if (node != NULL) {
+			(*nodes)++;
+			if (node->type == TsTypeString
+				&& (node->flags & (TS_MESSAGE_FLAG_SPILLED | TS_MESSAGE_FLAG_BORROWED)) != 0) {
+				*strings = *strings + node->size + 1;
+			}
+			if (!_ts_message_is_primitive(node->type)) {
+				if (top == TS_MESSAGE_MAX_DEPTH) {
+					return TsStatusErrorRecursionTooDeep;
+				}
+				_ts_message_push_frame(&(stack[top++]), node);
+			}
+			node = NULL;
+		}
+		if (top == 0) {
+			return TsStatusOk;
+		}
+		TsMessageFrame_t *frame = &(stack[top - 1]);
+		if (frame->branch != NULL) {
+			node = frame->branch;
+			frame->branch = node->next;
+		} else {
+			top--;
+		}
+	}
+}
+
+/* (private) _ts_message_snapshot_node */
+/* write the image of a single node, unlinked, moving a long (or borrowed) string to the string table */
+static void _ts_message_snapshot_node(uint8_t *buffer, TsMessageRef_t message, unsigned int depth,
+									  TsMessageRef_t node, size_t *used)
+{
+	memcpy(node, message, sizeof(TsMessage_t));
+	node->next = NULL;
+	node->parent = NULL;
+	node->allocator = NULL;
+	node->references = 1;
+	node->cache = 0;
+	node->depth = message->depth - depth;
+	node->flags &= ~TS_MESSAGE_FLAG_CACHED;
+	if (!_ts_message_is_primitive(message->type)) {
+		node->value._xbranches = NULL;
+		node->encoding = NULL;
+	} else if (message->type == TsTypeString
+			   && (message->flags & (TS_MESSAGE_FLAG_SPILLED | TS_MESSAGE_FLAG_BORROWED)) != 0) {
+		memcpy(buffer + *used, message->value._xstring, message->size);
+		buffer[*used + message->size] = '\0';
+		node->value._xstring = (char *) (uintptr_t) (*used);
+		node->flags = (node->flags & ~TS_MESSAGE_FLAG_BORROWED) | TS_MESSAGE_FLAG_SPILLED;
+		*used = *used + message->size + 1;
+	}
+}
+
+/* (private) _ts_message_snapshot_header */
+/* the header of the given image, NULL unless saved by a build like this one */
+static TsMessageSnapshot_t * _ts_message_snapshot_header(const uint8_t *buffer, size_t buffer_size)
+{
+	TsMessageSnapshot_t *header = (TsMessageSnapshot_t *) buffer;
+	if (buffer_size < sizeof(TsMessageSnapshot_t) || header->magic != TS_MESSAGE_SNAPSHOT_MAGIC
+		|| header->version != TS_MESSAGE_SNAPSHOT_VERSION || header->node_size != sizeof(TsMessage_t)
+		|| header->nodes == 0 || header->size > buffer_size
+		|| header->size != sizeof(TsMessageSnapshot_t) + (uint64_t) header->nodes * sizeof(TsMessage_t)
+						   + header->strings) {
+		return NULL;
+	}
+	return header;
+}
+
+/* (private) _ts_message_snapshot_link */
+/* whether the given offset is none, or a node after the given one */
+static bool _ts_message_snapshot_link(const TsMessageSnapshot_t *header, size_t after, uintptr_t offset)
+{
+	size_t end = sizeof(TsMessageSnapshot_t) + (size_t) header->nodes * sizeof(TsMessage_t);
+	return offset == 0
+		   || (offset > after && offset < end && (offset - sizeof(TsMessageSnapshot_t)) % sizeof(TsMessage_t) == 0);
+}
+
+/* (private) _ts_message_snapshot_string */
+/* whether the given offset is a (zero terminated) string of the given length in the string table */
+static bool _ts_message_snapshot_string(const TsMessageSnapshot_t *header, uintptr_t offset, size_t length)
+{
+	size_t start = sizeof(TsMessageSnapshot_t) + (size_t) header->nodes * sizeof(TsMessage_t);
+	return offset >= start && offset + length < header->size && ((const uint8_t *) header)[offset + length] == '\0';
+}
+
+/* (private) _ts_message_snapshot_allocate */
+/* nodes (and long strings) added to a loaded snapshot are taken from the heap */
+static void * _ts_message_snapshot_allocate(void *context, size_t size)
+{
+	(void) context;
+#ifdef TS_MESSAGE_STATIC_MEMORY
+	(void) size;
+	return NULL;
+#else
+	return _ts_message_aligned(size);
+#endif
+}
+
+/* (private) _ts_message_snapshot_release */
+/* the nodes (and strings) of the image itself are released with the image, by its owner */
+static void _ts_message_snapshot_release(void *context, void *pointer, size_t size)
+{
+	(void) size;
+	TsMessageSnapshot_t *header = (TsMessageSnapshot_t *) context;
+	if ((uint8_t *) pointer < (uint8_t *) header || (uint8_t *) pointer >= (uint8_t *) header + header->size) {
+		free(pointer);
+	}
+}
+
+/* (private) _ts_message_trace_allocate */
+static void * _ts_message_trace_allocate(void *context, size_t size)
+{
+	TsMessageTraceRef_t trace = (TsMessageTraceRef_t) context;
+	uint64_t start = _ts_message_now();
+	void *pointer = trace->target != NULL ? trace->target->allocate(trace->target->context, size)
+											: _ts_message_aligned(size);
+	uint64_t created = _ts_message_now();
+
+	_ts_message_trace_lock(trace);
+	trace->allocate_ns += created - start;
+	if (pointer == NULL) {
+		trace->failures++;
+	} else {
+		trace->allocations++;
+		trace->live_bytes += size;
+		if (trace->live_bytes > trace->peak_bytes) {
+			trace->peak_bytes = trace->live_bytes;
+		}
+		if (trace->count < TS_MESSAGE_TRACE_SIZE) {
+			TsMessageTraceRecord_t *record = &(trace->records[(trace->count)++]);
+			record->pointer = pointer;
+			record->size = size;
+			record->function = _ts_message_site.function;
+			record->file = _ts_message_site.file;
+			record->line = _ts_message_site.line;
+			record->created = created;
+		} else {
+			trace->untracked++;
+		}
+	}
+	_ts_message_trace_unlock(trace);
+	return pointer;
+}
+
+/* (private) _ts_message_trace_release */
+static void _ts_message_trace_release(void *context, void *pointer, size_t size)
+{
+	TsMessageTraceRef_t trace = (TsMessageTraceRef_t) context;
+	uint64_t start = _ts_message_now();
+
+	/* drop the record (replacing it by the last), counting its lifetime */
+	_ts_message_trace_lock(trace);
+	trace->releases++;
+	trace->live_bytes -= size;
+	for (size_t i = 0; i < trace->count; i++) {
+		if (trace->records[i].pointer == pointer) {
+			_ts_message_latency(trace->lifetime, start - trace->records[i].created);
+			trace->records[i] = trace->records[--(trace->count)];
+			break;
+		}
+	}
+	_ts_message_trace_unlock(trace);
+
+	if (trace->target != NULL) {
+		trace->target->release(trace->target->context, pointer, size);
+	} else {
+		free(pointer);
+	}
+	_ts_message_atomic_add(&(trace->release_ns), _ts_message_now() - start);
+}
+
+/* (private) _ts_message_trace_lock */
+static void _ts_message_trace_lock(TsMessageTraceRef_t trace)
+{
+	while (__atomic_test_and_set(&(trace->lock), __ATOMIC_ACQUIRE)) {
+	}
+}
+
+/* (private) _ts_message_trace_unlock */
+static void _ts_message_trace_unlock(TsMessageTraceRef_t trace)
+{
+	__atomic_clear(&(trace->lock), __ATOMIC_RELEASE);
+}
+
+/* (private) _ts_message_thread_cache */
+static TsMessageCache_t * _ts_message_thread_cache()
+{
+	TsMessageCache_t *cache = &_ts_message_cache;
+	if (cache->id == 0) {
+		cache->id = _ts_message_atomic_add(&_ts_message_caches, 1);
+	}
+
+	/* claim a free counter slot, or share the last one */
+	if (cache->counters == NULL) {
+		cache->counters = &_ts_message_counters[TS_MESSAGE_MAX_THREADS - 1];
+		for (int i = 0; i < TS_MESSAGE_MAX_THREADS - 1; i++) {
+			bool used = false;
+			if (_ts_message_atomic_cas(&(_ts_message_counters[i].used), &used, true)) {
+				cache->counters = &_ts_message_counters[i];
+				break;
+			}
+		}
+	}
+	return cache;
+}
+
+/* (private) _ts_message_alloc */
+/* take a free node from the given allocator, or the cache of the calling thread, refilling it when empty */
+static TsMessageRef_t _ts_message_alloc(TsMessageAllocatorRef_t allocator, const char *function)
+{
+	TsMessageCache_t *cache = _ts_message_thread_cache();
+	if (allocator != NULL) {
+		_ts_message_site.function = function;
+		TsMessageRef_t node = (TsMessageRef_t) allocator->allocate(allocator->context, sizeof(TsMessage_t));
+		if (node == NULL) {
+			_ts_message_count(cache->counters->failures, 1);
+		} else {
+			_ts_message_count(cache->counters->creates, 1);
+		}
+		return node;
+	}
+	if (cache->count == 0) {
+		_ts_message_refill(cache);
+		if (cache->count == 0) {
+			_ts_message_count(cache->counters->failures, 1);
+			return NULL;
+		}
+	}
+	_ts_message_count(cache->counters->creates, 1);
+	return cache->nodes[--(cache->count)];
+}
+
+/* (private) _ts_message_free */
+/* return a destroyed node to its allocator, or the cache of the calling thread, flushing half of it when full */
+static void _ts_message_free(TsMessageRef_t message)
+{
+	TsMessageCache_t *cache = _ts_message_thread_cache();
+	_ts_message_count(cache->counters->destroys, 1);
+	_ts_message_release_string(message);
+	_ts_message_release_encoding(message);
+	if (message->allocator != NULL) {
+		message->allocator->release(message->allocator->context, message, sizeof(TsMessage_t));
+		return;
+	}
+	if (message->cache != cache->id) {
+		cache->remote_frees++;
+	}
+	if (cache->count == TS_MESSAGE_CACHE_SIZE) {
+		_ts_message_flush(cache, TS_MESSAGE_CACHE_BATCH);
+	}
+	cache->nodes[(cache->count)++] = message;
+}
+
+/* (private) _ts_message_refill */
+static void _ts_message_refill(TsMessageCache_t *cache)
+{
+	int count = cache->count;
+#ifdef TS_MESSAGE_STATIC_MEMORY
+	while (cache->count < TS_MESSAGE_CACHE_BATCH) {
+		TsMessageRef_t node = _ts_message_pop();
+		if (node == NULL) {
+			break;
+		}
+		cache->nodes[(cache->count)++] = node;
+	}
+#else
+	_ts_message_lock();
+	while (cache->count < TS_MESSAGE_CACHE_BATCH && _ts_message_pool != NULL) {
+		TsMessageRef_t node = _ts_message_pool;
+		_ts_message_pool = node->next;
+		_ts_message_pool_size--;
+		cache->nodes[(cache->count)++] = node;
+	}
+	_ts_message_unlock();
+
+	/* allocate the remainder */
+	while (cache->count < TS_MESSAGE_CACHE_BATCH) {
+		TsMessageRef_t node = (TsMessageRef_t) (_ts_message_aligned(sizeof(TsMessage_t)));
+		if (node == NULL) {
+			break;
+		}
+		cache->nodes[(cache->count)++] = node;
+	}
+#endif
+	if (cache->count > count) {
+		_ts_message_atomic_add(&(_ts_message_cache_statistics.refills), 1);
+
+		/* track the peak of the nodes held */
+		int held = _ts_message_atomic_add(&_ts_message_counter, cache->count - count);
+		int peak = _ts_message_atomic_load(&_ts_message_peak);
+		while (held > peak && !_ts_message_atomic_cas(&_ts_message_peak, &peak, held)) {
+		}
+	}
+	_ts_message_atomic_add(&(_ts_message_cache_statistics.remote_frees), cache->remote_frees);
+	cache->remote_frees = 0;
+}
+
+/* (private) _ts_message_flush */
+/* return the given number of nodes from the top of the cache to the shared node pool */
+static void _ts_message_flush(TsMessageCache_t *cache, int count)
+{
+	if (count > cache->count) {
+		count = cache->count;
+	}
+	if (count > 0) {
+		cache->count -= count;
+#ifdef TS_MESSAGE_STATIC_MEMORY
+		for (int i = 0; i < count; i++) {
+			_ts_message_push(cache->nodes[cache->count + i]);
+		}
+		if (_ts_message_atomic_add(&_ts_message_counter, -count) <= 0) {
+			dbg_printf("ts_message_destroy: all messages that had been created are now destroyed\n");
+		}
+#else
+		_ts_message_atomic_add(&_ts_message_counter, -count);
+		int i = 0;
+		_ts_message_lock();
+		for (; i < count && _ts_message_pool_size < TS_MESSAGE_POOL_SIZE; i++) {
+			TsMessageRef_t node = cache->nodes[cache->count + i];
+			node->next = _ts_message_pool;
+			_ts_message_pool = node;
+			_ts_message_pool_size++;
+		}
+		_ts_message_unlock();
+
+		/* free the remainder */
+		for (; i < count; i++) {
+			free(cache->nodes[cache->count + i]);
+		}
+#endif
+		_ts_message_atomic_add(&(_ts_message_cache_statistics.flushes), 1);
+	}
+	_ts_message_atomic_add(&(_ts_message_cache_statistics.remote_frees), cache->remote_frees);
+	cache->remote_frees = 0;
+}
+
+/**
+ * Set the current message node to the given type and value. The optional field may be used to set a node relative
+ * to the one given, e.g., as in a JSON object field.
+ * @param message
+ * The object of the action, set.
+ * @param field
+ * The optional field name, e.g., a JSON object field. If this value is NULL, then the given message node type and
+ * value is set with the ones given. Otherwise, if this value isn't NULL, then the given message node is treated as
+ * an object, and the value as the fields, where one field is named, typed and valued with the values provided.
+ * @param type
+ * The type of the message, e.g., TsTypeInteger, TsTypeFloat, etc.
+ * @param value
+ * The value of the message, e.g., int, float, etc. Warning, if the given value is a message or array type, the
+ * value is copied (not reference counted), the caller will need to insure the value is deleted w/o.r.t. the given
+ * message's eventual 'destroy'.
+ * @return
+ * The status of the call as defined by ts_common.h
+ */
+static TsStatus_t _ts_message_set(TsMessageRef_t message, TsPathNode_t field, TsType_t type, TsValue_t value)
 {
-	/* report some basic statistics */
-	dbg_printf("initializing messaging, message_t size (%lu) preallocated message nodes (%d)\n", sizeof(TsMessage_t),
-			   TS_MESSAGE_MAX_NODES);
+	/* check preconditions */
+	if (message == NULL || (type != TsTypeNull && value == NULL)) {
+		return TsStatusErrorPreconditionFailed;
+	}
+
+	/* set the given node itself (e.g., a template leaf), without a key lookup */
+	if (field == NULL) {
+		if (!_ts_message_is_primitive(message->type)) {
+			return TsStatusErrorPreconditionFailed;
+		}
+		_ts_message_touch(message->parent);
+		return _ts_message_assign(message, type, value);
+	}
+
+	/* search for the relevant node, i.e., either new (appended) or established previously */
+	TsMessageRef_t *link = _ts_message_find(message, field);
+	TsMessageRef_t branch = *link;
+
+	/* the structure of a frozen message is fixed, only its leaf values may change */
+	if ((message->flags & TS_MESSAGE_FLAG_FROZEN) != 0) {
+		if (branch == NULL || !_ts_message_is_primitive(branch->type)) {
+			dbg_printf("failed to set (%s), the message is frozen\n", field);
+			return TsStatusErrorPreconditionFailed;
+		}
+		_ts_message_touch(message);
+		return _ts_message_assign(branch, type, value);
+	}
+
+	/* primitives are overwritten in place, avoiding a destroy and (re)create */
+	if (branch != NULL && _ts_message_is_primitive(branch->type) && _ts_message_is_primitive(type)) {
+		_ts_message_touch(message);
+		return _ts_message_assign(branch, type, value);
+	}
+
+	/* there isn't a branch available */
+	if (branch == NULL && message->size >= TS_MESSAGE_MAX_BRANCHES) {
+		dbg_printf("failed to set (%s), there are no additional nodes available\n", field);
+		return TsStatusErrorPayloadTooLarge;
+	}
+
+	/* establish the new branch */
+	TsMessageRef_t update;
+	switch (type) {
+
+	case TsTypeInteger:
+	case TsTypeFloat:
+	case TsTypeBoolean:
+	case TsTypeString:
+	case TsTypeNull: {
+
+		/* create a new messsage */
+		if (_ts_message_is_too_deep(type, message->depth + 1)) {
+			return TsStatusErrorRecursionTooDeep;
+		}
+		TsStatus_t status = _ts_message_create(message->allocator, "_ts_message_set", &update);
+		if (status != TsStatusOk) {
+			dbg_printf("_ts_message_set: failed to create new primitive(%d)\n", status);
+			return status;
+		}
+		update->depth = message->depth + 1;
+		status = _ts_message_assign(update, type, value);
+		if (status != TsStatusOk) {
+			ts_message_destroy(update);
+			return status;
+		}
+		break;
+	}
+	case TsTypeMessage:
+	case TsTypeArray: {
 
-	/* initialize message management system */
-	for (int i = 0; i < TS_MESSAGE_MAX_NODES; i++) {
+		/* copy given messsage */
+		TsStatus_t status = _ts_message_copy(message->allocator, (TsMessageRef_t) value, message->depth + 1, &update);
+		if (status != TsStatusOk) {
+			dbg_printf("_ts_message_set: failed to copy message or array(%d)\n", status);
+			return status;
+		}
 
-		/* just mark everything free */
-		_ts_message_nodes[i].references = 0;
+		/* (only containers are retyped, a copied primitive is linked as it is) */
+		if (!_ts_message_is_primitive(update->type)) {
+			update->type = type;
+		}
+		break;
 	}
-	_ts_message_nodes_initialized = true;
+	default:
 
-	/* return ok */
+		dbg_printf("_ts_message_set: unknown type\n");
+		return TsStatusErrorBadRequest;
+	}
+	_ts_message_name(update, field);
+
+	/* (re)link the updated branch in place, */
+	/* and only then destroy the old message (if overwriting) */
+	update->next = branch != NULL ? branch->next : NULL;
+	_ts_message_link(message, update);
+	*link = update;
+	_ts_message_touch(message);
+	_ts_message_atomic_add(&_ts_message_generation, 1);
+	if (branch != NULL) {
+		ts_message_destroy(branch);
+	} else {
+		message->size++;
+	}
 	return TsStatusOk;
 }
-#endif
+
+/* _ts_message_is_primitive */
+static bool _ts_message_is_primitive(TsType_t type)
+{
+	return type != TsTypeMessage && type != TsTypeArray;
+}
 
 /**
- * Set the current message node to the given type and value. The optional field may be used to set a node relative
- * to the one given, e.g., as in a JSON object field.
+ * Assign the given primitive type and value to the message node in place, i.e., without allocation
+ * (but for strings too long to be kept inline).
  * @param message
- * The object of the action, set.
- * @param field
- * The optional field name, e.g., a JSON object field. If this value is NULL, then the given message node type and
- * value is set with the ones given. Otherwise, if this value isn't NULL, then the given message node is treated as
- * an object, and the value as the fields, where one field is named, typed and valued with the values provided.
+ * The (primitive) message node to assign.
  * @param type
- * The type of the message, e.g., TsTypeInteger, TsTypeFloat, etc.
+ * The type of the value, e.g., TsTypeInteger, TsTypeFloat, etc. Frozen nodes keep their type.
  * @param value
- * The value of the message, e.g., int, float, etc. Warning, if the given value is a message or array type, the
- * value is copied (not reference counted), the caller will need to insure the value is deleted w/o.r.t. the given
- * message's eventual 'destroy'.
+ * The value, e.g., int, float, etc.
  * @return
  * The status of the call as defined by ts_common.h
  */
-static TsStatus_t _ts_message_set(TsMessageRef_t message, TsPathNode_t field, TsType_t type, TsValue_t value)
+static TsStatus_t _ts_message_assign(TsMessageRef_t message, TsType_t type, TsValue_t value)
 {
 	/* check preconditions */
-	if (message == NULL || (type != TsTypeNull && value == NULL)) {
+	if (!_ts_message_is_primitive(type)) {
+		return TsStatusErrorBadRequest;
+	}
+	if ((message->flags & TS_MESSAGE_FLAG_FROZEN) != 0 && message->type != type) {
+		dbg_printf("failed to set (%s), the frozen type cannot change\n", message->name);
 		return TsStatusErrorPreconditionFailed;
 	}
 
-	/* search for the relevant node */
-	/* normally assume we're adding or modifying a field, */
-	/* however we will check for primitives during the first iteration */
-	for (int i = 0; i < TS_MESSAGE_MAX_BRANCHES; i++) {
+	/* (re)set the type and value */
+	if (message->type == TsTypeString && type != TsTypeString) {
+		_ts_message_release_string(message);
+		message->size = 0;
+	}
+	message->type = type;
+	switch (type) {
 
-		/* check for primitives */
-		TsMessageRef_t branch = message;
-		if (field != NULL) {
+	case TsTypeInteger:
 
-			/* the path node is either new or has been established previously */
-			branch = message->value._xfields[i];
-			if (branch == NULL || strcmp(field, branch->name) == 0) {
+		message->value._xinteger = *((int *) (value));
+		break;
 
-				/* destroy the old message if overwriting a new value */
-				if (branch != NULL) {
-					message->value._xfields[i] = NULL;
-					ts_message_destroy(branch);
-				}
+	case TsTypeFloat:
 
-				/* establish branch */
-				switch (type) {
+		message->value._xfloat = *((float *) (value));
+		break;
 
-				case TsTypeInteger:
-				case TsTypeFloat:
-				case TsTypeBoolean:
-				case TsTypeString:
-				case TsTypeNull: {
+	case TsTypeBoolean:
 
-					/* (re)create a new messsage */
-					TsStatus_t status = ts_message_create(&branch);
-					if (status != TsStatusOk) {
-						dbg_printf("_ts_message_set: failed to create new primitive(%d)\n", status);
-						return status;
-					}
-					break;
-				}
-				case TsTypeMessage:
-				case TsTypeArray: {
-
-					/* copy given messsage */
-					TsStatus_t status = ts_message_create_copy((TsMessageRef_t) value, &branch);
-					if (status != TsStatusOk) {
-						dbg_printf("_ts_message_set: failed to copy message or array(%d)\n", status);
-						return status;
-					}
-					break;
-				}
-				default:
+		message->value._xboolean = *((bool *) (value));
+		break;
 
-					dbg_printf("_ts_message_set: unknown type\n");
-					return TsStatusErrorBadRequest;
-				}
-			} else {
-				continue;
-			}
+	case TsTypeString:
 
-			/* (re)set this field array to the updated branch */
-			message->value._xfields[i] = branch;
+		if ((message->flags & TS_MESSAGE_FLAG_BORROWED) == 0 && _ts_message_string(message) == (char *) value) {
+			break;
 		}
+		return _ts_message_store(message, (char *) value, strlen((char *) value));
 
-		/* (re)set the field name and type */
-		snprintf(branch->name, TS_MESSAGE_MAX_KEY_SIZE, "%s", field);
-		branch->type = type;
-
-		/* (re)set the field value */
-		switch (type) {
-
-		case TsTypeInteger:
-
-			branch->value._xinteger = *((int *) (value));
-			break;
+	case TsTypeNull:
+	default:
 
-		case TsTypeFloat:
+		/* do nothing */
+		break;
+	}
+	return TsStatusOk;
+}
 
-			branch->value._xfloat = *((float *) (value));
-			break;
+/* _ts_message_flag */
+/* set or clear the given flag on the message and all of its branches */
+static void _ts_message_flag(TsMessageRef_t message, unsigned int flag, bool set)
+{
+	if (set) {
+		message->flags |= flag;
+	} else {
+		message->flags &= ~flag;
+	}
+	if (!_ts_message_is_primitive(message->type)) {
+		for (TsMessageRef_t branch = message->value._xbranches; branch != NULL; branch = branch->next) {
+			_ts_message_flag(branch, flag, set);
+		}
+	}
+}
 
-		case TsTypeBoolean:
+/* _ts_message_child */
+/* find the branch of a message by name, or the item of an array by (decimal) index */
+static TsStatus_t _ts_message_child(TsMessageRef_t message, TsPathNode_t node, TsMessageRef_t *value)
+{
+	if (message != NULL && message->type == TsTypeArray) {
+		char *end;
+		unsigned long index = strtoul(node, &end, 10);
+		if (end == node || *end != '\0') {
+			return TsStatusErrorNotFound;
+		}
+		return ts_message_get_at(message, (size_t) index, value);
+	}
+	return ts_message_has(message, node, value);
+}
 
-			branch->value._xboolean = *((bool *) (value));
-			break;
+/* _ts_message_path_parent */
+/* resolve all but the last node of the given path, optionally creating the messages along it */
+static TsStatus_t _ts_message_path_parent(TsMessageRef_t message, TsPath_t path, bool create,
+										  TsMessageRef_t *parent, TsPathNode_t *field)
+{
+	/* check preconditions */
+	if (message == NULL || path == NULL || path[0] == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
 
-		case TsTypeString:
+	TsMessageRef_t current = message;
+	size_t depth = 0;
+	for (; path[depth + 1] != NULL; depth++) {
+		if (depth + 1 >= TS_MESSAGE_MAX_DEPTH) {
+			return TsStatusErrorRecursionTooDeep;
+		}
+		TsMessageRef_t next;
+		TsStatus_t status = _ts_message_child(current, path[depth], &next);
+		if (status == TsStatusErrorNotFound && create && current->type == TsTypeMessage) {
+			status = ts_message_create_message(current, path[depth], &next);
+		}
+		if (status != TsStatusOk) {
+			return status;
+		}
+		current = next;
+	}
+	*parent = current;
+	*field = path[depth];
+	return TsStatusOk;
+}
 
-			snprintf(branch->value._xstring, TS_MESSAGE_MAX_STRING_SIZE, "%s", (char *) value);
-			if (strlen(branch->value._xstring) < strlen((char *) value)) {
-				dbg_printf("issue detected during set (%s), string truncated; the given string is too large\n",
-						   field);
-			}
-			break;
+/* _ts_message_get_path */
+static TsStatus_t _ts_message_get_path(TsMessageRef_t message, TsPath_t path, TsType_t type, TsValue_t value)
+{
+	TsMessageRef_t object;
+	TsStatus_t status = ts_message_get_path(message, path, &object);
+	if (status != TsStatusOk) {
+		return status;
+	}
+	return _ts_message_get(object, NULL, type, value);
+}
 
-		case TsTypeMessage:
-		case TsTypeArray:
-		case TsTypeNull:
+/* _ts_message_set_path */
+static TsStatus_t _ts_message_set_path(TsMessageRef_t message, TsPath_t path, TsType_t type, TsValue_t value)
+{
+	TsMessageRef_t parent;
+	TsPathNode_t field;
+	TsStatus_t status = _ts_message_path_parent(message, path, true, &parent, &field);
+	if (status != TsStatusOk) {
+		return status;
+	}
 
-			/* do nothing */
-			break;
+	/* array items are (re)set in place, i.e., the array isn't extended */
+	if (parent->type == TsTypeArray) {
+		TsMessageRef_t item;
+		status = _ts_message_child(parent, field, &item);
+		if (status != TsStatusOk) {
+			return status;
 		}
-
-		return TsStatusOk;
+		return _ts_message_set(item, NULL, type, value);
 	}
-
-	/* there isn't a branch available */
-	dbg_printf("failed to set (%s), there are no additional nodes available\n", field);
-	return TsStatusErrorPayloadTooLarge;
+	return _ts_message_set(parent, field, type, value);
 }
 
 /* _ts_message_get */
 static TsStatus_t _ts_message_get(TsMessageRef_t message, TsPathNode_t field, TsType_t type, TsValue_t value)
 {
-	TsMessageRef_t object;
-	if (ts_message_has(message, field, &object) == TsStatusOk) {
+	/* a NULL field gets the given node itself, e.g., a resolved path */
+	TsMessageRef_t object = message;
+	if ((field == NULL && message != NULL) || ts_message_has(message, field, &object) == TsStatusOk) {
 
 		/* automatic type promotion */
 		switch (object->type) {
@@ -841,7 +4625,7 @@ static TsStatus_t _ts_message_get(TsMessageRef_t message, TsPathNode_t field, Ts
 			return TsStatusOk;
 
 		case TsTypeString:
-			*((char **) (value)) = object->value._xstring;
+			*((char **) (value)) = _ts_message_string(object);
 			return TsStatusOk;
 
 		case TsTypeMessage:
@@ -864,12 +4648,64 @@ static TsStatus_t _ts_message_get(TsMessageRef_t message, TsPathNode_t field, Ts
 
 /* _ts_message_encode_none */
 /* simple debug based 'encoder', display the structure of the message as it stands */
-static TsStatus_t _ts_message_encode_debug(TsMessageRef_t message, int depth)
+static TsStatus_t _ts_message_encode_debug(TsMessageRef_t message)
+{
+	TsMessageFrame_t stack[TS_MESSAGE_MAX_DEPTH];
+	size_t top = 0;
+	TsMessageRef_t node = message;
+	for (;;) {
+
+		/* display the node (indented by its level), and descend into messages and arrays */
+		if (node != NULL) {
+			_ts_message_debug_node(node, top);
+			if (!_ts_message_is_primitive(node->type)) {
+				if (top == TS_MESSAGE_MAX_DEPTH) {
+					return TsStatusErrorRecursionTooDeep;
+				}
+				_ts_message_push_frame(&(stack[top++]), node);
+			} else if (top > 0 && stack[top - 1].message->type == TsTypeArray) {
+				_ts_message_debug_node(NULL, top - 1);
+			}
+			node = NULL;
+		}
+		if (top == 0) {
+			break;
+		}
+
+		/* next branch, items of arrays are enclosed in braces */
+		TsMessageFrame_t *frame = &(stack[top - 1]);
+		if (frame->branch != NULL) {
+			if (frame->message->type == TsTypeArray) {
+				for (size_t i = 0; i < top - 1; i++) {
+					dbg_printf("  ");
+				}
+				dbg_printf("[%d] = {\n", frame->index);
+			}
+			node = frame->branch;
+			frame->branch = node->next;
+			frame->index++;
+		} else {
+			top--;
+			if (top > 0 && stack[top - 1].message->type == TsTypeArray) {
+				_ts_message_debug_node(NULL, top - 1);
+			}
+		}
+	}
+	return TsStatusOk;
+}
+
+/* _ts_message_debug_node */
+/* display a single node at the given level, or the closing brace of an array item when NULL */
+static void _ts_message_debug_node(TsMessageRef_t message, size_t depth)
 {
 	/* pretty print (indent) */
-	for (int i = 0; i < depth; i++) {
+	for (size_t i = 0; i < depth; i++) {
 		dbg_printf("  ");
 	}
+	if (message == NULL) {
+		dbg_printf("}\n");
+		return;
+	}
 	if (strlen(message->name) > 0) {
 		dbg_printf("%s", message->name);
 	}
@@ -893,196 +4729,309 @@ static TsStatus_t _ts_message_encode_debug(TsMessageRef_t message, int depth)
 		break;
 
 	case TsTypeString:
-		dbg_printf(":string( %s )\n", message->value._xstring);
+		dbg_printf(":string( %s )\n", _ts_message_string(message));
 		break;
 
-	case TsTypeArray: {
+	case TsTypeArray:
 		dbg_printf(":array\n");
-		for (int i = 0; i < TS_MESSAGE_MAX_BRANCHES; i++) {
-			TsMessageRef_t branch = message->value._xfields[i];
-			if (branch == NULL) {
-				break;
-			}
-			for (int i = 0; i < depth; i++) {
-				dbg_printf("  ");
-			}
-			dbg_printf("[%d] = {\n", i);
-			_ts_message_encode_debug(branch, depth + 1);
-			for (int i = 0; i < depth; i++) {
-				dbg_printf("  ");
-			}
-			dbg_printf("}\n");
-		}
 		break;
-	}
-	case TsTypeMessage: {
+
+	case TsTypeMessage:
 		dbg_printf(":message\n");
-		for (int i = 0; i < TS_MESSAGE_MAX_BRANCHES; i++) {
-			TsMessageRef_t branch = message->value._xfields[i];
-			if (branch == NULL) {
-				break;
-			}
-			_ts_message_encode_debug(branch, depth + 1);
-		}
 		break;
-	}
+
 	default:
 		dbg_printf(":unknown\n");
 		break;
 	}
-	return TsStatusOk;
 }
 
 /* _ts_message_encode_json */
+/* appends to the (zero terminated) contents of the given buffer */
 static TsStatus_t _ts_message_encode_json(TsMessageRef_t message, uint8_t *buffer, size_t buffer_size)
 {
-	/* re-point buffer append */
 	/* TODO - check for negative sizes, etc. */
 	char *xbuffer = (char *) buffer;
-	size_t xbuffer_size = buffer_size - strlen(xbuffer);
-	xbuffer = xbuffer + strlen(xbuffer);
-
-	/* display type and value */
-	switch (message->type) {
-	case TsTypeNull:
-		snprintf(xbuffer, xbuffer_size, "null");
-		break;
-
-	case TsTypeInteger:
-		snprintf(xbuffer, xbuffer_size, "%d", message->value._xinteger);
-		break;
-
-	case TsTypeFloat:
-		snprintf(xbuffer, xbuffer_size, "%f", message->value._xfloat);
-		break;
-
-	case TsTypeBoolean:
-		snprintf(xbuffer, xbuffer_size, "%s", message->value._xboolean ? "true" : "false");
-		break;
+	size_t length = strlen(xbuffer);
 
-	case TsTypeString:
-		snprintf(xbuffer, xbuffer_size, "\"%s\"", message->value._xstring);
-		break;
+	TsMessageFrame_t stack[TS_MESSAGE_MAX_DEPTH];
+	size_t top = 0;
+	TsMessageRef_t node = message;
+	for (;;) {
 
-	case TsTypeArray: {
-		snprintf(xbuffer + strlen(xbuffer), xbuffer_size - strlen(xbuffer), "[");
-		for (int i = 0; i < TS_MESSAGE_MAX_BRANCHES; i++) {
-			TsMessageRef_t branch = message->value._xfields[i];
-			if (branch == NULL) {
-				break;
+		/* open the node (keyed in a message), and descend into messages and arrays,... */
+		if (node != NULL) {
+			if ((unsigned int) node->type > TsTypeNull) {
+				return TsStatusErrorInternalServerError;
 			}
-			if (i > 0) {
-				/* TODO - check for negative sizes, etc. */
-				snprintf(xbuffer + strlen(xbuffer), xbuffer_size - strlen(xbuffer), ",");
-			}
-			switch (branch->type) {
-			case TsTypeArray:
-				snprintf(xbuffer + strlen(xbuffer), xbuffer_size - strlen(xbuffer), "[");
-				_ts_message_encode_json(branch, buffer, buffer_size);
-				snprintf(xbuffer + strlen(xbuffer), xbuffer_size - strlen(xbuffer), "]");
-				break;
-			default:
-				_ts_message_encode_json(branch, buffer, buffer_size);
-				break;
+			TsMessageRef_t parent = top > 0 ? stack[top - 1].message : NULL;
+			const TsMessageEncoding_t *cached = top > 0 ? _ts_message_cached(node, TS_MESSAGE_ENCODING_JSON) : NULL;
+			_ts_message_json_key(node, parent, top > 0 ? stack[top - 1].index : 0, xbuffer, buffer_size, &length);
+			if (cached != NULL) {
+				_ts_message_append(xbuffer, buffer_size, &length, "%.*s", (int) cached->sizes[TS_MESSAGE_ENCODING_JSON],
+								   (const char *) cached->bytes[TS_MESSAGE_ENCODING_JSON]);
+			} else {
+				size_t start = length;
+				_ts_message_json_node(node, xbuffer, buffer_size, &length);
+				if (!_ts_message_is_primitive(node->type)) {
+					if (top == TS_MESSAGE_MAX_DEPTH) {
+						return TsStatusErrorRecursionTooDeep;
+					}
+					_ts_message_push_frame(&(stack[top]), node);
+					stack[top++].start = start;
+				}
 			}
+			node = NULL;
 		}
-		snprintf(xbuffer + strlen(xbuffer), xbuffer_size - strlen(xbuffer), "]");
-		break;
-	}
-	case TsTypeMessage: {
-		snprintf(xbuffer + strlen(xbuffer), xbuffer_size - strlen(xbuffer), "{");
-		for (int i = 0; i < TS_MESSAGE_MAX_BRANCHES; i++) {
-			TsMessageRef_t branch = message->value._xfields[i];
-			if (branch == NULL) {
-				break;
+		if (top == 0) {
+			break;
+		}
+
+		/* ...then close it once all of its branches are done (arrays in arrays are bracketed twice) */
+		TsMessageFrame_t *frame = &(stack[top - 1]);
+		if (frame->branch != NULL) {
+			node = frame->branch;
+			frame->branch = node->next;
+			frame->index++;
+		} else {
+			top--;
+			if (frame->message->type == TsTypeMessage) {
+				_ts_message_append(xbuffer, buffer_size, &length, "}");
+			} else if (top > 0 && stack[top - 1].message->type == TsTypeArray) {
+				_ts_message_append(xbuffer, buffer_size, &length, "]]");
 			} else {
-				/* TODO - check for negative sizes, etc. */
-				if (i > 0) {
-					snprintf(xbuffer + strlen(xbuffer), xbuffer_size - strlen(xbuffer), ",");
-				}
-				snprintf(xbuffer + strlen(xbuffer), xbuffer_size - strlen(xbuffer), "\"%s\":", branch->name);
-				_ts_message_encode_json(branch, buffer, buffer_size);
+				_ts_message_append(xbuffer, buffer_size, &length, "]");
+			}
+
+			/* (the encoding of a message is only complete when not truncated) */
+			if (top > 0 && length < buffer_size - 1) {
+				_ts_message_remember(frame->message, TS_MESSAGE_ENCODING_JSON, buffer + frame->start,
+									 length - frame->start);
 			}
 		}
-		snprintf(xbuffer + strlen(xbuffer), xbuffer_size - strlen(xbuffer), "}");
-		break;
-	}
-	default:
-		return TsStatusErrorInternalServerError;
 	}
 
 	/* check if we've used up the buffer */
-	/* note, snprintf is safe, it wont overwrite the given buffer size */
+	/* note, the output is truncated (as by snprintf), it wont overwrite the given buffer size */
 	/* note also, the buffer_size includes the terminating null */
-	if (strlen((char *) buffer) >= (buffer_size - 1)) {
+	if (length >= (buffer_size - 1)) {
 		return TsStatusErrorOutOfMemory;
 	}
 	return TsStatusOk;
 }
 
-/* _ts_message_encode_cbor */
-static TsStatus_t _ts_message_encode_cbor(TsMessageRef_t message, CborEncoder *encoder, uint8_t *buffer,
-										  size_t buffer_size)
+/* _ts_message_json_key */
+/* start the given node as the next branch (index) of its parent, i.e., */
+/* separated from the previous branch, and keyed in a message */
+static void _ts_message_json_key(TsMessageRef_t message, TsMessageRef_t parent, int index, char *buffer,
+								 size_t buffer_size, size_t *length)
+{
+	/* the index is of the next branch by now */
+	if (parent != NULL && index > 1) {
+		_ts_message_append(buffer, buffer_size, length, ",");
+	}
+	if (parent != NULL && parent->type == TsTypeMessage) {
+		_ts_message_append(buffer, buffer_size, length, "\"%s\":", message->name);
+	} else if (parent != NULL && message->type == TsTypeArray) {
+		_ts_message_append(buffer, buffer_size, length, "[");
+	}
+}
+
+/* _ts_message_json_node */
+/* append the value of the given node, i.e., opened when a message or array */
+static void _ts_message_json_node(TsMessageRef_t message, char *buffer, size_t buffer_size, size_t *length)
 {
 	/* display type and value */
 	switch (message->type) {
 	case TsTypeNull:
-		cbor_encode_text_stringz(encoder, message->name);
-		cbor_encode_null(encoder);
+		_ts_message_append(buffer, buffer_size, length, "null");
 		break;
 
 	case TsTypeInteger:
-		cbor_encode_text_stringz(encoder, message->name);
-		cbor_encode_int(encoder, message->value._xinteger);
+		_ts_message_append(buffer, buffer_size, length, "%d", message->value._xinteger);
 		break;
 
 	case TsTypeFloat:
-		cbor_encode_text_stringz(encoder, message->name);
-		cbor_encode_float(encoder, message->value._xfloat);
+		_ts_message_append(buffer, buffer_size, length, "%f", message->value._xfloat);
 		break;
 
 	case TsTypeBoolean:
-		cbor_encode_text_stringz(encoder, message->name);
-		cbor_encode_boolean(encoder, message->value._xboolean);
+		_ts_message_append(buffer, buffer_size, length, "%s", message->value._xboolean ? "true" : "false");
 		break;
 
 	case TsTypeString:
-		cbor_encode_text_stringz(encoder, message->name);
-		cbor_encode_text_stringz(encoder, message->value._xstring);
+		_ts_message_append(buffer, buffer_size, length, "\"%.*s\"", (int) message->size, _ts_message_string(message));
 		break;
 
-	case TsTypeArray: {
-		/* TODO - add array */
-		return TsStatusErrorNotImplemented;
+	case TsTypeArray:
+		_ts_message_append(buffer, buffer_size, length, "[");
+		break;
+
+	case TsTypeMessage:
+		_ts_message_append(buffer, buffer_size, length, "{");
+		break;
+
+	default:
+		break;
 	}
-	case TsTypeMessage: {
+}
 
-		/* tag if not root */
-		if (strcmp(message->name, "$root") != 0) {
-			cbor_encode_text_stringz(encoder, message->name);
+/* _ts_message_append */
+/* append to the (zero terminated) contents of the given buffer, truncating as snprintf */
+static void _ts_message_append(char *buffer, size_t buffer_size, size_t *length, const char *format, ...)
+{
+	if (*length + 1 >= buffer_size) {
+		return;
+	}
+	va_list arguments;
+	va_start(arguments, format);
+	int written = vsnprintf(buffer + *length, buffer_size - *length, format, arguments);
+	va_end(arguments);
+	if (written > 0) {
+		*length = *length + (size_t) written < buffer_size - 1 ? *length + (size_t) written : buffer_size - 1;
+	}
+}
+
+/* _ts_message_json_depth */
+/* the deepest nesting of objects and arrays in the given json text */
+static size_t _ts_message_json_depth(const char *text, size_t size)
+{
+	size_t depth = 0, deepest = 0;
+	bool string = false;
+	for (size_t i = 0; i < size && text[i] != '\0'; i++) {
+		char c = text[i];
+		if (string) {
+			if (c == '\\') {
+				i++;
+			} else if (c == '"') {
+				string = false;
+			}
+		} else if (c == '"') {
+			string = true;
+		} else if (c == '{' || c == '[') {
+			depth++;
+			deepest = depth > deepest ? depth : deepest;
+		} else if ((c == '}' || c == ']') && depth > 0) {
+			depth--;
 		}
+	}
+	return deepest;
+}
+
+/* (private) _ts_message_cbor_splice */
+/* append the given (cached) encoding as the next item of the given map, as tinycbor appends, */
+/* i.e., counting the bytes needed once out of space */
+static void _ts_message_cbor_splice(CborEncoder *encoder, const uint8_t *bytes, size_t size)
+{
+	encoder->added++;
+	if (encoder->end != NULL && (size_t) (encoder->end - encoder->data.ptr) >= size) {
+		memcpy(encoder->data.ptr, bytes, size);
+		encoder->data.ptr += size;
+		return;
+	}
+	if (encoder->end != NULL) {
+		size -= (size_t) (encoder->end - encoder->data.ptr);
+		encoder->end = NULL;
+		encoder->data.bytes_needed = 0;
+	}
+	encoder->data.bytes_needed += (ptrdiff_t) size;
+}
+
+/* _ts_message_encode_cbor */
+static TsStatus_t _ts_message_encode_cbor(TsMessageRef_t message, CborEncoder *encoder, uint8_t *buffer,
+										  size_t buffer_size)
+{
+	/* the map (or array) encoder of each level */
+	TsMessageFrame_t stack[TS_MESSAGE_MAX_DEPTH];
+	CborEncoder maps[TS_MESSAGE_MAX_DEPTH];
+	size_t top = 0;
+	TsMessageRef_t node = message;
+	for (;;) {
+		if (node != NULL) {
+
+			/* keyed in a message, i.e., everywhere but in arrays and on the root (unless a branch) */
+			if ((unsigned int) node->type > TsTypeNull) {
+				return TsStatusErrorInternalServerError;
+			}
+			CborEncoder *parent = top > 0 ? &(maps[top - 1]) : encoder;
+			bool keyed = top > 0 ? stack[top - 1].message->type == TsTypeMessage
+								 : _ts_message_is_primitive(node->type) || strcmp(node->name, "$root") != 0;
+			if (keyed) {
+				cbor_encode_text_stringz(parent, node->name);
+			}
+
+			/* display type and value */
+			switch (node->type) {
+			case TsTypeNull:
+				cbor_encode_null(parent);
+				break;
+
+			case TsTypeInteger:
+				cbor_encode_int(parent, node->value._xinteger);
+				break;
+
+			case TsTypeFloat:
+				cbor_encode_float(parent, node->value._xfloat);
+				break;
+
+			case TsTypeBoolean:
+				cbor_encode_boolean(parent, node->value._xboolean);
+				break;
+
+			case TsTypeString:
+				cbor_encode_text_string(parent, _ts_message_string(node), node->size);
+				break;
 
-		/* determine size of map */
-		/* TODO - avoid search, hold current free index in root */
-		size_t length = TS_MESSAGE_MAX_BRANCHES;
-		for (size_t i = 0; i < TS_MESSAGE_MAX_BRANCHES; i++) {
-			if (message->value._xfields[i] == NULL) {
-				length = i;
+			case TsTypeArray:
+			case TsTypeMessage: {
+				if (top == TS_MESSAGE_MAX_DEPTH) {
+					return TsStatusErrorRecursionTooDeep;
+				}
+
+				/* splice the cached map (or array),... */
+				const TsMessageEncoding_t *cached = top > 0 ? _ts_message_cached(node, TS_MESSAGE_ENCODING_CBOR) : NULL;
+				if (cached != NULL) {
+					_ts_message_cbor_splice(parent, cached->bytes[TS_MESSAGE_ENCODING_CBOR],
+											cached->sizes[TS_MESSAGE_ENCODING_CBOR]);
+					break;
+				}
+
+				/* ...or create it, filled with the branches that follow */
+				size_t start = parent->end != NULL ? (size_t) (parent->data.ptr - buffer) : 0;
+				if (node->type == TsTypeArray) {
+					cbor_encoder_create_array(parent, &(maps[top]), node->size);
+				} else {
+					cbor_encoder_create_map(parent, &(maps[top]), node->size);
+				}
+				_ts_message_push_frame(&(stack[top]), node);
+				stack[top++].start = start;
+				break;
+			}
+			default:
 				break;
 			}
+			node = NULL;
+		}
+		if (top == 0) {
+			break;
 		}
 
-		/* create and fill map */
-		CborEncoder map;
-		cbor_encoder_create_map(encoder, &map, length);
-		for (int i = 0; i < length; i++) {
-			_ts_message_encode_cbor(message->value._xfields[i], &map, buffer, buffer_size);
+		/* next branch, or close the map (or array) */
+		TsMessageFrame_t *frame = &(stack[top - 1]);
+		if (frame->branch != NULL) {
+			node = frame->branch;
+			frame->branch = node->next;
+		} else {
+			top--;
+			CborEncoder *parent = top > 0 ? &(maps[top - 1]) : encoder;
+			cbor_encoder_close_container(parent, &(maps[top]));
+
+			/* (the encoding is only complete when the buffer was never full) */
+			if (top > 0 && parent->end != NULL) {
+				_ts_message_remember(frame->message, TS_MESSAGE_ENCODING_CBOR, buffer + frame->start,
+									 (size_t) (parent->data.ptr - buffer) - frame->start);
+			}
 		}
-		cbor_encoder_close_container(encoder, &map);
-		break;
-	}
-	default:
-		return TsStatusErrorInternalServerError;
 	}
 
 	/* check if we've used up the buffer */
@@ -9,6 +9,7 @@
 #include "cbor.h"
 
 #include "ts_common.h"
+#include "ts_pool.h"
 
 /* static memory model, e.g., for debug (warning - affects bss directly) */
 /* #define TS_MESSAGE_STATIC_MEMORY */
@@ -26,13 +27,50 @@
 /* total number of nodes available for messages */
 #define TS_MESSAGE_MAX_NODES        (TS_MESSAGE_MAX_BRANCHES * TS_MESSAGE_MAX_ROOTS)
 
-/* maximum size of a string attribute */
+/* maximum size of a string of a fixed layout (see ts_layout.h), or generated struct */
 /* i.e., length of a uuid with dashes (36) plus termination */
 #define TS_MESSAGE_MAX_STRING_SIZE  37
 
+/* size of the inline storage of a string attribute (of any length) */
+/* longer strings are kept by the allocator of the node, or the heap. in the static */
+/* memory model, without an allocator, they are truncated to fit. */
+#define TS_MESSAGE_INLINE_STRING_SIZE   40
+
 /* maximum size of a key (i.e., field name) */
 #define TS_MESSAGE_MAX_KEY_SIZE     24
 
+/* maximum depth of a message, i.e., the nesting of messages and arrays */
+/* (enforced when nodes are set, and sizing the explicit stacks messages are traversed with, */
+/* i.e., the encoders, decoders, copy and destroy use a fixed amount of the callers stack) */
+#ifndef TS_MESSAGE_MAX_DEPTH
+#define TS_MESSAGE_MAX_DEPTH        16
+#endif
+
+/* size of the per-thread node cache (magazine), and the number of nodes moved */
+/* between it and the shared node pool at once */
+#ifdef TS_MESSAGE_STATIC_MEMORY
+#define TS_MESSAGE_CACHE_SIZE       8
+#else
+#define TS_MESSAGE_CACHE_SIZE       64
+#endif
+#define TS_MESSAGE_CACHE_BATCH      (TS_MESSAGE_CACHE_SIZE / 2)
+
+/* maximum number of free nodes kept by the shared node pool (malloc model only, the rest are freed) */
+#define TS_MESSAGE_POOL_SIZE        1024
+
+/* maximum number of threads counting statistics at the same time (others share a single slot) */
+#define TS_MESSAGE_MAX_THREADS      64
+
+/* number of latency histogram buckets, bucket 0 counts latencies under 1 us, */
+/* bucket i those under 2^i us (and over the previous), and the last all others */
+#define TS_MESSAGE_HISTOGRAM_SIZE   12
+
+/* cache line size, nodes are aligned to it (see TsMessage_t) */
+#define TS_MESSAGE_CACHE_LINE       64
+
+/* maximum number of live allocations recorded by a tracing allocator */
+#define TS_MESSAGE_TRACE_SIZE       256
+
 /* supported encoders */
 typedef enum {
 	TsEncoderDebug,
@@ -40,10 +78,14 @@ typedef enum {
 	TsEncoderCbor,
 } TsEncoder_t;
 
+/* number of supported encoders */
+#define TS_MESSAGE_ENCODERS         3
+
 /* field path node */
 typedef char *TsPathNode_t;
 
 /* field path */
+/* (a NULL terminated array of path nodes, where array items are selected by a decimal index) */
 typedef TsPathNode_t *TsPath_t;
 
 /* supported encoded field types */
@@ -57,45 +99,209 @@ typedef enum {
 	TsTypeNull      /* no value */
 } TsType_t;
 
+/* node allocator, e.g., an rtos heap, a tlsf allocator or a test arena */
+/* (allocate returns NULL when out of memory, both are called from any thread creating or destroying nodes, */
+/* nodes should be aligned to TS_MESSAGE_CACHE_LINE) */
+typedef struct TsMessageAllocator *TsMessageAllocatorRef_t;
+typedef struct TsMessageAllocator {
+	void *	(*allocate)(void *context, size_t size);
+	void	(*release)(void *context, void *pointer, size_t size);
+	void	*context;
+} TsMessageAllocator_t;
+
 /* forward reference and typedef to TsMessage pointer */
 typedef struct TsMessage *TsMessageRef_t;
 
 /* value */
 typedef void *TsValue_t;
 
-/* field value */
-/* note, union size will take the largest attribute */
+/* field value, i.e., the small value of a leaf, or the first branch of a message or array */
+/* (the branches are linked in order through next, short strings are kept inline, see TsMessage_t) */
 typedef union TsField *TsFieldRef_t;
 typedef union {
 	int				_xinteger;
 	float			_xfloat;
 	bool			_xboolean;
-	char			_xstring[TS_MESSAGE_MAX_STRING_SIZE];
-	/* TODO - switch to linked list */
-	TsMessageRef_t	_xfields[TS_MESSAGE_MAX_BRANCHES];
+	char			*_xstring;      /* a string too long to be kept inline */
+	TsMessageRef_t	_xbranches;
 } TsField_t;
 
 /* a single message node binding */
 /* (which, during runtime, could be either a root or a branch node) */
+/* the hot part, read on every lookup and encode, is held in the first cache line, and looked up by */
+/* the hash of the name. inline strings (or the cached encodings of a message or array) start in the */
+/* remainder of that line, names (cold, i.e., only read on a hash match or when encoding) follow. */
 typedef struct TsMessage {
-	int				references;
-	char			name[TS_MESSAGE_MAX_KEY_SIZE];
 	TsType_t		type;
+	uint32_t		hash;           /* of the name */
+	TsMessageRef_t	next;           /* the next branch of the parent */
 	TsField_t		value;
-} TsMessage_t;
+	unsigned int	size;           /* number of branches, or length of a string */
+	unsigned int	flags;
+	union {
+		char						string[TS_MESSAGE_INLINE_STRING_SIZE];
+		struct {
+			struct TsMessageEncoding	*encoding;  /* see ts_message_cache_encodings */
+			uint64_t					digest;     /* see ts_message_digest */
+		};
+	};
+	char			name[TS_MESSAGE_MAX_KEY_SIZE];
+	int				references;     /* changed atomically, see ts_message_retain and ts_message_destroy */
+	unsigned int	cache;          /* the per-thread node cache the node was taken from */
+	unsigned int	depth;          /* levels below its root, at most TS_MESSAGE_MAX_DEPTH (one less for containers) */
+	TsMessageAllocatorRef_t	allocator;  /* NULL when taken from the node caches */
+	TsMessageRef_t	parent;         /* the message or array the node is a branch of, NULL for a root */
+} __attribute__((aligned(TS_MESSAGE_CACHE_LINE))) TsMessage_t;
+
+/* per-thread node cache statistics */
+typedef struct TsMessageCacheStatistics {
+	uint64_t		refills;        /* batches of nodes taken from the shared pool */
+	uint64_t		flushes;        /* batches of nodes returned to the shared pool */
+	uint64_t		remote_frees;   /* nodes destroyed by another thread than the one that created them */
+} TsMessageCacheStatistics_t;
+
+/* encoder statistics */
+typedef struct TsMessageCoderStatistics {
+	uint64_t		encodes;
+	uint64_t		encode_bytes;
+	uint64_t		encode_errors;
+	uint64_t		decodes;
+	uint64_t		decode_bytes;
+	uint64_t		decode_errors;
+	uint64_t		encode_latency[TS_MESSAGE_HISTOGRAM_SIZE];
+	uint64_t		decode_latency[TS_MESSAGE_HISTOGRAM_SIZE];
+} TsMessageCoderStatistics_t;
+
+/* runtime statistics */
+/* note, nodes held by threads (i.e., in use or cached) and their peak are updated per cache batch */
+typedef struct TsMessageStatistics {
+	int64_t						live_nodes;             /* nodes created and not yet destroyed */
+	int64_t						held_nodes;             /* nodes taken from the shared pool */
+	int64_t						peak_nodes;             /* peak of the held nodes */
+	uint64_t					live_bytes;
+	uint64_t					held_bytes;
+	uint64_t					allocation_failures;
+	TsMessageCacheStatistics_t	cache;
+	TsMessageCoderStatistics_t	coders[TS_MESSAGE_ENCODERS];    /* by encoder */
+} TsMessageStatistics_t;
+
+/* memory footprint and shape of a message tree */
+typedef struct TsMessageFootprint {
+	size_t		nodes;
+	size_t		depth;              /* levels of nodes, i.e., one for a single node */
+	size_t		widest;             /* most branches of a single container */
+	size_t		longest_name;       /* compare with TS_MESSAGE_MAX_KEY_SIZE */
+	size_t		longest_string;     /* compare with TS_MESSAGE_INLINE_STRING_SIZE */
+	size_t		bytes_allocated;    /* i.e., nodes of sizeof(TsMessage_t), long strings and cached encodings */
+	size_t		bytes_used;         /* node headers, names, and the part of the values actually used */
+	size_t		json_size;          /* predicted size of the ts_message_encode output */
+	size_t		cbor_size;
+} TsMessageFootprint_t;
+
+/* live allocation, as recorded by the tracing allocator */
+typedef struct TsMessageTraceRecord {
+	void			*pointer;
+	size_t			size;
+	const char		*function;      /* the function allocating the node */
+	const char		*file;          /* the application call site, see ts_message_trace_site */
+	int				line;
+	uint64_t		created;        /* monotonic time in ns */
+} TsMessageTraceRecord_t;
+
+/* tracing allocator, i.e., an allocator recording every allocation of the one it wraps */
+/* (set its allocator as the global or a per-root allocator, records are kept for up to */
+/* TS_MESSAGE_TRACE_SIZE live allocations, those over it are counted as untracked) */
+typedef struct TsMessageTrace *TsMessageTraceRef_t;
+typedef struct TsMessageTrace {
+	TsMessageAllocator_t	allocator;
+	TsMessageAllocatorRef_t	target;         /* the allocator traced, NULL for malloc */
+	bool					lock;
+	uint64_t				allocations;
+	uint64_t				releases;
+	uint64_t				failures;
+	uint64_t				untracked;
+	uint64_t				live_bytes;
+	uint64_t				peak_bytes;
+	uint64_t				allocate_ns;    /* time spent in the traced allocator, i.e., its overhead */
+	uint64_t				release_ns;
+	uint64_t				lifetime[TS_MESSAGE_HISTOGRAM_SIZE];    /* of the released allocations */
+	size_t					count;
+	TsMessageTraceRecord_t	records[TS_MESSAGE_TRACE_SIZE];
+} TsMessageTrace_t;
+
+/* compiled path, i.e., a path resolved once into the nodes along it */
+/* (revalidated by generation, which changes whenever the structure of any message changes) */
+typedef struct TsPathHandle *TsPathHandleRef_t;
+typedef struct TsPathHandle {
+	TsMessageRef_t	root;
+	TsPath_t		path;
+	size_t			depth;
+	unsigned int	generation;
+	TsMessageRef_t	nodes[TS_MESSAGE_MAX_DEPTH];
+} TsPathHandle_t;
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-/* create and destroy */
+/* statistics */
+/* counters are kept per thread and summed on read, the export fills the given message with them */
 TsStatus_t ts_message_report();
+TsStatus_t ts_message_statistics(TsMessageStatistics_t *statistics);
+TsStatus_t ts_message_statistics_export(TsMessageRef_t message);
+
+/* create and destroy */
 TsStatus_t ts_message_create(TsMessageRef_t *message);
 TsStatus_t ts_message_create_copy(TsMessageRef_t message, TsMessageRef_t *value);
 TsStatus_t ts_message_create_array(TsMessageRef_t message, TsPathNode_t field, TsMessageRef_t *value);
 TsStatus_t ts_message_create_message(TsMessageRef_t message, TsPathNode_t field, TsMessageRef_t *value);
 TsStatus_t ts_message_destroy(TsMessageRef_t message);
 
+/* allocators */
+/* nodes are taken from the given allocator, i.e., the global one for new roots (NULL restores the */
+/* built-in node caches), or the one of a single root. branches are taken from the allocator of their parent. */
+TsStatus_t ts_message_set_allocator(TsMessageAllocatorRef_t allocator);
+TsStatus_t ts_message_create_with(TsMessageAllocatorRef_t allocator, TsMessageRef_t *message);
+
+/* allocation tracing */
+/* the site is that of the calling thread, e.g., ts_message_trace_site(__FILE__, __LINE__), until changed */
+TsStatus_t ts_message_trace_init(TsMessageTraceRef_t trace, TsMessageAllocatorRef_t target);
+TsStatus_t ts_message_trace_site(const char *file, int line);
+TsStatus_t ts_message_trace_report(TsMessageTraceRef_t trace);
+
+/* hand-off between threads */
+/* a retained message is released by ts_message_destroy, i.e., the last destroy frees it, */
+/* so a producer may retain a message, pass it to a consumer, and destroy its own reference */
+TsStatus_t ts_message_retain(TsMessageRef_t message);
+
+/* per-thread node caches */
+/* nodes are created from and destroyed into a cache of the calling thread, */
+/* so a thread should flush its cache before it exits */
+TsStatus_t ts_message_cache_flush();
+TsStatus_t ts_message_cache_statistics(TsMessageCacheStatistics_t *statistics);
+
+/* templates */
+/* a frozen message keeps its structure (names, types and nodes) between send cycles, */
+/* leaf values are overwritten in place, e.g., ts_message_set_int(leaf, NULL, value) */
+TsStatus_t ts_message_freeze(TsMessageRef_t message);
+TsStatus_t ts_message_thaw(TsMessageRef_t message);
+TsStatus_t ts_message_reset(TsMessageRef_t message);
+
+/* cached encodings */
+/* the messages and arrays of a cached message keep their json and cbor encodings between encodes, */
+/* so only those changed since (and their parents) are encoded again, e.g., for periodic reports where */
+/* most subtrees never change. the root of an encode is always encoded again, and a cached message */
+/* must not be encoded by several threads at once. */
+TsStatus_t ts_message_cache_encodings(TsMessageRef_t message, bool enable);
+
+/* structural hash and equality */
+/* the digest (a stable 64 bit hash) of a message doesnt depend on the order of its fields, that of an */
+/* array does depend on the order of its items. messages and arrays keep their digest until they (or any */
+/* of their branches) change, e.g., to tell whether a report changed since it was last sent. equality */
+/* compares the trees themselves, floats by their bits (as encoded). */
+TsStatus_t ts_message_digest(TsMessageRef_t message, uint64_t *digest);
+TsStatus_t ts_message_equal(TsMessageRef_t message, TsMessageRef_t other, bool *equal);
+
 /* set and get operations */
 TsStatus_t ts_message_set(TsMessageRef_t message, TsPathNode_t field, TsMessageRef_t value);
 TsStatus_t ts_message_set_null(TsMessageRef_t message, TsPathNode_t field);
@@ -106,6 +312,11 @@ TsStatus_t ts_message_set_bool(TsMessageRef_t message, TsPathNode_t field, bool
 TsStatus_t ts_message_set_array(TsMessageRef_t message, TsPathNode_t field, TsMessageRef_t value);
 TsStatus_t ts_message_set_message(TsMessageRef_t message, TsPathNode_t field, TsMessageRef_t value);
 
+/* borrowed strings, i.e., referred to rather than copied (e.g., constants or identity fields held by the firmware) */
+/* the string must stay valid and unchanged while set on the message, or on any copy of it, i.e., until */
+/* overwritten, reset or destroyed. encoders write directly from the borrowed string. */
+TsStatus_t ts_message_set_string_borrowed(TsMessageRef_t message, TsPathNode_t field, const char *value);
+
 TsStatus_t ts_message_has(TsMessageRef_t message, TsPathNode_t field, TsMessageRef_t *value);
 
 TsStatus_t ts_message_get(TsMessageRef_t message, TsPathNode_t field, TsMessageRef_t *value);
@@ -116,6 +327,24 @@ TsStatus_t ts_message_get_bool(TsMessageRef_t message, TsPathNode_t field, bool
 TsStatus_t ts_message_get_array(TsMessageRef_t message, TsPathNode_t field, TsMessageRef_t *value);
 TsStatus_t ts_message_get_message(TsMessageRef_t message, TsPathNode_t field, TsMessageRef_t *value);
 
+/* path operations */
+/* note, set operations create the intermediate messages of the path as required */
+TsStatus_t ts_message_path_parse(char *text, TsPathNode_t *path, size_t path_size);
+TsStatus_t ts_message_path_compile(TsMessageRef_t message, TsPath_t path, TsPathHandleRef_t handle);
+TsStatus_t ts_message_path_resolve(TsPathHandleRef_t handle, TsMessageRef_t *value);
+
+TsStatus_t ts_message_get_path(TsMessageRef_t message, TsPath_t path, TsMessageRef_t *value);
+TsStatus_t ts_message_get_int_path(TsMessageRef_t message, TsPath_t path, int *value);
+TsStatus_t ts_message_get_float_path(TsMessageRef_t message, TsPath_t path, float *value);
+TsStatus_t ts_message_get_string_path(TsMessageRef_t message, TsPath_t path, char **value);
+TsStatus_t ts_message_get_bool_path(TsMessageRef_t message, TsPath_t path, bool *value);
+
+TsStatus_t ts_message_set_null_path(TsMessageRef_t message, TsPath_t path);
+TsStatus_t ts_message_set_int_path(TsMessageRef_t message, TsPath_t path, int value);
+TsStatus_t ts_message_set_float_path(TsMessageRef_t message, TsPath_t path, float value);
+TsStatus_t ts_message_set_string_path(TsMessageRef_t message, TsPath_t path, char *value);
+TsStatus_t ts_message_set_bool_path(TsMessageRef_t message, TsPath_t path, bool value);
+
 /* array operations */
 TsStatus_t ts_message_get_size(TsMessageRef_t array, size_t *size);
 
@@ -123,6 +352,7 @@ TsStatus_t ts_message_set_at(TsMessageRef_t array, size_t index, TsMessageRef_t
 TsStatus_t ts_message_set_int_at(TsMessageRef_t array, size_t index, int value);
 TsStatus_t ts_message_set_float_at(TsMessageRef_t array, size_t index, float value);
 TsStatus_t ts_message_set_string_at(TsMessageRef_t array, size_t index, char* value);
+TsStatus_t ts_message_set_string_borrowed_at(TsMessageRef_t array, size_t index, const char *value);
 TsStatus_t ts_message_set_bool_at(TsMessageRef_t array, size_t index, bool value);
 TsStatus_t ts_message_set_array_at(TsMessageRef_t array, size_t index, TsMessageRef_t item);
 TsStatus_t ts_message_set_message_at(TsMessageRef_t array, size_t index, TsMessageRef_t item);
@@ -132,6 +362,59 @@ TsStatus_t ts_message_get_at(TsMessageRef_t array, size_t index, TsMessageRef_t
 /* encoding and decoding */
 TsStatus_t ts_message_encode(TsMessageRef_t message, TsEncoder_t encoder, uint8_t *buffer, size_t *buffer_size);
 TsStatus_t ts_message_decode(TsMessageRef_t message, TsEncoder_t encoder, uint8_t *buffer, size_t buffer_size);
+
+/* projected decoding */
+/* decode just the fields found in the given projection (a template message, e.g., built with the *_path */
+/* setters), the others are skipped by the tokenizer and take no nodes, so don't count against */
+/* TS_MESSAGE_MAX_BRANCHES. a field projected by a message is decoded with the fields of that message (objects */
+/* of an array with those of the projection of the array), a field projected by any other value is decoded */
+/* whole. a NULL projection decodes everything. json only. */
+TsStatus_t ts_message_decode_projected(TsMessageRef_t message, TsMessageRef_t projection, TsEncoder_t encoder,
+									   uint8_t *buffer, size_t buffer_size);
+
+/* transcoding */
+/* convert json into cbor (or cbor into json) as it is read, token by token, i.e., without building a tree, */
+/* using memory bounded by the nesting (of at most TS_MESSAGE_MAX_DEPTH). the conventions of the encoders */
+/* hold, i.e., the root is a message, keys are the names of fields (of less than TS_MESSAGE_MAX_KEY_SIZE), */
+/* integers in range are integers and any other number a (single precision) float, printed as by */
+/* ts_message_encode. cbor containers are written with indefinite length, tags are dropped. */
+TsStatus_t ts_message_transcode(TsEncoder_t encoder, uint8_t *buffer, size_t buffer_size, TsEncoder_t target,
+								uint8_t *output, size_t *output_size);
+
+/* patching */
+/* rfc 7386 merge patches and rfc 6902 patches (with rfc 6901 json pointers) are applied in place, looking up */
+/* and changing just the paths they address. a patch is given decoded (a message, or an array of operations) */
+/* or json encoded, the latter is applied as it is read, i.e., without decoding it first. the operations of a */
+/* patch are applied in order, a failing operation (e.g., a failing test, TsStatusErrorPreconditionFailed) */
+/* stops the patch, those before it remain applied. */
+TsStatus_t ts_message_merge_patch(TsMessageRef_t message, TsMessageRef_t patch);
+TsStatus_t ts_message_merge_patch_json(TsMessageRef_t message, uint8_t *buffer, size_t buffer_size);
+TsStatus_t ts_message_patch(TsMessageRef_t message, TsMessageRef_t patch);
+TsStatus_t ts_message_patch_json(TsMessageRef_t message, uint8_t *buffer, size_t buffer_size);
+
+/* footprint, i.e., walk the given message without encoding it (the json and cbor sizes are those encoded) */
+TsStatus_t ts_message_footprint(TsMessageRef_t message, TsMessageFootprint_t *footprint);
+
+/* snapshots */
+/* a relocatable binary image of a message, i.e., its nodes with links (and long strings) as offsets, */
+/* valid for builds of the same node size and byte order. a writable image (e.g., copied in a single memcpy, */
+/* or mapped privately) is loaded in place by fixing up its links, the loaded message lives in the image */
+/* (which must outlive it), nodes added later are taken from the heap (none in the static memory model). */
+/* ts_message_snapshot_get_path reads an image in place, without loading it. images are aligned to */
+/* TS_MESSAGE_CACHE_LINE. */
+TsStatus_t ts_message_snapshot_size(TsMessageRef_t message, size_t *size);
+TsStatus_t ts_message_snapshot_save(TsMessageRef_t message, uint8_t *buffer, size_t *buffer_size);
+TsStatus_t ts_message_snapshot_load(uint8_t *buffer, size_t buffer_size, TsMessageRef_t *message);
+TsStatus_t ts_message_snapshot_get_path(const uint8_t *buffer, size_t buffer_size, TsPath_t path, TsType_t *type,
+										const void **value);
+
+/* parallel encoding */
+/* the top-level branches of a message (or the messages of a batch) are encoded on the given pool, */
+/* each into a buffer of its own, and stitched in order, i.e., the output equals ts_message_encode */
+TsStatus_t ts_message_encode_parallel(TsMessageRef_t message, TsEncoder_t encoder, TsPoolRef_t pool, uint8_t *buffer,
+									  size_t *buffer_size);
+TsStatus_t ts_message_encode_batch(TsMessageRef_t *messages, size_t count, TsEncoder_t encoder, TsPoolRef_t pool,
+								   uint8_t **buffers, size_t *buffer_sizes);
 TsStatus_t ts_message_decode_json(TsMessageRef_t message, cJSON *value);
 TsStatus_t ts_message_decode_cbor(TsMessageRef_t message, CborValue *value);
 
@@ -0,0 +1,217 @@
+#include <string.h>
+#include <stdio.h>
+
+/* client debug */
+/* dbg_printf() */
+#include "dbg.h"
+
+#include "ts_common.h"
+#include "ts_pool.h"
+#include "ts_message.h"
+
+/* forward references */
+static void * _ts_pool_worker(void *);
+static bool _ts_pool_take(TsPoolRef_t, size_t, TsPoolTask_t *, void **);
+static bool _ts_pool_push(TsPoolDeque_t *, TsPoolTask_t, void *);
+static bool _ts_pool_pop(TsPoolDeque_t *, bool, TsPoolTask_t *, void **);
+static void _ts_pool_run(TsPoolRef_t, TsPoolTask_t, void *);
+
+/* ts_pool_create */
+TsStatus_t ts_pool_create(TsPoolRef_t pool, size_t workers)
+{
+	/* check preconditions */
+	if (pool == NULL || workers == 0) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	if (workers > TS_POOL_MAX_WORKERS) {
+		return TsStatusErrorPayloadTooLarge;
+	}
+
+	/* clear all */
+	memset(pool, 0x00, sizeof(TsPool_t));
+	pthread_mutex_init(&(pool->mutex), NULL);
+	pthread_cond_init(&(pool->wake), NULL);
+	pthread_cond_init(&(pool->done), NULL);
+
+	/* start the workers */
+	for (size_t i = 0; i < workers; i++) {
+		pool->contexts[i].pool = pool;
+		pool->contexts[i].index = i;
+		if (pthread_create(&(pool->threads[i]), NULL, _ts_pool_worker, &(pool->contexts[i])) != 0) {
+			dbg_printf("ts_pool_create: failed to start worker (%lu)\n", (unsigned long) i);
+			ts_pool_destroy(pool);
+			return TsStatusErrorInternalServerError;
+		}
+		pool->workers++;
+	}
+	return TsStatusOk;
+}
+
+/* ts_pool_destroy */
+/* stop the workers, once all tasks are finished */
+TsStatus_t ts_pool_destroy(TsPoolRef_t pool)
+{
+	/* check preconditions */
+	if (pool == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	ts_pool_wait(pool);
+
+	pthread_mutex_lock(&(pool->mutex));
+	pool->stopping = true;
+	pthread_cond_broadcast(&(pool->wake));
+	pthread_mutex_unlock(&(pool->mutex));
+	for (size_t i = 0; i < pool->workers; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+	pool->workers = 0;
+
+	pthread_cond_destroy(&(pool->done));
+	pthread_cond_destroy(&(pool->wake));
+	pthread_mutex_destroy(&(pool->mutex));
+	return TsStatusOk;
+}
+
+/* ts_pool_submit */
+/* queue the given task, or when all queues are full, run it on the calling thread */
+TsStatus_t ts_pool_submit(TsPoolRef_t pool, TsPoolTask_t task, void *argument)
+{
+	/* check preconditions */
+	if (pool == NULL || task == NULL || pool->workers == 0) {
+		return TsStatusErrorPreconditionFailed;
+	}
+
+	__atomic_add_fetch(&(pool->pending), 1, __ATOMIC_ACQ_REL);
+	__atomic_add_fetch(&(pool->queued), 1, __ATOMIC_ACQ_REL);
+	for (size_t i = 0; i < pool->workers; i++) {
+		TsPoolDeque_t *deque = &(pool->deques[(pool->next + i) % pool->workers]);
+		if (_ts_pool_push(deque, task, argument)) {
+			pool->next = pool->next + i + 1;
+
+			/* wake a sleeping worker */
+			pthread_mutex_lock(&(pool->mutex));
+			pthread_cond_signal(&(pool->wake));
+			pthread_mutex_unlock(&(pool->mutex));
+			return TsStatusOk;
+		}
+	}
+	__atomic_sub_fetch(&(pool->queued), 1, __ATOMIC_ACQ_REL);
+	_ts_pool_run(pool, task, argument);
+	return TsStatusOk;
+}
+
+/* ts_pool_wait */
+/* wait for all submitted tasks to finish, helping out while tasks are queued */
+TsStatus_t ts_pool_wait(TsPoolRef_t pool)
+{
+	/* check preconditions */
+	if (pool == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+
+	TsPoolTask_t task;
+	void *argument;
+	while (pool->workers > 0 && _ts_pool_take(pool, 0, &task, &argument)) {
+		_ts_pool_run(pool, task, argument);
+	}
+
+	pthread_mutex_lock(&(pool->mutex));
+	while (__atomic_load_n(&(pool->pending), __ATOMIC_ACQUIRE) > 0) {
+		pthread_cond_wait(&(pool->done), &(pool->mutex));
+	}
+	pthread_mutex_unlock(&(pool->mutex));
+	return TsStatusOk;
+}
+
+/* //////////////////////////////////////////////////////////////////////////// */
+/* P R I V A T E */
+
+/* (private) _ts_pool_worker */
+static void * _ts_pool_worker(void *argument)
+{
+	TsPoolRef_t pool = ((TsPoolContext_t *) argument)->pool;
+	size_t index = ((TsPoolContext_t *) argument)->index;
+
+	for (;;) {
+
+		/* run the tasks of its own queue, then those stolen from the others,... */
+		TsPoolTask_t task;
+		void *item;
+		if (_ts_pool_take(pool, index, &task, &item)) {
+			_ts_pool_run(pool, task, item);
+			continue;
+		}
+
+		/* ...and sleep when there are none */
+		pthread_mutex_lock(&(pool->mutex));
+		while (!pool->stopping && __atomic_load_n(&(pool->queued), __ATOMIC_ACQUIRE) == 0) {
+			pthread_cond_wait(&(pool->wake), &(pool->mutex));
+		}
+		bool stopping = pool->stopping;
+		pthread_mutex_unlock(&(pool->mutex));
+		if (stopping) {
+
+			/* give back the nodes and counter slot taken by the tasks, */
+			/* otherwise every pool created would hold on to slots of threads long gone */
+			ts_message_cache_flush();
+			return NULL;
+		}
+	}
+}
+
+/* (private) _ts_pool_take */
+/* take a task from the bottom of the given queue, or steal one from the top of another */
+static bool _ts_pool_take(TsPoolRef_t pool, size_t index, TsPoolTask_t *task, void **argument)
+{
+	for (size_t i = 0; i < pool->workers; i++) {
+		TsPoolDeque_t *deque = &(pool->deques[(index + i) % pool->workers]);
+		if (_ts_pool_pop(deque, i == 0, task, argument)) {
+			__atomic_sub_fetch(&(pool->queued), 1, __ATOMIC_ACQ_REL);
+			return true;
+		}
+	}
+	return false;
+}
+
+/* (private) _ts_pool_push */
+static bool _ts_pool_push(TsPoolDeque_t *deque, TsPoolTask_t task, void *argument)
+{
+	bool pushed = false;
+	while (__atomic_test_and_set(&(deque->lock), __ATOMIC_ACQUIRE)) {
+	}
+	if (deque->bottom - deque->top < TS_POOL_MAX_TASKS) {
+		deque->items[deque->bottom % TS_POOL_MAX_TASKS].task = task;
+		deque->items[deque->bottom % TS_POOL_MAX_TASKS].argument = argument;
+		deque->bottom++;
+		pushed = true;
+	}
+	__atomic_clear(&(deque->lock), __ATOMIC_RELEASE);
+	return pushed;
+}
+
+/* (private) _ts_pool_pop */
+static bool _ts_pool_pop(TsPoolDeque_t *deque, bool bottom, TsPoolTask_t *task, void **argument)
+{
+	bool popped = false;
+	while (__atomic_test_and_set(&(deque->lock), __ATOMIC_ACQUIRE)) {
+	}
+	if (deque->bottom > deque->top) {
+		size_t index = bottom ? --(deque->bottom) : (deque->top)++;
+		*task = deque->items[index % TS_POOL_MAX_TASKS].task;
+		*argument = deque->items[index % TS_POOL_MAX_TASKS].argument;
+		popped = true;
+	}
+	__atomic_clear(&(deque->lock), __ATOMIC_RELEASE);
+	return popped;
+}
+
+/* (private) _ts_pool_run */
+static void _ts_pool_run(TsPoolRef_t pool, TsPoolTask_t task, void *argument)
+{
+	task(argument);
+	if (__atomic_sub_fetch(&(pool->pending), 1, __ATOMIC_ACQ_REL) == 0) {
+		pthread_mutex_lock(&(pool->mutex));
+		pthread_cond_broadcast(&(pool->done));
+		pthread_mutex_unlock(&(pool->mutex));
+	}
+}
@@ -0,0 +1,73 @@
+#ifndef TS_POOL_H
+#define TS_POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "ts_common.h"
+
+/* maximum number of worker threads per pool */
+#define TS_POOL_MAX_WORKERS     8
+
+/* maximum number of tasks queued per worker */
+#define TS_POOL_MAX_TASKS       64
+
+/* task, run on one of the worker threads */
+typedef void (*TsPoolTask_t)(void *argument);
+
+/* task queue of a single worker */
+/* the worker takes from the bottom, idle workers steal from the top */
+typedef struct TsPoolDeque {
+	bool			lock;
+	size_t			top;
+	size_t			bottom;
+	struct {
+		TsPoolTask_t	task;
+		void			*argument;
+	} items[TS_POOL_MAX_TASKS];
+} TsPoolDeque_t;
+
+/* worker context, i.e., the pool and the queue the worker serves */
+typedef struct TsPoolContext {
+	struct TsPool	*pool;
+	size_t			index;
+} TsPoolContext_t;
+
+/* small work-stealing thread pool */
+/* tasks are spread over the queues of the workers, and a worker running out of tasks */
+/* steals from the others before going to sleep. */
+typedef struct TsPool *TsPoolRef_t;
+typedef struct TsPool {
+	size_t			workers;
+	size_t			next;       /* queue of the next submitted task */
+	int				queued;     /* tasks not yet taken */
+	int				pending;    /* tasks not yet finished */
+	bool			stopping;
+	pthread_mutex_t	mutex;
+	pthread_cond_t	wake;       /* signalled when tasks are queued or the pool stops */
+	pthread_cond_t	done;       /* signalled when all tasks are finished */
+	pthread_t		threads[TS_POOL_MAX_WORKERS];
+	TsPoolContext_t	contexts[TS_POOL_MAX_WORKERS];
+	TsPoolDeque_t	deques[TS_POOL_MAX_WORKERS];
+} TsPool_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* create and destroy */
+TsStatus_t ts_pool_create(TsPoolRef_t pool, size_t workers);
+TsStatus_t ts_pool_destroy(TsPoolRef_t pool);
+
+/* task operations */
+/* submit tasks (from a single thread), then wait for all of them to finish */
+TsStatus_t ts_pool_submit(TsPoolRef_t pool, TsPoolTask_t task, void *argument);
+TsStatus_t ts_pool_wait(TsPoolRef_t pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TS_POOL_H */
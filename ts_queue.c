@@ -0,0 +1,197 @@
+#include <string.h>
+#include <stdio.h>
+
+/* client debug */
+/* dbg_printf() */
+#include "dbg.h"
+
+#include "ts_common.h"
+#include "ts_queue.h"
+
+/* record header, ahead of every message in the ring */
+/* records are aligned to the header size, so a record never starts in the last bytes of the ring */
+typedef struct {
+	uint32_t	size;       /* record size including the header, zero until published */
+	uint32_t	length;     /* message size, zero when discarded */
+} TsQueueHeader_t;
+
+/* the length of a padding record, filling the end of the ring when a record doesnt fit */
+#define TS_QUEUE_PADDING    0xffffffff
+
+/* forward references */
+static TsQueueHeader_t * _ts_queue_header(TsQueueRef_t, uint64_t);
+static uint64_t _ts_queue_align(uint64_t);
+
+/* ts_queue_init */
+TsStatus_t ts_queue_init(TsQueueRef_t queue, uint8_t *buffer, size_t buffer_size)
+{
+	/* check preconditions */
+	if (queue == NULL || buffer == NULL || ((uintptr_t) buffer) % sizeof(TsQueueHeader_t) != 0) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	if (buffer_size < 2 * sizeof(TsQueueHeader_t) || (buffer_size & (buffer_size - 1)) != 0) {
+		dbg_printf("ts_queue_init: buffer size must be a power of two\n");
+		return TsStatusErrorBadRequest;
+	}
+
+	/* clear all, i.e., no record has been published yet */
+	memset(buffer, 0x00, buffer_size);
+	queue->buffer = buffer;
+	queue->size = buffer_size;
+	queue->reserved = 0;
+	queue->consumed = 0;
+	return TsStatusOk;
+}
+
+/* ts_queue_reserve */
+/* reserve space for a message of (at most) the given size */
+TsStatus_t ts_queue_reserve(TsQueueRef_t queue, size_t size, TsQueueReservation_t *reservation)
+{
+	/* check preconditions */
+	if (queue == NULL || reservation == NULL || size == 0) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	uint64_t record = _ts_queue_align(size + sizeof(TsQueueHeader_t));
+	if (record > queue->size) {
+		return TsStatusErrorPayloadTooLarge;
+	}
+
+	/* claim the space (and any padding ahead of it) */
+	uint64_t padding;
+	uint64_t position = __atomic_load_n(&(queue->reserved), __ATOMIC_RELAXED);
+	do {
+		uint64_t offset = position & (queue->size - 1);
+		padding = (offset + record > queue->size) ? queue->size - offset : 0;
+		uint64_t consumed = __atomic_load_n(&(queue->consumed), __ATOMIC_ACQUIRE);
+		if (position + padding + record - consumed > queue->size) {
+			return TsStatusErrorOutOfMemory;
+		}
+	} while (!__atomic_compare_exchange_n(&(queue->reserved), &position, position + padding + record, false,
+										  __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+	/* publish the padding right away, the consumer skips it */
+	if (padding > 0) {
+		TsQueueHeader_t *header = _ts_queue_header(queue, position);
+		header->length = TS_QUEUE_PADDING;
+		__atomic_store_n(&(header->size), (uint32_t) padding, __ATOMIC_RELEASE);
+		position = position + padding;
+	}
+
+	reservation->position = position;
+	reservation->buffer = (uint8_t *) (_ts_queue_header(queue, position) + 1);
+	reservation->size = (size_t) (record - sizeof(TsQueueHeader_t));
+	return TsStatusOk;
+}
+
+/* ts_queue_commit */
+/* publish the message written to the given reservation */
+TsStatus_t ts_queue_commit(TsQueueRef_t queue, TsQueueReservation_t *reservation, size_t size)
+{
+	/* check preconditions */
+	if (queue == NULL || reservation == NULL || reservation->buffer == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+
+	/* an oversized commit is discarded (it must still be published for the consumer to move on) */
+	TsStatus_t status = TsStatusOk;
+	if (size > reservation->size) {
+		status = TsStatusErrorPayloadTooLarge;
+		size = 0;
+	}
+
+	TsQueueHeader_t *header = _ts_queue_header(queue, reservation->position);
+	header->length = (uint32_t) size;
+	__atomic_store_n(&(header->size), (uint32_t) (reservation->size + sizeof(TsQueueHeader_t)), __ATOMIC_RELEASE);
+	reservation->buffer = NULL;
+	return status;
+}
+
+/* ts_queue_encode */
+/* encode the given message directly into the queue, reserving (at most) the given size */
+TsStatus_t ts_queue_encode(TsQueueRef_t queue, TsMessageRef_t message, TsEncoder_t encoder, size_t size)
+{
+	TsQueueReservation_t reservation;
+	TsStatus_t status = ts_queue_reserve(queue, size, &reservation);
+	if (status != TsStatusOk) {
+		return status;
+	}
+
+	size_t buffer_size = reservation.size;
+	status = ts_message_encode(message, encoder, reservation.buffer, &buffer_size);
+	if (status != TsStatusOk) {
+		ts_queue_commit(queue, &reservation, 0);
+		return status;
+	}
+	return ts_queue_commit(queue, &reservation, buffer_size);
+}
+
+/* ts_queue_drain */
+/* gather the committed messages in order, up to the first one still being written */
+/* (the batch is empty when there is nothing to send, and is released once sent either way) */
+TsStatus_t ts_queue_drain(TsQueueRef_t queue, TsQueueBatch_t *batch)
+{
+	/* check preconditions */
+	if (queue == NULL || batch == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+
+	batch->count = 0;
+	batch->size = 0;
+	uint64_t consumed = __atomic_load_n(&(queue->consumed), __ATOMIC_RELAXED);
+	uint64_t position = consumed;
+	while (batch->count < TS_QUEUE_MAX_BATCH && position - consumed < queue->size) {
+
+		TsQueueHeader_t *header = _ts_queue_header(queue, position);
+		uint32_t size = __atomic_load_n(&(header->size), __ATOMIC_ACQUIRE);
+		if (size == 0) {
+			break;
+		}
+		if (header->length != TS_QUEUE_PADDING && header->length > 0) {
+			batch->messages[batch->count].buffer = (uint8_t *) (header + 1);
+			batch->messages[batch->count].size = header->length;
+			batch->size = batch->size + header->length;
+			batch->count++;
+		}
+		position = position + size;
+	}
+	batch->end = position;
+	return TsStatusOk;
+}
+
+/* ts_queue_release */
+/* return the space of a drained batch to the producers */
+TsStatus_t ts_queue_release(TsQueueRef_t queue, TsQueueBatch_t *batch)
+{
+	/* check preconditions */
+	if (queue == NULL || batch == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+
+	/* clear the released space, i.e., the headers of the records that will be written there */
+	uint64_t position = __atomic_load_n(&(queue->consumed), __ATOMIC_RELAXED);
+	uint64_t size = batch->end - position;
+	uint64_t offset = position & (queue->size - 1);
+	uint64_t first = (offset + size > queue->size) ? queue->size - offset : size;
+	memset(queue->buffer + offset, 0x00, (size_t) first);
+	memset(queue->buffer, 0x00, (size_t) (size - first));
+
+	__atomic_store_n(&(queue->consumed), batch->end, __ATOMIC_RELEASE);
+	batch->count = 0;
+	batch->size = 0;
+	return TsStatusOk;
+}
+
+/* //////////////////////////////////////////////////////////////////////////// */
+/* P R I V A T E */
+
+/* (private) _ts_queue_header */
+static TsQueueHeader_t * _ts_queue_header(TsQueueRef_t queue, uint64_t position)
+{
+	return (TsQueueHeader_t *) (queue->buffer + (position & (queue->size - 1)));
+}
+
+/* (private) _ts_queue_align */
+static uint64_t _ts_queue_align(uint64_t size)
+{
+	return (size + sizeof(TsQueueHeader_t) - 1) & ~((uint64_t) sizeof(TsQueueHeader_t) - 1);
+}
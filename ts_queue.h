@@ -0,0 +1,65 @@
+#ifndef TS_QUEUE_H
+#define TS_QUEUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "ts_common.h"
+#include "ts_message.h"
+
+/* maximum number of messages handed to the consumer at once */
+#define TS_QUEUE_MAX_BATCH      64
+
+/* outbound queue of encoded messages */
+/* a bounded multi-producer, single-consumer ring over a caller-owned buffer (a power of two in size). */
+/* producers reserve space, encode in place and commit, the consumer drains batches of committed */
+/* messages and releases them once sent. neither side takes a lock, and messages are never copied. */
+typedef struct TsQueue *TsQueueRef_t;
+typedef struct TsQueue {
+	uint8_t		*buffer;
+	size_t		size;
+	uint64_t	reserved;   /* end of the space reserved by the producers (shared by the producers) */
+	uint64_t	consumed;   /* start of the space not yet released by the consumer */
+} TsQueue_t;
+
+/* space reserved by a producer, committed with the size actually used */
+typedef struct TsQueueReservation {
+	uint8_t		*buffer;
+	size_t		size;
+	uint64_t	position;
+} TsQueueReservation_t;
+
+/* batch of consecutive committed messages, e.g., for a single writev */
+typedef struct TsQueueBatch {
+	size_t		count;
+	size_t		size;       /* total size of the messages */
+	uint64_t	end;        /* end of the space released with the batch */
+	struct {
+		uint8_t	*buffer;
+		size_t	size;
+	} messages[TS_QUEUE_MAX_BATCH];
+} TsQueueBatch_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* initialize */
+TsStatus_t ts_queue_init(TsQueueRef_t queue, uint8_t *buffer, size_t buffer_size);
+
+/* producer operations */
+/* every reservation must be committed, a commit of zero size discards the reservation */
+TsStatus_t ts_queue_reserve(TsQueueRef_t queue, size_t size, TsQueueReservation_t *reservation);
+TsStatus_t ts_queue_commit(TsQueueRef_t queue, TsQueueReservation_t *reservation, size_t size);
+TsStatus_t ts_queue_encode(TsQueueRef_t queue, TsMessageRef_t message, TsEncoder_t encoder, size_t size);
+
+/* consumer operations */
+TsStatus_t ts_queue_drain(TsQueueRef_t queue, TsQueueBatch_t *batch);
+TsStatus_t ts_queue_release(TsQueueRef_t queue, TsQueueBatch_t *batch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TS_QUEUE_H */
@@ -0,0 +1,388 @@
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* client debug */
+/* dbg_printf() */
+#include "dbg.h"
+
+#include "ts_common.h"
+#include "ts_store.h"
+
+/* record header, ahead of every record in the ring */
+/* records are aligned to the header size, so a header never wraps around the end of the ring */
+typedef struct {
+	uint64_t	position;   /* of the record in the store, telling it apart from the records of earlier laps */
+	uint32_t	length;     /* record size, without the header */
+	uint32_t	crc;        /* of the position, the length and the record */
+} TsStoreHeader_t;
+
+/* the length of a padding record, filling the end of the ring when a record doesnt fit */
+#define TS_STORE_PADDING    0xffffffff
+
+/* saved state, in one of two slots of the file header (written alternately, so one is always complete) */
+#define TS_STORE_MAGIC      0x52545354  /* "TSTR" in little endian */
+#define TS_STORE_SLOT_SIZE  64
+typedef struct {
+	uint32_t	magic;
+	uint32_t	crc;        /* of the rest of the slot */
+	uint64_t	sequence;   /* the valid slot of the latest sequence holds the state */
+	uint64_t	size;       /* of the ring */
+	uint64_t	tail;
+} TsStoreState_t;
+
+/* crc-32 (ieee 802.3) lookup table, filled on the first open */
+static uint32_t _ts_store_crc_table[256];
+static bool _ts_store_crc_ready = false;
+
+/* forward references */
+static TsStoreHeader_t * _ts_store_header(TsStoreRef_t, uint64_t);
+static uint64_t _ts_store_align(uint64_t);
+static uint64_t _ts_store_next(TsStoreRef_t, uint64_t, TsStoreHeader_t *);
+static uint32_t _ts_store_crc(uint32_t, const void *, size_t);
+static uint32_t _ts_store_record_crc(TsStoreHeader_t *);
+static void _ts_store_write(TsStoreRef_t, uint64_t, uint32_t);
+static bool _ts_store_load_state(TsStoreRef_t);
+static TsStatus_t _ts_store_save_state(TsStoreRef_t);
+static void _ts_store_scan(TsStoreRef_t);
+
+/* ts_store_open */
+/* map the given file (creating it when missing), and recover the records not yet released */
+TsStatus_t ts_store_open(TsStoreRef_t store, const char *path, size_t size)
+{
+	/* check preconditions */
+	if (store == NULL || path == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	if (size < 2 * sizeof(TsStoreHeader_t) || (size & (size - 1)) != 0 || size > UINT32_MAX) {
+		dbg_printf("ts_store_open: ring size must be a power of two\n");
+		return TsStatusErrorBadRequest;
+	}
+	if (!_ts_store_crc_ready) {
+		for (uint32_t i = 0; i < 256; i++) {
+			uint32_t crc = i;
+			for (int j = 0; j < 8; j++) {
+				crc = (crc & 1) != 0 ? (crc >> 1) ^ 0xedb88320u : crc >> 1;
+			}
+			_ts_store_crc_table[i] = crc;
+		}
+		_ts_store_crc_ready = true;
+	}
+
+	/* open, size (when new) and map the file */
+	memset(store, 0x00, sizeof(TsStore_t));
+	store->file = open(path, O_RDWR | O_CREAT, 0644);
+	if (store->file < 0) {
+		dbg_printf("ts_store_open: failed to open (%s)\n", path);
+		return TsStatusErrorNotFound;
+	}
+	struct stat status;
+	size_t total = TS_STORE_HEADER_SIZE + size;
+	if (fstat(store->file, &status) != 0 || (status.st_size == 0 && ftruncate(store->file, (off_t) total) != 0)) {
+		close(store->file);
+		return TsStatusErrorInternalServerError;
+	}
+	if (status.st_size != 0 && (size_t) status.st_size != total) {
+		dbg_printf("ts_store_open: store of another size (%lu)\n", (unsigned long) status.st_size);
+		close(store->file);
+		return TsStatusErrorBadRequest;
+	}
+	store->map = (uint8_t *) mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, store->file, 0);
+	if (store->map == MAP_FAILED) {
+		close(store->file);
+		return TsStatusErrorOutOfMemory;
+	}
+	store->ring = store->map + TS_STORE_HEADER_SIZE;
+	store->size = size;
+
+	/* a new store (or one without a valid state) starts empty, */
+	/* otherwise the records from the saved tail on are taken up to the first incomplete one */
+	if (!_ts_store_load_state(store)) {
+		store->tail = 0;
+		store->sequence = 0;
+		TsStatus_t result = _ts_store_save_state(store);
+		if (result != TsStatusOk) {
+			ts_store_close(store);
+			return result;
+		}
+	}
+	_ts_store_scan(store);
+	return TsStatusOk;
+}
+
+/* ts_store_close */
+TsStatus_t ts_store_close(TsStoreRef_t store)
+{
+	/* check preconditions */
+	if (store == NULL || store->map == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+
+	msync(store->map, TS_STORE_HEADER_SIZE + store->size, MS_SYNC);
+	munmap(store->map, TS_STORE_HEADER_SIZE + store->size);
+	close(store->file);
+	store->map = NULL;
+	store->ring = NULL;
+	return TsStatusOk;
+}
+
+/* ts_store_reserve */
+/* reserve space for a record of (at most) the given size */
+TsStatus_t ts_store_reserve(TsStoreRef_t store, size_t size, TsStoreReservation_t *reservation)
+{
+	/* check preconditions */
+	if (store == NULL || store->map == NULL || reservation == NULL || size == 0) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	uint64_t record = _ts_store_align(size + sizeof(TsStoreHeader_t));
+	if (record > store->size) {
+		return TsStatusErrorPayloadTooLarge;
+	}
+
+	/* claim the space (and any padding ahead of it) */
+	uint64_t offset = store->head & (store->size - 1);
+	uint64_t padding = (offset + record > store->size) ? store->size - offset : 0;
+	if (store->head + padding + record - store->tail > store->size) {
+		return TsStatusErrorOutOfMemory;
+	}
+
+	/* write the padding right away, the consumer skips it */
+	if (padding > 0) {
+		_ts_store_write(store, store->head, TS_STORE_PADDING);
+		store->head = store->head + padding;
+	}
+
+	reservation->position = store->head;
+	reservation->buffer = (uint8_t *) (_ts_store_header(store, store->head) + 1);
+	reservation->size = (size_t) (record - sizeof(TsStoreHeader_t));
+	return TsStatusOk;
+}
+
+/* ts_store_commit */
+/* frame the record written to the given reservation */
+TsStatus_t ts_store_commit(TsStoreRef_t store, TsStoreReservation_t *reservation, size_t size)
+{
+	/* check preconditions */
+	if (store == NULL || reservation == NULL || reservation->buffer == NULL || reservation->position != store->head) {
+		return TsStatusErrorPreconditionFailed;
+	}
+
+	/* an oversized commit is discarded, as is an empty one */
+	reservation->buffer = NULL;
+	if (size > reservation->size) {
+		return TsStatusErrorPayloadTooLarge;
+	}
+	if (size > 0) {
+		_ts_store_write(store, store->head, (uint32_t) size);
+		store->head = store->head + _ts_store_align(size + sizeof(TsStoreHeader_t));
+	}
+	return TsStatusOk;
+}
+
+/* ts_store_append */
+/* append a copy of the given record */
+TsStatus_t ts_store_append(TsStoreRef_t store, const uint8_t *buffer, size_t buffer_size)
+{
+	/* check preconditions */
+	if (buffer == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+
+	TsStoreReservation_t reservation;
+	TsStatus_t status = ts_store_reserve(store, buffer_size, &reservation);
+	if (status != TsStatusOk) {
+		return status;
+	}
+	memcpy(reservation.buffer, buffer, buffer_size);
+	return ts_store_commit(store, &reservation, buffer_size);
+}
+
+/* ts_store_encode */
+/* encode the given message directly into the store, reserving (at most) the given size */
+TsStatus_t ts_store_encode(TsStoreRef_t store, TsMessageRef_t message, TsEncoder_t encoder, size_t size)
+{
+	TsStoreReservation_t reservation;
+	TsStatus_t status = ts_store_reserve(store, size, &reservation);
+	if (status != TsStatusOk) {
+		return status;
+	}
+
+	size_t buffer_size = reservation.size;
+	status = ts_message_encode(message, encoder, reservation.buffer, &buffer_size);
+	if (status != TsStatusOk) {
+		ts_store_commit(store, &reservation, 0);
+		return status;
+	}
+	return ts_store_commit(store, &reservation, buffer_size);
+}
+
+/* ts_store_sync */
+TsStatus_t ts_store_sync(TsStoreRef_t store)
+{
+	/* check preconditions */
+	if (store == NULL || store->map == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	if (msync(store->map, TS_STORE_HEADER_SIZE + store->size, MS_SYNC) != 0) {
+		return TsStatusErrorInternalServerError;
+	}
+	return TsStatusOk;
+}
+
+/* ts_store_read */
+/* gather the records from the tail on, in order */
+/* (the batch is empty when there is nothing to replay, and is released once sent) */
+TsStatus_t ts_store_read(TsStoreRef_t store, TsStoreBatch_t *batch)
+{
+	/* check preconditions */
+	if (store == NULL || store->map == NULL || batch == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+
+	/* the records up to the head are all framed (and were checked on open), so they are taken as they are */
+	batch->count = 0;
+	batch->size = 0;
+	uint64_t position = store->tail;
+	while (batch->count < TS_STORE_MAX_BATCH && position < store->head) {
+		TsStoreHeader_t *header = _ts_store_header(store, position);
+		if (header->length != TS_STORE_PADDING) {
+			batch->records[batch->count].buffer = (uint8_t *) (header + 1);
+			batch->records[batch->count].size = header->length;
+			batch->size = batch->size + header->length;
+			batch->count++;
+		}
+		position = _ts_store_next(store, position, header);
+	}
+	batch->end = position;
+	return TsStatusOk;
+}
+
+/* ts_store_release */
+/* drop the records of a replayed batch, saving the new tail */
+TsStatus_t ts_store_release(TsStoreRef_t store, TsStoreBatch_t *batch)
+{
+	/* check preconditions */
+	if (store == NULL || store->map == NULL || batch == NULL || batch->end < store->tail
+		|| batch->end > store->head) {
+		return TsStatusErrorPreconditionFailed;
+	}
+
+	store->tail = batch->end;
+	batch->count = 0;
+	batch->size = 0;
+	return _ts_store_save_state(store);
+}
+
+/* //////////////////////////////////////////////////////////////////////////// */
+/* P R I V A T E */
+
+/* (private) _ts_store_header */
+static TsStoreHeader_t * _ts_store_header(TsStoreRef_t store, uint64_t position)
+{
+	return (TsStoreHeader_t *) (store->ring + (position & (store->size - 1)));
+}
+
+/* (private) _ts_store_align */
+static uint64_t _ts_store_align(uint64_t size)
+{
+	return (size + sizeof(TsStoreHeader_t) - 1) & ~((uint64_t) sizeof(TsStoreHeader_t) - 1);
+}
+
+/* (private) _ts_store_next */
+/* the position of the record after the given one */
+static uint64_t _ts_store_next(TsStoreRef_t store, uint64_t position, TsStoreHeader_t *header)
+{
+	if (header->length == TS_STORE_PADDING) {
+		return position + store->size - (position & (store->size - 1));
+	}
+	return position + _ts_store_align(header->length + sizeof(TsStoreHeader_t));
+}
+
+/* (private) _ts_store_crc */
+static uint32_t _ts_store_crc(uint32_t crc, const void *bytes, size_t size)
+{
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++) {
+		crc = _ts_store_crc_table[(crc ^ ((const uint8_t *) bytes)[i]) & 0xff] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+/* (private) _ts_store_record_crc */
+static uint32_t _ts_store_record_crc(TsStoreHeader_t *header)
+{
+	uint32_t crc = _ts_store_crc(0, &(header->position), sizeof(header->position));
+	crc = _ts_store_crc(crc, &(header->length), sizeof(header->length));
+	return _ts_store_crc(crc, header + 1, header->length != TS_STORE_PADDING ? header->length : 0);
+}
+
+/* (private) _ts_store_write */
+/* frame the record (already written) at the given position */
+static void _ts_store_write(TsStoreRef_t store, uint64_t position, uint32_t length)
+{
+	TsStoreHeader_t *header = _ts_store_header(store, position);
+	header->position = position;
+	header->length = length;
+	header->crc = _ts_store_record_crc(header);
+}
+
+/* (private) _ts_store_load_state */
+/* take the state from the valid slot of the latest sequence, if any */
+static bool _ts_store_load_state(TsStoreRef_t store)
+{
+	bool loaded = false;
+	for (int i = 0; i < 2; i++) {
+		TsStoreState_t *state = (TsStoreState_t *) (store->map + i * TS_STORE_SLOT_SIZE);
+		if (state->magic != TS_STORE_MAGIC || state->size != store->size
+			|| state->crc != _ts_store_crc(0, &(state->sequence), sizeof(TsStoreState_t) - 2 * sizeof(uint32_t))
+			|| (loaded && state->sequence < store->sequence)) {
+			continue;
+		}
+		store->sequence = state->sequence;
+		store->tail = state->tail;
+		loaded = true;
+	}
+	return loaded;
+}
+
+/* (private) _ts_store_save_state */
+/* write the state to the slot not holding the current one, and through to the file */
+static TsStatus_t _ts_store_save_state(TsStoreRef_t store)
+{
+	store->sequence++;
+	TsStoreState_t *state = (TsStoreState_t *) (store->map + (store->sequence % 2) * TS_STORE_SLOT_SIZE);
+	state->magic = TS_STORE_MAGIC;
+	state->sequence = store->sequence;
+	state->size = store->size;
+	state->tail = store->tail;
+	state->crc = _ts_store_crc(0, &(state->sequence), sizeof(TsStoreState_t) - 2 * sizeof(uint32_t));
+	if (msync(store->map, TS_STORE_HEADER_SIZE, MS_SYNC) != 0) {
+		return TsStatusErrorInternalServerError;
+	}
+	return TsStatusOk;
+}
+
+/* (private) _ts_store_scan */
+/* find the head, i.e., the end of the complete records from the tail on */
+static void _ts_store_scan(TsStoreRef_t store)
+{
+	uint64_t position = store->tail;
+	while (position - store->tail < store->size) {
+		TsStoreHeader_t *header = _ts_store_header(store, position);
+		uint64_t offset = position & (store->size - 1);
+		if (header->position != position
+			|| (header->length != TS_STORE_PADDING && header->length > store->size - offset - sizeof(TsStoreHeader_t))
+			|| header->crc != _ts_store_record_crc(header)) {
+			break;
+		}
+		uint64_t next = _ts_store_next(store, position, header);
+		if (next - store->tail > store->size) {
+			break;
+		}
+		position = next;
+	}
+	store->head = position;
+}
@@ -0,0 +1,80 @@
+#ifndef TS_STORE_H
+#define TS_STORE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "ts_common.h"
+#include "ts_message.h"
+
+/* maximum number of records handed to the consumer at once */
+#define TS_STORE_MAX_BATCH      64
+
+/* size of the file header (holding the state of the store), ahead of the ring */
+#define TS_STORE_HEADER_SIZE    4096
+
+/* store-and-forward ring of encoded messages, kept in a (memory mapped) file */
+/* records are framed by their length, their position in the store and a crc, so a store reopened after */
+/* a crash picks up every record completely written before it (and nothing else). only the start of the */
+/* records not yet released (the tail) is saved, in one of two alternating slots of the file header. */
+/* records are appended in place (as with ts_queue) and replayed in batches straight from the mapping. */
+/* a store is used by a single thread at a time, and returns TsStatusErrorOutOfMemory when full. */
+typedef struct TsStore *TsStoreRef_t;
+typedef struct TsStore {
+	int			file;
+	uint8_t		*map;       /* the whole file, i.e., the header and the ring */
+	uint8_t		*ring;
+	size_t		size;       /* of the ring, a power of two */
+	uint64_t	head;       /* end of the records appended */
+	uint64_t	tail;       /* start of the records not yet released */
+	uint64_t	sequence;   /* of the state last saved */
+} TsStore_t;
+
+/* space reserved for a record, committed with the size actually used */
+typedef struct TsStoreReservation {
+	uint8_t		*buffer;
+	size_t		size;
+	uint64_t	position;
+} TsStoreReservation_t;
+
+/* batch of consecutive records, e.g., for a single writev */
+typedef struct TsStoreBatch {
+	size_t		count;
+	size_t		size;       /* total size of the records */
+	uint64_t	end;        /* end of the space released with the batch */
+	struct {
+		uint8_t	*buffer;
+		size_t	size;
+	} records[TS_STORE_MAX_BATCH];
+} TsStoreBatch_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* open (creating the file when missing) and close */
+/* the ring of an existing file must be of the given size */
+TsStatus_t ts_store_open(TsStoreRef_t store, const char *path, size_t size);
+TsStatus_t ts_store_close(TsStoreRef_t store);
+
+/* producer operations */
+/* a reservation is committed (a commit of zero size discards it) before the next one is made */
+TsStatus_t ts_store_reserve(TsStoreRef_t store, size_t size, TsStoreReservation_t *reservation);
+TsStatus_t ts_store_commit(TsStoreRef_t store, TsStoreReservation_t *reservation, size_t size);
+TsStatus_t ts_store_append(TsStoreRef_t store, const uint8_t *buffer, size_t buffer_size);
+TsStatus_t ts_store_encode(TsStoreRef_t store, TsMessageRef_t message, TsEncoder_t encoder, size_t size);
+
+/* write the appended records through to the file */
+TsStatus_t ts_store_sync(TsStoreRef_t store);
+
+/* consumer operations */
+/* the records of a batch point into the store, and stay valid until released */
+TsStatus_t ts_store_read(TsStoreRef_t store, TsStoreBatch_t *batch);
+TsStatus_t ts_store_release(TsStoreRef_t store, TsStoreBatch_t *batch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TS_STORE_H */
@@ -0,0 +1,459 @@
+#include <stdarg.h>
+#include <string.h>
+#include <stdio.h>
+#include "cbor.h"
+
+/* client debug */
+/* dbg_printf() */
+#include "dbg.h"
+
+#include "ts_common.h"
+#include "ts_json.h"
+#include "ts_struct.h"
+
+/* json output buffer */
+typedef struct {
+	char	*buffer;
+	size_t	size;
+	size_t	used;
+} TsStructWriter_t;
+
+/* forward references */
+/* note, recursion is bounded by the (static) nesting of the descriptor tables */
+static TsStatus_t _ts_struct_encode_json(const TsDescriptor_t *, size_t, const uint8_t *, TsStructWriter_t *);
+static TsStatus_t _ts_struct_encode_cbor(const TsDescriptor_t *, size_t, const uint8_t *, CborEncoder *);
+static TsStatus_t _ts_struct_decode_json(const TsDescriptor_t *, size_t, uint8_t *, TsJsonReaderRef_t);
+static TsStatus_t _ts_struct_decode_cbor(const TsDescriptor_t *, size_t, uint8_t *, CborValue *);
+static TsStatus_t _ts_struct_printf(TsStructWriter_t *, const char *, ...);
+static size_t _ts_struct_length(const char *, size_t);
+
+/* ts_struct_encode */
+/* encode will attempt to fill the given buffer with the members of the given struct, as described. */
+TsStatus_t ts_struct_encode(const TsDescriptor_t *fields, size_t count, const void *data, TsEncoder_t encoder,
+							uint8_t *buffer, size_t *buffer_size)
+{
+	/* check preconditions */
+	if (fields == NULL || data == NULL || buffer_size == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	if (buffer == NULL) {
+		return TsStatusErrorBadRequest;
+	}
+
+	/* perform encoding */
+	switch (encoder) {
+	case TsEncoderJson: {
+
+		TsStructWriter_t writer = {.buffer = (char *) buffer, .size = *buffer_size, .used = 0};
+		TsStatus_t status = _ts_struct_encode_json(fields, count, (const uint8_t *) data, &writer);
+		*buffer_size = writer.used;
+		return status;
+	}
+
+	case TsEncoderCbor: {
+
+		CborEncoder cbor;
+		cbor_encoder_init(&cbor, buffer, *buffer_size, 0);
+		TsStatus_t status = _ts_struct_encode_cbor(fields, count, (const uint8_t *) data, &cbor);
+		*buffer_size = cbor_encoder_get_buffer_size(&cbor, buffer);
+		return status;
+	}
+
+	case TsEncoderDebug:
+	default:
+		/* do nothing */
+		break;
+	}
+	return TsStatusErrorNotImplemented;
+}
+
+/* ts_struct_decode */
+/* decode will set the members of the given struct from the fields found in the given buffer, */
+/* fields not described are skipped, and members not found are left unchanged. */
+TsStatus_t ts_struct_decode(const TsDescriptor_t *fields, size_t count, void *data, TsEncoder_t encoder,
+							uint8_t *buffer, size_t buffer_size)
+{
+	/* check preconditions */
+	if (fields == NULL || data == NULL) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	if (buffer == NULL) {
+		return TsStatusErrorBadRequest;
+	}
+
+	/* perform decoding */
+	switch (encoder) {
+	case TsEncoderJson: {
+
+		TsJsonReader_t reader;
+		TsJsonToken_t token;
+		ts_json_reader_init(&reader, (const char *) buffer, buffer_size);
+		TsStatus_t status = ts_json_next(&reader, &token);
+		if (status != TsStatusOk) {
+			return status;
+		}
+		if (token.type != TsJsonTokenObjectBegin) {
+			return TsStatusErrorPreconditionFailed;
+		}
+		return _ts_struct_decode_json(fields, count, (uint8_t *) data, &reader);
+	}
+
+	case TsEncoderCbor: {
+
+		CborParser parser;
+		CborValue value;
+		if (cbor_parser_init(buffer, buffer_size, 0, &parser, &value) != CborNoError) {
+			return TsStatusErrorBadRequest;
+		}
+		return _ts_struct_decode_cbor(fields, count, (uint8_t *) data, &value);
+	}
+
+	case TsEncoderDebug:
+	default:
+		/* do nothing */
+		break;
+	}
+	return TsStatusErrorNotImplemented;
+}
+
+/* //////////////////////////////////////////////////////////////////////////// */
+/* P R I V A T E */
+
+/* _ts_struct_encode_json */
+/* note, values are formatted as they are in ts_message, i.e., the output is the same */
+static TsStatus_t _ts_struct_encode_json(const TsDescriptor_t *fields, size_t count, const uint8_t *data,
+										 TsStructWriter_t *writer)
+{
+	TsStatus_t status = _ts_struct_printf(writer, "{");
+	for (size_t i = 0; i < count && status == TsStatusOk; i++) {
+
+		const TsDescriptor_t *field = &(fields[i]);
+		const uint8_t *member = data + field->offset;
+		status = _ts_struct_printf(writer, i > 0 ? ",\"%s\":" : "\"%s\":", field->name);
+		if (status != TsStatusOk) {
+			break;
+		}
+		switch (field->type) {
+		case TsTypeInteger:
+			status = _ts_struct_printf(writer, "%d", *((const int *) member));
+			break;
+
+		case TsTypeFloat:
+			status = _ts_struct_printf(writer, "%f", *((const float *) member));
+			break;
+
+		case TsTypeBoolean:
+			status = _ts_struct_printf(writer, "%s", *((const bool *) member) ? "true" : "false");
+			break;
+
+		case TsTypeString:
+			status = _ts_struct_printf(writer, "\"%.*s\"",
+									   (int) _ts_struct_length((const char *) member, field->size),
+									   (const char *) member);
+			break;
+
+		case TsTypeMessage:
+			status = _ts_struct_encode_json(field->fields, field->count, member, writer);
+			break;
+
+		case TsTypeNull:
+			status = _ts_struct_printf(writer, "null");
+			break;
+
+		case TsTypeArray:
+		default:
+			return TsStatusErrorNotImplemented;
+		}
+	}
+	if (status != TsStatusOk) {
+		return status;
+	}
+	return _ts_struct_printf(writer, "}");
+}
+
+/* _ts_struct_encode_cbor */
+static TsStatus_t _ts_struct_encode_cbor(const TsDescriptor_t *fields, size_t count, const uint8_t *data,
+										 CborEncoder *encoder)
+{
+	/* note, tinycbor keeps counting once out of memory, so errors are checked once at the end */
+	CborEncoder map;
+	CborError error = cbor_encoder_create_map(encoder, &map, count);
+	for (size_t i = 0; i < count; i++) {
+
+		const TsDescriptor_t *field = &(fields[i]);
+		const uint8_t *member = data + field->offset;
+		error |= cbor_encode_text_stringz(&map, field->name);
+		switch (field->type) {
+		case TsTypeInteger:
+			error |= cbor_encode_int(&map, *((const int *) member));
+			break;
+
+		case TsTypeFloat:
+			error |= cbor_encode_float(&map, *((const float *) member));
+			break;
+
+		case TsTypeBoolean:
+			error |= cbor_encode_boolean(&map, *((const bool *) member));
+			break;
+
+		case TsTypeString:
+			error |= cbor_encode_text_string(&map, (const char *) member,
+											 _ts_struct_length((const char *) member, field->size));
+			break;
+
+		case TsTypeMessage: {
+			TsStatus_t status = _ts_struct_encode_cbor(field->fields, field->count, member, &map);
+			if (status != TsStatusOk && status != TsStatusErrorOutOfMemory) {
+				return status;
+			}
+			break;
+		}
+
+		case TsTypeNull:
+			error |= cbor_encode_null(&map);
+			break;
+
+		case TsTypeArray:
+		default:
+			return TsStatusErrorNotImplemented;
+		}
+	}
+	error |= cbor_encoder_close_container(encoder, &map);
+	if (error != CborNoError || cbor_encoder_get_extra_bytes_needed(encoder) > 0) {
+		return TsStatusErrorOutOfMemory;
+	}
+	return TsStatusOk;
+}
+
+/* _ts_struct_decode_json */
+/* decode the members of an object, the reader is positioned just after its opening brace */
+static TsStatus_t _ts_struct_decode_json(const TsDescriptor_t *fields, size_t count, uint8_t *data,
+										 TsJsonReaderRef_t reader)
+{
+	TsJsonToken_t token;
+	for (;;) {
+
+		/* read the next key, or the end of the object */
+		TsStatus_t status = ts_json_next(reader, &token);
+		if (status != TsStatusOk) {
+			return status;
+		}
+		if (token.type == TsJsonTokenObjectEnd) {
+			return TsStatusOk;
+		}
+
+		/* find the described field, skipping any others */
+		const TsDescriptor_t *field = NULL;
+		for (size_t i = 0; i < count; i++) {
+			if (ts_json_equals(&token, fields[i].name)) {
+				field = &(fields[i]);
+				break;
+			}
+		}
+		if (field == NULL) {
+			status = ts_json_skip(reader, &token);
+			if (status != TsStatusOk) {
+				return status;
+			}
+			continue;
+		}
+
+		/* read its value */
+		status = ts_json_next(reader, &token);
+		if (status != TsStatusOk) {
+			return status;
+		}
+		if (token.type == TsJsonTokenNull) {
+			continue;
+		}
+		uint8_t *member = data + field->offset;
+		switch (field->type) {
+		case TsTypeInteger:
+		case TsTypeFloat: {
+			double value;
+			if (ts_json_number(&token, &value) != TsStatusOk) {
+				return TsStatusErrorPreconditionFailed;
+			}
+			if (field->type == TsTypeInteger) {
+				/* (out of range, or nan, would be undefined when cast) */
+				if (!(value >= INT32_MIN && value <= INT32_MAX)) {
+					return TsStatusErrorPreconditionFailed;
+				}
+				*((int *) member) = (int) value;
+			} else {
+				*((float *) member) = (float) value;
+			}
+			break;
+		}
+
+		case TsTypeBoolean:
+			if (token.type != TsJsonTokenTrue && token.type != TsJsonTokenFalse) {
+				return TsStatusErrorPreconditionFailed;
+			}
+			*((bool *) member) = (token.type == TsJsonTokenTrue);
+			break;
+
+		case TsTypeString:
+			if (token.type != TsJsonTokenString) {
+				return TsStatusErrorPreconditionFailed;
+			}
+			if (ts_json_string(&token, (char *) member, field->size) != TsStatusOk) {
+				dbg_printf("issue detected during decode (%s), string truncated; the given string is too large\n",
+						   field->name);
+			}
+			break;
+
+		case TsTypeMessage:
+			if (token.type != TsJsonTokenObjectBegin) {
+				return TsStatusErrorPreconditionFailed;
+			}
+			status = _ts_struct_decode_json(field->fields, field->count, member, reader);
+			if (status != TsStatusOk) {
+				return status;
+			}
+			break;
+
+		default:
+			/* i.e., nothing to bind */
+			status = ts_json_skip(reader, &token);
+			if (status != TsStatusOk) {
+				return status;
+			}
+			break;
+		}
+	}
+}
+
+/* _ts_struct_decode_cbor */
+/* decode the members of a map, the value is advanced past the map */
+static TsStatus_t _ts_struct_decode_cbor(const TsDescriptor_t *fields, size_t count, uint8_t *data,
+										 CborValue *value)
+{
+	if (!cbor_value_is_map(value)) {
+		return TsStatusErrorPreconditionFailed;
+	}
+	CborValue map;
+	if (cbor_value_enter_container(value, &map) != CborNoError) {
+		return TsStatusErrorBadRequest;
+	}
+	while (!cbor_value_at_end(&map)) {
+
+		/* find the described field,... */
+		if (!cbor_value_is_text_string(&map)) {
+			return TsStatusErrorBadRequest;
+		}
+		const TsDescriptor_t *field = NULL;
+		for (size_t i = 0; i < count; i++) {
+			bool result = false;
+			if (cbor_value_text_string_equals(&map, fields[i].name, &result) == CborNoError && result) {
+				field = &(fields[i]);
+				break;
+			}
+		}
+		if (cbor_value_advance(&map) != CborNoError) {
+			return TsStatusErrorBadRequest;
+		}
+
+		/* ...and read its value, skipping any others */
+		uint8_t *member = field != NULL ? data + field->offset : NULL;
+		CborError error = CborNoError;
+		if (field == NULL || cbor_value_is_null(&map)) {
+			error = cbor_value_advance(&map);
+
+		} else {
+			switch (field->type) {
+			case TsTypeInteger:
+			case TsTypeFloat: {
+				double xvalue;
+				if (cbor_value_is_integer(&map)) {
+					int64_t xinteger;
+					cbor_value_get_int64(&map, &xinteger);
+					xvalue = (double) xinteger;
+				} else if (cbor_value_is_float(&map)) {
+					float xfloat;
+					cbor_value_get_float(&map, &xfloat);
+					xvalue = xfloat;
+				} else if (cbor_value_is_double(&map)) {
+					cbor_value_get_double(&map, &xvalue);
+				} else {
+					return TsStatusErrorPreconditionFailed;
+				}
+				if (field->type == TsTypeInteger) {
+					if (!(xvalue >= INT32_MIN && xvalue <= INT32_MAX)) {
+						return TsStatusErrorPreconditionFailed;
+					}
+					*((int *) member) = (int) xvalue;
+				} else {
+					*((float *) member) = (float) xvalue;
+				}
+				error = cbor_value_advance_fixed(&map);
+				break;
+			}
+
+			case TsTypeBoolean:
+				if (!cbor_value_is_boolean(&map)) {
+					return TsStatusErrorPreconditionFailed;
+				}
+				cbor_value_get_boolean(&map, (bool *) member);
+				error = cbor_value_advance_fixed(&map);
+				break;
+
+			case TsTypeString: {
+				if (!cbor_value_is_text_string(&map)) {
+					return TsStatusErrorPreconditionFailed;
+				}
+				size_t size = field->size;
+				error = cbor_value_copy_text_string(&map, (char *) member, &size, &map);
+				if (error == CborErrorOutOfMemory) {
+					dbg_printf("failed to decode (%s), the given string is too large\n", field->name);
+					return TsStatusErrorPayloadTooLarge;
+				}
+				break;
+			}
+
+			case TsTypeMessage: {
+				TsStatus_t status = _ts_struct_decode_cbor(field->fields, field->count, member, &map);
+				if (status != TsStatusOk) {
+					return status;
+				}
+				break;
+			}
+
+			default:
+				/* i.e., nothing to bind */
+				error = cbor_value_advance(&map);
+				break;
+			}
+		}
+		if (error != CborNoError) {
+			return TsStatusErrorBadRequest;
+		}
+	}
+	if (cbor_value_leave_container(value, &map) != CborNoError) {
+		return TsStatusErrorBadRequest;
+	}
+	return TsStatusOk;
+}
+
+/* _ts_struct_printf */
+/* append to the json output, terminated (i.e., the used size excludes the termination) */
+static TsStatus_t _ts_struct_printf(TsStructWriter_t *writer, const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(writer->buffer + writer->used, writer->size - writer->used, format, args);
+	va_end(args);
+	if (length < 0 || (size_t) length >= writer->size - writer->used) {
+		return TsStatusErrorOutOfMemory;
+	}
+	writer->used = writer->used + (size_t) length;
+	return TsStatusOk;
+}
+
+/* _ts_struct_length */
+/* length of a string member, which may not be terminated if it fills the member */
+static size_t _ts_struct_length(const char *member, size_t size)
+{
+	const char *end = memchr(member, '\0', size);
+	return end != NULL ? (size_t) (end - member) : size;
+}
@@ -0,0 +1,52 @@
+#ifndef TS_STRUCT_H
+#define TS_STRUCT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "ts_common.h"
+#include "ts_message.h"
+
+/* field descriptor, binding a member of a c struct to a message field */
+/* TsTypeInteger binds int, TsTypeFloat binds float, TsTypeBoolean binds bool, */
+/* TsTypeString binds char[size], and TsTypeMessage binds a nested struct */
+typedef struct TsDescriptor TsDescriptor_t;
+struct TsDescriptor {
+	char					*name;      /* field name */
+	size_t					offset;     /* offset of the member in the struct */
+	TsType_t				type;       /* field type */
+	size_t					size;       /* size of the member, e.g., the capacity of a char array */
+	const TsDescriptor_t	*fields;    /* descriptor table of a nested struct (TsTypeMessage only) */
+	size_t					count;      /* number of descriptors in the nested table */
+};
+
+/* number of descriptors in a descriptor table */
+#define TS_DESCRIPTOR_COUNT(table) (sizeof(table) / sizeof((table)[0]))
+
+/* descriptor initializers */
+#define TS_DESCRIPTOR_MEMBER(type, member, name, xtype) \
+	{ (name), offsetof(type, member), (xtype), sizeof(((type *) 0)->member), NULL, 0 }
+#define TS_DESCRIPTOR_INT(type, member, name) TS_DESCRIPTOR_MEMBER(type, member, name, TsTypeInteger)
+#define TS_DESCRIPTOR_FLOAT(type, member, name) TS_DESCRIPTOR_MEMBER(type, member, name, TsTypeFloat)
+#define TS_DESCRIPTOR_BOOL(type, member, name) TS_DESCRIPTOR_MEMBER(type, member, name, TsTypeBoolean)
+#define TS_DESCRIPTOR_STRING(type, member, name) TS_DESCRIPTOR_MEMBER(type, member, name, TsTypeString)
+#define TS_DESCRIPTOR_MESSAGE(type, member, name, table) \
+	{ (name), offsetof(type, member), TsTypeMessage, sizeof(((type *) 0)->member), (table), TS_DESCRIPTOR_COUNT(table) }
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* encoding and decoding, directly between a c struct and the encoded buffer (i.e., no message tree) */
+TsStatus_t ts_struct_encode(const TsDescriptor_t *fields, size_t count, const void *data, TsEncoder_t encoder,
+							uint8_t *buffer, size_t *buffer_size);
+TsStatus_t ts_struct_decode(const TsDescriptor_t *fields, size_t count, void *data, TsEncoder_t encoder,
+							uint8_t *buffer, size_t buffer_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TS_STRUCT_H */